@@ -5,10 +5,15 @@
 #include <memory>
 #include <algorithm>
 #include <numeric>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <random>
 
 extern "C" {
 #include "levelcache.h"
 #include "storage_engine.h"
+#include "uthash.h"
 }
 
 engine_t etype = ENGINE_ROCKSDB;
@@ -39,7 +44,7 @@ public:
             char command[256];
             snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
             system(command);
-            cache = levelcache_open(DB_PATH_BENCH, 100, 0, 0, LOG_FATAL, ENGINE_ROCKSDB); // 100 MB cache
+            cache = levelcache_open(DB_PATH_BENCH, 100, 0, 0, LOG_FATAL, etype); // 100 MB cache
             if (!cache) {
                 // This is a fatal error for the benchmark suite.
                 // We use a raw fprintf and exit because this setup is outside the benchmark run state.
@@ -72,15 +77,23 @@ public:
 };
 
 BENCHMARK_F(LevelCacheBenchmark, BM_Write)(benchmark::State& state) {
-    char key[32];
+    // Inputs are generated up front so the loop times only the put.
+    const size_t pool_size = 1 << 18;
+    std::vector<std::string> write_keys(pool_size);
+    for (auto& k : write_keys) {
+        char key_buf[32];
+        generate_random_string(key_buf, sizeof(key_buf));
+        k = key_buf;
+    }
     char value[128];
+    generate_random_string(value, sizeof(value));
     std::vector<double> latencies;
     latencies.reserve(state.max_iterations);
 
+    size_t i = 0;
     for (auto _ : state) {
-        generate_random_string(key, sizeof(key));
-        generate_random_string(value, sizeof(value));
-        
+        const char *key = write_keys[i++ % pool_size].c_str();
+
         struct timespec start, end;
         clock_gettime(CLOCK_MONOTONIC, &start);
         
@@ -107,9 +120,14 @@ BENCHMARK_F(LevelCacheBenchmark, BM_Read)(benchmark::State& state) {
     }
     std::vector<double> latencies;
     latencies.reserve(state.max_iterations);
+    std::vector<uint32_t> order(1 << 16);
+    for (auto& k : order) {
+        k = rand() % keys.size();
+    }
 
+    size_t i = 0;
     for (auto _ : state) {
-        const std::string& key = keys[rand() % keys.size()];
+        const std::string& key = keys[order[i++ % order.size()]];
         
         struct timespec start, end;
         clock_gettime(CLOCK_MONOTONIC, &start);
@@ -133,4 +151,1138 @@ BENCHMARK_F(LevelCacheBenchmark, BM_Read)(benchmark::State& state) {
     state.SetItemsProcessed(state.iterations());
 }
 
+// Read path variants over 4-64 KB values: the allocating levelcache_get,
+// the caller-buffer levelcache_get_into and the zero-copy pinned read.
+enum ReadMode { READ_ALLOC = 0, READ_INTO = 1, READ_PINNED = 2 };
+
+BENCHMARK_DEFINE_F(LevelCacheBenchmark, BM_ReadLargeValue)(benchmark::State& state) {
+    const size_t value_size = state.range(0);
+    const int mode = state.range(1);
+    const int num_keys = 256;
+    std::string value(value_size, 'v');
+    std::vector<std::string> large_keys;
+    for (int i = 0; i < num_keys; ++i) {
+        large_keys.push_back("large_" + std::to_string(value_size) + "_" + std::to_string(i));
+        levelcache_put(cache, large_keys.back().c_str(), value.c_str(), 0);
+    }
+    std::vector<char> buf(value_size);
+
+    int i = 0;
+    for (auto _ : state) {
+        const char* key = large_keys[i++ % num_keys].c_str();
+        if (mode == READ_ALLOC) {
+            char* val = levelcache_get(cache, key);
+            benchmark::DoNotOptimize(val);
+            free(val);
+        } else if (mode == READ_INTO) {
+            ssize_t len = levelcache_get_into(cache, key, buf.data(), buf.size());
+            benchmark::DoNotOptimize(len);
+        } else {
+            LevelCachePinnedValue pinned;
+            if (levelcache_get_pinned(cache, key, &pinned) == 0) {
+                benchmark::DoNotOptimize(pinned.data[pinned.len - 1]);
+                levelcache_value_release(&pinned);
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * value_size);
+}
+BENCHMARK_REGISTER_F(LevelCacheBenchmark, BM_ReadLargeValue)
+    ->ArgsProduct({{4 << 10, 16 << 10, 64 << 10}, {READ_ALLOC, READ_INTO, READ_PINNED}});
+
+// Writes batch_size pairs per iteration through levelcache_put_batch.
+// Arg(1) is the per-key baseline.
+BENCHMARK_DEFINE_F(LevelCacheBenchmark, BM_WriteBatch)(benchmark::State& state) {
+    const size_t batch_size = state.range(0);
+    const size_t pool_size = 100000;
+    std::vector<std::string> batch_keys(pool_size);
+    for (auto& k : batch_keys) {
+        char key_buf[32];
+        generate_random_string(key_buf, sizeof(key_buf));
+        k = key_buf;
+    }
+    char value[128];
+    generate_random_string(value, sizeof(value));
+
+    std::vector<const char*> key_ptrs(batch_size), value_ptrs(batch_size, value);
+    size_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch_size; ++i) {
+            key_ptrs[i] = batch_keys[next].c_str();
+            next = (next + 1) % pool_size;
+        }
+        if (levelcache_put_batch(cache, key_ptrs.data(), value_ptrs.data(), batch_size, 0) != 0) {
+            state.SkipWithError("Put batch failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK_REGISTER_F(LevelCacheBenchmark, BM_WriteBatch)->Arg(1)->Arg(50)->Arg(500);
+
+// Insert-then-delete churn on fresh keys: stresses metadata allocation and
+// release on the put/delete path.
+BENCHMARK_F(LevelCacheBenchmark, BM_PutDeleteChurn)(benchmark::State& state) {
+    char key[32];
+    const char *value = "v";
+    uint64_t i = 0;
+    for (auto _ : state) {
+        snprintf(key, sizeof(key), "churn:%llu", (unsigned long long)i++);
+        if (levelcache_put(cache, key, value, 0) != 0 || levelcache_delete(cache, key) != 0) {
+            state.SkipWithError("Put/delete failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Shared by all threads of a BM_Concurrent* run; opened by thread 0 before
+// the timed loop (which starts with a barrier) and closed after it.
+static LevelCache* concurrent_cache = nullptr;
+static std::vector<std::string> concurrent_keys;
+
+static void ConcurrentSetUp(const benchmark::State& state) {
+    if (state.thread_index() != 0) {
+        return;
+    }
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+    concurrent_cache = levelcache_open(DB_PATH_BENCH, 100, 0, 0, LOG_FATAL, etype);
+    if (!concurrent_cache) {
+        fprintf(stderr, "Failed to open database. Aborting benchmarks.\n");
+        exit(1);
+    }
+    concurrent_keys.clear();
+    concurrent_keys.reserve(20000);
+    for (int i = 0; i < 20000; ++i) {
+        char key_buf[32];
+        char val_buf[128];
+        generate_random_string(key_buf, sizeof(key_buf));
+        generate_random_string(val_buf, sizeof(val_buf));
+        levelcache_put(concurrent_cache, key_buf, val_buf, 0);
+        concurrent_keys.push_back(key_buf);
+    }
+}
+
+static void ConcurrentTearDown(const benchmark::State& state) {
+    if (state.thread_index() != 0) {
+        return;
+    }
+    levelcache_close(concurrent_cache);
+    concurrent_cache = nullptr;
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+}
+
+// 90% reads / 10% writes over the pre-populated key set. Throughput should
+// scale with the thread count since keys are spread over independent shards.
+static void BM_ConcurrentMixed(benchmark::State& state) {
+    unsigned int seed = 0x9e3779b9u * (state.thread_index() + 1);
+    char value[128];
+    memset(value, 'v', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+
+    for (auto _ : state) {
+        const std::string& key = concurrent_keys[rand_r(&seed) % concurrent_keys.size()];
+        if (rand_r(&seed) % 10 == 0) {
+            if (levelcache_put(concurrent_cache, key.c_str(), value, 0) != 0) {
+                state.SkipWithError("Put failed");
+                break;
+            }
+        } else {
+            char* val = levelcache_get(concurrent_cache, key.c_str());
+            benchmark::DoNotOptimize(val);
+            free(val);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConcurrentMixed)
+    ->Setup(ConcurrentSetUp)
+    ->Teardown(ConcurrentTearDown)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+// Reads concentrated on 1% of the keys, with the hot tier off (0) or on (1).
+// With the tier on, repeated reads no longer go through the engine.
+static void BM_ReadHotKeys(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = 100;
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.hot_tier_bytes = state.range(0) ? 16 << 20 : 0;
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    std::vector<std::string> hot_keys;
+    for (int i = 0; i < 20000; ++i) {
+        char key_buf[32];
+        char val_buf[128];
+        generate_random_string(key_buf, sizeof(key_buf));
+        generate_random_string(val_buf, sizeof(val_buf));
+        levelcache_put(cache, key_buf, val_buf, 0);
+        if (i % 100 == 0) {
+            hot_keys.push_back(key_buf);
+        }
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        char* val = levelcache_get(cache, hot_keys[i++ % hot_keys.size()].c_str());
+        benchmark::DoNotOptimize(val);
+        free(val);
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_ReadHotKeys)->Arg(0)->Arg(1);
+
+// Put throughput on engine range(0) with the ephemeral profile off (0) or
+// on (1).
+static void BM_WriteProfile(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = 100;
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = (engine_t)state.range(0);
+    options.ephemeral = state.range(1);
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    const size_t pool_size = 1 << 18;
+    std::vector<std::string> write_keys(pool_size);
+    for (auto& k : write_keys) {
+        char key_buf[32];
+        generate_random_string(key_buf, sizeof(key_buf));
+        k = key_buf;
+    }
+    char value[128];
+    generate_random_string(value, sizeof(value));
+    size_t i = 0;
+    for (auto _ : state) {
+        if (levelcache_put(cache, write_keys[i++ % pool_size].c_str(), value, 0) != 0) {
+            state.SkipWithError("Put failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_WriteProfile)
+    ->ArgNames({"engine", "ephemeral"})
+    ->ArgsProduct({{ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_BITCASK}, {0, 1}})
+    ->UseRealTime();
+
+// Reads from a single event-loop thread through the async API with
+// range(0) workers, keeping 256 gets outstanding and reaping completions as
+// the eventfd signals them. One iteration is one completed get.
+static void BM_AsyncRead(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = 100;
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.async_threads = (uint32_t)state.range(0);
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    std::vector<std::string> read_keys(20000);
+    for (auto& k : read_keys) {
+        char key_buf[32];
+        char val_buf[128];
+        generate_random_string(key_buf, sizeof(key_buf));
+        generate_random_string(val_buf, sizeof(val_buf));
+        levelcache_put(cache, key_buf, val_buf, 0);
+        k = key_buf;
+    }
+
+    const size_t in_flight = 256;
+    size_t submitted = 0;
+    auto submit = [&]() {
+        const std::string& key = read_keys[submitted++ % read_keys.size()];
+        return levelcache_get_async(cache, key.data(), key.size(), nullptr, nullptr) == 0;
+    };
+    for (size_t i = 0; i < in_flight; ++i) {
+        submit();
+    }
+    int fd = levelcache_completion_fd(cache);
+    LevelCacheCompletion completions[64];
+    size_t ready = 0;
+    size_t next = 0;
+    for (auto _ : state) {
+        while (next == ready) {
+            uint64_t signals;
+            if (read(fd, &signals, sizeof(signals)) < 0) {
+                sched_yield();
+            }
+            ready = levelcache_poll_completions(cache, completions, 64);
+            next = 0;
+        }
+        benchmark::DoNotOptimize(completions[next].value);
+        free(completions[next++].value);
+        submit();
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_AsyncRead)->ArgNames({"workers"})->Arg(1)->Arg(4)->Arg(16)->UseRealTime();
+
+// Invalidates one tenant's 100k keys on engine range(0), either with a
+// levelcache_delete per key (range(1) == 0) or with levelcache_delete_prefix
+// (1). Another tenant's keys stay in the cache throughout.
+static void BM_InvalidatePrefix(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = 100;
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = (engine_t)state.range(0);
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    const size_t tenant_keys = 100000;
+    std::vector<std::string> keys;
+    std::vector<const char*> key_ptrs;
+    for (size_t i = 0; i < tenant_keys; ++i) {
+        keys.push_back("tenant:1:" + std::to_string(i));
+    }
+    for (const auto& k : keys) {
+        key_ptrs.push_back(k.c_str());
+    }
+    std::vector<std::string> other;
+    std::vector<const char*> other_ptrs;
+    for (size_t i = 0; i < tenant_keys; ++i) {
+        other.push_back("tenant:2:" + std::to_string(i));
+    }
+    for (const auto& k : other) {
+        other_ptrs.push_back(k.c_str());
+    }
+    levelcache_put_batch(cache, other_ptrs.data(), other_ptrs.data(), other_ptrs.size(), 0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        levelcache_put_batch(cache, key_ptrs.data(), key_ptrs.data(), key_ptrs.size(), 0);
+        state.ResumeTiming();
+        if (state.range(1)) {
+            levelcache_delete_prefix(cache, "tenant:1:", 9);
+        } else {
+            for (const auto& k : keys) {
+                levelcache_delete_n(cache, k.data(), k.size());
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * tenant_keys);
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_InvalidatePrefix)
+    ->ArgNames({"engine", "prefix"})
+    ->ArgsProduct({{ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_MEMORY, ENGINE_BITCASK}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// A JSON record of about `size` bytes: a fixed set of fields with varying
+// values, padded with an array of event objects.
+static std::string json_record(std::mt19937& rng, size_t size) {
+    static const char* plans[] = {"free", "pro", "premium", "enterprise"};
+    static const char* countries[] = {"US", "DE", "IN", "BR", "JP", "FR"};
+    std::string id = std::to_string(rng() % 10000000);
+    std::string record = "{\"id\":" + id + ",\"name\":\"user" + id + "\",\"email\":\"user" + id +
+                         "@example.com\",\"plan\":\"" + plans[rng() % 4] + "\",\"country\":\"" +
+                         countries[rng() % 6] + "\",\"verified\":" + (rng() % 2 ? "true" : "false") +
+                         ",\"events\":[";
+    while (record.size() + 2 < size) {
+        record += "{\"type\":\"" + std::string(rng() % 2 ? "login" : "purchase") + "\",\"ts\":" +
+                  std::to_string(1700000000 + rng() % 10000000) + ",\"amount\":" +
+                  std::to_string(rng() % 50000) + "},";
+    }
+    record.back() = ']';
+    record += "}";
+    return record;
+}
+
+// Writes and reads back JSON records of range(1) bytes with the value codec
+// off (range(0) == 0) or on (1). The ratio counter is value bytes per byte
+// handed to the engine, i.e. what the codec saves in memtables, block cache
+// and on disk for the CPU the timings show.
+static void BM_ValueCodec(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.codec = state.range(0) ? LEVELCACHE_CODEC_ZSTD : LEVELCACHE_CODEC_NONE;
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    const size_t num_records = 20000;
+    std::mt19937 rng(42);
+    std::vector<std::string> keys;
+    std::vector<std::string> records;
+    for (size_t i = 0; i < num_records; ++i) {
+        keys.push_back("record:" + std::to_string(i));
+        records.push_back(json_record(rng, state.range(1)));
+    }
+    // The first pass trains the dictionary.
+    for (size_t i = 0; i < num_records; ++i) {
+        levelcache_put_n(cache, keys[i].data(), keys[i].size(), records[i].data(), records[i].size(), 0);
+    }
+    LevelCacheStats before;
+    levelcache_get_stats(cache, &before);
+
+    size_t i = 0;
+    size_t value_len;
+    for (auto _ : state) {
+        const std::string& key = keys[i];
+        levelcache_put_n(cache, key.data(), key.size(), records[i].data(), records[i].size(), 0);
+        char* value = levelcache_get_n(cache, key.data(), key.size(), &value_len);
+        benchmark::DoNotOptimize(value);
+        free(value);
+        i = (i + 1) % num_records;
+    }
+    LevelCacheStats after;
+    levelcache_get_stats(cache, &after);
+    uint64_t written = after.bytes_written - before.bytes_written;
+    uint64_t stored = after.bytes_stored - before.bytes_stored;
+    state.counters["ratio"] = stored > 0 ? (double)written / stored : 0;
+    state.SetBytesProcessed(state.iterations() * state.range(1) * 2);
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_ValueCodec)
+    ->ArgNames({"codec", "value_size"})
+    ->ArgsProduct({{0, 1}, {200, 600, 2000}});
+
+// Time to reopen a cache holding range(0) keys with keep_existing, i.e. to
+// rebuild the index from the engine.
+static void BM_WarmRestart(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.keep_existing = 1;
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+    const int64_t num_keys = state.range(0);
+    std::vector<std::string> keys(1000);
+    std::vector<std::string> values(1000);
+    std::vector<const char*> key_ptrs(1000);
+    std::vector<const char*> value_ptrs(1000);
+    for (int64_t i = 0; i < num_keys; i += 1000) {
+        size_t n = std::min<int64_t>(1000, num_keys - i);
+        for (size_t j = 0; j < n; ++j) {
+            char key_buf[32];
+            char val_buf[128];
+            generate_random_string(key_buf, sizeof(key_buf));
+            generate_random_string(val_buf, sizeof(val_buf));
+            keys[j] = key_buf;
+            values[j] = val_buf;
+            key_ptrs[j] = keys[j].c_str();
+            value_ptrs[j] = values[j].c_str();
+        }
+        levelcache_put_batch(cache, key_ptrs.data(), value_ptrs.data(), n, 0);
+    }
+    levelcache_close(cache);
+
+    for (auto _ : state) {
+        cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+        if (!cache) {
+            state.SkipWithError("Failed to reopen database");
+            break;
+        }
+        state.PauseTiming();
+        levelcache_close(cache);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * num_keys);
+    system(command);
+}
+BENCHMARK(BM_WarmRestart)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Index-only comparison between uthash, which the key index used to be built
+// on, and KeyIndex. Each entry carries the same key inline.
+struct UthashEntry {
+    uint64_t expiration;
+    UT_hash_handle hh;
+    char key[24];
+};
+
+struct KeyIndexEntry {
+    uint64_t expiration;
+    KeyIndexNode node;
+    char key[24];
+};
+
+// Inserts range(1) keys into uthash (range(0) == 0) or KeyIndex (1), timing
+// each insert. Reports the worst and 99.9th percentile insert latency and the
+// bytes of index bookkeeping per key, i.e. everything but the key and its
+// expiration.
+static void BM_IndexInsert(benchmark::State& state) {
+    const size_t num_keys = state.range(1);
+    std::vector<uint64_t> latencies(num_keys);
+    double overhead_per_key = 0;
+
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            std::vector<UthashEntry> entries(num_keys);
+            UthashEntry *table = NULL;
+            for (size_t i = 0; i < num_keys; ++i) {
+                UthashEntry *e = &entries[i];
+                snprintf(e->key, sizeof(e->key), "k%014zu", i);
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                HASH_ADD(hh, table, key, strlen(e->key), e);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                latencies[i] = (end.tv_sec - start.tv_sec) * 1000000000ull + (end.tv_nsec - start.tv_nsec);
+            }
+            overhead_per_key = sizeof(UT_hash_handle) +
+                (double)(sizeof(UT_hash_table) + table->hh.tbl->num_buckets * sizeof(UT_hash_bucket)) / num_keys;
+            HASH_CLEAR(hh, table);
+        } else {
+            std::vector<KeyIndexEntry> entries(num_keys);
+            KeyIndex index;
+            ki_init(&index);
+            for (size_t i = 0; i < num_keys; ++i) {
+                KeyIndexEntry *e = &entries[i];
+                e->node.key_len = snprintf(e->key, sizeof(e->key), "k%014zu", i);
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                e->node.hash = ki_hash(e->key, e->node.key_len);
+                ki_insert(&index, &e->node);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                latencies[i] = (end.tv_sec - start.tv_sec) * 1000000000ull + (end.tv_nsec - start.tv_nsec);
+            }
+            overhead_per_key = sizeof(KeyIndexNode) + (double)ki_memory(&index) / num_keys;
+            ki_destroy(&index);
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    state.counters["index_bytes_per_key"] = overhead_per_key;
+    state.counters["p999_insert_ns"] = latencies[num_keys * 999 / 1000];
+    state.counters["max_insert_ns"] = latencies.back();
+    state.SetItemsProcessed(state.iterations() * num_keys);
+}
+BENCHMARK(BM_IndexInsert)
+    ->ArgNames({"keyindex", "keys"})
+    ->Args({0, 1 << 20})
+    ->Args({1, 1 << 20})
+    ->Unit(benchmark::kMillisecond);
+
+// Workload suite: YCSB core workloads A-F, a value size sweep past the memory
+// budget and TTL churn, each on every engine. Keys, values and every thread's
+// operation sequence are generated in Setup, so the timed loop only runs
+// cache calls. `make benchmark-json` writes the results as JSON for
+// regression tracking.
+
+// YCSB's Zipfian generator (Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases"). Rank 0 is the most popular item.
+class ZipfianGenerator {
+public:
+    explicit ZipfianGenerator(uint64_t items, double theta = 0.99) : items_(items), theta_(theta) {
+        zetan_ = zeta(items, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta(2, theta) / zetan_);
+    }
+
+    uint64_t next(std::mt19937_64& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan_;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        uint64_t rank = (uint64_t)(items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+        return rank < items_ ? rank : items_ - 1;
+    }
+
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1 / std::pow((double)i, theta);
+        }
+        return sum;
+    }
+
+    uint64_t items_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// Spreads Zipfian ranks over the key space like YCSB's scrambled generator,
+// so the hot keys do not all land next to each other.
+static uint64_t fnv1a64(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ (value & 0xff)) * 0x100000001b3ull;
+        value >>= 8;
+    }
+    return hash;
+}
+
+enum WorkloadOpType { OP_READ = 0, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW, OP_TYPES };
+static const char* OP_NAMES[OP_TYPES] = { "read", "update", "insert", "scan", "rmw" };
+
+// Percentage of each operation type. With `latest`, reads favour the most
+// recently inserted keys (YCSB D).
+struct WorkloadMix {
+    const char *name;
+    int percent[OP_TYPES];
+    bool latest;
+};
+
+static const WorkloadMix YCSB_WORKLOADS[] = {
+    { "A", { 50, 50, 0, 0, 0 }, false },    // update heavy
+    { "B", { 95, 5, 0, 0, 0 }, false },     // read mostly
+    { "C", { 100, 0, 0, 0, 0 }, false },    // read only
+    { "D", { 95, 0, 5, 0, 0 }, true },      // read latest
+    { "E", { 0, 0, 5, 95, 0 }, false },     // short ranges
+    { "F", { 50, 0, 0, 0, 50 }, false },    // read-modify-write
+};
+static const WorkloadMix TTL_CHURN = { "ttl-churn", { 30, 70, 0, 0, 0 }, false };
+
+enum KeyDistribution { DIST_UNIFORM = 0, DIST_ZIPFIAN = 1 };
+
+struct WorkloadConfig {
+    engine_t engine;
+    const WorkloadMix *mix;
+    KeyDistribution distribution;
+    size_t records;
+    size_t value_size;
+    size_t max_memory_mb;
+    uint32_t cleanup_frequency_sec;
+    uint32_t ttl_seconds;
+};
+
+// One pre-generated operation. `key` is a record id, or for `latest` reads a
+// distance back from the newest insert.
+struct WorkloadOp {
+    uint8_t type;
+    uint8_t scan_len;
+    uint32_t key;
+};
+
+#define WORKLOAD_OPS_PER_THREAD (1 << 16)
+#define WORKLOAD_MAX_SCAN 100
+#define VALUE_POOL_SLACK 4096
+
+// Shared by all threads of a workload run; built by thread 0 in Setup.
+struct WorkloadRun {
+    WorkloadConfig config;
+    LevelCache *cache = nullptr;
+    std::vector<std::string> keys;      // twice `records`, leaving room for inserts
+    std::vector<const char*> key_ptrs;
+    std::vector<size_t> key_lens;
+    std::string value_pool;             // values are slices of random bytes
+    std::atomic<uint64_t> next_insert{0};
+    std::vector<std::vector<WorkloadOp>> ops;
+};
+static WorkloadRun workload;
+
+static const char* workload_value(size_t i) {
+    return workload.value_pool.data() + (i * 64) % VALUE_POOL_SLACK;
+}
+
+static std::vector<WorkloadOp> generate_ops(const WorkloadConfig& config, uint64_t seed, ZipfianGenerator *zipf) {
+    std::mt19937_64 rng(seed);
+    std::vector<WorkloadOp> ops(WORKLOAD_OPS_PER_THREAD);
+    for (auto& op : ops) {
+        int roll = (int)(rng() % 100);
+        op.type = 0;
+        while (roll >= config.mix->percent[op.type]) {
+            roll -= config.mix->percent[op.type++];
+        }
+        if (config.mix->latest || config.distribution == DIST_ZIPFIAN) {
+            uint64_t rank = zipf->next(rng);
+            op.key = (uint32_t)(config.mix->latest ? rank : fnv1a64(rank) % config.records);
+        } else {
+            op.key = (uint32_t)(rng() % config.records);
+        }
+        op.scan_len = (uint8_t)(1 + rng() % WORKLOAD_MAX_SCAN);
+    }
+    return ops;
+}
+
+static void WorkloadSetUp(const benchmark::State& state, const WorkloadConfig& config) {
+    if (state.thread_index() != 0) {
+        return;
+    }
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = config.max_memory_mb;
+    options.cleanup_frequency_sec = config.cleanup_frequency_sec;
+    options.log_level = LOG_FATAL;
+    options.engine = config.engine;
+    workload.config = config;
+    workload.cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!workload.cache) {
+        fprintf(stderr, "Failed to open database. Aborting benchmarks.\n");
+        exit(1);
+    }
+
+    size_t pool = config.records * 2;
+    workload.keys.resize(pool);
+    workload.key_ptrs.resize(pool);
+    workload.key_lens.resize(pool);
+    for (size_t i = 0; i < pool; i++) {
+        char key_buf[32];
+        snprintf(key_buf, sizeof(key_buf), "user%012zu", i);
+        workload.keys[i] = key_buf;
+        workload.key_ptrs[i] = workload.keys[i].c_str();
+        workload.key_lens[i] = workload.keys[i].size();
+    }
+    workload.value_pool.resize(config.value_size + VALUE_POOL_SLACK + 1);
+    generate_random_string(&workload.value_pool[0], workload.value_pool.size());
+
+    std::vector<const char*> value_ptrs(1000);
+    std::vector<size_t> value_lens(1000, config.value_size);
+    for (size_t i = 0; i < config.records; i += 1000) {
+        size_t n = std::min<size_t>(1000, config.records - i);
+        for (size_t j = 0; j < n; j++) {
+            value_ptrs[j] = workload_value(i + j);
+        }
+        levelcache_put_batch_n(workload.cache, &workload.key_ptrs[i], &workload.key_lens[i],
+                               value_ptrs.data(), value_lens.data(), n, config.ttl_seconds);
+    }
+    workload.next_insert = config.records;
+
+    std::unique_ptr<ZipfianGenerator> zipf;
+    if (config.mix->latest || config.distribution == DIST_ZIPFIAN) {
+        zipf.reset(new ZipfianGenerator(config.records));
+    }
+    workload.ops.clear();
+    for (int t = 0; t < state.threads(); t++) {
+        workload.ops.push_back(generate_ops(config, 0x9e3779b97f4a7c15ull * (t + 1), zipf.get()));
+    }
+}
+
+static void WorkloadTearDown(const benchmark::State& state) {
+    if (state.thread_index() != 0) {
+        return;
+    }
+    levelcache_close(workload.cache);
+    workload.cache = nullptr;
+    workload.keys.clear();
+    workload.key_ptrs.clear();
+    workload.key_lens.clear();
+    workload.ops.clear();
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+}
+
+// Per-thread results of a workload run.
+struct WorkloadCounts {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+static void count_read(WorkloadCounts& counts, const char *value) {
+    if (value != nullptr) {
+        counts.hits++;
+    } else {
+        counts.misses++;
+    }
+}
+
+// Runs one operation; returns false if the cache reported an error.
+static bool run_op(const WorkloadOp& op, size_t i, WorkloadCounts& counts, LevelCacheScanEntry *scan_entries) {
+    const WorkloadConfig& config = workload.config;
+    size_t pool = workload.keys.size();
+    uint64_t id = op.key;
+    if (config.mix->latest) {
+        id = workload.next_insert.load(std::memory_order_relaxed) - 1 - op.key;
+    }
+    size_t slot = id % pool;
+    const char *key = workload.key_ptrs[slot];
+    size_t key_len = workload.key_lens[slot];
+
+    switch (op.type) {
+    case OP_READ: {
+        char *val = levelcache_get_n(workload.cache, key, key_len, NULL);
+        benchmark::DoNotOptimize(val);
+        count_read(counts, val);
+        free(val);
+        return true;
+    }
+    case OP_UPDATE:
+        return levelcache_put_n(workload.cache, key, key_len, workload_value(i), config.value_size,
+                                config.ttl_seconds) == 0;
+    case OP_INSERT: {
+        slot = workload.next_insert.fetch_add(1, std::memory_order_relaxed) % pool;
+        return levelcache_put_n(workload.cache, workload.key_ptrs[slot], workload.key_lens[slot],
+                                workload_value(i), config.value_size, config.ttl_seconds) == 0;
+    }
+    case OP_SCAN: {
+        // Up to scan_len keys in order, starting at the chosen one.
+        LevelCacheScan *scan = levelcache_scan_range(workload.cache, key, key_len, NULL, 0);
+        if (scan == NULL) {
+            return false;
+        }
+        ssize_t found = levelcache_scan_next(scan, scan_entries, op.scan_len);
+        benchmark::DoNotOptimize(scan_entries);
+        levelcache_scan_close(scan);
+        if (found >= 0) {
+            counts.hits += found;
+            counts.misses += op.scan_len - found;
+        }
+        return found >= 0;
+    }
+    case OP_RMW: {
+        char *val = levelcache_get_n(workload.cache, key, key_len, NULL);
+        count_read(counts, val);
+        free(val);
+        return levelcache_put_n(workload.cache, key, key_len, workload_value(i), config.value_size,
+                                config.ttl_seconds) == 0;
+    }
+    }
+    return false;
+}
+
+// Runs the thread's pre-generated operations, timing each into a per-thread
+// histogram. Percentiles are averaged over threads in the report.
+static void run_workload(benchmark::State& state) {
+    std::vector<WorkloadOp>& ops = workload.ops[state.thread_index()];
+    CacheStats latency;
+    if (cache_stats_init(&latency, CACHE_STATS_TIMINGS, 1, OP_TYPES) != 0) {
+        state.SkipWithError("Failed to allocate histograms");
+        return;
+    }
+    WorkloadCounts counts;
+    LevelCacheScanEntry scan_entries[WORKLOAD_MAX_SCAN];
+
+    size_t i = 0;
+    for (auto _ : state) {
+        const WorkloadOp& op = ops[i % WORKLOAD_OPS_PER_THREAD];
+        uint64_t start = cache_stats_read_ticks();
+        if (!run_op(op, i, counts, scan_entries)) {
+            state.SkipWithError("Operation failed");
+            break;
+        }
+        cache_stats_record(&latency, op.type, start, cache_stats_read_ticks());
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    for (int type = 0; type < OP_TYPES; type++) {
+        CacheStatsSummary summary;
+        cache_stats_summarize(&latency, type, &summary);
+        if (summary.count == 0) {
+            continue;
+        }
+        std::string name = OP_NAMES[type];
+        state.counters[name + "_p50(ns)"] = benchmark::Counter(summary.p50_ns, benchmark::Counter::kAvgThreads);
+        state.counters[name + "_p99(ns)"] = benchmark::Counter(summary.p99_ns, benchmark::Counter::kAvgThreads);
+        state.counters[name + "_p999(ns)"] = benchmark::Counter(summary.p999_ns, benchmark::Counter::kAvgThreads);
+    }
+    if (counts.hits + counts.misses > 0) {
+        state.counters["hit_ratio"] = benchmark::Counter((double)counts.hits / (counts.hits + counts.misses),
+                                                         benchmark::Counter::kAvgThreads);
+    }
+    cache_stats_destroy(&latency);
+}
+
+// YCSB workload range(1) on engine range(0), with uniform (range(2) == 0) or
+// Zipfian (1) keys. 100k records of 1 KB, as in the YCSB defaults.
+static WorkloadConfig ycsb_config(const benchmark::State& state) {
+    WorkloadConfig config;
+    config.engine = (engine_t)state.range(0);
+    config.mix = &YCSB_WORKLOADS[state.range(1)];
+    config.distribution = (KeyDistribution)state.range(2);
+    config.records = 100000;
+    config.value_size = 1000;
+    config.max_memory_mb = 256;
+    config.cleanup_frequency_sec = 0;
+    config.ttl_seconds = 0;
+    return config;
+}
+
+static void YcsbSetUp(const benchmark::State& state) {
+    WorkloadSetUp(state, ycsb_config(state));
+}
+
+static void BM_Ycsb(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        state.SetLabel(std::string(engine_names[state.range(0)]) + " workload " + YCSB_WORKLOADS[state.range(1)].name);
+    }
+    run_workload(state);
+}
+BENCHMARK(BM_Ycsb)
+    ->ArgNames({"engine", "workload", "zipfian"})
+    ->ArgsProduct({{ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_MEMORY, ENGINE_BITCASK}, {0, 1, 2, 3, 4, 5}, {DIST_UNIFORM, DIST_ZIPFIAN}})
+    ->Setup(YcsbSetUp)
+    ->Teardown(WorkloadTearDown)
+    ->Threads(1)
+    ->Threads(8)
+    ->UseRealTime();
+
+// YCSB A with uniform keys on engine range(0) and range(1)-byte values. The
+// working set is range(2) percent of a 32 MB budget, so runs above 100 keep
+// evicting and the hit ratio shows how much of it stays cached.
+static void ValueSizeSetUp(const benchmark::State& state) {
+    WorkloadConfig config;
+    config.engine = (engine_t)state.range(0);
+    config.mix = &YCSB_WORKLOADS[0];
+    config.distribution = DIST_UNIFORM;
+    config.value_size = state.range(1);
+    config.max_memory_mb = 32;
+    size_t working_set = config.max_memory_mb * 1024 * 1024 / 100 * state.range(2);
+    config.records = std::min<size_t>(std::max<size_t>(working_set / (config.value_size + 16), 16), 1 << 20);
+    config.cleanup_frequency_sec = 0;
+    config.ttl_seconds = 0;
+    WorkloadSetUp(state, config);
+}
+
+static void BM_ValueSize(benchmark::State& state) {
+    run_workload(state);
+    state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_ValueSize)
+    ->ArgNames({"engine", "value_size", "working_set_pct"})
+    ->ArgsProduct({{ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_MEMORY, ENGINE_BITCASK}, {16, 256, 4 << 10, 64 << 10, 1 << 20}, {50, 400}})
+    ->Setup(ValueSizeSetUp)
+    ->Teardown(WorkloadTearDown)
+    ->Threads(4)
+    ->UseRealTime();
+
+// Writes with a 1 second TTL over 100k keys on engine range(0) while the
+// cleanup thread runs every second, so expiry, cleanup and eviction compete
+// with the foreground operations.
+static void TtlChurnSetUp(const benchmark::State& state) {
+    WorkloadConfig config;
+    config.engine = (engine_t)state.range(0);
+    config.mix = &TTL_CHURN;
+    config.distribution = DIST_UNIFORM;
+    config.records = 100000;
+    config.value_size = 128;
+    config.max_memory_mb = 64;
+    config.cleanup_frequency_sec = 1;
+    config.ttl_seconds = 1;
+    WorkloadSetUp(state, config);
+}
+
+static void BM_TtlChurn(benchmark::State& state) {
+    run_workload(state);
+    if (state.thread_index() == 0) {
+        LevelCacheStats stats;
+        levelcache_get_stats(workload.cache, &stats);
+        state.counters["cleanup_deletions"] = stats.cleanup_deletions;
+        state.counters["expired_on_read"] = stats.expired_on_read;
+    }
+}
+BENCHMARK(BM_TtlChurn)
+    ->ArgNames({"engine"})
+    ->Arg(ENGINE_LEVELDB)
+    ->Arg(ENGINE_ROCKSDB)
+    ->Arg(ENGINE_MEMORY)
+    ->Arg(ENGINE_BITCASK)
+    ->Setup(TtlChurnSetUp)
+    ->Teardown(WorkloadTearDown)
+    ->Threads(1)
+    ->Threads(4)
+    ->MinTime(3)
+    ->UseRealTime();
+
+// Read-through traffic against a 4 MB budget that holds a fraction of the
+// keys: Zipfian reads over 100k keys, each miss loading the key with a put,
+// interleaved with range(1) percent of one-off keys as a batch job scanning
+// through the cache would produce. Admission is off (range(0) == 0) or on
+// (1); hit_ratio is that of the Zipfian reads alone.
+static void BM_AdmissionHitRatio(benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = 4;
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.admission = (int)state.range(0);
+    LevelCache* cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    if (!cache) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+
+    const uint64_t records = 100000;
+    ZipfianGenerator zipf(records);
+    std::mt19937_64 rng(7);
+    std::string value(100, 'v');
+    uint64_t next_scan_key = 0;
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+    size_t value_len;
+    for (auto _ : state) {
+        bool scan = (int64_t)(rng() % 100) < state.range(1);
+        std::string key = scan ? "scan:" + std::to_string(next_scan_key++)
+                               : "user:" + std::to_string(fnv1a64(zipf.next(rng)) % records);
+        char* found = levelcache_get_n(cache, key.data(), key.size(), &value_len);
+        if (found != nullptr) {
+            hits += !scan;
+            free(found);
+        } else {
+            levelcache_put_n(cache, key.data(), key.size(), value.data(), value.size(), 0);
+        }
+        reads += !scan;
+    }
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    state.counters["hit_ratio"] = reads > 0 ? (double)hits / reads : 0;
+    state.counters["admitted"] = stats.admitted;
+    state.counters["rejected"] = stats.rejected;
+
+    levelcache_close(cache);
+    system(command);
+}
+BENCHMARK(BM_AdmissionHitRatio)
+    ->ArgNames({"admission", "scan_pct"})
+    ->ArgsProduct({{0, 1}, {0, 50}})
+    ->Iterations(1000000);
+
+// Read-through traffic from 16 threads over 16 hot keys with a 1 second TTL,
+// each load costing 20 ms of backend time. Mode range(0) == 0 loads every miss
+// with a get followed by a put, so an expiring key sends each thread to the
+// backend; 1 goes through get_or_load without early refresh, coalescing those
+// misses into one load; 2 adds early refresh, so keys are reloaded before
+// they expire and hardly any caller misses.
+static LevelCache* stampede_cache;
+static std::atomic<uint64_t> stampede_loads;
+
+static char* StampedeLoader(const char*, size_t, size_t* value_len, void*) {
+    stampede_loads++;
+    usleep(20000);
+    *value_len = 100;
+    char* value = (char*)malloc(100);
+    memset(value, 'v', 100);
+    return value;
+}
+
+static void StampedeSetUp(const benchmark::State& state) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.cleanup_frequency_sec = 0;
+    options.log_level = LOG_FATAL;
+    options.engine = etype;
+    options.early_refresh_beta = (state.range(0) == 2) ? 1.0 : 0;
+    stampede_cache = levelcache_open_with_options(DB_PATH_BENCH, &options);
+    stampede_loads = 0;
+}
+
+static void StampedeTearDown(const benchmark::State&) {
+    levelcache_close(stampede_cache);
+    stampede_cache = nullptr;
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH_BENCH);
+    system(command);
+}
+
+static void BM_GetOrLoadStampede(benchmark::State& state) {
+    if (stampede_cache == nullptr) {
+        state.SkipWithError("Failed to open database");
+        return;
+    }
+    std::mt19937_64 rng(state.thread_index() + 1);
+    size_t value_len;
+    for (auto _ : state) {
+        std::string key = "hot:" + std::to_string(rng() % 16);
+        char* value;
+        if (state.range(0) == 0) {
+            value = levelcache_get_n(stampede_cache, key.data(), key.size(), &value_len);
+            if (value == nullptr) {
+                value = StampedeLoader(key.data(), key.size(), &value_len, nullptr);
+                levelcache_put_n(stampede_cache, key.data(), key.size(), value, value_len, 1);
+            }
+        } else {
+            value = levelcache_get_or_load_n(stampede_cache, key.data(), key.size(), &value_len,
+                                             StampedeLoader, nullptr, 1);
+        }
+        free(value);
+    }
+    if (state.thread_index() == 0) {
+        LevelCacheStats stats;
+        levelcache_get_stats(stampede_cache, &stats);
+        state.counters["backend_loads"] = stampede_loads.load();
+        state.counters["misses"] = stats.misses;
+    }
+}
+BENCHMARK(BM_GetOrLoadStampede)
+    ->ArgNames({"mode"})
+    ->DenseRange(0, 2)
+    ->Setup(StampedeSetUp)
+    ->Teardown(StampedeTearDown)
+    ->Threads(16)
+    ->MinTime(3)
+    ->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -0,0 +1,40 @@
+#ifndef ASYNC_POOL_H
+#define ASYNC_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LevelCache;
+
+/**
+ * @brief Most queued requests a worker takes at once. The gets among them
+ * are answered with a single multi_get.
+ */
+#define ASYNC_POOL_BATCH 32
+
+/**
+ * @brief The workers behind the asynchronous API.
+ *
+ * Submissions go onto one queue under a mutex; each worker takes up to
+ * ASYNC_POOL_BATCH requests, runs them through the synchronous API and either
+ * calls the request's callback or appends the completion to a done queue and
+ * signals an eventfd. The number of workers is the number of engine
+ * operations in flight, which is what lets a disk-bound engine overlap reads.
+ */
+typedef struct AsyncPool AsyncPool;
+
+/**
+ * @brief Starts `threads` workers for `cache`. At most `depth` operations may
+ * be submitted and not yet completed or polled.
+ *
+ * @return The pool, or NULL if the eventfd or a thread could not be created.
+ */
+AsyncPool* async_pool_create(struct LevelCache *cache, uint32_t threads, size_t depth);
+
+/**
+ * @brief Runs whatever is still queued, stops the workers and frees
+ * completions that were never polled, values included.
+ */
+void async_pool_destroy(AsyncPool *pool);
+
+#endif // ASYNC_POOL_H
@@ -0,0 +1,87 @@
+#ifndef CACHE_LOG_H
+#define CACHE_LOG_H
+
+#include "log.h"
+
+/**
+ * @brief Lowest log level compiled in.
+ *
+ * Calls below it are removed entirely, arguments included, so a build with
+ * `-DLEVELCACHE_MIN_LOG_LEVEL=LOG_WARN` (`make MIN_LOG_LEVEL=LOG_WARN`) pays
+ * nothing for the trace, debug and info logging on the put and get paths.
+ */
+#ifndef LEVELCACHE_MIN_LOG_LEVEL
+#define LEVELCACHE_MIN_LOG_LEVEL LOG_TRACE
+#endif
+
+// Runtime level and whether records go through the async ring; read with a
+// relaxed load before anything else is done for a call.
+extern int cache_log_level;
+extern int cache_log_async;
+
+void cache_log_async_push(int level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#define CACHE_LOG(level, ...)                                                      \
+    do {                                                                           \
+        if ((level) >= LEVELCACHE_MIN_LOG_LEVEL &&                                 \
+            (level) >= __atomic_load_n(&cache_log_level, __ATOMIC_RELAXED)) {      \
+            if (__atomic_load_n(&cache_log_async, __ATOMIC_RELAXED)) {             \
+                cache_log_async_push((level), __FILE__, __LINE__, __VA_ARGS__);    \
+            } else {                                                               \
+                log_log((level), __FILE__, __LINE__, __VA_ARGS__);                 \
+            }                                                                      \
+        }                                                                          \
+    } while (0)
+
+// The log.h macros are replaced so every existing call site is gated.
+#undef log_trace
+#undef log_debug
+#undef log_info
+#undef log_warn
+#undef log_error
+#undef log_fatal
+#define log_trace(...) CACHE_LOG(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) CACHE_LOG(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  CACHE_LOG(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  CACHE_LOG(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) CACHE_LOG(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) CACHE_LOG(LOG_FATAL, __VA_ARGS__)
+
+/**
+ * @brief Sets the runtime log level, here and in log.c.
+ */
+void cache_log_set_level(int level);
+
+/**
+ * @brief Number of records the async ring holds. A record that finds it full
+ * is dropped and counted rather than blocking the caller.
+ */
+#define CACHE_LOG_RING_SLOTS 4096
+#define CACHE_LOG_MESSAGE_MAX 224
+
+/**
+ * @brief Starts routing log records through a lock-free ring drained by a
+ * background thread, or registers another user if it is already running.
+ *
+ * The caller only renders the message into a ring slot; the background
+ * thread hands it to log.c, which adds the timestamp, level and source
+ * location and does the I/O. Messages longer than CACHE_LOG_MESSAGE_MAX are
+ * truncated.
+ *
+ * @return 0 on success, -1 if the ring or thread could not be created.
+ */
+int cache_log_async_acquire(void);
+
+/**
+ * @brief Drops a user of the async logger. The last one drains the ring and
+ * stops the thread, and logging goes back to being synchronous.
+ */
+void cache_log_async_release(void);
+
+/**
+ * @brief Records dropped because the ring was full.
+ */
+size_t cache_log_async_dropped(void);
+
+#endif // CACHE_LOG_H
@@ -0,0 +1,137 @@
+#ifndef CACHE_STATS_H
+#define CACHE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * @brief Counters and latency histograms, striped so that threads updating
+ * them do not share cache lines.
+ *
+ * Each thread is given a stripe the first time it records anything, and every
+ * update is a relaxed atomic add to that stripe, so recording costs a few
+ * nanoseconds and no locks. Readers sum all stripes.
+ *
+ * Histograms are log-linear in the style of HdrHistogram: each power of two is
+ * split into CACHE_STATS_SUB_BUCKETS linear buckets, giving about 12% relative
+ * precision over the whole range. Latencies are recorded in raw timestamp
+ * counter ticks and converted to nanoseconds only when read.
+ */
+#define CACHE_STATS_STRIPES 16
+#define CACHE_STATS_SUB_BITS 3
+#define CACHE_STATS_SUB_BUCKETS (1u << CACHE_STATS_SUB_BITS)
+// Covers 2^40 ticks, several minutes on any current clock.
+#define CACHE_STATS_BUCKETS ((40 - CACHE_STATS_SUB_BITS) * CACHE_STATS_SUB_BUCKETS + 2 * CACHE_STATS_SUB_BUCKETS)
+
+typedef enum {
+    CACHE_STATS_OFF = 0,
+    CACHE_STATS_COUNTERS,       /**< Counters only. */
+    CACHE_STATS_TIMINGS,        /**< Counters and latency histograms. */
+} CacheStatsLevel;
+
+typedef struct CacheStatsStripe {
+    uint64_t *counters;
+    uint64_t *buckets;          // num_histograms * CACHE_STATS_BUCKETS, or NULL
+} CacheStatsStripe;
+
+typedef struct CacheStats {
+    CacheStatsLevel level;
+    unsigned num_counters;
+    unsigned num_histograms;
+    CacheStatsStripe stripes[CACHE_STATS_STRIPES];
+    uint64_t start_ticks;
+    uint64_t start_ns;
+} CacheStats;
+
+/**
+ * @brief Summary of one histogram, in nanoseconds.
+ */
+typedef struct CacheStatsSummary {
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} CacheStatsSummary;
+
+extern __thread unsigned cache_stats_thread_stripe;
+unsigned cache_stats_assign_stripe(void);
+
+static inline CacheStatsStripe* cache_stats_stripe(CacheStats *stats) {
+    unsigned stripe = cache_stats_thread_stripe;
+    if (__builtin_expect(stripe == 0, 0)) {
+        stripe = cache_stats_assign_stripe();
+    }
+    return &stats->stripes[stripe - 1];
+}
+
+static inline uint64_t cache_stats_read_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void cache_stats_add(CacheStats *stats, unsigned counter, uint64_t n) {
+    if (stats->level >= CACHE_STATS_COUNTERS) {
+        __atomic_add_fetch(&cache_stats_stripe(stats)->counters[counter], n, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief A timestamp to pass to cache_stats_record, or 0 when timings are off.
+ */
+static inline uint64_t cache_stats_ticks(const CacheStats *stats) {
+    return stats->level >= CACHE_STATS_TIMINGS ? cache_stats_read_ticks() : 0;
+}
+
+static inline unsigned cache_stats_bucket(uint64_t ticks) {
+    if (ticks < 2 * CACHE_STATS_SUB_BUCKETS) {
+        return (unsigned)ticks;
+    }
+    unsigned shift = 63 - __builtin_clzll(ticks) - CACHE_STATS_SUB_BITS;
+    unsigned bucket = shift * CACHE_STATS_SUB_BUCKETS + (unsigned)(ticks >> shift);
+    return bucket < CACHE_STATS_BUCKETS ? bucket : CACHE_STATS_BUCKETS - 1;
+}
+
+/**
+ * @brief Records `end - start` into histogram `histogram`.
+ */
+static inline void cache_stats_record(CacheStats *stats, unsigned histogram, uint64_t start, uint64_t end) {
+    if (stats->level >= CACHE_STATS_TIMINGS) {
+        uint64_t *buckets = cache_stats_stripe(stats)->buckets + (size_t)histogram * CACHE_STATS_BUCKETS;
+        __atomic_add_fetch(&buckets[cache_stats_bucket(end > start ? end - start : 0)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Initialises `stats` for `num_counters` counters and, at
+ * CACHE_STATS_TIMINGS, `num_histograms` histograms.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int cache_stats_init(CacheStats *stats, CacheStatsLevel level, unsigned num_counters, unsigned num_histograms);
+
+void cache_stats_destroy(CacheStats *stats);
+
+/**
+ * @brief Bytes allocated for the stripes.
+ */
+size_t cache_stats_memory(const CacheStats *stats);
+
+uint64_t cache_stats_counter(const CacheStats *stats, unsigned counter);
+
+void cache_stats_summarize(const CacheStats *stats, unsigned histogram, CacheStatsSummary *summary);
+
+#endif // CACHE_STATS_H
@@ -0,0 +1,67 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Where the process-wide coarse clock gets its time from.
+ */
+typedef enum {
+    COARSE_CLOCK_TICKER = 0,    /**< A background thread refreshes a cached value once per second. */
+    COARSE_CLOCK_MONOTONIC,     /**< CLOCK_MONOTONIC_COARSE, offset to wall-clock time at startup. */
+    COARSE_CLOCK_MANUAL,        /**< Only moves when set or advanced; for tests. */
+} CoarseClockSource;
+
+// Cached wall-clock seconds. Zero while the monotonic source is selected.
+extern uint64_t coarse_clock_seconds;
+extern int64_t coarse_clock_offset;
+
+/**
+ * @brief Current wall-clock time in whole seconds.
+ *
+ * TTLs have one-second granularity, so this is what every expiration is
+ * computed and compared against instead of time(NULL). With the ticker or a
+ * manual clock a read is a single relaxed load.
+ */
+static inline uint64_t coarse_clock_now(void) {
+    uint64_t seconds = __atomic_load_n(&coarse_clock_seconds, __ATOMIC_RELAXED);
+    if (__builtin_expect(seconds != 0, 1)) {
+        return seconds;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)(ts.tv_sec + __atomic_load_n(&coarse_clock_offset, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Registers a user of the clock, starting it on the first one.
+ *
+ * The clock is shared by every cache in the process. `source` only takes
+ * effect when the clock is not already in use, and never replaces a manual
+ * clock.
+ */
+void coarse_clock_acquire(CoarseClockSource source);
+
+/**
+ * @brief Drops a user of the clock; the ticker thread stops with the last one.
+ */
+void coarse_clock_release(void);
+
+/**
+ * @brief Switches the clock's source. Switching to COARSE_CLOCK_MANUAL
+ * freezes it at the current time.
+ */
+void coarse_clock_set_source(CoarseClockSource source);
+
+/**
+ * @brief Sets a manual clock to `seconds`, switching to it if needed.
+ */
+void coarse_clock_set(uint64_t seconds);
+
+/**
+ * @brief Moves a manual clock forward by `seconds`.
+ */
+void coarse_clock_advance(uint64_t seconds);
+
+#endif // COARSE_CLOCK_H
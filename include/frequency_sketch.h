@@ -0,0 +1,52 @@
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Approximate access counts of recently seen keys (TinyLFU).
+ *
+ * A count-min sketch of 4-bit counters, sixteen to a 64-bit word, four per
+ * key. A key's estimate is the smallest of its counters, so collisions can
+ * only overstate it. Once ten increments per tracked key have been recorded
+ * every counter is halved, so counts reflect recent popularity rather than
+ * all history.
+ *
+ * Updates are lock-free compare-and-swaps on the word holding a counter; a
+ * halving that races with them may lose an increment, which only makes the
+ * estimate a little lower.
+ */
+typedef struct FrequencySketch {
+    uint64_t *table;
+    uint64_t mask;          // counters in the table minus one
+    uint64_t sample_size;   // increments between two halvings
+    uint64_t additions;     // increments since the last halving
+    int resetting;
+} FrequencySketch;
+
+/**
+ * @brief Sizes the sketch to track about `keys` distinct keys.
+ *
+ * @return 0 on success, -1 if out of memory.
+ */
+int sketch_init(FrequencySketch *sketch, size_t keys);
+
+void sketch_destroy(FrequencySketch *sketch);
+
+/**
+ * @brief Records one access of the key with hash `hash`.
+ */
+void sketch_increment(FrequencySketch *sketch, uint64_t hash);
+
+/**
+ * @brief Recent accesses of the key with hash `hash`, at most 15.
+ */
+uint32_t sketch_estimate(const FrequencySketch *sketch, uint64_t hash);
+
+/**
+ * @brief Bytes held by the sketch.
+ */
+size_t sketch_memory(const FrequencySketch *sketch);
+
+#endif // FREQUENCY_SKETCH_H
@@ -0,0 +1,95 @@
+#ifndef HOT_TIER_H
+#define HOT_TIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "uthash.h"
+
+/**
+ * @brief A value cached in process memory.
+ *
+ * Entries are reference counted: the tier holds one reference while the
+ * entry is resident and every reader holds one while it uses the value, so
+ * eviction never frees memory a reader is still looking at.
+ */
+typedef struct HotEntry {
+    uint32_t refcnt;
+    uint8_t referenced;
+    uint64_t expiration;
+    size_t key_len;
+    size_t value_len;
+    struct HotEntry *clock_prev;
+    struct HotEntry *clock_next;
+    UT_hash_handle hh;
+    char data[]; // key bytes followed by value bytes
+} HotEntry;
+
+static inline const char* hot_entry_value(const HotEntry *entry) {
+    return entry->data + entry->key_len;
+}
+
+/**
+ * @brief One partition of the tier, with its own CLOCK ring and byte budget.
+ *
+ * `generation` is bumped by every invalidation; a reader that fetched a
+ * value from the engine only installs it if no invalidation happened in
+ * between, so a racing write can never be shadowed by a stale value.
+ */
+typedef struct HotShard {
+    pthread_rwlock_t lock;
+    HotEntry *table;
+    HotEntry *hand;
+    size_t bytes;
+    size_t capacity;
+    uint64_t generation;
+} __attribute__((aligned(64))) HotShard;
+
+typedef struct HotTier {
+    uint32_t num_shards;
+    uint32_t shard_shift;
+    size_t max_entry_bytes;
+    HotShard *shards;
+} HotTier;
+
+/**
+ * @brief Creates a tier holding at most `capacity_bytes` of entries, split
+ * evenly over `num_shards` (a power of two) partitions.
+ */
+HotTier* hot_tier_create(size_t capacity_bytes, uint32_t num_shards);
+
+void hot_tier_destroy(HotTier *tier);
+
+/**
+ * @brief Looks a key up. On a hit the entry is returned with an extra
+ * reference that the caller drops with hot_entry_release().
+ */
+HotEntry* hot_tier_lookup(HotTier *tier, const char *key, size_t key_len, uint64_t hash, uint64_t now);
+
+/**
+ * @brief Reads the generation of the key's shard, to be passed back to
+ * hot_tier_insert() after the value has been fetched.
+ */
+uint64_t hot_tier_generation(HotTier *tier, uint64_t hash);
+
+/**
+ * @brief Caches a value unless the shard was invalidated since `generation`
+ * was read, or the value is too large for the tier.
+ */
+void hot_tier_insert(HotTier *tier, const char *key, size_t key_len, uint64_t hash,
+                     const char *value, size_t value_len, uint64_t expiration, uint64_t generation);
+
+/**
+ * @brief Drops any cached value for the key. Must be called after the engine
+ * write that made it stale.
+ */
+void hot_tier_invalidate(HotTier *tier, const char *key, size_t key_len, uint64_t hash);
+
+void hot_entry_release(HotEntry *entry);
+
+/**
+ * @brief Bytes currently held by resident entries.
+ */
+size_t hot_tier_usage(HotTier *tier);
+
+#endif // HOT_TIER_H
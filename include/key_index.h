@@ -0,0 +1,105 @@
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KI_GROUP_SIZE 16
+
+/**
+ * @brief The part of an indexed object the index reads.
+ *
+ * The key bytes must directly follow the node in memory, which is how
+ * KeyMetadata lays out its inline key.
+ */
+typedef struct KeyIndexNode {
+    uint64_t hash;
+    uint32_t key_len;
+} KeyIndexNode;
+
+static inline const char* ki_node_key(const KeyIndexNode *node) {
+    return (const char *)(node + 1);
+}
+
+typedef struct KeyIndexTable {
+    uint8_t *ctrl;          // one control byte per slot: empty, deleted or a 7-bit fingerprint
+    KeyIndexNode **slots;
+    size_t capacity;        // power of two, at least one group
+    size_t size;
+    size_t tombstones;
+} KeyIndexTable;
+
+/**
+ * @brief An open-addressing hash index in the style of a Swiss table.
+ *
+ * Slots are probed a group of 16 at a time by comparing a 7-bit fingerprint
+ * of every slot against the key's with one SSE2 instruction, so most
+ * lookups touch a single cache line of control bytes and dereference only
+ * the entry that matches. A key costs its 16-byte node plus 9 bytes per
+ * slot, against uthash's 56-byte handle plus its bucket array.
+ *
+ * Growing never rehashes the whole table at once: a larger table is
+ * allocated and every following insert or erase migrates one group from the
+ * old table, which is searched as well until it is drained.
+ *
+ * Not thread-safe; the caller provides locking.
+ */
+typedef struct KeyIndex {
+    KeyIndexTable cur;
+    KeyIndexTable old;
+    size_t migrate_pos;
+} KeyIndex;
+
+/**
+ * @brief Hashes a key. The index takes the fingerprint from the low bits and
+ * the probe start from the bits above them, so callers partitioning keys
+ * should use the high bits.
+ */
+uint64_t ki_hash(const void *key, size_t key_len);
+
+void ki_init(KeyIndex *index);
+
+/**
+ * @brief Frees the index's tables; the indexed objects are left alone.
+ */
+void ki_destroy(KeyIndex *index);
+
+KeyIndexNode* ki_find(const KeyIndex *index, const char *key, size_t key_len, uint64_t hash);
+
+/**
+ * @brief Adds a node whose key is not in the index yet.
+ *
+ * @return 0 on success, -1 if the table was full and could not grow.
+ */
+int ki_insert(KeyIndex *index, KeyIndexNode *node);
+
+/**
+ * @brief Removes a node that is in the index.
+ */
+void ki_erase(KeyIndex *index, KeyIndexNode *node);
+
+static inline size_t ki_size(const KeyIndex *index) {
+    return index->cur.size + index->old.size;
+}
+
+/**
+ * @brief Bytes held by the index's own tables.
+ */
+size_t ki_memory(const KeyIndex *index);
+
+/**
+ * @brief Iterates over all nodes. Start with `*cursor = 0`; returns NULL at
+ * the end. The index must not be modified while iterating.
+ */
+KeyIndexNode* ki_iter_next(const KeyIndex *index, size_t *cursor);
+
+/**
+ * @brief Fills `out` with up to `count` nodes from consecutive slots,
+ * starting at a slot picked from `seed` and wrapping around at most once.
+ *
+ * @return The number of nodes stored; fewer than `count` only if the index
+ *         holds fewer.
+ */
+size_t ki_sample(const KeyIndex *index, uint64_t seed, KeyIndexNode **out, size_t count);
+
+#endif // KEY_INDEX_H
@@ -4,26 +4,64 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include "leveldb/c.h"
 #include "../vendor/rocksdb/include/rocksdb/c.h"
-#include "uthash.h"
-#include "log.h"
+#include "cache_log.h"
 #include "storage_engine.h"
+#include "timer_wheel.h"
+#include "hot_tier.h"
+#include "slab.h"
+#include "key_index.h"
+#include "coarse_clock.h"
+#include "cache_stats.h"
+#include "async_pool.h"
+#include "value_codec.h"
+#include "frequency_sketch.h"
+#include "single_flight.h"
 
-static StorageEngine* ALL_ENGINES[LIMIT] = {
-    &LEVELDB_ENGINE,
-    &ROCKSDB_ENGINE
-};
+extern StorageEngine* ALL_ENGINES[LIMIT];
 
 /**
  * @brief Metadata for each key, stored in the in-memory index.
+ *
+ * The key is stored inline after the struct, so an entry is a single
+ * allocation from its shard's slab.
  */
 typedef struct KeyMetadata {
-    char *key;
     uint64_t expiration;
-    UT_hash_handle hh;
+    TimerNode timer;
+    KeyIndexNode node;      // hash and key length; must directly precede the key
+    char key[];
 } KeyMetadata;
 
+/**
+ * @brief Number of index shards, as a power of two.
+ *
+ * Keys are partitioned across shards by the high bits of their hash so that
+ * operations on different keys rarely contend for the same lock.
+ */
+#ifndef LEVELCACHE_SHARD_BITS
+#define LEVELCACHE_SHARD_BITS 6
+#endif
+#define LEVELCACHE_NUM_SHARDS (1u << LEVELCACHE_SHARD_BITS)
+
+/**
+ * @brief One hash partition of the in-memory index, guarded by its own lock.
+ *
+ * Readers take the lock shared; puts, deletes and the cleanup thread take it
+ * exclusive and hold it across the engine write so the index never disagrees
+ * with the engine about a key. Each shard keeps its own expiry wheel so the
+ * cleanup thread only visits keys that are actually due, and its own slab so
+ * metadata allocation needs no lock beyond the shard's.
+ */
+typedef struct IndexShard {
+    pthread_rwlock_t lock;
+    KeyIndex index;
+    TimerWheel wheel;
+    Slab slab;
+} __attribute__((aligned(64))) IndexShard;
+
 /**
  * @brief An opaque handle to the LevelCache database.
  */
@@ -31,24 +69,157 @@ typedef struct LevelCache {
     void *db;
     void *options;
     void *roptions;
+    void *iter_roptions;    // total-order read options for internal iterators, or NULL
     void *woptions;
     void *lru_cache;
     size_t max_memory_mb;
     size_t used_memory_bytes;
     uint32_t default_ttl;
-    KeyMetadata *index;
+    IndexShard shards[LEVELCACHE_NUM_SHARDS];
     pthread_t cleanup_thread;
     int stop_cleanup_thread;
     uint32_t cleanup_frequency_sec;
     int log_level;
     size_t total_memory_bytes;
     StorageEngine* engine;
+    HotTier *hot;
+    size_t reserved_memory_bytes;
+    uint64_t evicted_keys;
+    uint32_t writes_since_check;
+    int evicting;
+    int budget_unreachable; // the engine alone is over budget; warned once until it is not
+    int native_ttl;
+    int value_header;
+    void *ttl_filter;
+    void *ephemeral;        // engine state of the ephemeral profile, if any
+    int async_log;
+    int engine_statistics;  // the engine keeps its own statistics object
+    int no_index;           // keys are not indexed; expirations live in the values
+    char *sweep_cursor;     // where the next expiry sweep resumes, without an index
+    size_t sweep_cursor_len;
+    AsyncPool *async;       // workers of the async API, if enabled
+    size_t scan_prefix_len; // prefix length covered by the engine's prefix blooms, or 0
+    ValueCodec *codec;      // compresses stored values, if enabled
+    FrequencySketch *admission; // access frequencies the admission filter compares, if enabled
+    SingleFlight flights;   // get_or_load loads in progress
+    double early_refresh_beta;
+    uint64_t load_time_ns;  // moving average of get_or_load loader calls
+    CacheStats stats;
 } LevelCache;
 
+/**
+ * @brief How stored values are encoded.
+ */
+typedef enum {
+    LEVELCACHE_CODEC_NONE = 0,      /**< Values are stored as given. */
+    LEVELCACHE_CODEC_ZSTD           /**< zstd with a dictionary trained on the first values written. */
+} LevelCacheCodec;
+
+/**
+ * @brief Configuration for levelcache_open_with_options().
+ *
+ * Initialize with levelcache_options_init() and override only the fields you
+ * need, so new options keep their defaults.
+ */
+typedef struct LevelCacheOptions {
+    size_t max_memory_mb;           /**< Memory budget in megabytes, enforced by eviction. 0 disables it. */
+    uint32_t default_ttl_seconds;   /**< TTL used when a put passes 0. 0 selects one day. */
+    uint32_t cleanup_frequency_sec; /**< Cleanup thread period. 0 disables the thread. */
+    int log_level;                  /**< Initial log level, see log.h. */
+    engine_t engine;                /**< Storage engine backing the cache. */
+    size_t hot_tier_bytes;          /**< Budget of the in-process hot value tier. 0 disables it. */
+    int native_ttl;                 /**< Let the engine drop expired values during compaction when it can. */
+    int keep_existing;              /**< Reopen existing data instead of starting empty. */
+    uint32_t restore_threads;       /**< Threads rebuilding the index on reopen. 0 uses one per CPU. */
+    CoarseClockSource clock_source; /**< Time source for TTLs, shared by all caches in the process. */
+    int ephemeral;                  /**< Tune the engine for data that need not survive a crash. */
+    int async_log;                  /**< Write logs from a background thread, see cache_log.h. */
+    CacheStatsLevel stats_level;    /**< What levelcache_get_stats() collects. */
+    int engine_statistics;          /**< Enable the engine's statistics object (RocksDB only); costs a few percent. */
+    int no_index;                   /**< Keep no per-key index in memory, for keyspaces larger than RAM. */
+    uint32_t async_threads;         /**< Workers serving the async API, i.e. engine operations in flight. 0 disables it. */
+    size_t async_queue_depth;       /**< Async operations that may be outstanding at once. 0 selects 1024. */
+    size_t scan_prefix_len;         /**< Key prefix length covered by prefix bloom filters (RocksDB). 0 disables them. */
+    LevelCacheCodec codec;          /**< Compression of stored values. */
+    size_t codec_min_bytes;         /**< Values shorter than this are stored uncompressed. 0 selects 128. */
+    int codec_level;                /**< zstd compression level. 0 selects 3. */
+    size_t codec_dict_bytes;        /**< Size of the trained dictionary. 0 selects 16 KB. */
+    int admission;                  /**< Keep keys used less than eviction victims out under memory pressure. Needs max_memory_mb. */
+    double early_refresh_beta;      /**< How early levelcache_get_or_load() reloads keys about to expire. 0, the default, waits for expiry; 1 suits most loads. */
+} LevelCacheOptions;
+
+/**
+ * @brief Fills `options` with the defaults: LevelDB, no block cache, one day
+ * TTL, cleanup every 60 seconds, LOG_INFO, no hot tier, native TTL on, the
+ * ticker clock, the ephemeral profile, counters plus latency histograms, no
+ * async workers and no early refresh.
+ */
+void levelcache_options_init(LevelCacheOptions *options);
+
+/**
+ * @brief Opens a LevelCache database at the specified path.
+ *
+ * When `hot_tier_bytes` is set, recently read values are kept in process
+ * memory and answered without going through the engine's read path. Writes,
+ * deletes and expiry invalidate them, so reads never observe a stale value.
+ *
+ * When `native_ttl` is set and the engine supports it, each value is stored
+ * with its expiration and expired values are dropped by the engine during
+ * compaction. Expiry then only prunes the in-memory index instead of writing
+ * a tombstone per key.
+ *
+ * By default the path is wiped and the cache starts empty. With
+ * `keep_existing` the data is kept and the index is rebuilt by scanning it in
+ * parallel, skipping entries that expired while the cache was down. Values
+ * then always carry their expiration, so a database must be reopened with
+ * `keep_existing` only if it was written with it.
+ *
+ * With `ephemeral` (the default) the engine is tuned for a cache rather than
+ * a database: writes skip the write-ahead log where the engine allows it,
+ * tables get bloom filters and hash-indexed blocks and are read through mmap,
+ * and memtables are sized from the memory budget. Data is still flushed on a
+ * clean close, but a crash loses recent writes, so clear it when reopening
+ * with `keep_existing` must not lose any.
+ *
+ * With `no_index` no per-key metadata is kept in memory, so memory scales
+ * with the hot tier and the engine's buffers rather than with the number of
+ * keys. Every value carries its expiration, every get goes to the engine
+ * (the ephemeral profile's bloom filters keep misses cheap) and expired
+ * values are deleted when a read finds them. Without native TTL the cleanup
+ * thread also sweeps a slice of the keyspace each cycle for expired values
+ * nobody reads. Eviction needs the index, so `max_memory_mb` then only sizes
+ * the engine. Reopening with `keep_existing` needs no restore scan.
+ *
+ * With `codec` set to LEVELCACHE_CODEC_ZSTD, values of at least
+ * `codec_min_bytes` are compressed before they reach the engine, shrinking
+ * memtables, block cache and disk alike. The first values written train a
+ * dictionary of their common content, after which small structured values
+ * compress several times better than on their own; persistent engines keep
+ * it next to the data. Gets return decoded values, which the hot tier keeps
+ * too. Like `keep_existing`, a database must be reopened with the codec it
+ * was written with.
+ *
+ * With `admission` and a memory budget, gets are counted per key in a small
+ * frequency sketch, misses included. Once usage nears the budget, a put of a
+ * key not in the cache is only stored if the key has been read more often
+ * lately than the least read of a few keys sampled from its shard, which is
+ * then evicted in its place; otherwise the put succeeds without storing
+ * anything. Scans and other one-off writes then no longer push the
+ * frequently read keys out, while a key that keeps missing is let in once it
+ * is wanted. Updates of keys already cached are always stored.
+ *
+ * @param path The filesystem path to the database.
+ * @param options The configuration, see LevelCacheOptions.
+ * @return A handle to the database, or NULL on error.
+ */
+LevelCache* levelcache_open_with_options(const char *path, const LevelCacheOptions *options);
+
 
 /**
  * @brief Opens a LevelCache database at the specified path.
  *
+ * All operations on the returned handle are thread-safe.
+ *
  * @param path The filesystem path to the database.
  * @param max_memory_mb The maximum memory capacity in megabytes.
  * @param default_ttl_seconds The default time-to-live in seconds for keys. 0 means no TTL.
@@ -58,6 +229,69 @@ typedef struct LevelCache {
  */
 LevelCache* levelcache_open(const char *path, size_t max_memory_mb, uint32_t default_ttl_seconds, uint32_t cleanup_frequency_sec, int log_level, engine_t engine);
 
+/**
+ * @brief Breakdown of the memory held by a cache instance, in bytes.
+ */
+typedef struct LevelCacheMemoryStats {
+    size_t index_bytes;         /**< Key metadata, key copies and index tables. */
+    size_t hot_tier_bytes;      /**< Values resident in the hot tier. */
+    size_t memtable_bytes;      /**< Engine memtables (LevelDB: memtables plus block cache). */
+    size_t table_reader_bytes;  /**< Engine index and filter blocks held outside the block cache. */
+    size_t block_cache_bytes;   /**< Engine block cache usage. */
+    size_t total_bytes;         /**< Sum of the above. */
+    size_t limit_bytes;         /**< The budget from max_memory_mb, or 0. */
+    uint64_t evicted_keys;      /**< Keys evicted to stay under the budget since open. */
+} LevelCacheMemoryStats;
+
+/**
+ * @brief Operations timed by levelcache_get_stats().
+ */
+typedef enum {
+    LEVELCACHE_OP_GET = 0,      /**< levelcache_get*(), and each multi_get call as one get. */
+    LEVELCACHE_OP_PUT,
+    LEVELCACHE_OP_DELETE,
+    LEVELCACHE_OP_COUNT
+} LevelCacheOp;
+
+/**
+ * @brief Where the time of an operation went.
+ */
+typedef enum {
+    LEVELCACHE_PHASE_TOTAL = 0, /**< The whole call. */
+    LEVELCACHE_PHASE_INDEX,     /**< Hashing, shard locking and the index lookup. */
+    LEVELCACHE_PHASE_ENGINE,    /**< The hot tier or storage engine call. */
+    LEVELCACHE_PHASE_COPY,      /**< Framing the value on put, copying it out on get. */
+    LEVELCACHE_PHASE_COUNT
+} LevelCachePhase;
+
+/**
+ * @brief Counters and latency summaries since open.
+ *
+ * Counters need `stats_level` of at least CACHE_STATS_COUNTERS and latencies
+ * CACHE_STATS_TIMINGS; anything not collected reads as 0. The block cache
+ * figures additionally need `engine_statistics`.
+ */
+typedef struct LevelCacheStats {
+    uint64_t hits;                  /**< Gets that returned a value. */
+    uint64_t misses;                /**< Gets that found nothing, expired keys included. */
+    uint64_t hot_tier_hits;         /**< Hits answered by the hot tier. */
+    uint64_t expired_on_read;       /**< Keys found expired by a get. */
+    uint64_t cleanup_deletions;     /**< Keys removed by the cleanup thread. */
+    uint64_t evictions;             /**< Keys evicted to stay under the memory budget. */
+    uint64_t engine_errors;         /**< Engine calls that returned an error. */
+    uint64_t bytes_read;            /**< Value bytes returned by hits. */
+    uint64_t bytes_written;         /**< Value bytes stored by puts. */
+    uint64_t bytes_stored;          /**< Bytes puts handed to the engine, after headers and compression. */
+    uint64_t admitted;              /**< New keys the admission filter let in under memory pressure. */
+    uint64_t rejected;              /**< Puts of new keys the admission filter kept out. */
+    uint64_t loads;                 /**< Loader calls made by levelcache_get_or_load(). */
+    uint64_t coalesced_loads;       /**< get_or_load misses answered by another caller's load. */
+    uint64_t early_refreshes;       /**< Loads of keys that had not expired yet. */
+    uint64_t block_cache_hits;      /**< Engine block cache hits. */
+    uint64_t block_cache_misses;    /**< Engine block cache misses. */
+    CacheStatsSummary latency[LEVELCACHE_OP_COUNT][LEVELCACHE_PHASE_COUNT];
+} LevelCacheStats;
+
 /**
  * @brief Closes a LevelCache database.
  *
@@ -76,6 +310,22 @@ void levelcache_close(LevelCache *cache);
  */
 int levelcache_put(LevelCache *cache, const char *key, const char *value, uint32_t ttl_seconds);
 
+/**
+ * @brief Stores a binary-safe key-value pair given as (pointer, length) pairs.
+ *
+ * Keys and values may contain NUL bytes. The key is hashed once and the hash
+ * is reused for the shard, the index lookup and the engine call.
+ *
+ * @param cache The database handle.
+ * @param key The key bytes.
+ * @param key_len The length of the key in bytes.
+ * @param value The value bytes.
+ * @param value_len The length of the value in bytes.
+ * @param ttl_seconds The time-to-live in seconds. If 0, the default TTL is used.
+ * @return 0 on success, -1 on error.
+ */
+int levelcache_put_n(LevelCache *cache, const char *key, size_t key_len, const char *value, size_t value_len, uint32_t ttl_seconds);
+
 /**
  * @brief Retrieves a value from the database for a given key.
  *
@@ -87,6 +337,125 @@ int levelcache_put(LevelCache *cache, const char *key, const char *value, uint32
  */
 char* levelcache_get(LevelCache *cache, const char *key);
 
+/**
+ * @brief Binary-safe variant of levelcache_get().
+ *
+ * The returned buffer holds `*value_len` bytes followed by a terminating NUL
+ * that is not counted. The caller is responsible for freeing it.
+ *
+ * @param cache The database handle.
+ * @param key The key bytes.
+ * @param key_len The length of the key in bytes.
+ * @param value_len Receives the length of the value. May be NULL.
+ * @return A pointer to the value, or NULL if the key is not found or an error occurs.
+ */
+char* levelcache_get_n(LevelCache *cache, const char *key, size_t key_len, size_t *value_len);
+
+/**
+ * @brief Produces the value of a key levelcache_get_or_load() did not find.
+ *
+ * @param key The key bytes.
+ * @param key_len The length of the key in bytes.
+ * @param value_len Receives the length of the value.
+ * @param ctx The context given to levelcache_get_or_load().
+ * @return The value in a buffer from malloc(), which the cache takes over, or
+ *         NULL if it cannot be loaded.
+ */
+typedef char* (*LevelCacheLoader)(const char *key, size_t key_len, size_t *value_len, void *ctx);
+
+/**
+ * @brief Retrieves a value, loading and storing it on a miss.
+ *
+ * Concurrent misses on the same key are coalesced: one caller runs the
+ * loader and stores its value with `ttl_seconds`, and the others wait for it
+ * and return copies of the same value, so a hot key expiring sends one
+ * request to the backend rather than one per thread.
+ *
+ * With `early_refresh_beta` set, a hit may also reload the key before it
+ * expires, with a probability that grows as expiry nears and with the time
+ * loads take (XFetch). One caller reloads while the others keep getting the
+ * cached value, and a key read in its last second is always reloaded, so keys
+ * that stay hot never expire. A failed refresh returns the cached value.
+ *
+ * The caller is responsible for freeing the returned string.
+ *
+ * @param cache The database handle.
+ * @param key The key to retrieve.
+ * @param loader Called with `ctx` to produce the value on a miss.
+ * @param ctx Passed to `loader`.
+ * @param ttl_seconds TTL of a loaded value. If 0, the default TTL is used.
+ * @return A pointer to a null-terminated string, or NULL if the key is not
+ *         cached and the loader failed.
+ */
+char* levelcache_get_or_load(LevelCache *cache, const char *key, LevelCacheLoader loader, void *ctx, uint32_t ttl_seconds);
+
+/**
+ * @brief Binary-safe variant of levelcache_get_or_load(), see levelcache_get_n().
+ */
+char* levelcache_get_or_load_n(LevelCache *cache, const char *key, size_t key_len, size_t *value_len,
+                               LevelCacheLoader loader, void *ctx, uint32_t ttl_seconds);
+
+/**
+ * @brief Retrieves a value into a caller-provided buffer.
+ *
+ * The value is copied only if it fits; it is not null-terminated. When the
+ * buffer is too small nothing is copied and the required length is still
+ * returned, so the caller can retry with a larger buffer.
+ *
+ * @param cache The database handle.
+ * @param key The key to retrieve.
+ * @param buf The destination buffer.
+ * @param buf_len The size of `buf` in bytes.
+ * @return The length of the value, or -1 if the key is not found or an error occurs.
+ */
+ssize_t levelcache_get_into(LevelCache *cache, const char *key, char *buf, size_t buf_len);
+
+/**
+ * @brief Binary-safe variant of levelcache_get_into().
+ */
+ssize_t levelcache_get_into_n(LevelCache *cache, const char *key, size_t key_len, char *buf, size_t buf_len);
+
+/**
+ * @brief A value pinned in engine or hot tier memory and read in place.
+ *
+ * `data` and `len` stay valid until the value is passed to
+ * levelcache_value_release(). The remaining fields are private.
+ */
+typedef struct LevelCachePinnedValue {
+    const char *data;
+    size_t len;
+    void *handle;
+    void (*release)(void *handle);
+} LevelCachePinnedValue;
+
+/**
+ * @brief Retrieves a value without copying it.
+ *
+ * Values in the hot tier are referenced in place. Otherwise, on engines with
+ * pinnable reads (RocksDB) the value is referenced directly from the block
+ * cache or memtable; others fall back to a single engine allocation.
+ *
+ * @param cache The database handle.
+ * @param key The key to retrieve.
+ * @param value Filled in on success; must be released with levelcache_value_release().
+ * @return 0 on success, -1 if the key is not found, -2 if an error occurs.
+ */
+int levelcache_get_pinned(LevelCache *cache, const char *key, LevelCachePinnedValue *value);
+
+/**
+ * @brief Binary-safe variant of levelcache_get_pinned().
+ */
+int levelcache_get_pinned_n(LevelCache *cache, const char *key, size_t key_len, LevelCachePinnedValue *value);
+
+/**
+ * @brief Releases a value returned by levelcache_get_pinned().
+ *
+ * Safe to call on a value that was not filled in or was already released.
+ *
+ * @param value The pinned value.
+ */
+void levelcache_value_release(LevelCachePinnedValue *value);
+
 /**
  * @brief Deletes a key-value pair from the database.
  *
@@ -96,6 +465,266 @@ char* levelcache_get(LevelCache *cache, const char *key);
  */
 int levelcache_delete(LevelCache *cache, const char *key);
 
+/**
+ * @brief Binary-safe variant of levelcache_delete().
+ *
+ * @param cache The database handle.
+ * @param key The key bytes.
+ * @param key_len The length of the key in bytes.
+ * @return 0 on success, -1 on error.
+ */
+int levelcache_delete_n(LevelCache *cache, const char *key, size_t key_len);
+
+/**
+ * @brief Stores several key-value pairs with a single engine write batch.
+ *
+ * The batch is applied atomically: either every pair is stored or none is.
+ * Each touched index shard is locked once for the whole batch. The one
+ * exception is the admission filter (see levelcache_open_with_options()):
+ * under memory pressure it may keep new keys out of the batch, exactly as it
+ * would keep out single puts, and the call still returns 0. Such keys are
+ * counted in LevelCacheStats::rejected.
+ *
+ * @param cache The database handle.
+ * @param keys The keys to store.
+ * @param values The null-terminated string values, one per key.
+ * @param count The number of pairs.
+ * @param ttl_seconds The time-to-live in seconds for every pair. If 0, the default TTL is used.
+ * @return 0 on success, -1 on error.
+ */
+int levelcache_put_batch(LevelCache *cache, const char *const *keys, const char *const *values, size_t count, uint32_t ttl_seconds);
+
+/**
+ * @brief Binary-safe variant of levelcache_put_batch().
+ *
+ * `key_lens` and `value_lens` give the length of each key and value. Either
+ * may be NULL, in which case the corresponding strings are NUL-terminated.
+ */
+int levelcache_put_batch_n(LevelCache *cache, const char *const *keys, const size_t *key_lens,
+                           const char *const *values, const size_t *value_lens, size_t count, uint32_t ttl_seconds);
+
+/**
+ * @brief Retrieves the values of several keys with one engine multi-get.
+ *
+ * On return values[i] holds a null-terminated copy of the value of keys[i],
+ * or NULL if the key is missing or expired. The caller is responsible for
+ * freeing every non-NULL entry.
+ *
+ * @param cache The database handle.
+ * @param keys The keys to retrieve.
+ * @param count The number of keys.
+ * @param values Output array with room for `count` pointers.
+ * @return The number of keys found, or -1 on error (in which case every values[i] is NULL).
+ */
+int levelcache_multi_get(LevelCache *cache, const char *const *keys, size_t count, char **values);
+
+/**
+ * @brief Binary-safe variant of levelcache_multi_get().
+ *
+ * `key_lens` may be NULL for NUL-terminated keys. If `value_lens` is not
+ * NULL it receives the length of each value (0 for misses).
+ */
+int levelcache_multi_get_n(LevelCache *cache, const char *const *keys, const size_t *key_lens, size_t count,
+                           char **values, size_t *value_lens);
+
+/**
+ * @brief Deletes several keys with a single engine write batch.
+ *
+ * @param cache The database handle.
+ * @param keys The keys to delete.
+ * @param count The number of keys.
+ * @return 0 on success, -1 on error.
+ */
+int levelcache_delete_batch(LevelCache *cache, const char *const *keys, size_t count);
+
+/**
+ * @brief Binary-safe variant of levelcache_delete_batch().
+ *
+ * `key_lens` may be NULL for NUL-terminated keys.
+ */
+int levelcache_delete_batch_n(LevelCache *cache, const char *const *keys, const size_t *key_lens, size_t count);
+
+/**
+ * @brief Deletes every key in [start, limit).
+ *
+ * The keys are removed in chunks of up to 16384. Each chunk costs one engine
+ * write: a single range tombstone on RocksDB, a batch of deletes elsewhere.
+ * While a chunk is removed all index shards are locked, so other operations
+ * wait for it. Keys put into the range concurrently may or may not survive.
+ * With `no_index`, no hot tier and a bounded range on RocksDB, the whole
+ * range is one tombstone and no key is read.
+ *
+ * @param cache The database handle.
+ * @param start The first key to delete, or NULL to start at the first key.
+ * @param start_len The length of `start`.
+ * @param limit The key to stop before, or NULL to delete to the end.
+ * @param limit_len The length of `limit`.
+ * @return 0 on success, -1 on error, in which case a prefix of the range
+ *         may already be deleted.
+ */
+int levelcache_delete_range(LevelCache *cache, const char *start, size_t start_len, const char *limit, size_t limit_len);
+
+/**
+ * @brief Deletes every key starting with `prefix`, see levelcache_delete_range().
+ *
+ * @param cache The database handle.
+ * @param prefix The prefix bytes.
+ * @param prefix_len The length of the prefix. 0 deletes every key.
+ * @return 0 on success, -1 on error.
+ */
+int levelcache_delete_prefix(LevelCache *cache, const char *prefix, size_t prefix_len);
+
+/**
+ * @brief One entry returned by levelcache_scan_next().
+ *
+ * Key and value point into the scan's buffer and stay valid until the next
+ * call on the same scan.
+ */
+typedef struct LevelCacheScanEntry {
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} LevelCacheScanEntry;
+
+/**
+ * @brief A cursor over a key range, in bytewise key order.
+ */
+typedef struct LevelCacheScan LevelCacheScan;
+
+/**
+ * @brief Starts a scan of the keys that begin with `prefix`.
+ *
+ * The scan reads a consistent view of the engine as of this call where the
+ * engine has snapshots (LevelDB, RocksDB). It streams with read-ahead and
+ * without filling the block cache where the engine allows, so it does not
+ * push out the point lookups' working set. When `prefix_len` is at least
+ * the `scan_prefix_len` given at open, RocksDB skips tables by their prefix
+ * bloom filters. Expired keys are skipped.
+ *
+ * @param cache The database handle.
+ * @param prefix The prefix bytes.
+ * @param prefix_len The length of the prefix. 0 scans every key.
+ * @return A scan to release with levelcache_scan_close(), or NULL on error.
+ */
+LevelCacheScan* levelcache_scan_prefix(LevelCache *cache, const char *prefix, size_t prefix_len);
+
+/**
+ * @brief Starts a scan of the keys in [start, limit), see levelcache_scan_prefix().
+ *
+ * @param cache The database handle.
+ * @param start The first key to return, or NULL to start at the first key.
+ * @param start_len The length of `start`.
+ * @param limit The key to stop before, or NULL to scan to the end.
+ * @param limit_len The length of `limit`.
+ * @return A scan to release with levelcache_scan_close(), or NULL on error.
+ */
+LevelCacheScan* levelcache_scan_range(LevelCache *cache, const char *start, size_t start_len,
+                                      const char *limit, size_t limit_len);
+
+/**
+ * @brief Returns the next batch of live entries.
+ *
+ * @param scan The scan.
+ * @param entries Output array with room for `max` entries.
+ * @param max The most entries to return.
+ * @return The number of entries, 0 once the scan is exhausted, or -1 on error.
+ */
+ssize_t levelcache_scan_next(LevelCacheScan *scan, LevelCacheScanEntry *entries, size_t max);
+
+/**
+ * @brief Ends a scan and frees its buffer. Accepts NULL.
+ */
+void levelcache_scan_close(LevelCacheScan *scan);
+
+/**
+ * @brief Operations of the asynchronous API.
+ */
+typedef enum {
+    LEVELCACHE_ASYNC_GET = 0,
+    LEVELCACHE_ASYNC_PUT,
+    LEVELCACHE_ASYNC_DELETE
+} LevelCacheAsyncOp;
+
+/**
+ * @brief The outcome of an asynchronous operation.
+ *
+ * `value` is set only for a get that found the key. It is NUL-terminated
+ * like the result of levelcache_get_n() and belongs to the receiver, who
+ * releases it with free().
+ */
+typedef struct LevelCacheCompletion {
+    LevelCacheAsyncOp op;
+    int status;         /**< 0 on success, -1 on a miss, -2 on an error. */
+    char *value;
+    size_t value_len;
+    void *user_data;    /**< As passed when the operation was submitted. */
+} LevelCacheCompletion;
+
+/**
+ * @brief Receives a completion on the worker thread that ran the operation.
+ * It should hand the work off rather than block, since the worker serves no
+ * other operation meanwhile.
+ */
+typedef void (*LevelCacheCallback)(LevelCacheCompletion *completion);
+
+/**
+ * @brief Starts a get and returns without waiting for it.
+ *
+ * Needs `async_threads` at open. The key is copied, so the caller's buffer
+ * may be reused at once. With a `callback` the completion is delivered by
+ * calling it; without one it is queued for levelcache_poll_completions().
+ * Operations run concurrently and complete in any order, so two operations
+ * on the same key are only ordered if the second is submitted after the
+ * first has completed. With a single worker (`async_threads` of 1) they
+ * run in submission order.
+ *
+ * @param cache The database handle.
+ * @param key The key bytes.
+ * @param key_len The length of the key in bytes.
+ * @param callback Called with the completion, or NULL to queue it.
+ * @param user_data Returned in the completion.
+ * @return 0 if the operation was submitted, -1 if the async API is disabled,
+ *         `async_queue_depth` operations are outstanding, or out of memory.
+ */
+int levelcache_get_async(LevelCache *cache, const char *key, size_t key_len,
+                         LevelCacheCallback callback, void *user_data);
+
+/**
+ * @brief Starts a put, see levelcache_get_async(). Key and value are copied.
+ */
+int levelcache_put_async(LevelCache *cache, const char *key, size_t key_len, const char *value, size_t value_len,
+                         uint32_t ttl_seconds, LevelCacheCallback callback, void *user_data);
+
+/**
+ * @brief Starts a delete, see levelcache_get_async().
+ */
+int levelcache_delete_async(LevelCache *cache, const char *key, size_t key_len,
+                            LevelCacheCallback callback, void *user_data);
+
+/**
+ * @brief Returns an eventfd that is readable while queued completions are
+ * waiting, for registering with epoll or poll. The cache owns it.
+ *
+ * @param cache The database handle.
+ * @return The descriptor, or -1 if the async API is disabled.
+ */
+int levelcache_completion_fd(LevelCache *cache);
+
+/**
+ * @brief Takes up to `max` queued completions, oldest first. Never blocks.
+ *
+ * The descriptor from levelcache_completion_fd() stays readable while more
+ * are left, so an edge- or level-triggered loop can call this until it
+ * returns fewer than `max`.
+ *
+ * @param cache The database handle.
+ * @param completions Output array with room for `max` entries.
+ * @param max The most completions to take.
+ * @return The number of completions taken.
+ */
+size_t levelcache_poll_completions(LevelCache *cache, LevelCacheCompletion *completions, size_t max);
+
 /**
  * @brief Gets the current memory usage of the cache in bytes.
  *
@@ -104,4 +733,43 @@ int levelcache_delete(LevelCache *cache, const char *key);
  */
 size_t levelcache_get_memory_usage(LevelCache *cache);
 
+/**
+ * @brief Measures the memory held by the cache, including the engine's
+ * memtables, table readers and block cache.
+ *
+ * This is the figure checked against max_memory_mb. When it is exceeded, keys
+ * closest to their expiration are evicted until usage is back under 90% of
+ * the budget, or just under the budget when the engine's own memory leaves
+ * less room. Evicting only gives back key metadata, hot tier values and, for
+ * the in-memory engines, the values themselves; block caches, LSM memtables
+ * and table readers stay. If those alone exceed the budget, a warning is
+ * logged and nothing is evicted.
+ *
+ * @param cache The database handle.
+ * @param stats Filled with the current figures.
+ */
+void levelcache_get_memory_stats(LevelCache *cache, LevelCacheMemoryStats *stats);
+
+/**
+ * @brief Reports the counters and latency histograms collected since open.
+ *
+ * Recording is a relaxed atomic add into a per-thread stripe, so it is cheap
+ * enough to leave on; this call sums the stripes and may be made at any time
+ * from any thread.
+ *
+ * @param cache The database handle.
+ * @param stats Filled with the current figures.
+ */
+void levelcache_get_stats(LevelCache *cache, LevelCacheStats *stats);
+
+/**
+ * @brief Returns the engine's own statistics report: compaction and level
+ * statistics, followed by the ticker and histogram dump when
+ * `engine_statistics` is on.
+ *
+ * @param cache The database handle.
+ * @return A NUL-terminated report to release with free(), or NULL.
+ */
+char* levelcache_get_engine_stats(LevelCache *cache);
+
 #endif // LEVELCACHE_H
@@ -0,0 +1,74 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SINGLE_FLIGHT_STRIPES 64
+
+/**
+ * @brief A load of one key in progress, shared by every caller that asked
+ * for the key while it ran.
+ */
+typedef struct Flight {
+    struct Flight *next;
+    uint64_t hash;
+    uint32_t refs;      // the leader plus every waiter
+    int done;
+    char *value;        // the loaded value, NUL-terminated; NULL if the load failed
+    size_t value_len;
+    size_t key_len;
+    char key[];
+} Flight;
+
+typedef struct FlightStripe {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    Flight *flights;
+} __attribute__((aligned(64))) FlightStripe;
+
+/**
+ * @brief Coalesces concurrent loads of the same key.
+ *
+ * The first caller to begin a flight for a key becomes its leader and loads
+ * the value; callers arriving before it finishes wait for the leader's result
+ * instead of loading it again. Flights are kept in lists striped by key hash,
+ * each under its own mutex, and are removed as soon as the leader finishes,
+ * so a later miss starts a new load.
+ */
+typedef struct SingleFlight {
+    FlightStripe stripes[SINGLE_FLIGHT_STRIPES];
+} SingleFlight;
+
+void single_flight_init(SingleFlight *sf);
+
+void single_flight_destroy(SingleFlight *sf);
+
+/**
+ * @brief Joins the flight of `key`, starting it if there is none.
+ *
+ * @param leader Set to 1 if the caller started the flight and must end it
+ *               with single_flight_finish(), to 0 if it must collect the
+ *               result with single_flight_wait().
+ * @param join If 0, a flight already in progress is not joined and NULL is
+ *             returned instead.
+ * @return The flight, or NULL if out of memory or not joined.
+ */
+Flight* single_flight_begin(SingleFlight *sf, const char *key, size_t key_len, uint64_t hash, int join, int *leader);
+
+/**
+ * @brief Ends a flight the caller leads, handing `value` (NULL if the load
+ * failed) to its waiters. The value is copied only if someone waits.
+ */
+void single_flight_finish(SingleFlight *sf, Flight *flight, const char *value, size_t value_len);
+
+/**
+ * @brief Waits for the leader of a joined flight to finish.
+ *
+ * @return A NUL-terminated copy of the loaded value, which the caller frees,
+ *         or NULL if the load failed or out of memory.
+ */
+char* single_flight_wait(SingleFlight *sf, Flight *flight, size_t *value_len);
+
+#endif // SINGLE_FLIGHT_H
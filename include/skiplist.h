@@ -0,0 +1,113 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "slab.h"
+
+#define SKIPLIST_MAX_HEIGHT 16
+
+/**
+ * @brief A skiplist node. The key is stored inline after the `height` next
+ * pointers; `value` belongs to the engine that owns the list.
+ */
+typedef struct SkipNode {
+    void *value;
+    uint32_t key_len;
+    uint32_t height;
+    struct SkipNode *next[];
+} SkipNode;
+
+/**
+ * @brief One shard of an engine's ordered key index.
+ *
+ * Keys are kept in bytewise order. Nodes come out of the shard's slab. The
+ * list is not thread-safe: callers take `lock`, shared for lookups and
+ * exclusive for inserts and erases. `bytes` counts the nodes, and the owning
+ * engine may add what it allocates for values on top.
+ */
+typedef struct SkipList {
+    pthread_rwlock_t lock;
+    SkipNode *head;
+    uint32_t height;
+    uint32_t rng;
+    size_t count;
+    size_t bytes;
+    Slab slab;
+} __attribute__((aligned(64))) SkipList;
+
+static inline const char* skiplist_key(const SkipNode *node) {
+    return (const char *)&node->next[node->height];
+}
+
+/**
+ * @brief Initializes an empty list. `seed` drives node heights; give every
+ * shard a different one. Returns 0, or -1 if out of memory.
+ */
+int skiplist_init(SkipList *list, uint32_t seed);
+
+/**
+ * @brief Frees the nodes and the slab. Values are not touched; free them first
+ * by walking `head->next[0]` if the engine owns them.
+ */
+void skiplist_destroy(SkipList *list);
+
+/**
+ * @brief Returns the node holding `key`, or NULL.
+ */
+SkipNode* skiplist_find(const SkipList *list, const char *key, size_t key_len);
+
+/**
+ * @brief Returns the first node whose key is >= `key` (> with `strict`), or NULL.
+ */
+SkipNode* skiplist_seek(const SkipList *list, const char *key, size_t key_len, int strict);
+
+/**
+ * @brief Returns the node with the largest key, or NULL if the list is empty.
+ */
+SkipNode* skiplist_last(const SkipList *list);
+
+/**
+ * @brief Returns the node holding `key`, linking a new one with a NULL value
+ * if there is none. `*created` tells which. Returns NULL if out of memory.
+ */
+SkipNode* skiplist_insert(SkipList *list, const char *key, size_t key_len, int *created);
+
+/**
+ * @brief Unlinks and frees the node holding `key`. Returns its value, or NULL
+ * if the key was not there.
+ */
+void* skiplist_erase(SkipList *list, const char *key, size_t key_len);
+
+/**
+ * @brief Returns the bytes of an engine value, read under the shard lock.
+ */
+typedef const char* (*SkipValueFn)(const void *value, size_t *len);
+
+typedef struct SkipIterator SkipIterator;
+
+/**
+ * @brief Creates a forward iterator over `num_lists` shards in bytewise key
+ * order, as the storage engine vtable expects.
+ *
+ * The shards are merged with one cursor each, holding a copy of that shard's
+ * next entry; stepping re-seeks only the shard that was just consumed. There
+ * is no snapshot: an entry is copied when the iterator reaches it, so writes
+ * made while the iterator is open may or may not be seen.
+ */
+SkipIterator* skiplist_iter_create(SkipList *lists, uint32_t num_lists, SkipValueFn value_of);
+void skiplist_iter_destroy(SkipIterator *it);
+int skiplist_iter_valid(const SkipIterator *it);
+void skiplist_iter_seek(SkipIterator *it, const char *key, size_t key_len);
+void skiplist_iter_seek_to_last(SkipIterator *it);
+void skiplist_iter_next(SkipIterator *it);
+const char* skiplist_iter_key(const SkipIterator *it, size_t *key_len);
+const char* skiplist_iter_value(const SkipIterator *it, size_t *value_len);
+
+/**
+ * @brief Returns 1 if copying an entry failed for lack of memory.
+ */
+int skiplist_iter_failed(const SkipIterator *it);
+
+#endif // SKIPLIST_H
@@ -0,0 +1,65 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_GRANULARITY 16
+#define SLAB_NUM_CLASSES 16
+#define SLAB_MAX_OBJECT (SLAB_GRANULARITY * SLAB_NUM_CLASSES)
+#define SLAB_CHUNK_BYTES (64 * 1024)
+
+typedef struct SlabChunk {
+    struct SlabChunk *next;
+} SlabChunk;
+
+/**
+ * @brief A size-classed allocator for small objects.
+ *
+ * Objects up to SLAB_MAX_OBJECT bytes are carved out of 64 KB chunks and
+ * recycled through one free list per 16-byte size class; larger ones fall
+ * back to malloc(). A slab is not thread-safe: each one is owned by a single
+ * index shard and used under its lock. slab_release_all() returns every chunk
+ * at once without visiting the objects.
+ */
+typedef struct Slab {
+    void *free_lists[SLAB_NUM_CLASSES];
+    char *bump;
+    char *bump_end;
+    SlabChunk *chunks;
+} Slab;
+
+void slab_init(Slab *slab);
+
+/**
+ * @brief The number of bytes actually reserved for an object of `size` bytes.
+ */
+static inline size_t slab_object_size(size_t size) {
+    if (size > SLAB_MAX_OBJECT) {
+        return size;
+    }
+    return (size + SLAB_GRANULARITY - 1) & ~(size_t)(SLAB_GRANULARITY - 1);
+}
+
+/**
+ * @brief Returns 1 if objects of `size` bytes bypass the slab.
+ */
+static inline int slab_is_large(size_t size) {
+    return size > SLAB_MAX_OBJECT;
+}
+
+void* slab_alloc(Slab *slab, size_t size);
+
+/**
+ * @brief Returns an object to the slab. `size` must be the size it was
+ * allocated with.
+ */
+void slab_free(Slab *slab, void *ptr, size_t size);
+
+/**
+ * @brief Frees every chunk. Objects larger than SLAB_MAX_OBJECT are not owned
+ * by the chunks and must be freed by the caller first.
+ */
+void slab_release_all(Slab *slab);
+
+#endif // SLAB_H
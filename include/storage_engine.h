@@ -3,14 +3,26 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum engine_t { 
     ENGINE_LEVELDB,
     ENGINE_ROCKSDB,
+    ENGINE_MEMORY,
+    ENGINE_BITCASK,
     LIMIT,
 } engine_t;
 
-static const char* engine_names[LIMIT] = { "leveldb", "rocksdb" };
+extern const char* engine_names[LIMIT];
+
+/**
+ * @brief Memory held by the engine itself, in bytes.
+ */
+typedef struct EngineMemoryUsage {
+    size_t memtables;
+    size_t table_readers;
+    size_t block_cache;
+} EngineMemoryUsage;
 
 /**
  * @brief i will write it later.
@@ -40,22 +52,104 @@ typedef struct StorageEngine {
                 size_t* valuelen, char **err);
     void  (*del)(void *db, void *woptions, const char *key, size_t keylen,
                 char **err);
+    // Returns a handle that keeps *value alive until pinned_destroy, or NULL
+    // if the key is missing.
+    void* (*get_pinned)(void *db, void *roptions, const char *key, size_t keylen,
+                const char **value, size_t *valuelen, char **err);
+    void  (*pinned_destroy)(void *handle);
+
+    // Batched Read/Write
+    void* (*writebatch_create)();
+    void  (*writebatch_destroy)(void *batch);
+    void  (*writebatch_put)(void *batch, const char *key, size_t keylen,
+                const char *value, size_t valuelen);
+    void  (*writebatch_delete)(void *batch, const char *key, size_t keylen);
+    // Applies every record of the batch, in order, or on error none of them.
+    void  (*write)(void *db, void *woptions, void *batch, char **err);
+    // Deletes [start, limit) with one range tombstone; NULL where the engine
+    // has none, in which case keys are deleted one by one in batches.
+    void  (*delete_range)(void *db, void *woptions, const char *start, size_t start_len,
+                const char *limit, size_t limit_len, char **err);
+    // values[i] is NULL for missing keys; errs[i] is set on per-key failures.
+    // Both are released with free_fn.
+    void  (*multi_get)(void *db, void *roptions, size_t num_keys,
+                const char *const *keys, const size_t *keylens,
+                char **values, size_t *valuelens, char **errs);
+
+    // Iteration, in bytewise key order
+    void* (*iter_create)(void *db, void *roptions);
+    void  (*iter_destroy)(void *iter);
+    int   (*iter_valid)(const void *iter);
+    void  (*iter_seek_to_first)(void *iter);
+    void  (*iter_seek_to_last)(void *iter);
+    void  (*iter_seek)(void *iter, const char *key, size_t keylen);
+    void  (*iter_next)(void *iter);
+    const char* (*iter_key)(const void *iter, size_t *keylen);
+    const char* (*iter_value)(const void *iter, size_t *valuelen);
+    void  (*iter_get_error)(const void *iter, char **err);
+    // Read options for one range scan: bounded above by `limit` (NULL for
+    // none; it must outlive them), reading `readahead` bytes ahead and not
+    // filling the block cache where the engine allows, and with `prefix_seek`
+    // confined to the prefix of the seek key so prefix bloom filters apply.
+    // NULL where the engine has nothing to tune; the default read options
+    // are used instead.
+    void* (*readoptions_create_scan)(const char *limit, size_t limit_len, size_t readahead, int prefix_seek);
+    // Bloom filters over the first `prefix_len` bytes of every key, for
+    // prefix scans; must precede open. NULL where unsupported.
+    void  (*options_set_prefix_bloom)(void *options, size_t prefix_len);
 
     //cache
     void* (*cache_create_lru)(size_t cache_size);
     void  (*options_set_cache)(void *options, void *cache);
     void  (*cache_destroy)(void *lru_cache);
 
+    // memory
+    void  (*options_set_write_buffer_size)(void *options, size_t size);
+    // `cache` may be NULL when no block cache was configured.
+    void  (*memory_usage)(void *db, void *cache, EngineMemoryUsage *usage);
+
+    // statistics. stats_report returns the engine's own summary (compaction
+    // and level stats), released with free_fn. The rest are NULL where the
+    // engine has no statistics object; enabling it must precede open.
+    char* (*stats_report)(void *db);
+    void  (*options_enable_statistics)(void *options);
+    char* (*statistics_report)(void *options);
+    void  (*block_cache_stats)(void *options, uint64_t *hits, uint64_t *misses);
+
+    // maintenance
+    void  (*compact_range)(void *db, const char *start, size_t start_len,
+                const char *limit, size_t limit_len);
+
+    // ephemeral profile, for data that need not survive a crash: bloom
+    // filters, hash-indexed blocks and mmap reads where the engine has them,
+    // with `cache` (may be NULL) kept as the block cache and the memtable
+    // sized to `write_buffer_size`. Returns a handle to release with
+    // ephemeral_destroy once the db is closed, or NULL.
+    void* (*options_set_ephemeral)(void *options, void *cache, size_t write_buffer_size);
+    void  (*ephemeral_destroy)(void *handle);
+    // Skips the write-ahead log; NULL where the engine cannot.
+    void  (*writeoptions_disable_wal)(void *woptions);
+
+    // native TTL, only set when supports_native_ttl is true. Installs a
+    // compaction filter that drops values whose header (see value_format.h)
+    // has expired; the returned filter must outlive the db.
+    void* (*options_set_ttl_filter)(void *options);
+    void  (*ttl_filter_destroy)(void *filter);
+
     //free function for db-allocated bufers (errors) 
     //rocksdb uses free() but leveldb has its owd leveldb_free()
     void  (*free_fn)(void *ptr);
 
     bool supports_native_ttl;
+    // Data survives close and can be reopened with keep_existing.
+    bool persistent;
 
 } StorageEngine;
 
 extern StorageEngine LEVELDB_ENGINE;
 extern StorageEngine ROCKSDB_ENGINE;
+extern StorageEngine MEMORY_ENGINE;
+extern StorageEngine BITCASK_ENGINE;
 
 #endif // STORAGE_ENGINE_H
 
@@ -0,0 +1,79 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1u << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+
+/**
+ * @brief An intrusive timer, embedded in the object it expires.
+ *
+ * `pprev` points at whatever points at this node, so a node can be unlinked
+ * in O(1) without knowing which slot it sits in. It is NULL while the node is
+ * not scheduled.
+ */
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;
+    uint64_t expires;
+} TimerNode;
+
+/**
+ * @brief A hierarchical timing wheel with one-second ticks.
+ *
+ * Level 0 covers the next 64 seconds one slot per second, each following level
+ * covers 64 times the range of the previous one. Timers further out than the
+ * last level are parked in its farthest slot and re-placed when it cascades.
+ * Advancing the wheel costs O(elapsed ticks + timers that fire), independent
+ * of the number of timers scheduled.
+ */
+typedef struct TimerWheel {
+    uint64_t current;
+    size_t count;
+    TimerNode *slots[TW_LEVELS][TW_SLOTS];
+} TimerWheel;
+
+/**
+ * @brief Initializes an empty wheel whose clock starts at `now`.
+ */
+void tw_init(TimerWheel *wheel, uint64_t now);
+
+/**
+ * @brief Schedules `node` to fire once the wheel reaches `expires`.
+ *
+ * If the node is already scheduled it is moved, which is how TTL updates are
+ * applied without rescanning anything.
+ */
+void tw_schedule(TimerWheel *wheel, TimerNode *node, uint64_t expires);
+
+/**
+ * @brief Unschedules `node`. Does nothing if it is not scheduled.
+ */
+void tw_cancel(TimerWheel *wheel, TimerNode *node);
+
+/**
+ * @brief Advances the wheel to `now` and unlinks every timer with
+ * `expires <= now`.
+ *
+ * @return A singly linked list (through `next`) of the fired nodes, or NULL.
+ */
+TimerNode* tw_advance(TimerWheel *wheel, uint64_t now);
+
+/**
+ * @brief Unschedules and returns one of the timers due soonest, or NULL if
+ * the wheel is empty.
+ *
+ * Timers are ordered only to the granularity of the slot that holds them, so
+ * the result is approximately, not strictly, the earliest.
+ */
+TimerNode* tw_pop_next(TimerWheel *wheel);
+
+static inline int tw_is_scheduled(const TimerNode *node) {
+    return node->pprev != NULL;
+}
+
+#endif // TIMER_WHEEL_H
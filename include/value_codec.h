@@ -0,0 +1,78 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief First byte of every stored value when a codec is configured. It
+ * follows the expiration header (see value_format.h) when there is one, so
+ * expiry checks and the TTL compaction filter never decode a value.
+ */
+#define VALUE_CODEC_RAW       0   /**< Stored as given: too small, or compression did not pay. */
+#define VALUE_CODEC_ZSTD      1   /**< A zstd frame without a dictionary. */
+#define VALUE_CODEC_ZSTD_DICT 2   /**< A zstd frame using the codec's trained dictionary. */
+
+/**
+ * @brief Per-value zstd compression with a dictionary trained on the values
+ * themselves.
+ *
+ * Small values that share structure (JSON documents, serialized records)
+ * hardly compress one at a time; a dictionary holding their common parts
+ * does. Until enough values have been seen the codec compresses without a
+ * dictionary and keeps copies of values as training samples. Once the
+ * samples reach 64 times the dictionary size it trains the dictionary once,
+ * in the thread that completed the sample set, and uses it for every later
+ * value. The dictionary never changes afterwards, so every value written with
+ * it stays readable; when a file path is given it is saved there so a
+ * reopened cache can still decode them.
+ *
+ * Compression contexts are kept per thread and shared by all codecs.
+ */
+typedef struct ValueCodec ValueCodec;
+
+/**
+ * @brief Creates a codec.
+ *
+ * @param level zstd compression level.
+ * @param min_bytes Values shorter than this are stored raw.
+ * @param dict_bytes Size of the dictionary to train. 0 never trains one.
+ * @param dict_path File the dictionary is saved to and loaded from, or NULL.
+ * @param load Load an existing dictionary from `dict_path` instead of
+ *             removing it.
+ * @return The codec, or NULL if out of memory or a saved dictionary could
+ *         not be loaded.
+ */
+ValueCodec* value_codec_create(int level, size_t min_bytes, size_t dict_bytes, const char *dict_path, int load);
+
+void value_codec_destroy(ValueCodec *codec);
+
+/**
+ * @brief Most bytes value_codec_encode() writes for `len` input bytes.
+ */
+size_t value_codec_bound(size_t len);
+
+/**
+ * @brief Writes the codec byte and the value, compressed if that saves space,
+ * to `dst`, which holds value_codec_bound(len) bytes. Returns the bytes
+ * written.
+ */
+size_t value_codec_encode(ValueCodec *codec, char *dst, const char *src, size_t len);
+
+/**
+ * @brief Decodes a stored value. Raw values are returned in place with
+ * `*owned` set to NULL; others are decompressed into a NUL-terminated buffer
+ * returned in `*owned`, which the caller releases with free().
+ *
+ * @return 0 on success, -1 if the value is malformed or needs a dictionary
+ *         the codec does not have.
+ */
+int value_codec_decode(ValueCodec *codec, const char *src, size_t len,
+                       const char **out, size_t *out_len, char **owned);
+
+/**
+ * @brief Size of the trained dictionary, or 0 if there is none yet.
+ */
+size_t value_codec_dict_size(const ValueCodec *codec);
+
+#endif // VALUE_CODEC_H
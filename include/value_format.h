@@ -0,0 +1,41 @@
+#ifndef VALUE_FORMAT_H
+#define VALUE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Stored value layout used when the engine expires keys itself.
+ *
+ * Each value is prefixed with its absolute expiration time in seconds, as a
+ * fixed-width little-endian integer, so the engine can drop expired entries
+ * during compaction without consulting the in-memory index.
+ */
+#define VALUE_HEADER_SIZE 8
+
+static inline void value_header_encode(char *buf, uint64_t expiration) {
+    for (int i = 0; i < VALUE_HEADER_SIZE; i++) {
+        buf[i] = (char)(expiration >> (8 * i));
+    }
+}
+
+static inline uint64_t value_header_expiration(const char *buf) {
+    uint64_t expiration = 0;
+    for (int i = 0; i < VALUE_HEADER_SIZE; i++) {
+        expiration |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+    }
+    return expiration;
+}
+
+/**
+ * @brief Returns 1 if a stored value is malformed or expired at `now`.
+ */
+static inline int value_is_expired(const char *value, size_t value_len, uint64_t now) {
+    if (value_len < VALUE_HEADER_SIZE) {
+        return 1;
+    }
+    uint64_t expiration = value_header_expiration(value);
+    return expiration > 0 && now > expiration;
+}
+
+#endif // VALUE_FORMAT_H
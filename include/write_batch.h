@@ -0,0 +1,43 @@
+#ifndef WRITE_BATCH_H
+#define WRITE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A batch of puts and deletes for the native engines.
+ *
+ * Records are packed into one growing byte string: a type byte, the key and
+ * value lengths, then the bytes of both. An allocation failure marks the
+ * batch `failed` and later records are dropped; the engine reports it when
+ * the batch is written.
+ */
+typedef struct WriteBatch {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} WriteBatch;
+
+enum { WRITE_BATCH_PUT = 1, WRITE_BATCH_DELETE = 2 };
+
+typedef struct WriteBatchEntry {
+    int type;
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} WriteBatchEntry;
+
+WriteBatch* write_batch_create(void);
+void write_batch_destroy(WriteBatch *batch);
+void write_batch_put(WriteBatch *batch, const char *key, size_t key_len, const char *value, size_t value_len);
+void write_batch_delete(WriteBatch *batch, const char *key, size_t key_len);
+
+/**
+ * @brief Decodes the record at `*pos` into `entry` and advances `*pos`.
+ * Start with `*pos` at 0. Returns 0 once every record has been read.
+ */
+int write_batch_next(const WriteBatch *batch, size_t *pos, WriteBatchEntry *entry);
+
+#endif // WRITE_BATCH_H
@@ -0,0 +1,359 @@
+#include "async_pool.h"
+#include "levelcache.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "cache_log.h"
+
+#define ASYNC_DEFAULT_DEPTH 1024
+
+// One submitted operation. The key, followed by the value of a put, is
+// copied inline so the caller's buffers are free as soon as it is queued.
+typedef struct AsyncRequest {
+    struct AsyncRequest *next;
+    LevelCacheCompletion completion;
+    LevelCacheCallback callback;
+    uint32_t ttl_seconds;
+    size_t key_len;
+    size_t value_len;
+    char data[];
+} AsyncRequest;
+
+typedef struct AsyncQueue {
+    AsyncRequest *head;
+    AsyncRequest *tail;
+} AsyncQueue;
+
+struct AsyncPool {
+    LevelCache *cache;
+    pthread_mutex_t lock;       // guards `submitted` and `stop`
+    pthread_cond_t ready;
+    AsyncQueue submitted;
+    int stop;
+    pthread_mutex_t done_lock;  // guards `done`
+    AsyncQueue done;
+    int event_fd;
+    size_t outstanding;         // submitted and not yet delivered
+    size_t depth;
+    uint32_t num_threads;
+    pthread_t threads[];
+};
+
+static void queue_push(AsyncQueue *queue, AsyncRequest *request) {
+    request->next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->next = request;
+    } else {
+        queue->head = request;
+    }
+    queue->tail = request;
+}
+
+static AsyncRequest* queue_pop(AsyncQueue *queue) {
+    AsyncRequest *request = queue->head;
+    if (request != NULL) {
+        queue->head = request->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+    return request;
+}
+
+static void signal_completions(AsyncPool *pool) {
+    uint64_t one = 1;
+    while (write(pool->event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+// Answers a get with levelcache_get_pinned_n() so a miss (-1) and an error
+// (-2) are told apart.
+static void run_get(LevelCache *cache, AsyncRequest *request) {
+    LevelCacheCompletion *completion = &request->completion;
+    LevelCachePinnedValue pinned;
+    completion->status = levelcache_get_pinned_n(cache, request->data, request->key_len, &pinned);
+    if (completion->status != 0) {
+        return;
+    }
+    completion->value = (char *) malloc(pinned.len + 1);
+    if (completion->value == NULL) {
+        log_error("[async] Failed to allocate memory for a value");
+        completion->status = -2;
+    } else {
+        memcpy(completion->value, pinned.data, pinned.len);
+        completion->value[pinned.len] = '\0';
+        completion->value_len = pinned.len;
+    }
+    levelcache_value_release(&pinned);
+}
+
+// Answers the gets collected so far with one multi_get so an engine that
+// overlaps the reads of a batch (RocksDB) gets to do so. If it fails, each
+// key is retried on its own so one bad key does not fail the others.
+static void run_gets(LevelCache *cache, AsyncRequest **gets, size_t num_gets) {
+    const char *keys[ASYNC_POOL_BATCH];
+    size_t key_lens[ASYNC_POOL_BATCH];
+    char *values[ASYNC_POOL_BATCH];
+    size_t value_lens[ASYNC_POOL_BATCH];
+
+    if (num_gets == 1) {
+        run_get(cache, gets[0]);
+        return;
+    }
+    for (size_t i = 0; i < num_gets; i++) {
+        keys[i] = gets[i]->data;
+        key_lens[i] = gets[i]->key_len;
+    }
+    if (levelcache_multi_get_n(cache, keys, key_lens, num_gets, values, value_lens) < 0) {
+        for (size_t i = 0; i < num_gets; i++) {
+            run_get(cache, gets[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < num_gets; i++) {
+        LevelCacheCompletion *completion = &gets[i]->completion;
+        completion->value = values[i];
+        completion->value_len = (values[i] != NULL) ? value_lens[i] : 0;
+        completion->status = (values[i] != NULL) ? 0 : -1;
+    }
+}
+
+// Runs a batch taken off the queue in submission order. Gets are held back
+// and answered together, until a write to the key of one of them comes up.
+static void run_batch(AsyncPool *pool, AsyncRequest **batch, size_t count) {
+    LevelCache *cache = pool->cache;
+    AsyncRequest *gets[ASYNC_POOL_BATCH];
+    size_t num_gets = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        AsyncRequest *request = batch[i];
+        LevelCacheCompletion *completion = &request->completion;
+        if (completion->op == LEVELCACHE_ASYNC_GET) {
+            gets[num_gets++] = request;
+            continue;
+        }
+        for (size_t j = 0; j < num_gets; j++) {
+            if (gets[j]->key_len == request->key_len &&
+                memcmp(gets[j]->data, request->data, request->key_len) == 0) {
+                run_gets(cache, gets, num_gets);
+                num_gets = 0;
+                break;
+            }
+        }
+        int rc;
+        if (completion->op == LEVELCACHE_ASYNC_PUT) {
+            rc = levelcache_put_n(cache, request->data, request->key_len,
+                                  request->data + request->key_len, request->value_len,
+                                  request->ttl_seconds);
+        } else {
+            rc = levelcache_delete_n(cache, request->data, request->key_len);
+        }
+        completion->status = (rc == 0) ? 0 : -2;
+    }
+    if (num_gets > 0) {
+        run_gets(cache, gets, num_gets);
+    }
+
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++) {
+        AsyncRequest *request = batch[i];
+        if (request->callback != NULL) {
+            request->callback(&request->completion);
+            free(request);
+            __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_RELEASE);
+            batch[i] = NULL;
+        } else {
+            queued++;
+        }
+    }
+    if (queued > 0) {
+        pthread_mutex_lock(&pool->done_lock);
+        for (size_t i = 0; i < count; i++) {
+            if (batch[i] != NULL) {
+                queue_push(&pool->done, batch[i]);
+            }
+        }
+        pthread_mutex_unlock(&pool->done_lock);
+        signal_completions(pool);
+    }
+}
+
+// Workers finish what is queued before they stop, so every submitted
+// operation is carried out even if the cache is closed right after.
+static void* async_worker(void *arg) {
+    AsyncPool *pool = (AsyncPool *)arg;
+    AsyncRequest *batch[ASYNC_POOL_BATCH];
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->submitted.head == NULL && !pool->stop) {
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        }
+        size_t count = 0;
+        while (count < ASYNC_POOL_BATCH && (batch[count] = queue_pop(&pool->submitted)) != NULL) {
+            count++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (count == 0) {
+            return NULL;
+        }
+        run_batch(pool, batch, count);
+    }
+}
+
+AsyncPool* async_pool_create(LevelCache *cache, uint32_t threads, size_t depth) {
+    AsyncPool *pool = (AsyncPool *) calloc(1, sizeof(AsyncPool) + threads * sizeof(pthread_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->cache = cache;
+    pool->depth = depth ? depth : ASYNC_DEFAULT_DEPTH;
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->event_fd < 0) {
+        log_error("[async] Failed to create the completion eventfd: %s", strerror(errno));
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pthread_mutex_init(&pool->done_lock, NULL);
+    for (uint32_t i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, async_worker, pool) != 0) {
+            log_error("[async] Failed to create worker thread %u", i);
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads < threads) {
+        async_pool_destroy(pool);
+        return NULL;
+    }
+    log_info("[async] Started %u workers, %zu operations outstanding at most", threads, pool->depth);
+    return pool;
+}
+
+void async_pool_destroy(AsyncPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    AsyncRequest *request;
+    size_t dropped = 0;
+    while ((request = queue_pop(&pool->done)) != NULL) {
+        free(request->completion.value);
+        free(request);
+        dropped++;
+    }
+    if (dropped > 0) {
+        log_warn("[async] Dropped %zu completions that were never polled", dropped);
+    }
+    close(pool->event_fd);
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static int submit(LevelCache *cache, LevelCacheAsyncOp op, const char *key, size_t key_len,
+                  const char *value, size_t value_len, uint32_t ttl_seconds,
+                  LevelCacheCallback callback, void *user_data) {
+    AsyncPool *pool = cache->async;
+    if (pool == NULL) {
+        log_error("[async] The async API needs async_threads at open");
+        return -1;
+    }
+    // Reserve a slot first so the depth is never exceeded, even briefly.
+    if (__atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_ACQUIRE) > pool->depth) {
+        __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_RELEASE);
+        log_debug("[async] Queue full, rejecting operation on key '%.*s'", (int)key_len, key);
+        return -1;
+    }
+    AsyncRequest *request = (AsyncRequest *) malloc(sizeof(AsyncRequest) + key_len + value_len);
+    if (request == NULL) {
+        __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_RELEASE);
+        log_error("[async] Failed to allocate memory for a request");
+        return -1;
+    }
+    request->completion.op = op;
+    request->completion.status = -1;
+    request->completion.value = NULL;
+    request->completion.value_len = 0;
+    request->completion.user_data = user_data;
+    request->callback = callback;
+    request->ttl_seconds = ttl_seconds;
+    request->key_len = key_len;
+    request->value_len = value_len;
+    memcpy(request->data, key, key_len);
+    if (value_len > 0) {
+        memcpy(request->data + key_len, value, value_len);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    queue_push(&pool->submitted, request);
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int levelcache_get_async(LevelCache *cache, const char *key, size_t key_len,
+                         LevelCacheCallback callback, void *user_data) {
+    return submit(cache, LEVELCACHE_ASYNC_GET, key, key_len, NULL, 0, 0, callback, user_data);
+}
+
+int levelcache_put_async(LevelCache *cache, const char *key, size_t key_len, const char *value, size_t value_len,
+                         uint32_t ttl_seconds, LevelCacheCallback callback, void *user_data) {
+    return submit(cache, LEVELCACHE_ASYNC_PUT, key, key_len, value, value_len, ttl_seconds, callback, user_data);
+}
+
+int levelcache_delete_async(LevelCache *cache, const char *key, size_t key_len,
+                            LevelCacheCallback callback, void *user_data) {
+    return submit(cache, LEVELCACHE_ASYNC_DELETE, key, key_len, NULL, 0, 0, callback, user_data);
+}
+
+int levelcache_completion_fd(LevelCache *cache) {
+    return (cache->async != NULL) ? cache->async->event_fd : -1;
+}
+
+size_t levelcache_poll_completions(LevelCache *cache, LevelCacheCompletion *completions, size_t max) {
+    AsyncPool *pool = cache->async;
+    if (pool == NULL || max == 0) {
+        return 0;
+    }
+    // Reset the eventfd before looking at the queue: a completion pushed
+    // after the read signals it again, so none can be missed.
+    uint64_t signals;
+    while (read(pool->event_fd, &signals, sizeof(signals)) < 0 && errno == EINTR) {
+    }
+
+    size_t taken = 0;
+    AsyncRequest *requests = NULL;
+    pthread_mutex_lock(&pool->done_lock);
+    AsyncRequest *request;
+    while (taken < max && (request = queue_pop(&pool->done)) != NULL) {
+        completions[taken++] = request->completion;
+        request->next = requests;
+        requests = request;
+    }
+    int more = (pool->done.head != NULL);
+    pthread_mutex_unlock(&pool->done_lock);
+    if (more) {
+        signal_completions(pool);
+    }
+
+    while (requests != NULL) {
+        AsyncRequest *next = requests->next;
+        free(requests);
+        requests = next;
+    }
+    __atomic_sub_fetch(&pool->outstanding, taken, __ATOMIC_RELEASE);
+    return taken;
+}
@@ -0,0 +1,823 @@
+#include "../include/storage_engine.h"
+#include "../include/key_index.h"
+#include "../include/skiplist.h"
+#include "../include/write_batch.h"
+#include "../include/value_format.h"
+#include "../include/coarse_clock.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A log-structured engine in the style of Bitcask. Values are appended to
+// mmap'd segment files and an in-memory index (hash-partitioned skiplists, as
+// in the memory engine) maps each key to its latest record, so a read is a
+// lookup plus a pointer into the mapping. Nothing is ever rewritten: a segment
+// is dropped whole once the index no longer points into it, or once every
+// value in it has expired, and there is no compaction work at all.
+//
+// Segment files are unlinked as soon as they are mapped. The page cache still
+// backs them, so the data set may outgrow RAM, but the space goes back to the
+// filesystem with the mapping, even after a crash, and the data does not
+// outlive the db. That also means deletes need no tombstones.
+
+#define BC_SHARD_BITS 4
+#define BC_NUM_SHARDS (1u << BC_SHARD_BITS)
+#define BC_DEFAULT_SEGMENT_BYTES (64 << 20)
+
+typedef struct BcSegment {
+    struct BcSegment *prev;   // segments are listed oldest first, the active
+    struct BcSegment *next;   // one last, under the append lock
+    char *base;
+    size_t size;
+    size_t used;              // append offset, fixed once sealed
+    uint64_t id;
+    uint32_t refs;            // one while listed, plus one per pinned read
+    uint32_t pending;         // appends reserved but not yet indexed
+    size_t live;              // records the index points at or is about to
+    uint64_t max_expiration;  // of the values appended so far
+    int never_expires;        // holds a value with no expiration
+    int sealed;
+    int retired;
+} BcSegment;
+
+// Records are 8-byte aligned; the key and then the value follow the header.
+typedef struct BcRecord {
+    BcSegment *segment;
+    uint64_t seq;
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[];
+} BcRecord;
+
+typedef struct BcDb {
+    SkipList shards[BC_NUM_SHARDS];
+    pthread_mutex_t append_lock;
+    BcSegment *oldest;
+    BcSegment *newest;
+    BcSegment *active;        // the newest segment unless it was sealed
+    uint64_t next_id;
+    uint64_t seq;
+    size_t segment_bytes;
+    int ttl;
+    char *path;
+    size_t segments;
+    size_t mapped_bytes;
+    uint64_t reclaimed;
+} BcDb;
+
+typedef struct BcOptions {
+    size_t segment_bytes;
+    int ttl;
+    int create_if_missing;
+} BcOptions;
+
+// Read and write options have no fields; the TTL filter is a flag on the
+// options, so its handle is a placeholder too.
+static char bc_no_options;
+static char bc_ttl_filter;
+
+static inline size_t record_size(size_t key_len, size_t value_len) {
+    return (sizeof(BcRecord) + key_len + value_len + 7) & ~(size_t)7;
+}
+
+static inline const char* record_value(const BcRecord *record) {
+    return record->data + record->key_len;
+}
+
+static inline SkipList* shard_for(BcDb *db, const char *key, size_t key_len) {
+    return &db->shards[ki_hash(key, key_len) & (BC_NUM_SHARDS - 1)];
+}
+
+static char* bc_error(const char *message) {
+    return strdup(message);
+}
+
+static char* bc_errno_error(const char *what) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "bitcask engine: %s: %s", what, strerror(errno));
+    return strdup(buf);
+}
+
+static int record_expired(const BcDb *db, const BcRecord *record) {
+    if (!db->ttl || record->value_len < VALUE_HEADER_SIZE) {
+        return 0;
+    }
+    uint64_t expiration = value_header_expiration(record_value(record));
+    return expiration > 0 && coarse_clock_now() > expiration;
+}
+
+static void segment_unref(BcSegment *segment) {
+    if (__atomic_sub_fetch(&segment->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        munmap(segment->base, segment->size);
+        free(segment);
+    }
+}
+
+// Called with the append lock held. Takes the segment off the list; its
+// mapping goes once the last pinned reader lets go.
+static void segment_unlink_locked(BcDb *db, BcSegment *segment) {
+    if (segment->prev != NULL) {
+        segment->prev->next = segment->next;
+    } else {
+        db->oldest = segment->next;
+    }
+    if (segment->next != NULL) {
+        segment->next->prev = segment->prev;
+    } else {
+        db->newest = segment->prev;
+    }
+    segment->prev = segment->next = NULL;
+    segment->retired = 1;
+    db->segments--;
+    db->mapped_bytes -= segment->size;
+    db->reclaimed++;
+}
+
+// Called with the append lock held.
+static BcSegment* segment_create_locked(BcDb *db, size_t size, char **err) {
+    char file[4096];
+    snprintf(file, sizeof(file), "%s/%06llu.seg", db->path, (unsigned long long)db->next_id);
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        *err = bc_errno_error("cannot create segment");
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        *err = bc_errno_error("cannot size segment");
+        close(fd);
+        unlink(file);
+        return NULL;
+    }
+    char *base = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    unlink(file);
+    if (base == MAP_FAILED) {
+        *err = bc_errno_error("cannot map segment");
+        return NULL;
+    }
+    BcSegment *segment = (BcSegment *) calloc(1, sizeof(BcSegment));
+    if (segment == NULL) {
+        munmap(base, size);
+        *err = bc_error("bitcask engine: out of memory");
+        return NULL;
+    }
+    segment->base = base;
+    segment->size = size;
+    segment->id = db->next_id++;
+    segment->refs = 1;
+    segment->prev = db->newest;
+    if (db->newest != NULL) {
+        db->newest->next = segment;
+    } else {
+        db->oldest = segment;
+    }
+    db->newest = segment;
+    db->active = segment;
+    db->segments++;
+    db->mapped_bytes += size;
+    return segment;
+}
+
+// Called with the append lock held. Unlinks every sealed segment whose values
+// have all expired and returns them chained through `next`; their index
+// entries still have to be erased before they are released.
+static BcSegment* collect_expired_locked(BcDb *db) {
+    BcSegment *expired = NULL;
+    uint64_t now = coarse_clock_now();
+    BcSegment *segment = db->oldest;
+    while (segment != NULL) {
+        BcSegment *next = segment->next;
+        if (segment->sealed && !segment->never_expires && segment->max_expiration > 0 &&
+            now > segment->max_expiration && __atomic_load_n(&segment->pending, __ATOMIC_ACQUIRE) == 0) {
+            segment_unlink_locked(db, segment);
+            segment->next = expired;
+            expired = segment;
+        }
+        segment = next;
+    }
+    return expired;
+}
+
+// Erases the index entries that still point into each expired segment, then
+// drops the list's reference on it.
+static void reclaim_expired(BcDb *db, BcSegment *expired) {
+    while (expired != NULL) {
+        BcSegment *next = expired->next;
+        size_t pos = 0;
+        while (pos < expired->used) {
+            BcRecord *record = (BcRecord *)(expired->base + pos);
+            SkipList *shard = shard_for(db, record->data, record->key_len);
+            pthread_rwlock_wrlock(&shard->lock);
+            SkipNode *node = skiplist_find(shard, record->data, record->key_len);
+            if (node != NULL && node->value == record) {
+                skiplist_erase(shard, record->data, record->key_len);
+            }
+            pthread_rwlock_unlock(&shard->lock);
+            pos += record_size(record->key_len, record->value_len);
+        }
+        segment_unref(expired);
+        expired = next;
+    }
+}
+
+// Called with the append lock held.
+static void segment_seal_locked(BcDb *db, BcSegment *segment) {
+    segment->sealed = 1;
+    if (__atomic_load_n(&segment->live, __ATOMIC_ACQUIRE) == 0) {
+        segment_unlink_locked(db, segment);
+        segment_unref(segment);
+    }
+    db->active = NULL;
+}
+
+// The index no longer points at `record`. A sealed segment left with no live
+// records is dropped. Called with the record's shard lock held; the append
+// lock always nests inside shard locks.
+//
+// Only the last live record is released under the append lock, so dropping
+// to zero and the sealed check are one step against segment_seal_locked;
+// otherwise a writer sealing the segment in between could free it first.
+static void record_dead(BcDb *db, BcRecord *record) {
+    BcSegment *segment = record->segment;
+    size_t live = __atomic_load_n(&segment->live, __ATOMIC_RELAXED);
+    while (live > 1) {
+        if (__atomic_compare_exchange_n(&segment->live, &live, live - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&db->append_lock);
+    if (__atomic_sub_fetch(&segment->live, 1, __ATOMIC_ACQ_REL) == 0 && segment->sealed && !segment->retired) {
+        segment_unlink_locked(db, segment);
+        segment_unref(segment);
+    }
+    pthread_mutex_unlock(&db->append_lock);
+}
+
+// Called with the append lock held. Reserves room for a record at the tail of
+// the log, rolling to a new segment when it does not fit; segments found to
+// have expired on a roll are chained onto `*expired`. The record stays
+// pending, which keeps its segment from being reclaimed as expired, until the
+// caller has indexed it and calls append_done.
+static BcRecord* log_reserve_locked(BcDb *db, size_t need, uint64_t expiration, BcSegment **expired, char **err) {
+    BcSegment *segment = db->active;
+    if (segment == NULL || segment->used + need > segment->size) {
+        if (segment != NULL) {
+            segment_seal_locked(db, segment);
+        }
+        segment = segment_create_locked(db, need > db->segment_bytes ? need : db->segment_bytes, err);
+        if (segment == NULL) {
+            return NULL;
+        }
+        BcSegment *collected = collect_expired_locked(db);
+        if (collected != NULL) {
+            BcSegment *tail = collected;
+            while (tail->next != NULL) {
+                tail = tail->next;
+            }
+            tail->next = *expired;
+            *expired = collected;
+        }
+    }
+    BcRecord *record = (BcRecord *)(segment->base + segment->used);
+    segment->used += need;
+    if (expiration == 0) {
+        segment->never_expires = 1;
+    } else if (expiration > segment->max_expiration) {
+        segment->max_expiration = expiration;
+    }
+    record->segment = segment;
+    record->seq = ++db->seq;
+    __atomic_add_fetch(&segment->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&segment->pending, 1, __ATOMIC_RELAXED);
+    return record;
+}
+
+// Called with the append lock held, on the latest reservation not yet undone,
+// so the segment's tail goes back to where the record started. A sealed
+// segment left with no live records is dropped.
+static void log_unreserve_locked(BcDb *db, BcRecord *record) {
+    BcSegment *segment = record->segment;
+    segment->used = (size_t)((char *)record - segment->base);
+    __atomic_sub_fetch(&segment->pending, 1, __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&segment->live, 1, __ATOMIC_ACQ_REL) == 0 && segment->sealed && !segment->retired) {
+        segment_unlink_locked(db, segment);
+        segment_unref(segment);
+    }
+}
+
+static uint64_t value_expiration(const BcDb *db, const char *value, size_t value_len) {
+    if (db->ttl && value_len >= VALUE_HEADER_SIZE) {
+        return value_header_expiration(value);
+    }
+    return 0;
+}
+
+static void record_fill(BcRecord *record, const char *key, size_t key_len, const char *value, size_t value_len) {
+    record->key_len = (uint32_t)key_len;
+    record->value_len = (uint32_t)value_len;
+    memcpy(record->data, key, key_len);
+    if (value_len > 0) {
+        memcpy(record->data + key_len, value, value_len);
+    }
+}
+
+// Appends one record. Space is reserved under the append lock but filled
+// outside it, so writers only serialize on the bump.
+static BcRecord* log_append(BcDb *db, const char *key, size_t key_len, const char *value, size_t value_len, char **err) {
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+        *err = bc_error("bitcask engine: record too large");
+        return NULL;
+    }
+    BcSegment *expired = NULL;
+    pthread_mutex_lock(&db->append_lock);
+    BcRecord *record = log_reserve_locked(db, record_size(key_len, value_len),
+                                          value_expiration(db, value, value_len), &expired, err);
+    pthread_mutex_unlock(&db->append_lock);
+    reclaim_expired(db, expired);
+    if (record != NULL) {
+        record_fill(record, key, key_len, value, value_len);
+    }
+    return record;
+}
+
+// Called with the record's shard lock held, once the index points at it or
+// before it is dropped; its live count still keeps the segment listed.
+static inline void append_done(BcRecord *record) {
+    __atomic_sub_fetch(&record->segment->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void bc_put_record(BcDb *db, const char *key, size_t keylen, const char *value, size_t valuelen, char **err) {
+    BcRecord *record = log_append(db, key, keylen, value, valuelen, err);
+    if (record == NULL) {
+        return;
+    }
+    SkipList *shard = shard_for(db, key, keylen);
+    pthread_rwlock_wrlock(&shard->lock);
+    int created = 0;
+    SkipNode *node = skiplist_insert(shard, key, keylen, &created);
+    BcRecord *dead = NULL;
+    if (node == NULL) {
+        *err = bc_error("bitcask engine: out of memory");
+        dead = record;
+    } else if (created) {
+        node->value = record;
+    } else {
+        // Writers to one key can reach the index out of order; the later
+        // append wins.
+        BcRecord *old = (BcRecord *)node->value;
+        if (old->seq > record->seq) {
+            dead = record;
+        } else {
+            node->value = record;
+            dead = old;
+        }
+    }
+    append_done(record);
+    if (dead != NULL) {
+        record_dead(db, dead);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+static void bc_delete_record(BcDb *db, const char *key, size_t keylen) {
+    SkipList *shard = shard_for(db, key, keylen);
+    pthread_rwlock_wrlock(&shard->lock);
+    BcRecord *record = (BcRecord *) skiplist_erase(shard, key, keylen);
+    if (record != NULL) {
+        record_dead(db, record);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+static void* bc_open(void *options, const char *path, char **err) {
+    BcOptions *opts = (BcOptions *)options;
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        if (!opts->create_if_missing) {
+            *err = bc_error("bitcask engine: database does not exist");
+            return NULL;
+        }
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            *err = bc_errno_error("cannot create directory");
+            return NULL;
+        }
+    }
+    BcDb *db = NULL;
+    if (posix_memalign((void **)&db, 64, sizeof(BcDb)) != 0) {
+        *err = bc_error("bitcask engine: out of memory");
+        return NULL;
+    }
+    memset(db, 0, sizeof(BcDb));
+    db->path = strdup(path);
+    if (db->path == NULL) {
+        free(db);
+        *err = bc_error("bitcask engine: out of memory");
+        return NULL;
+    }
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        if (skiplist_init(&db->shards[i], 0x85ebca6bu * (i + 1)) != 0) {
+            for (uint32_t j = 0; j < i; j++) {
+                skiplist_destroy(&db->shards[j]);
+            }
+            free(db->path);
+            free(db);
+            *err = bc_error("bitcask engine: out of memory");
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&db->append_lock, NULL);
+    db->segment_bytes = opts->segment_bytes;
+    db->ttl = opts->ttl;
+    return db;
+}
+
+static void bc_close(void *handle) {
+    BcDb *db = (BcDb *)handle;
+    BcSegment *segment = db->oldest;
+    while (segment != NULL) {
+        BcSegment *next = segment->next;
+        munmap(segment->base, segment->size);
+        free(segment);
+        segment = next;
+    }
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        skiplist_destroy(&db->shards[i]);
+    }
+    pthread_mutex_destroy(&db->append_lock);
+    free(db->path);
+    free(db);
+}
+
+static void* bc_options_create() {
+    BcOptions *opts = (BcOptions *) calloc(1, sizeof(BcOptions));
+    if (opts != NULL) {
+        opts->segment_bytes = BC_DEFAULT_SEGMENT_BYTES;
+    }
+    return opts;
+}
+static void bc_options_destroy(void *options) { free(options); }
+static void bc_options_set_create_if_missing(void *options, int v) { ((BcOptions *)options)->create_if_missing = v; }
+
+// Segments are unlinked once mapped, so only files left by a crash in between
+// and the directory itself remain.
+static void bc_destroy_db(void *options, const char *path, char **err) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char file[4096];
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcmp(entry->d_name + len - 4, ".seg") == 0) {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            unlink(file);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static void* bc_readoptions_create() { return &bc_no_options; }
+static void* bc_writeoptions_create() { return &bc_no_options; }
+static void bc_readoptions_destroy(void *roptions) {}
+static void bc_writeoptions_destroy(void *woptions) {}
+
+static void bc_put(void *handle, void *woptions, const char *key, size_t keylen, const char *value, size_t valuelen, char **err) {
+    bc_put_record((BcDb *)handle, key, keylen, value, valuelen, err);
+}
+
+static char* bc_get(void *handle, void *roptions, const char *key, size_t keylen, size_t *valuelen, char **err) {
+    BcDb *db = (BcDb *)handle;
+    SkipList *shard = shard_for(db, key, keylen);
+    char *result = NULL;
+    pthread_rwlock_rdlock(&shard->lock);
+    SkipNode *node = skiplist_find(shard, key, keylen);
+    if (node != NULL && !record_expired(db, (BcRecord *)node->value)) {
+        BcRecord *record = (BcRecord *)node->value;
+        result = (char *) malloc(record->value_len ? record->value_len : 1);
+        if (result != NULL) {
+            memcpy(result, record_value(record), record->value_len);
+            *valuelen = record->value_len;
+        } else {
+            *err = bc_error("bitcask engine: out of memory");
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+// The value is read in place from the mapping; the handle is a reference on
+// the segment, which keeps it mapped even if it is reclaimed meanwhile.
+static void* bc_get_pinned(void *handle, void *roptions, const char *key, size_t keylen, const char **value, size_t *valuelen, char **err) {
+    BcDb *db = (BcDb *)handle;
+    SkipList *shard = shard_for(db, key, keylen);
+    BcSegment *pinned = NULL;
+    pthread_rwlock_rdlock(&shard->lock);
+    SkipNode *node = skiplist_find(shard, key, keylen);
+    if (node != NULL && !record_expired(db, (BcRecord *)node->value)) {
+        BcRecord *record = (BcRecord *)node->value;
+        pinned = record->segment;
+        __atomic_add_fetch(&pinned->refs, 1, __ATOMIC_RELAXED);
+        *value = record_value(record);
+        *valuelen = record->value_len;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return pinned;
+}
+
+static void bc_pinned_destroy(void *handle) { segment_unref((BcSegment *)handle); }
+
+static void bc_del(void *handle, void *woptions, const char *key, size_t keylen, char **err) {
+    bc_delete_record((BcDb *)handle, key, keylen);
+}
+
+static void* bc_writebatch_create() { return write_batch_create(); }
+static void bc_writebatch_destroy(void *batch) { write_batch_destroy((WriteBatch *)batch); }
+static void bc_writebatch_put(void *batch, const char *key, size_t keylen, const char *value, size_t valuelen) {
+    write_batch_put((WriteBatch *)batch, key, keylen, value, valuelen);
+}
+static void bc_writebatch_delete(void *batch, const char *key, size_t keylen) {
+    write_batch_delete((WriteBatch *)batch, key, keylen);
+}
+
+// Every shard the batch touches is write-locked, in shard order, for the
+// whole write, so readers see all of the batch or none of it. Missing nodes
+// are linked first and every record is reserved under one hold of the append
+// lock; if either fails, the reservations are taken back off the tail of the
+// log, the new nodes are unlinked and the db is left as it was. Deletes only
+// clear their node's value while records are applied, so a later put of the
+// same key finds its node still there; cleared nodes are unlinked at the end.
+static void bc_write(void *handle, void *woptions, void *batch_handle, char **err) {
+    BcDb *db = (BcDb *)handle;
+    WriteBatch *batch = (WriteBatch *)batch_handle;
+    if (batch->failed) {
+        *err = bc_error("bitcask engine: out of memory building batch");
+        return;
+    }
+    size_t pos = 0, puts = 0;
+    uint32_t touched = 0;
+    WriteBatchEntry entry;
+    while (write_batch_next(batch, &pos, &entry)) {
+        if (entry.type == WRITE_BATCH_PUT) {
+            if (entry.key_len > UINT32_MAX || entry.value_len > UINT32_MAX) {
+                *err = bc_error("bitcask engine: record too large");
+                return;
+            }
+            puts++;
+        }
+        touched |= 1u << (ki_hash(entry.key, entry.key_len) & (BC_NUM_SHARDS - 1));
+    }
+    BcRecord **records = NULL;
+    if (puts > 0 && (records = (BcRecord **) malloc(puts * sizeof(BcRecord *))) == NULL) {
+        *err = bc_error("bitcask engine: out of memory");
+        return;
+    }
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_wrlock(&db->shards[i].lock);
+        }
+    }
+
+    int failed = 0;
+    for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+        int created = 0;
+        if (entry.type == WRITE_BATCH_PUT &&
+            skiplist_insert(shard_for(db, entry.key, entry.key_len), entry.key, entry.key_len, &created) == NULL) {
+            *err = bc_error("bitcask engine: out of memory");
+            failed = 1;
+            break;
+        }
+    }
+    BcSegment *expired = NULL;
+    size_t reserved = 0;
+    if (!failed) {
+        pthread_mutex_lock(&db->append_lock);
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            if (entry.type != WRITE_BATCH_PUT) {
+                continue;
+            }
+            BcRecord *record = log_reserve_locked(db, record_size(entry.key_len, entry.value_len),
+                                                  value_expiration(db, entry.value, entry.value_len), &expired, err);
+            if (record == NULL) {
+                while (reserved > 0) {
+                    log_unreserve_locked(db, records[--reserved]);
+                }
+                failed = 1;
+                break;
+            }
+            records[reserved++] = record;
+        }
+        pthread_mutex_unlock(&db->append_lock);
+    }
+
+    if (failed) {
+        // Nodes linked above are the only ones without a record.
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            SkipList *shard = shard_for(db, entry.key, entry.key_len);
+            SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+            if (node != NULL && node->value == NULL) {
+                skiplist_erase(shard, entry.key, entry.key_len);
+            }
+        }
+    } else {
+        size_t applied = 0;
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            SkipList *shard = shard_for(db, entry.key, entry.key_len);
+            SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+            if (node == NULL) {
+                continue;
+            }
+            BcRecord *old = (BcRecord *)node->value;
+            node->value = NULL;
+            if (entry.type == WRITE_BATCH_PUT) {
+                BcRecord *record = records[applied++];
+                record_fill(record, entry.key, entry.key_len, entry.value, entry.value_len);
+                node->value = record;
+                append_done(record);
+            }
+            if (old != NULL) {
+                record_dead(db, old);
+            }
+        }
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            if (entry.type == WRITE_BATCH_DELETE) {
+                SkipList *shard = shard_for(db, entry.key, entry.key_len);
+                SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+                if (node != NULL && node->value == NULL) {
+                    skiplist_erase(shard, entry.key, entry.key_len);
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_unlock(&db->shards[i].lock);
+        }
+    }
+    // Reclaiming takes shard locks of its own.
+    reclaim_expired(db, expired);
+    free(records);
+}
+
+static void bc_multi_get(void *db, void *roptions, size_t num_keys, const char *const *keys, const size_t *keylens,
+                         char **values, size_t *valuelens, char **errs) {
+    for (size_t i = 0; i < num_keys; i++) {
+        errs[i] = NULL;
+        values[i] = bc_get(db, roptions, keys[i], keylens[i], &valuelens[i], &errs[i]);
+    }
+}
+
+static const char* bc_value_of(const void *value, size_t *len) {
+    const BcRecord *record = (const BcRecord *)value;
+    *len = record->value_len;
+    return record_value(record);
+}
+
+static void* bc_iter_create(void *db, void *roptions) {
+    return skiplist_iter_create(((BcDb *)db)->shards, BC_NUM_SHARDS, bc_value_of);
+}
+static void bc_iter_destroy(void *iter) { skiplist_iter_destroy((SkipIterator *)iter); }
+static int bc_iter_valid(const void *iter) { return skiplist_iter_valid((const SkipIterator *)iter); }
+static void bc_iter_seek(void *iter, const char *key, size_t keylen) { skiplist_iter_seek((SkipIterator *)iter, key, keylen); }
+static void bc_iter_seek_to_first(void *iter) { skiplist_iter_seek((SkipIterator *)iter, "", 0); }
+static void bc_iter_seek_to_last(void *iter) { skiplist_iter_seek_to_last((SkipIterator *)iter); }
+static void bc_iter_next(void *iter) { skiplist_iter_next((SkipIterator *)iter); }
+static const char* bc_iter_key(const void *iter, size_t *keylen) { return skiplist_iter_key((const SkipIterator *)iter, keylen); }
+static const char* bc_iter_value(const void *iter, size_t *valuelen) { return skiplist_iter_value((const SkipIterator *)iter, valuelen); }
+static void bc_iter_get_error(const void *iter, char **err) {
+    if (skiplist_iter_failed((const SkipIterator *)iter)) {
+        *err = bc_error("bitcask engine: out of memory while iterating");
+    }
+}
+
+// Reads come straight from the page cache; there is no block cache to size.
+static void* bc_cache_create_lru(size_t capacity) { return NULL; }
+static void bc_options_set_cache(void *options, void *cache) {}
+static void bc_cache_destroy(void *cache) {}
+
+// The active segment plays the part of a memtable.
+static void bc_options_set_write_buffer_size(void *options, size_t size) {
+    ((BcOptions *)options)->segment_bytes = size;
+}
+
+// Only the index is process memory. Segment pages belong to the page cache,
+// which the kernel reclaims on its own, just like an LSM engine's table files.
+static void bc_memory_usage(void *handle, void *cache, EngineMemoryUsage *usage) {
+    BcDb *db = (BcDb *)handle;
+    usage->memtables = 0;
+    usage->table_readers = 0;
+    usage->block_cache = 0;
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        usage->memtables += __atomic_load_n(&db->shards[i].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static char* bc_stats_report(void *handle) {
+    BcDb *db = (BcDb *)handle;
+    size_t count = 0;
+    for (uint32_t i = 0; i < BC_NUM_SHARDS; i++) {
+        SkipList *shard = &db->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        count += shard->count;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    pthread_mutex_lock(&db->append_lock);
+    size_t segments = db->segments;
+    size_t mapped = db->mapped_bytes;
+    uint64_t reclaimed = db->reclaimed;
+    pthread_mutex_unlock(&db->append_lock);
+    char *report = (char *) malloc(160);
+    if (report != NULL) {
+        snprintf(report, 160, "bitcask engine: %zu keys, %zu segments, %zu MB mapped, %llu segments reclaimed\n",
+                 count, segments, mapped >> 20, (unsigned long long)reclaimed);
+    }
+    return report;
+}
+
+// Seals the active segment and reclaims every segment that has fully expired.
+// The range is ignored: segments are not ordered by key.
+static void bc_compact_range(void *handle, const char *start, size_t start_len, const char *limit, size_t limit_len) {
+    BcDb *db = (BcDb *)handle;
+    pthread_mutex_lock(&db->append_lock);
+    if (db->active != NULL && db->active->used > 0) {
+        segment_seal_locked(db, db->active);
+    }
+    BcSegment *expired = collect_expired_locked(db);
+    pthread_mutex_unlock(&db->append_lock);
+    reclaim_expired(db, expired);
+}
+
+// There is no log or filter to give up; the profile only sizes the segments.
+static void* bc_options_set_ephemeral(void *options, void *cache, size_t write_buffer_size) {
+    ((BcOptions *)options)->segment_bytes = write_buffer_size;
+    return NULL;
+}
+static void bc_ephemeral_destroy(void *handle) {}
+
+// Values carry their expiration header; expired ones read as missing and
+// their segment is dropped once all of its values have expired.
+static void* bc_options_set_ttl_filter(void *options) {
+    ((BcOptions *)options)->ttl = 1;
+    return &bc_ttl_filter;
+}
+static void bc_ttl_filter_destroy(void *filter) {}
+
+static void bc_free(void *ptr) { free(ptr); }
+
+StorageEngine BITCASK_ENGINE = {
+    .type = ENGINE_BITCASK,
+    .open = bc_open,
+    .close = bc_close,
+    .options_create = bc_options_create,
+    .options_destroy = bc_options_destroy,
+    .options_set_create_if_missing = bc_options_set_create_if_missing,
+    .destroy_db = bc_destroy_db,
+    .readoptions_create = bc_readoptions_create,
+    .writeoptions_create = bc_writeoptions_create,
+    .readoptions_destroy = bc_readoptions_destroy,
+    .writeoptions_destroy = bc_writeoptions_destroy,
+    .put = bc_put,
+    .get = bc_get,
+    .del = bc_del,
+    .get_pinned = bc_get_pinned,
+    .pinned_destroy = bc_pinned_destroy,
+    .writebatch_create = bc_writebatch_create,
+    .writebatch_destroy = bc_writebatch_destroy,
+    .writebatch_put = bc_writebatch_put,
+    .writebatch_delete = bc_writebatch_delete,
+    .write = bc_write,
+    .multi_get = bc_multi_get,
+    .iter_create = bc_iter_create,
+    .iter_destroy = bc_iter_destroy,
+    .iter_valid = bc_iter_valid,
+    .iter_seek_to_first = bc_iter_seek_to_first,
+    .iter_seek_to_last = bc_iter_seek_to_last,
+    .iter_seek = bc_iter_seek,
+    .iter_next = bc_iter_next,
+    .iter_key = bc_iter_key,
+    .iter_value = bc_iter_value,
+    .iter_get_error = bc_iter_get_error,
+    .cache_create_lru = bc_cache_create_lru,
+    .options_set_cache = bc_options_set_cache,
+    .cache_destroy = bc_cache_destroy,
+    .options_set_write_buffer_size = bc_options_set_write_buffer_size,
+    .memory_usage = bc_memory_usage,
+    .stats_report = bc_stats_report,
+    .compact_range = bc_compact_range,
+    .options_set_ephemeral = bc_options_set_ephemeral,
+    .ephemeral_destroy = bc_ephemeral_destroy,
+    .options_set_ttl_filter = bc_options_set_ttl_filter,
+    .ttl_filter_destroy = bc_ttl_filter_destroy,
+    .free_fn = bc_free,
+    .supports_native_ttl = true,
+    .persistent = false,
+};
@@ -0,0 +1,140 @@
+#include "cache_log.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int cache_log_level = LOG_TRACE;
+int cache_log_async;
+
+// One slot of the ring. `seq` says whose turn it is: the producer claiming
+// position p waits for seq == p, publishes with seq = p + 1, and the consumer
+// hands the slot back for the next lap with seq = p + CACHE_LOG_RING_SLOTS.
+typedef struct LogRecord {
+    size_t seq;
+    int level;
+    int line;
+    const char *file;
+    char message[CACHE_LOG_MESSAGE_MAX];
+} LogRecord;
+
+typedef struct LogRing {
+    LogRecord *records;
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    size_t dropped;
+} LogRing;
+
+static LogRing ring;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned async_users;
+static pthread_t drain_thread;
+static int drain_stop;
+
+void cache_log_set_level(int level) {
+    __atomic_store_n(&cache_log_level, level, __ATOMIC_RELAXED);
+    log_set_level(level);
+}
+
+void cache_log_async_push(int level, const char *file, int line, const char *fmt, ...) {
+    size_t pos = __atomic_load_n(&ring.enqueue_pos, __ATOMIC_RELAXED);
+    LogRecord *record;
+    for (;;) {
+        record = &ring.records[pos & (CACHE_LOG_RING_SLOTS - 1)];
+        size_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring.enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_add_fetch(&ring.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&ring.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->level = level;
+    record->file = file;
+    record->line = line;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(record->message, sizeof(record->message), fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+// Single consumer. Returns the number of records written.
+static size_t drain(void) {
+    size_t written = 0;
+    for (;;) {
+        LogRecord *record = &ring.records[ring.dequeue_pos & (CACHE_LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != ring.dequeue_pos + 1) {
+            return written;
+        }
+        log_log(record->level, record->file, record->line, "%s", record->message);
+        __atomic_store_n(&record->seq, ring.dequeue_pos + CACHE_LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        ring.dequeue_pos++;
+        written++;
+    }
+}
+
+static void *drain_thread_function(void *arg) {
+    const struct timespec idle = { 0, 2 * 1000 * 1000 };
+    while (!__atomic_load_n(&drain_stop, __ATOMIC_ACQUIRE)) {
+        if (drain() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain();
+    return NULL;
+}
+
+int cache_log_async_acquire(void) {
+    pthread_mutex_lock(&async_lock);
+    if (async_users > 0) {
+        async_users++;
+        pthread_mutex_unlock(&async_lock);
+        return 0;
+    }
+    // The ring is kept once allocated: a producer that saw the async flag
+    // just before it was cleared may still be writing into it.
+    if (ring.records == NULL) {
+        ring.records = (LogRecord *) malloc(CACHE_LOG_RING_SLOTS * sizeof(LogRecord));
+        if (ring.records == NULL) {
+            pthread_mutex_unlock(&async_lock);
+            return -1;
+        }
+        for (size_t i = 0; i < CACHE_LOG_RING_SLOTS; i++) {
+            ring.records[i].seq = i;
+        }
+    }
+    drain_stop = 0;
+    if (pthread_create(&drain_thread, NULL, drain_thread_function, NULL) != 0) {
+        pthread_mutex_unlock(&async_lock);
+        return -1;
+    }
+    async_users = 1;
+    __atomic_store_n(&cache_log_async, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&async_lock);
+    return 0;
+}
+
+void cache_log_async_release(void) {
+    pthread_mutex_lock(&async_lock);
+    if (async_users == 0 || --async_users > 0) {
+        pthread_mutex_unlock(&async_lock);
+        return;
+    }
+    __atomic_store_n(&cache_log_async, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&drain_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(drain_thread, NULL);
+    pthread_mutex_unlock(&async_lock);
+}
+
+size_t cache_log_async_dropped(void) {
+    return __atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,152 @@
+#include "cache_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+__thread unsigned cache_stats_thread_stripe;
+static unsigned next_stripe;
+
+unsigned cache_stats_assign_stripe(void) {
+    cache_stats_thread_stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % CACHE_STATS_STRIPES + 1;
+    return cache_stats_thread_stripe;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Stripes are padded to whole cache lines so neighbours never share one.
+static uint64_t* alloc_lines(size_t count) {
+    size_t bytes = (count * sizeof(uint64_t) + 63) & ~(size_t)63;
+    void *ptr = NULL;
+    if (bytes == 0 || posix_memalign(&ptr, 64, bytes) != 0) {
+        return NULL;
+    }
+    memset(ptr, 0, bytes);
+    return (uint64_t *)ptr;
+}
+
+int cache_stats_init(CacheStats *stats, CacheStatsLevel level, unsigned num_counters, unsigned num_histograms) {
+    memset(stats, 0, sizeof(*stats));
+    stats->level = level;
+    stats->num_counters = num_counters;
+    stats->num_histograms = (level >= CACHE_STATS_TIMINGS) ? num_histograms : 0;
+    if (level == CACHE_STATS_OFF) {
+        return 0;
+    }
+    for (unsigned i = 0; i < CACHE_STATS_STRIPES; i++) {
+        stats->stripes[i].counters = alloc_lines(num_counters);
+        if (stats->stripes[i].counters == NULL) {
+            cache_stats_destroy(stats);
+            return -1;
+        }
+        if (stats->num_histograms > 0) {
+            stats->stripes[i].buckets = alloc_lines((size_t)stats->num_histograms * CACHE_STATS_BUCKETS);
+            if (stats->stripes[i].buckets == NULL) {
+                cache_stats_destroy(stats);
+                return -1;
+            }
+        }
+    }
+    stats->start_ticks = cache_stats_read_ticks();
+    stats->start_ns = monotonic_ns();
+    return 0;
+}
+
+void cache_stats_destroy(CacheStats *stats) {
+    for (unsigned i = 0; i < CACHE_STATS_STRIPES; i++) {
+        free(stats->stripes[i].counters);
+        free(stats->stripes[i].buckets);
+        stats->stripes[i].counters = NULL;
+        stats->stripes[i].buckets = NULL;
+    }
+    stats->level = CACHE_STATS_OFF;
+}
+
+size_t cache_stats_memory(const CacheStats *stats) {
+    if (stats->level == CACHE_STATS_OFF) {
+        return 0;
+    }
+    size_t per_stripe = (stats->num_counters * sizeof(uint64_t) + 63) & ~(size_t)63;
+    per_stripe += ((size_t)stats->num_histograms * CACHE_STATS_BUCKETS * sizeof(uint64_t) + 63) & ~(size_t)63;
+    return per_stripe * CACHE_STATS_STRIPES;
+}
+
+uint64_t cache_stats_counter(const CacheStats *stats, unsigned counter) {
+    if (stats->level == CACHE_STATS_OFF) {
+        return 0;
+    }
+    uint64_t total = 0;
+    for (unsigned i = 0; i < CACHE_STATS_STRIPES; i++) {
+        total += __atomic_load_n(&stats->stripes[i].counters[counter], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Smallest and largest tick counts that land in `bucket`.
+static uint64_t bucket_low(unsigned bucket) {
+    if (bucket < 2 * CACHE_STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = bucket / CACHE_STATS_SUB_BUCKETS - 1;
+    return (uint64_t)(bucket - shift * CACHE_STATS_SUB_BUCKETS) << shift;
+}
+
+static uint64_t bucket_high(unsigned bucket) {
+    if (bucket < 2 * CACHE_STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = bucket / CACHE_STATS_SUB_BUCKETS - 1;
+    return bucket_low(bucket) + ((uint64_t)1 << shift) - 1;
+}
+
+void cache_stats_summarize(const CacheStats *stats, unsigned histogram, CacheStatsSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (histogram >= stats->num_histograms) {
+        return;
+    }
+    uint64_t merged[CACHE_STATS_BUCKETS] = {0};
+    for (unsigned i = 0; i < CACHE_STATS_STRIPES; i++) {
+        const uint64_t *buckets = stats->stripes[i].buckets + (size_t)histogram * CACHE_STATS_BUCKETS;
+        for (unsigned b = 0; b < CACHE_STATS_BUCKETS; b++) {
+            merged[b] += __atomic_load_n(&buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+
+    // Ticks are converted with the rate observed since init.
+    uint64_t elapsed_ticks = cache_stats_read_ticks() - stats->start_ticks;
+    uint64_t elapsed_ns = monotonic_ns() - stats->start_ns;
+    double ns_per_tick = (elapsed_ticks > 0) ? (double)elapsed_ns / (double)elapsed_ticks : 1.0;
+
+    double sum = 0;
+    int have_min = 0;
+    for (unsigned b = 0; b < CACHE_STATS_BUCKETS; b++) {
+        if (merged[b] == 0) {
+            continue;
+        }
+        if (!have_min) {
+            summary->min_ns = (uint64_t)(bucket_low(b) * ns_per_tick);
+            have_min = 1;
+        }
+        summary->max_ns = (uint64_t)(bucket_high(b) * ns_per_tick);
+        summary->count += merged[b];
+        sum += (double)merged[b] * (bucket_low(b) + bucket_high(b)) / 2;
+    }
+    if (summary->count == 0) {
+        return;
+    }
+    summary->mean_ns = (uint64_t)(sum / summary->count * ns_per_tick);
+
+    const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t *outputs[] = { &summary->p50_ns, &summary->p90_ns, &summary->p99_ns, &summary->p999_ns };
+    uint64_t seen = 0;
+    unsigned q = 0;
+    for (unsigned b = 0; b < CACHE_STATS_BUCKETS && q < 4; b++) {
+        seen += merged[b];
+        while (q < 4 && seen > 0 && seen >= (uint64_t)(quantiles[q] * summary->count + 0.5)) {
+            *outputs[q++] = (uint64_t)(bucket_high(b) * ns_per_tick);
+        }
+    }
+}
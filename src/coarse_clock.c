@@ -0,0 +1,136 @@
+#include "coarse_clock.h"
+#include <pthread.h>
+
+uint64_t coarse_clock_seconds;
+int64_t coarse_clock_offset;
+
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clock_cond = PTHREAD_COND_INITIALIZER;
+static CoarseClockSource clock_source = COARSE_CLOCK_TICKER;
+static unsigned clock_users;
+static pthread_t ticker_thread;
+static int ticker_running;
+// Bumped whenever a ticker is started or stopped; a ticker exits as soon as
+// it no longer matches the generation it was started with.
+static uintptr_t ticker_generation;
+
+static uint64_t wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+// Brings the published state in line with the source. Called with clock_lock
+// held.
+static void publish_locked(void) {
+    if (clock_source == COARSE_CLOCK_TICKER) {
+        __atomic_store_n(&coarse_clock_seconds, wall_seconds(), __ATOMIC_RELAXED);
+    } else if (clock_source == COARSE_CLOCK_MONOTONIC) {
+        struct timespec mono;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &mono);
+        __atomic_store_n(&coarse_clock_offset, (int64_t)wall_seconds() - (int64_t)mono.tv_sec, __ATOMIC_RELAXED);
+        __atomic_store_n(&coarse_clock_seconds, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void *ticker_function(void *arg) {
+    uintptr_t generation = (uintptr_t)arg;
+    pthread_mutex_lock(&clock_lock);
+    while (ticker_generation == generation) {
+        publish_locked();
+        // Wake on the next second boundary, so the cached value is never
+        // more than a scheduling delay behind.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        deadline.tv_nsec = 0;
+        pthread_cond_timedwait(&clock_cond, &clock_lock, &deadline);
+    }
+    pthread_mutex_unlock(&clock_lock);
+    return NULL;
+}
+
+// Starts or stops the ticker to match the users and the source. Returns 1
+// with `*stopped` set when a ticker was stopped and has to be joined once
+// clock_lock is dropped.
+static int sync_ticker_locked(pthread_t *stopped) {
+    int wanted = clock_users > 0 && clock_source == COARSE_CLOCK_TICKER;
+    if (wanted && !ticker_running) {
+        uintptr_t generation = ++ticker_generation;
+        if (pthread_create(&ticker_thread, NULL, ticker_function, (void *)generation) == 0) {
+            ticker_running = 1;
+        } else {
+            clock_source = COARSE_CLOCK_MONOTONIC;
+            publish_locked();
+        }
+    } else if (!wanted && ticker_running) {
+        ticker_generation++;
+        ticker_running = 0;
+        pthread_cond_signal(&clock_cond);
+        *stopped = ticker_thread;
+        return 1;
+    }
+    return 0;
+}
+
+static void unlock_and_sync(void) {
+    pthread_t stopped;
+    int join = sync_ticker_locked(&stopped);
+    pthread_mutex_unlock(&clock_lock);
+    if (join) {
+        pthread_join(stopped, NULL);
+    }
+}
+
+// Freezes the clock at its current reading. Called with clock_lock held.
+static void freeze_locked(void) {
+    if (clock_source != COARSE_CLOCK_MANUAL) {
+        __atomic_store_n(&coarse_clock_seconds, coarse_clock_now(), __ATOMIC_RELAXED);
+        clock_source = COARSE_CLOCK_MANUAL;
+    }
+}
+
+void coarse_clock_acquire(CoarseClockSource source) {
+    pthread_mutex_lock(&clock_lock);
+    if (clock_users++ == 0 && clock_source != COARSE_CLOCK_MANUAL) {
+        clock_source = source;
+        if (source == COARSE_CLOCK_MANUAL) {
+            __atomic_store_n(&coarse_clock_seconds, wall_seconds(), __ATOMIC_RELAXED);
+        }
+        publish_locked();
+    }
+    unlock_and_sync();
+}
+
+void coarse_clock_release(void) {
+    pthread_mutex_lock(&clock_lock);
+    if (clock_users > 0) {
+        clock_users--;
+    }
+    unlock_and_sync();
+}
+
+void coarse_clock_set_source(CoarseClockSource source) {
+    pthread_mutex_lock(&clock_lock);
+    if (source == COARSE_CLOCK_MANUAL) {
+        freeze_locked();
+    } else {
+        clock_source = source;
+        publish_locked();
+    }
+    unlock_and_sync();
+}
+
+void coarse_clock_set(uint64_t seconds) {
+    pthread_mutex_lock(&clock_lock);
+    clock_source = COARSE_CLOCK_MANUAL;
+    __atomic_store_n(&coarse_clock_seconds, seconds, __ATOMIC_RELAXED);
+    unlock_and_sync();
+}
+
+void coarse_clock_advance(uint64_t seconds) {
+    pthread_mutex_lock(&clock_lock);
+    freeze_locked();
+    __atomic_add_fetch(&coarse_clock_seconds, seconds, __ATOMIC_RELAXED);
+    unlock_and_sync();
+}
@@ -0,0 +1,102 @@
+#include "frequency_sketch.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX_COUNT 15
+#define SKETCH_MIN_COUNTERS 1024
+#define SKETCH_RESET_FACTOR 10                   // increments per tracked key between halvings
+#define SKETCH_HALVE_MASK 0x7777777777777777ull  // clears the bit shifted in from the next counter
+
+static const uint64_t SKETCH_SEEDS[SKETCH_DEPTH] = {
+    0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full, 0xcbf29ce484222325ull
+};
+
+// Each row takes its counter from a differently seeded mix of the key hash,
+// so keys that collide in one row rarely collide in the others.
+static inline uint64_t counter_index(const FrequencySketch *sketch, uint64_t hash, int row) {
+    uint64_t x = (hash + SKETCH_SEEDS[row]) * SKETCH_SEEDS[row];
+    x ^= x >> 32;
+    return x & sketch->mask;
+}
+
+static inline uint32_t counter_get(const FrequencySketch *sketch, uint64_t index) {
+    uint64_t word = __atomic_load_n(&sketch->table[index >> 4], __ATOMIC_RELAXED);
+    return (uint32_t)((word >> ((index & 15) << 2)) & SKETCH_MAX_COUNT);
+}
+
+// Returns 1 if the counter was below its maximum and has been incremented.
+static int counter_increment(FrequencySketch *sketch, uint64_t index) {
+    uint64_t *slot = &sketch->table[index >> 4];
+    unsigned shift = (unsigned)(index & 15) << 2;
+    uint64_t word = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    do {
+        if (((word >> shift) & SKETCH_MAX_COUNT) == SKETCH_MAX_COUNT) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(slot, &word, word + (1ull << shift), 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+// Halves every counter. Only one thread runs it; the others keep counting.
+static void sketch_halve(FrequencySketch *sketch) {
+    if (__atomic_exchange_n(&sketch->resetting, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    size_t words = (sketch->mask + 1) >> 4;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word = __atomic_load_n(&sketch->table[i], __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&sketch->table[i], &word, (word >> 1) & SKETCH_HALVE_MASK, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    __atomic_store_n(&sketch->additions, sketch->sample_size / 2, __ATOMIC_RELAXED);
+    __atomic_store_n(&sketch->resetting, 0, __ATOMIC_RELEASE);
+}
+
+int sketch_init(FrequencySketch *sketch, size_t keys) {
+    memset(sketch, 0, sizeof(*sketch));
+    // Four counters per tracked key, as the sketch has four rows.
+    size_t counters = SKETCH_MIN_COUNTERS;
+    while (counters < keys * SKETCH_DEPTH) {
+        counters <<= 1;
+    }
+    sketch->table = (uint64_t *) calloc(counters >> 4, sizeof(uint64_t));
+    if (sketch->table == NULL) {
+        return -1;
+    }
+    sketch->mask = counters - 1;
+    sketch->sample_size = (uint64_t)(counters / SKETCH_DEPTH) * SKETCH_RESET_FACTOR;
+    return 0;
+}
+
+void sketch_destroy(FrequencySketch *sketch) {
+    free(sketch->table);
+    sketch->table = NULL;
+}
+
+void sketch_increment(FrequencySketch *sketch, uint64_t hash) {
+    int added = 0;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        added |= counter_increment(sketch, counter_index(sketch, hash, row));
+    }
+    if (added && __atomic_add_fetch(&sketch->additions, 1, __ATOMIC_RELAXED) >= sketch->sample_size) {
+        sketch_halve(sketch);
+    }
+}
+
+uint32_t sketch_estimate(const FrequencySketch *sketch, uint64_t hash) {
+    uint32_t estimate = SKETCH_MAX_COUNT;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        uint32_t count = counter_get(sketch, counter_index(sketch, hash, row));
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+size_t sketch_memory(const FrequencySketch *sketch) {
+    return ((sketch->mask + 1) >> 4) * sizeof(uint64_t);
+}
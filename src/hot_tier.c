@@ -0,0 +1,185 @@
+#include "hot_tier.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline HotShard* hot_shard_for(HotTier *tier, uint64_t hash) {
+    // Same high-bit partitioning as the index, so a key maps to matching shards.
+    return &tier->shards[tier->num_shards > 1 ? hash >> tier->shard_shift : 0];
+}
+
+static inline size_t entry_bytes(const HotEntry *entry) {
+    return sizeof(HotEntry) + entry->key_len + entry->value_len;
+}
+
+void hot_entry_release(HotEntry *entry) {
+    if (__atomic_sub_fetch(&entry->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(entry);
+    }
+}
+
+static void clock_link(HotShard *shard, HotEntry *entry) {
+    if (shard->hand == NULL) {
+        entry->clock_prev = entry;
+        entry->clock_next = entry;
+        shard->hand = entry;
+        return;
+    }
+    // Insert just behind the hand so a new entry gets a full sweep before
+    // it is considered for eviction.
+    HotEntry *tail = shard->hand->clock_prev;
+    entry->clock_prev = tail;
+    entry->clock_next = shard->hand;
+    tail->clock_next = entry;
+    shard->hand->clock_prev = entry;
+}
+
+static void detach(HotShard *shard, HotEntry *entry) {
+    HASH_DEL(shard->table, entry);
+    if (entry->clock_next == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if (shard->hand == entry) {
+            shard->hand = entry->clock_next;
+        }
+    }
+    __atomic_sub_fetch(&shard->bytes, entry_bytes(entry), __ATOMIC_RELAXED);
+    hot_entry_release(entry);
+}
+
+// CLOCK: referenced entries get a second chance, the first unreferenced one
+// under the hand is evicted.
+static void evict_until_fits(HotShard *shard, size_t needed) {
+    while (shard->hand != NULL && shard->bytes + needed > shard->capacity) {
+        HotEntry *candidate = shard->hand;
+        if (__atomic_load_n(&candidate->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&candidate->referenced, 0, __ATOMIC_RELAXED);
+            shard->hand = candidate->clock_next;
+        } else {
+            detach(shard, candidate);
+        }
+    }
+}
+
+HotTier* hot_tier_create(size_t capacity_bytes, uint32_t num_shards) {
+    HotTier *tier = (HotTier *) malloc(sizeof(HotTier));
+    if (tier == NULL) {
+        return NULL;
+    }
+    if (posix_memalign((void **)&tier->shards, 64, num_shards * sizeof(HotShard)) != 0) {
+        free(tier);
+        return NULL;
+    }
+    tier->num_shards = num_shards;
+    tier->shard_shift = 64 - __builtin_ctz(num_shards);
+    size_t per_shard = capacity_bytes / num_shards;
+    // A single value may not take more than a quarter of its shard.
+    tier->max_entry_bytes = per_shard / 4;
+    for (uint32_t i = 0; i < num_shards; i++) {
+        HotShard *shard = &tier->shards[i];
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->table = NULL;
+        shard->hand = NULL;
+        shard->bytes = 0;
+        shard->capacity = per_shard;
+        shard->generation = 0;
+    }
+    return tier;
+}
+
+void hot_tier_destroy(HotTier *tier) {
+    if (tier == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < tier->num_shards; i++) {
+        HotShard *shard = &tier->shards[i];
+        while (shard->hand != NULL) {
+            detach(shard, shard->hand);
+        }
+        pthread_rwlock_destroy(&shard->lock);
+    }
+    free(tier->shards);
+    free(tier);
+}
+
+HotEntry* hot_tier_lookup(HotTier *tier, const char *key, size_t key_len, uint64_t hash, uint64_t now) {
+    HotShard *shard = hot_shard_for(tier, hash);
+    HotEntry *entry;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    HASH_FIND_BYHASHVALUE(hh, shard->table, key, key_len, (unsigned)hash, entry);
+    if (entry != NULL) {
+        if (entry->expiration > 0 && now > entry->expiration) {
+            entry = NULL;
+        } else {
+            __atomic_add_fetch(&entry->refcnt, 1, __ATOMIC_RELAXED);
+            if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return entry;
+}
+
+size_t hot_tier_usage(HotTier *tier) {
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < tier->num_shards; i++) {
+        bytes += __atomic_load_n(&tier->shards[i].bytes, __ATOMIC_RELAXED);
+    }
+    return bytes;
+}
+
+uint64_t hot_tier_generation(HotTier *tier, uint64_t hash) {
+    return __atomic_load_n(&hot_shard_for(tier, hash)->generation, __ATOMIC_ACQUIRE);
+}
+
+void hot_tier_insert(HotTier *tier, const char *key, size_t key_len, uint64_t hash,
+                     const char *value, size_t value_len, uint64_t expiration, uint64_t generation) {
+    size_t bytes = sizeof(HotEntry) + key_len + value_len;
+    if (bytes > tier->max_entry_bytes) {
+        return;
+    }
+    HotEntry *entry = (HotEntry *) malloc(bytes);
+    if (entry == NULL) {
+        return;
+    }
+    entry->refcnt = 1;
+    entry->referenced = 0;
+    entry->expiration = expiration;
+    entry->key_len = key_len;
+    entry->value_len = value_len;
+    memcpy(entry->data, key, key_len);
+    memcpy(entry->data + key_len, value, value_len);
+
+    HotShard *shard = hot_shard_for(tier, hash);
+    pthread_rwlock_wrlock(&shard->lock);
+    if (shard->generation != generation) {
+        pthread_rwlock_unlock(&shard->lock);
+        free(entry);
+        return;
+    }
+    HotEntry *existing;
+    HASH_FIND_BYHASHVALUE(hh, shard->table, key, key_len, (unsigned)hash, existing);
+    if (existing != NULL) {
+        detach(shard, existing);
+    }
+    evict_until_fits(shard, bytes);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, shard->table, entry->data, key_len, (unsigned)hash, entry);
+    clock_link(shard, entry);
+    __atomic_add_fetch(&shard->bytes, bytes, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+void hot_tier_invalidate(HotTier *tier, const char *key, size_t key_len, uint64_t hash) {
+    HotShard *shard = hot_shard_for(tier, hash);
+    pthread_rwlock_wrlock(&shard->lock);
+    __atomic_add_fetch(&shard->generation, 1, __ATOMIC_RELEASE);
+    HotEntry *entry;
+    HASH_FIND_BYHASHVALUE(hh, shard->table, key, key_len, (unsigned)hash, entry);
+    if (entry != NULL) {
+        detach(shard, entry);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
@@ -0,0 +1,313 @@
+#include "key_index.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Full slots have the high bit set and hold a 7-bit fingerprint. Empty is
+// zero, so a freshly calloc'ed table needs no initialising pass and its pages
+// are only faulted in as they are used.
+#define CTRL_EMPTY ((uint8_t)0x00)
+#define CTRL_DELETED ((uint8_t)0x01)
+#define CTRL_FULL ((uint8_t)0x80)
+
+// A table is grown once live and deleted slots reach 7/8 of its capacity.
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+static inline uint8_t h2(uint64_t hash) { return CTRL_FULL | (uint8_t)(hash & 0x7F); }
+static inline uint64_t h1(uint64_t hash) { return hash >> 7; }
+
+// Bitmasks with bit i set when control byte i of the group matches.
+#ifdef __SSE2__
+static inline uint32_t group_match(const uint8_t *group, uint8_t tag) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+// Empty and deleted are the only control bytes without the high bit.
+static inline uint32_t group_match_free(const uint8_t *group) {
+    return ~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group)) & 0xFFFF;
+}
+#else
+static inline uint32_t group_match(const uint8_t *group, uint8_t tag) {
+    uint32_t mask = 0;
+    for (int i = 0; i < KI_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+}
+static inline uint32_t group_match_free(const uint8_t *group) {
+    uint32_t mask = 0;
+    for (int i = 0; i < KI_GROUP_SIZE; i++) {
+        mask |= (uint32_t)!(group[i] & CTRL_FULL) << i;
+    }
+    return mask;
+}
+#endif
+
+// MurmurHash64A.
+uint64_t ki_hash(const void *key, size_t key_len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *data = (const unsigned char *)key;
+    uint64_t h = 0x9747b28c ^ (key_len * m);
+
+    size_t blocks = key_len / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k;
+        memcpy(&k, data + i * 8, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const unsigned char *tail = data + blocks * 8;
+    switch (key_len & 7) {
+        case 7: h ^= (uint64_t)tail[6] << 48; // fall through
+        case 6: h ^= (uint64_t)tail[5] << 40; // fall through
+        case 5: h ^= (uint64_t)tail[4] << 32; // fall through
+        case 4: h ^= (uint64_t)tail[3] << 24; // fall through
+        case 3: h ^= (uint64_t)tail[2] << 16; // fall through
+        case 2: h ^= (uint64_t)tail[1] << 8;  // fall through
+        case 1: h ^= (uint64_t)tail[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static int table_alloc(KeyIndexTable *table, size_t capacity) {
+    table->ctrl = (uint8_t *) calloc(capacity, 1);
+    table->slots = (KeyIndexNode **) malloc(capacity * sizeof(KeyIndexNode *));
+    if (table->ctrl == NULL || table->slots == NULL) {
+        free(table->ctrl);
+        free(table->slots);
+        return -1;
+    }
+    table->capacity = capacity;
+    table->size = 0;
+    table->tombstones = 0;
+    return 0;
+}
+
+static void table_free(KeyIndexTable *table) {
+    free(table->ctrl);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+// Probes group by group along a triangular sequence, which visits every group
+// once when the group count is a power of two.
+#define PROBE_BEGIN(table, hash, group_var)                                   \
+    size_t _gmask = (table)->capacity / KI_GROUP_SIZE - 1;                    \
+    size_t group_var = h1(hash) & _gmask;                                     \
+    for (size_t _step = 1; _step <= _gmask + 1; group_var = (group_var + _step++) & _gmask)
+
+static KeyIndexNode* table_find(const KeyIndexTable *table, const char *key, size_t key_len, uint64_t hash) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    uint8_t tag = h2(hash);
+    PROBE_BEGIN(table, hash, g) {
+        const uint8_t *group = table->ctrl + g * KI_GROUP_SIZE;
+        for (uint32_t mask = group_match(group, tag); mask != 0; mask &= mask - 1) {
+            KeyIndexNode *node = table->slots[g * KI_GROUP_SIZE + __builtin_ctz(mask)];
+            if (node->hash == hash && node->key_len == key_len &&
+                memcmp(ki_node_key(node), key, key_len) == 0) {
+                return node;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// The table must have a free slot.
+static void table_insert(KeyIndexTable *table, KeyIndexNode *node) {
+    PROBE_BEGIN(table, node->hash, g) {
+        uint8_t *group = table->ctrl + g * KI_GROUP_SIZE;
+        uint32_t mask = group_match_free(group);
+        if (mask != 0) {
+            size_t idx = g * KI_GROUP_SIZE + __builtin_ctz(mask);
+            if (table->ctrl[idx] == CTRL_DELETED) {
+                table->tombstones--;
+            }
+            table->ctrl[idx] = h2(node->hash);
+            table->slots[idx] = node;
+            table->size++;
+            return;
+        }
+    }
+}
+
+static int table_erase(KeyIndexTable *table, KeyIndexNode *node) {
+    if (table->capacity == 0) {
+        return 0;
+    }
+    PROBE_BEGIN(table, node->hash, g) {
+        uint8_t *group = table->ctrl + g * KI_GROUP_SIZE;
+        for (uint32_t mask = group_match(group, h2(node->hash)); mask != 0; mask &= mask - 1) {
+            size_t idx = g * KI_GROUP_SIZE + __builtin_ctz(mask);
+            if (table->slots[idx] != node) {
+                continue;
+            }
+            // A group that still has an empty slot has never been full, so
+            // no probe sequence continues past it and the slot can be
+            // emptied instead of leaving a tombstone.
+            if (group_match(group, CTRL_EMPTY) != 0) {
+                table->ctrl[idx] = CTRL_EMPTY;
+            } else {
+                table->ctrl[idx] = CTRL_DELETED;
+                table->tombstones++;
+            }
+            table->slots[idx] = NULL;
+            table->size--;
+            return 1;
+        }
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+void ki_init(KeyIndex *index) {
+    memset(index, 0, sizeof(*index));
+}
+
+void ki_destroy(KeyIndex *index) {
+    table_free(&index->cur);
+    table_free(&index->old);
+    index->migrate_pos = 0;
+}
+
+// Moves one group of the old table into the current one. Each moved slot is
+// cleared from the old table, so finds, erases and iteration see a node in
+// one table only. It becomes a tombstone rather than empty: probes of keys
+// still waiting in later groups may pass through this one.
+static void migrate_step(KeyIndex *index) {
+    KeyIndexTable *old = &index->old;
+    if (old->capacity == 0) {
+        return;
+    }
+    size_t base = index->migrate_pos * KI_GROUP_SIZE;
+    for (size_t i = base; i < base + KI_GROUP_SIZE; i++) {
+        if (old->ctrl[i] & CTRL_FULL) {
+            table_insert(&index->cur, old->slots[i]);
+            old->ctrl[i] = CTRL_DELETED;
+            old->slots[i] = NULL;
+            old->size--;
+            old->tombstones++;
+        }
+    }
+    index->migrate_pos++;
+    if (index->migrate_pos == old->capacity / KI_GROUP_SIZE) {
+        table_free(old);
+        index->migrate_pos = 0;
+    }
+}
+
+static inline int at_max_load(const KeyIndexTable *table) {
+    return (table->size + table->tombstones + 1) * MAX_LOAD_DEN > table->capacity * MAX_LOAD_NUM;
+}
+
+// Swaps in a fresh table. It doubles unless most of the load is tombstones,
+// in which case a table of the same size is enough. Either way the old table
+// drains, one group per write, well before the new one fills up.
+static int start_resize(KeyIndex *index) {
+    KeyIndexTable *cur = &index->cur;
+    size_t capacity = KI_GROUP_SIZE;
+    if (cur->capacity > 0) {
+        capacity = (cur->size * 2 * MAX_LOAD_DEN > cur->capacity * MAX_LOAD_NUM) ? cur->capacity * 2 : cur->capacity;
+    }
+    KeyIndexTable fresh;
+    if (table_alloc(&fresh, capacity) != 0) {
+        return -1;
+    }
+    if (cur->capacity > 0) {
+        index->old = *cur;
+        index->migrate_pos = 0;
+    }
+    *cur = fresh;
+    return 0;
+}
+
+int ki_insert(KeyIndex *index, KeyIndexNode *node) {
+    migrate_step(index);
+    if (index->cur.capacity == 0 || at_max_load(&index->cur)) {
+        // Only reachable mid-migration if writes outpaced it; finish first.
+        while (index->old.capacity != 0) {
+            migrate_step(index);
+        }
+        if (start_resize(index) != 0 &&
+            (index->cur.capacity == 0 || index->cur.size + index->cur.tombstones >= index->cur.capacity)) {
+            return -1;
+        }
+        migrate_step(index);
+    }
+    table_insert(&index->cur, node);
+    return 0;
+}
+
+void ki_erase(KeyIndex *index, KeyIndexNode *node) {
+    if (!table_erase(&index->cur, node)) {
+        table_erase(&index->old, node);
+    }
+    migrate_step(index);
+}
+
+KeyIndexNode* ki_find(const KeyIndex *index, const char *key, size_t key_len, uint64_t hash) {
+    KeyIndexNode *node = table_find(&index->cur, key, key_len, hash);
+    if (node == NULL && index->old.capacity != 0) {
+        node = table_find(&index->old, key, key_len, hash);
+    }
+    return node;
+}
+
+size_t ki_memory(const KeyIndex *index) {
+    return (index->cur.capacity + index->old.capacity) * (1 + sizeof(KeyIndexNode *));
+}
+
+KeyIndexNode* ki_iter_next(const KeyIndex *index, size_t *cursor) {
+    while (*cursor < index->cur.capacity + index->old.capacity) {
+        size_t i = (*cursor)++;
+        const KeyIndexTable *table = &index->cur;
+        if (i >= table->capacity) {
+            i -= table->capacity;
+            table = &index->old;
+        }
+        if (table->ctrl[i] & CTRL_FULL) {
+            return table->slots[i];
+        }
+    }
+    return NULL;
+}
+
+size_t ki_sample(const KeyIndex *index, uint64_t seed, KeyIndexNode **out, size_t count) {
+    size_t slots = index->cur.capacity + index->old.capacity;
+    size_t found = 0;
+    if (slots == 0) {
+        return 0;
+    }
+    size_t start = (size_t)((seed * 0x9e3779b97f4a7c15ull) >> 20) % slots;
+    for (size_t n = 0; n < slots && found < count; n++) {
+        size_t i = (start + n) % slots;
+        const KeyIndexTable *table = &index->cur;
+        if (i >= table->capacity) {
+            i -= table->capacity;
+            table = &index->old;
+        }
+        if (table->ctrl[i] & CTRL_FULL) {
+            out[found++] = table->slots[i];
+        }
+    }
+    return found;
+}
@@ -1,278 +1,2561 @@
 #include "levelcache.h"
+#include "value_format.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <stdint.h>
 #include <time.h>
 #include <pthread.h>
 #include <unistd.h>
-#include "uthash.h"
-#include "log.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include "cache_log.h"
 
 #define DEFAULT_TTL_SEC (24 * 60 * 60) // 1 day
+#define DEFAULT_CLEANUP_FREQUENCY_SEC 60
+#define BLOCK_CACHE_SHARE 2           // the block cache gets 1/2 of the memory budget
+#define WRITE_BUFFER_SHARE 8          // each memtable gets 1/8 of it
+#define EVICTION_CHECK_INTERVAL 1024  // writes between two budget checks
+#define EPHEMERAL_WRITE_BUFFER (64 << 20) // memtable size of the ephemeral profile without a budget
+#define SWEEP_KEYS_PER_CYCLE 65536    // keys an index-less cleanup cycle checks for expiry
+#define SCAN_READAHEAD (2 << 20)      // bytes a scan reads ahead where the engine supports it
+#define DELETE_RANGE_CHUNK 16384      // keys a range delete removes per hold of the shard locks
+#define CODEC_DEFAULT_MIN_BYTES 128   // shorter values gain little from compression
+#define CODEC_DEFAULT_LEVEL 3
+#define CODEC_DEFAULT_DICT_BYTES (16 << 10)
+#define CODEC_DICT_FILE "LEVELCACHE.zdict" // the trained dictionary, next to the engine's files
+#define ADMISSION_BYTES_PER_KEY 64    // budget bytes per key the admission sketch is sized for
+#define ADMISSION_VICTIM_SAMPLES 8    // keys of its shard a new key is compared against
+#define LOAD_TIME_WEIGHT 8            // loads the moving average of load times roughly spans
+
+const char* engine_names[LIMIT] = { "leveldb", "rocksdb", "memory", "bitcask" };
+
+StorageEngine* ALL_ENGINES[LIMIT] = {
+    &LEVELDB_ENGINE,
+    &ROCKSDB_ENGINE,
+    &MEMORY_ENGINE,
+    &BITCASK_ENGINE
+};
+
+// Counters kept in cache->stats. Histograms follow them, one per operation
+// and phase, indexed by stat_histogram().
+enum {
+    STAT_HITS = 0,
+    STAT_MISSES,
+    STAT_HOT_TIER_HITS,
+    STAT_EXPIRED_ON_READ,
+    STAT_CLEANUP_DELETIONS,
+    STAT_ENGINE_ERRORS,
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_BYTES_STORED,
+    STAT_ADMITTED,
+    STAT_REJECTED,
+    STAT_LOADS,
+    STAT_COALESCED_LOADS,
+    STAT_EARLY_REFRESHES,
+    STAT_COUNT
+};
+
+static inline void stat_add(LevelCache *cache, unsigned counter, uint64_t n) {
+    cache_stats_add(&cache->stats, counter, n);
+}
+
+static inline unsigned stat_histogram(LevelCacheOp op, LevelCachePhase phase) {
+    return (unsigned)op * LEVELCACHE_PHASE_COUNT + (unsigned)phase;
+}
+
+static inline void stat_time(LevelCache *cache, LevelCacheOp op, LevelCachePhase phase, uint64_t start, uint64_t end) {
+    cache_stats_record(&cache->stats, stat_histogram(op, phase), start, end);
+}
+
+static inline void memory_add(LevelCache *cache, size_t bytes) {
+    __atomic_add_fetch(&cache->total_memory_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static inline void memory_sub(LevelCache *cache, size_t bytes) {
+    __atomic_sub_fetch(&cache->total_memory_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// The shard is picked from the high bits of the hash; the index probes with
+// the low bits, so the two stay independent.
+static inline uint32_t shard_index(uint64_t hash) {
+    return (uint32_t)(hash >> (64 - LEVELCACHE_SHARD_BITS));
+}
+
+static inline IndexShard* shard_for(LevelCache *cache, uint64_t hash) {
+    return &cache->shards[shard_index(hash)];
+}
+
+_Static_assert(offsetof(KeyMetadata, key) == offsetof(KeyMetadata, node) + sizeof(KeyIndexNode),
+               "the index expects keys to follow their node");
+
+#define meta_from_node(n) \
+    ((KeyMetadata *)((char *)(n) - offsetof(KeyMetadata, node)))
+
+static inline KeyMetadata* meta_find(IndexShard *shard, const char *key, size_t key_len, uint64_t hash) {
+    KeyIndexNode *node = ki_find(&shard->index, key, key_len, hash);
+    return node ? meta_from_node(node) : NULL;
+}
+
+static inline size_t meta_alloc_size(size_t key_len) {
+    return sizeof(KeyMetadata) + key_len + 1;
+}
+
+static inline size_t meta_size(const KeyMetadata *meta) {
+    return slab_object_size(meta_alloc_size(meta->node.key_len));
+}
+
+// Metadata lives in the shard's slab with the key stored inline, so must be
+// created and freed under the shard write lock. Keys may contain NUL bytes;
+// the copy is still NUL-terminated for logging.
+static KeyMetadata* meta_create(IndexShard *shard, const char *key, size_t key_len, uint64_t hash) {
+    if (key_len > UINT32_MAX) {
+        return NULL;
+    }
+    KeyMetadata *meta = (KeyMetadata *) slab_alloc(&shard->slab, meta_alloc_size(key_len));
+    if (meta == NULL) {
+        return NULL;
+    }
+    memcpy(meta->key, key, key_len);
+    meta->key[key_len] = '\0';
+    meta->node.hash = hash;
+    meta->node.key_len = (uint32_t)key_len;
+    meta->expiration = 0;
+    meta->timer.next = NULL;
+    meta->timer.pprev = NULL;
+    return meta;
+}
+
+static void meta_free(IndexShard *shard, KeyMetadata *meta) {
+    slab_free(&shard->slab, meta, meta_alloc_size(meta->node.key_len));
+}
+
+// Called after every engine write or delete, with the shard write lock held.
+static inline void hot_invalidate(LevelCache *cache, const char *key, size_t key_len, uint64_t hash) {
+    if (cache->hot != NULL) {
+        hot_tier_invalidate(cache->hot, key, key_len, hash);
+    }
+}
+
+// With native TTL or warm restarts every stored value carries its expiration
+// in front of it, followed by the codec byte and payload when a codec is set.
+// Small values are framed in place, larger ones on the heap.
+typedef struct FramedValue {
+    const char *data;
+    size_t len;
+    char *heap;
+    char inline_buf[256];
+} FramedValue;
+
+static int frame_value(LevelCache *cache, FramedValue *framed, const char *value, size_t value_len, uint64_t expiration) {
+    framed->heap = NULL;
+    if (!cache->value_header && cache->codec == NULL) {
+        framed->data = value;
+        framed->len = value_len;
+        return 0;
+    }
+    size_t header = cache->value_header ? VALUE_HEADER_SIZE : 0;
+    size_t capacity = header + ((cache->codec != NULL) ? value_codec_bound(value_len) : value_len);
+    char *buf = framed->inline_buf;
+    if (capacity > sizeof(framed->inline_buf)) {
+        buf = framed->heap = (char *) malloc(capacity);
+        if (buf == NULL) {
+            return -1;
+        }
+    }
+    if (header > 0) {
+        value_header_encode(buf, expiration);
+    }
+    if (cache->codec != NULL) {
+        framed->len = header + value_codec_encode(cache->codec, buf + header, value, value_len);
+    } else {
+        memcpy(buf + header, value, value_len);
+        framed->len = header + value_len;
+    }
+    framed->data = buf;
+    return 0;
+}
+
+static inline void framed_release(FramedValue *framed) {
+    free(framed->heap);
+}
+
+// Strips the header off a stored value in place. Returns 0 if the value has
+// expired or is malformed.
+static inline int unframe_value(LevelCache *cache, const char **data, size_t *len) {
+    if (!cache->value_header) {
+        return 1;
+    }
+    if (value_is_expired(*data, *len, coarse_clock_now())) {
+        return 0;
+    }
+    *data += VALUE_HEADER_SIZE;
+    *len -= VALUE_HEADER_SIZE;
+    return 1;
+}
+
+// Decodes an unframed value. A compressed value comes back in `*owned`, which
+// the caller frees; others are left in place. Returns -1 if it cannot be
+// decoded.
+static inline int decode_value(LevelCache *cache, const char **data, size_t *len, char **owned) {
+    *owned = NULL;
+    if (cache->codec == NULL) {
+        return 0;
+    }
+    return value_codec_decode(cache->codec, *data, *len, data, len, owned);
+}
+
+#define meta_from_timer(node) \
+    ((KeyMetadata *)((char *)(node) - offsetof(KeyMetadata, timer)))
+
+// Eviction brings usage down to this much of the budget.
+static inline size_t budget_low_watermark(size_t limit) {
+    return limit - limit / 10;
+}
+
+// Only gets count as uses, misses included: a key loaded after a miss has
+// been asked for once, not twice, and keys that are written but never read
+// gain nothing from being cached.
+static inline void admission_record(LevelCache *cache, uint64_t hash) {
+    if (cache->admission != NULL) {
+        sketch_increment(cache->admission, hash);
+    }
+}
+
+// Once usage has reached the eviction low watermark, a new key is only let
+// in if it has been used more often lately than the least used of a few keys
+// sampled from its shard (TinyLFU with a sampled victim). The sample starts
+// at a slot of the shard's index picked from the new key's hash, so it is
+// spread over the shard rather than biased to recent or soon expiring keys.
+// With `replace` the victim is evicted in the new key's place, so the cache
+// keeps turning over towards frequently used keys instead of waiting for the
+// budget check. Batches pass 0, as the victim could be one of their own
+// keys. Called with the shard write lock held. Returns 1 if the key may be
+// inserted.
+static int admit_new_key(LevelCache *cache, IndexShard *shard, uint64_t hash, int replace) {
+    if (cache->admission == NULL) {
+        return 1;
+    }
+    size_t limit = cache->max_memory_mb * 1024 * 1024;
+    if (__atomic_load_n(&cache->used_memory_bytes, __ATOMIC_RELAXED) < budget_low_watermark(limit)) {
+        return 1;
+    }
+    KeyIndexNode *sample[ADMISSION_VICTIM_SAMPLES];
+    size_t sampled = ki_sample(&shard->index, hash, sample, ADMISSION_VICTIM_SAMPLES);
+    KeyMetadata *victim = NULL;
+    uint32_t victim_frequency = 0;
+    for (size_t i = 0; i < sampled; i++) {
+        uint32_t frequency = sketch_estimate(cache->admission, sample[i]->hash);
+        if (victim == NULL || frequency < victim_frequency) {
+            victim = meta_from_node(sample[i]);
+            victim_frequency = frequency;
+        }
+    }
+    if (victim != NULL && sketch_estimate(cache->admission, hash) <= victim_frequency) {
+        stat_add(cache, STAT_REJECTED, 1);
+        return 0;
+    }
+    stat_add(cache, STAT_ADMITTED, 1);
+    if (victim == NULL || !replace) {
+        return 1;
+    }
+
+    char *err = NULL;
+    cache->engine->del(cache->db, cache->woptions, victim->key, victim->node.key_len, &err);
+    if (err != NULL) {
+        log_error("[evict] Failed to delete key '%.*s': %s", (int)victim->node.key_len, victim->key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        return 1;
+    }
+    log_debug("[evict] Evicting key '%.*s' for a more frequently used one", (int)victim->node.key_len, victim->key);
+    hot_invalidate(cache, victim->key, victim->node.key_len, victim->node.hash);
+    ki_erase(&shard->index, &victim->node);
+    tw_cancel(&shard->wheel, &victim->timer);
+    memory_sub(cache, meta_size(victim));
+    meta_free(shard, victim);
+    __atomic_add_fetch(&cache->evicted_keys, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// A key is expired once the clock is strictly past its expiration, so its
+// timer is due one second later.
+static inline void schedule_expiry(IndexShard *shard, KeyMetadata *meta) {
+    if (meta->expiration > 0) {
+        tw_schedule(&shard->wheel, &meta->timer, meta->expiration + 1);
+    } else {
+        tw_cancel(&shard->wheel, &meta->timer);
+    }
+}
+
+// Deletes the key only if it is still expired once the shard is locked, so a
+// put that refreshed it in the meantime is not lost.
+static void expire_key(LevelCache *cache, const char *key, size_t key_len, uint64_t hash) {
+    IndexShard *shard = shard_for(cache, hash);
+    pthread_rwlock_wrlock(&shard->lock);
+    KeyMetadata *meta;
+    meta = meta_find(shard, key, key_len, hash);
+    if (meta == NULL || meta->expiration == 0 || coarse_clock_now() <= meta->expiration) {
+        pthread_rwlock_unlock(&shard->lock);
+        return;
+    }
+
+    // With native TTL the engine drops the value itself during compaction.
+    char *err = NULL;
+    if (!cache->native_ttl) {
+        cache->engine->del(cache->db, cache->woptions, key, key_len, &err);
+    }
+    if (err != NULL) {
+        log_error("[expire] Failed to delete key '%.*s': %s", (int)key_len, key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        pthread_rwlock_unlock(&shard->lock);
+        return;
+    }
+    hot_invalidate(cache, key, key_len, hash);
+    ki_erase(&shard->index, &meta->node);
+    tw_cancel(&shard->wheel, &meta->timer);
+    memory_sub(cache, meta_size(meta));
+    meta_free(shard, meta);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// Without an index the expiration is only known from the stored value. The
+// value is read again under the shard lock and deleted only if it is still
+// expired, so a put that refreshed it in the meantime is not lost. With
+// native TTL the engine drops it itself. Returns 1 if the key was deleted.
+static int expire_stored_key(LevelCache *cache, const char *key, size_t key_len, uint64_t hash) {
+    if (cache->native_ttl) {
+        return 0;
+    }
+    IndexShard *shard = shard_for(cache, hash);
+    pthread_rwlock_wrlock(&shard->lock);
+    char *err = NULL;
+    size_t value_len = 0;
+    char *value = cache->engine->get(cache->db, cache->roptions, key, key_len, &value_len, &err);
+    int deleted = 0;
+    if (err == NULL && value != NULL && value_is_expired(value, value_len, coarse_clock_now())) {
+        cache->engine->del(cache->db, cache->woptions, key, key_len, &err);
+        if (err == NULL) {
+            hot_invalidate(cache, key, key_len, hash);
+            deleted = 1;
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    if (value != NULL) {
+        cache->engine->free_fn(value);
+    }
+    if (err != NULL) {
+        log_error("[expire] Failed to delete key '%.*s': %s", (int)key_len, key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+    }
+    return deleted;
+}
+
+// Evicts a share of the shard's keys proportional to `excess / evictable`,
+// nearest expiration first, with a single engine write batch. Called with the
+// shard write lock held.
+static size_t evict_from_shard(LevelCache *cache, IndexShard *shard, size_t excess, size_t evictable) {
+    size_t keys = ki_size(&shard->index);
+    size_t n = (size_t)(((uint64_t)keys * excess + evictable - 1) / evictable);
+    if (n == 0) {
+        return 0;
+    }
+    KeyMetadata **victims = (KeyMetadata **) malloc(n * sizeof(KeyMetadata *));
+    if (victims == NULL) {
+        log_error("[evict] Failed to allocate eviction state");
+        return 0;
+    }
+
+    void *batch = cache->engine->writebatch_create();
+    size_t picked = 0;
+    while (picked < n) {
+        TimerNode *node = tw_pop_next(&shard->wheel);
+        if (node == NULL) {
+            break;
+        }
+        victims[picked] = meta_from_timer(node);
+        cache->engine->writebatch_delete(batch, victims[picked]->key, victims[picked]->node.key_len);
+        picked++;
+    }
+
+    char *err = NULL;
+    if (picked > 0) {
+        cache->engine->write(cache->db, cache->woptions, batch, &err);
+    }
+    if (err != NULL) {
+        log_error("[evict] Failed to delete %zu keys: %s", picked, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        for (size_t i = 0; i < picked; i++) {
+            schedule_expiry(shard, victims[i]);
+        }
+        picked = 0;
+    } else {
+        for (size_t i = 0; i < picked; i++) {
+            KeyMetadata *meta = victims[i];
+            log_debug("[evict] Evicting key '%.*s'", (int)meta->node.key_len, meta->key);
+            hot_invalidate(cache, meta->key, meta->node.key_len, meta->node.hash);
+            ki_erase(&shard->index, &meta->node);
+            memory_sub(cache, meta_size(meta));
+            meta_free(shard, meta);
+        }
+    }
+    cache->engine->writebatch_destroy(batch);
+    free(victims);
+    return picked;
+}
+
+// The part of the usage in `stats` that evicting keys gives back: key
+// metadata (the index tables keep their size), hot tier values, and the
+// memtables of engines without a block cache, which hold every value there.
+// Block caches, LSM memtables and table readers do not shrink when keys are
+// deleted.
+static size_t evictable_bytes(LevelCache *cache, const LevelCacheMemoryStats *stats) {
+    size_t keys = __atomic_load_n(&cache->total_memory_bytes, __ATOMIC_RELAXED) -
+                  cache->reserved_memory_bytes - sizeof(LevelCache);
+    size_t bytes = keys + stats->hot_tier_bytes;
+    if (cache->lru_cache == NULL) {
+        bytes += stats->memtable_bytes;
+    }
+    return bytes < stats->total_bytes ? bytes : stats->total_bytes;
+}
+
+// Measures memory usage and evicts keys if it is over budget. Only one thread
+// enforces at a time; the others skip the check.
+static void enforce_memory_budget(LevelCache *cache) {
+    if (cache->max_memory_mb == 0 || __atomic_exchange_n(&cache->evicting, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    LevelCacheMemoryStats stats;
+    levelcache_get_memory_stats(cache, &stats);
+    __atomic_store_n(&cache->used_memory_bytes, stats.total_bytes, __ATOMIC_RELAXED);
+
+    // Without an index there are no keys to pick victims from.
+    if (stats.total_bytes > stats.limit_bytes && !cache->no_index) {
+        size_t evictable = evictable_bytes(cache, &stats);
+        size_t fixed = stats.total_bytes - evictable;
+        if (fixed >= stats.limit_bytes || evictable == 0) {
+            // Evicting would empty the index without getting under budget.
+            if (!cache->budget_unreachable) {
+                log_warn("[evict] Engine memory of %zu bytes alone is over the budget of %zu bytes, not evicting",
+                         fixed, stats.limit_bytes);
+                cache->budget_unreachable = 1;
+            }
+        } else {
+            // Evict down to a low watermark so the next writes do not trip
+            // the limit again right away, or just under the limit when the
+            // engine's own memory already takes up the watermark.
+            size_t target = budget_low_watermark(stats.limit_bytes);
+            if (target <= fixed) {
+                target = stats.limit_bytes;
+            }
+            size_t excess = stats.total_bytes - target;
+            size_t evicted = 0;
+            for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+                IndexShard *shard = &cache->shards[i];
+                pthread_rwlock_wrlock(&shard->lock);
+                evicted += evict_from_shard(cache, shard, excess, evictable);
+                pthread_rwlock_unlock(&shard->lock);
+            }
+            __atomic_add_fetch(&cache->evicted_keys, evicted, __ATOMIC_RELAXED);
+            log_info("[evict] Usage of %zu bytes over budget of %zu bytes, evicted %zu keys",
+                     stats.total_bytes, stats.limit_bytes, evicted);
+            cache->budget_unreachable = 0;
+        }
+    } else {
+        cache->budget_unreachable = 0;
+    }
+    __atomic_store_n(&cache->evicting, 0, __ATOMIC_RELEASE);
+}
+
+// Runs a budget check every EVICTION_CHECK_INTERVAL writes. Must be called
+// without any shard lock held.
+static inline void note_writes(LevelCache *cache, size_t count) {
+    if (cache->max_memory_mb == 0) {
+        return;
+    }
+    uint32_t before = __atomic_fetch_add(&cache->writes_since_check, (uint32_t)count, __ATOMIC_RELAXED);
+    if (before / EVICTION_CHECK_INTERVAL != (before + (uint32_t)count) / EVICTION_CHECK_INTERVAL) {
+        enforce_memory_budget(cache);
+    }
+}
+
+// Iterators the cache walks itself, as opposed to scans a caller asked for,
+// see every key whatever prefix blooms are configured.
+static void* internal_iter_create(LevelCache *cache) {
+    return cache->engine->iter_create(cache->db, cache->iter_roptions ? cache->iter_roptions : cache->roptions);
+}
+
+// Without an index nothing tells the cleanup thread which keys are due, so
+// each cycle checks the next SWEEP_KEYS_PER_CYCLE keys of the engine for
+// expired values, resuming where the previous cycle stopped and wrapping
+// around at the end.
+static void sweep_expired(LevelCache *cache) {
+    void *iter = internal_iter_create(cache);
+    if (cache->sweep_cursor != NULL) {
+        cache->engine->iter_seek(iter, cache->sweep_cursor, cache->sweep_cursor_len);
+    } else {
+        cache->engine->iter_seek_to_first(iter);
+    }
+    uint64_t now = coarse_clock_now();
+    size_t scanned = 0;
+    size_t deleted = 0;
+    for (; cache->engine->iter_valid(iter) && scanned < SWEEP_KEYS_PER_CYCLE; cache->engine->iter_next(iter)) {
+        size_t key_len, value_len;
+        const char *key = cache->engine->iter_key(iter, &key_len);
+        const char *value = cache->engine->iter_value(iter, &value_len);
+        if (value_is_expired(value, value_len, now)) {
+            deleted += expire_stored_key(cache, key, key_len, ki_hash(key, key_len));
+        }
+        scanned++;
+    }
+
+    free(cache->sweep_cursor);
+    cache->sweep_cursor = NULL;
+    cache->sweep_cursor_len = 0;
+    if (cache->engine->iter_valid(iter)) {
+        size_t key_len;
+        const char *key = cache->engine->iter_key(iter, &key_len);
+        cache->sweep_cursor = (char *) malloc(key_len ? key_len : 1);
+        if (cache->sweep_cursor != NULL) {
+            memcpy(cache->sweep_cursor, key, key_len);
+            cache->sweep_cursor_len = key_len;
+        }
+    }
+    char *err = NULL;
+    cache->engine->iter_get_error(iter, &err);
+    if (err != NULL) {
+        log_error("[cleanup] Failed to sweep for expired keys: %s", err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+    }
+    cache->engine->iter_destroy(iter);
+    stat_add(cache, STAT_CLEANUP_DELETIONS, deleted);
+    log_debug("[cleanup] Swept %zu keys, deleted %zu expired", scanned, deleted);
+}
 
 void *cleanup_thread_function(void *arg) {
     LevelCache *cache = (LevelCache *)arg;
     log_info("[cleanup] Thread started with frequency %d seconds", cache->cleanup_frequency_sec);
-    while (!cache->stop_cleanup_thread) {
+    while (!__atomic_load_n(&cache->stop_cleanup_thread, __ATOMIC_ACQUIRE)) {
         sleep(cache->cleanup_frequency_sec);
         log_debug("[cleanup] Running cleanup cycle");
-        
-        KeyMetadata *current, *tmp;
-        HASH_ITER(hh, cache->index, current, tmp) {
-            if (current->expiration > 0 && time(NULL) > current->expiration) {
-                log_info("[cleanup] Key '%s' expired, deleting", current->key);
-                levelcache_delete(cache, current->key);
+
+        uint64_t now = coarse_clock_now();
+        for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+            IndexShard *shard = &cache->shards[i];
+            pthread_rwlock_wrlock(&shard->lock);
+            TimerNode *node = tw_advance(&shard->wheel, now);
+            while (node != NULL) {
+                TimerNode *next = node->next;
+                KeyMetadata *current = meta_from_timer(node);
+                log_info("[cleanup] Key '%.*s' expired, deleting", (int)current->node.key_len, current->key);
+                char *err = NULL;
+                if (!cache->native_ttl) {
+                    cache->engine->del(cache->db, cache->woptions, current->key, current->node.key_len, &err);
+                }
+                if (err != NULL) {
+                    log_error("[cleanup] Failed to delete key '%.*s': %s", (int)current->node.key_len, current->key, err);
+                    cache->engine->free_fn(err);
+                    stat_add(cache, STAT_ENGINE_ERRORS, 1);
+                    // Retry on the next cycle.
+                    tw_schedule(&shard->wheel, &current->timer, now + 1);
+                } else {
+                    hot_invalidate(cache, current->key, current->node.key_len, current->node.hash);
+                    ki_erase(&shard->index, &current->node);
+                    memory_sub(cache, meta_size(current));
+                    meta_free(shard, current);
+                    stat_add(cache, STAT_CLEANUP_DELETIONS, 1);
+                }
+                node = next;
             }
+            pthread_rwlock_unlock(&shard->lock);
+        }
+        if (cache->no_index && !cache->native_ttl) {
+            sweep_expired(cache);
+        }
+        enforce_memory_budget(cache);
+    }
+    log_info("[cleanup] Thread stopped");
+    return NULL;
+}
+
+void levelcache_options_init(LevelCacheOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->default_ttl_seconds = DEFAULT_TTL_SEC;
+    options->cleanup_frequency_sec = DEFAULT_CLEANUP_FREQUENCY_SEC;
+    options->log_level = LOG_INFO;
+    options->engine = ENGINE_LEVELDB;
+    options->native_ttl = 1;
+    options->ephemeral = 1;
+    options->stats_level = CACHE_STATS_TIMINGS;
+    options->early_refresh_beta = 0;
+}
+
+static int key_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) {
+        return c;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+// One key range of a warm restart scan, [start, limit). A NULL bound is open.
+typedef struct RestoreRange {
+    LevelCache *cache;
+    const char *start;
+    const char *limit;
+    size_t bound_len;
+    uint64_t now;
+    size_t loaded;
+    size_t skipped;
+    int failed;
+} RestoreRange;
+
+// Expired entries left behind by a non-native engine are deleted in batches
+// of this many keys while scanning.
+#define RESTORE_DELETE_BATCH 1024
+
+static void restore_flush_expired(LevelCache *cache, void **batch, size_t pending) {
+    if (pending == 0) {
+        return;
+    }
+    char *err = NULL;
+    cache->engine->write(cache->db, cache->woptions, *batch, &err);
+    if (err != NULL) {
+        log_warn("[open] Failed to delete expired keys: %s", err);
+        cache->engine->free_fn(err);
+    }
+    cache->engine->writebatch_destroy(*batch);
+    *batch = cache->engine->writebatch_create();
+}
+
+static void *restore_thread_function(void *arg) {
+    RestoreRange *range = (RestoreRange *)arg;
+    LevelCache *cache = range->cache;
+    void *iter = internal_iter_create(cache);
+    void *expired = cache->native_ttl ? NULL : cache->engine->writebatch_create();
+    size_t pending = 0;
+
+    if (range->start != NULL) {
+        cache->engine->iter_seek(iter, range->start, range->bound_len);
+    } else {
+        cache->engine->iter_seek_to_first(iter);
+    }
+    for (; cache->engine->iter_valid(iter); cache->engine->iter_next(iter)) {
+        size_t key_len, value_len;
+        const char *key = cache->engine->iter_key(iter, &key_len);
+        if (range->limit != NULL && key_compare(key, key_len, range->limit, range->bound_len) >= 0) {
+            break;
+        }
+        const char *value = cache->engine->iter_value(iter, &value_len);
+        if (value_is_expired(value, value_len, range->now)) {
+            range->skipped++;
+            if (expired != NULL) {
+                cache->engine->writebatch_delete(expired, key, key_len);
+                if (++pending == RESTORE_DELETE_BATCH) {
+                    restore_flush_expired(cache, &expired, pending);
+                    pending = 0;
+                }
+            }
+            continue;
+        }
+
+        uint64_t hash = ki_hash(key, key_len);
+        IndexShard *shard = shard_for(cache, hash);
+        pthread_rwlock_wrlock(&shard->lock);
+        KeyMetadata *meta = meta_create(shard, key, key_len, hash);
+        if (meta == NULL) {
+            pthread_rwlock_unlock(&shard->lock);
+            log_error("[open] Failed to allocate memory for key metadata");
+            range->failed = 1;
+            break;
+        }
+        if (ki_insert(&shard->index, &meta->node) != 0) {
+            meta_free(shard, meta);
+            pthread_rwlock_unlock(&shard->lock);
+            log_error("[open] Failed to grow the key index");
+            range->failed = 1;
+            break;
+        }
+        meta->expiration = value_header_expiration(value);
+        schedule_expiry(shard, meta);
+        pthread_rwlock_unlock(&shard->lock);
+        memory_add(cache, meta_size(meta));
+        range->loaded++;
+    }
+
+    char *err = NULL;
+    cache->engine->iter_get_error(iter, &err);
+    if (err != NULL) {
+        log_error("[open] Failed to scan existing data: %s", err);
+        cache->engine->free_fn(err);
+        range->failed = 1;
+    }
+    cache->engine->iter_destroy(iter);
+    if (expired != NULL) {
+        restore_flush_expired(cache, &expired, pending);
+        cache->engine->writebatch_destroy(expired);
+    }
+    return NULL;
+}
+
+// Rebuilds the index from the values already in the engine. The key space is
+// split on the first byte after the prefix shared by the first and last keys,
+// so keys with a common namespace prefix still spread over all threads.
+static int restore_index(LevelCache *cache, uint32_t num_threads) {
+    void *iter = internal_iter_create(cache);
+    cache->engine->iter_seek_to_first(iter);
+    if (!cache->engine->iter_valid(iter)) {
+        cache->engine->iter_destroy(iter);
+        log_info("[open] No existing data to restore");
+        return 0;
+    }
+    size_t first_len, last_len;
+    const char *key = cache->engine->iter_key(iter, &first_len);
+    char *first = (char *) malloc(first_len + 1);
+    if (first == NULL) {
+        cache->engine->iter_destroy(iter);
+        return -1;
+    }
+    memcpy(first, key, first_len);
+    cache->engine->iter_seek_to_last(iter);
+    key = cache->engine->iter_key(iter, &last_len);
+    char *last = (char *) malloc(last_len + 1);
+    if (last == NULL) {
+        free(first);
+        cache->engine->iter_destroy(iter);
+        return -1;
+    }
+    memcpy(last, key, last_len);
+    cache->engine->iter_destroy(iter);
+
+    size_t prefix_len = 0;
+    while (prefix_len < first_len && prefix_len < last_len && first[prefix_len] == last[prefix_len]) {
+        prefix_len++;
+    }
+    uint32_t lo = (prefix_len < first_len) ? (unsigned char)first[prefix_len] : 0;
+    uint32_t hi = (prefix_len < last_len) ? (unsigned char)last[prefix_len] : lo;
+    uint32_t span = hi - lo + 1;
+    if (num_threads > span) {
+        num_threads = span;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    // bounds[t] is the prefix followed by the first byte of range t.
+    size_t bound_len = prefix_len + 1;
+    char *bounds = (char *) malloc(num_threads * bound_len);
+    RestoreRange *ranges = (RestoreRange *) calloc(num_threads, sizeof(RestoreRange));
+    pthread_t *threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    int *started = (int *) calloc(num_threads, sizeof(int));
+    if (bounds == NULL || ranges == NULL || threads == NULL || started == NULL) {
+        free(bounds); free(ranges); free(threads); free(started);
+        free(first); free(last);
+        return -1;
+    }
+    uint64_t now = coarse_clock_now();
+    for (uint32_t t = 0; t < num_threads; t++) {
+        char *bound = bounds + t * bound_len;
+        memcpy(bound, first, prefix_len);
+        bound[prefix_len] = (char)(lo + (uint64_t)span * t / num_threads);
+        ranges[t].cache = cache;
+        ranges[t].start = (t == 0) ? NULL : bound;
+        ranges[t].limit = (t + 1 == num_threads) ? NULL : bounds + (t + 1) * bound_len;
+        ranges[t].bound_len = bound_len;
+        ranges[t].now = now;
+    }
+    for (uint32_t t = 0; t < num_threads; t++) {
+        started[t] = (t > 0 && pthread_create(&threads[t], NULL, restore_thread_function, &ranges[t]) == 0);
+    }
+    // Range 0, and any range whose thread could not be started, is scanned
+    // on the calling thread.
+    size_t loaded = 0, skipped = 0;
+    int rc = 0;
+    for (uint32_t t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            restore_thread_function(&ranges[t]);
+        }
+        loaded += ranges[t].loaded;
+        skipped += ranges[t].skipped;
+        if (ranges[t].failed) {
+            rc = -1;
+        }
+    }
+    log_info("[open] Restored %zu keys, skipped %zu expired, with %u threads", loaded, skipped, num_threads);
+
+    free(bounds); free(ranges); free(threads); free(started);
+    free(first); free(last);
+    return rc;
+}
+
+LevelCache* levelcache_open(const char *path, size_t max_memory_mb, uint32_t default_ttl_seconds, uint32_t cleanup_frequency_sec, int log_level, engine_t etype) {
+    LevelCacheOptions options;
+    levelcache_options_init(&options);
+    options.max_memory_mb = max_memory_mb;
+    options.default_ttl_seconds = default_ttl_seconds;
+    options.cleanup_frequency_sec = cleanup_frequency_sec;
+    options.log_level = log_level;
+    options.engine = etype;
+    return levelcache_open_with_options(path, &options);
+}
+
+LevelCache* levelcache_open_with_options(const char *path, const LevelCacheOptions *opts) {
+    size_t max_memory_mb = opts->max_memory_mb;
+    uint32_t default_ttl_seconds = opts->default_ttl_seconds;
+    uint32_t cleanup_frequency_sec = opts->cleanup_frequency_sec;
+    int log_level = opts->log_level;
+    engine_t etype = opts->engine;
+
+    cache_log_set_level(log_level);
+    log_info("[open] Opening database at '%s'", path);
+
+    if (etype >= LIMIT || etype < 0) {
+        log_error("[open] Invalid engine type");
+        return NULL;
+    }
+
+    LevelCache *cache = NULL;
+    if (posix_memalign((void **)&cache, 64, sizeof(LevelCache)) != 0) {
+        log_error("[open] Failed to allocate memory for cache");
+        return NULL;
+    }
+
+    log_info("[open] Configured engine to %s", engine_names[etype]);
+
+    StorageEngine *engine = ALL_ENGINES[etype];
+
+    cache->engine = engine;
+    coarse_clock_acquire(opts->clock_source);
+    uint64_t now = coarse_clock_now();
+    for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+        pthread_rwlock_init(&cache->shards[i].lock, NULL);
+        ki_init(&cache->shards[i].index);
+        tw_init(&cache->shards[i].wheel, now);
+        slab_init(&cache->shards[i].slab);
+    }
+    cache->default_ttl = (default_ttl_seconds > 0) ? default_ttl_seconds : DEFAULT_TTL_SEC;
+    cache->cleanup_frequency_sec = cleanup_frequency_sec;
+    cache->stop_cleanup_thread = 0;
+    cache->log_level = log_level;
+    cache->total_memory_bytes = sizeof(LevelCache);
+    cache->hot = NULL;
+    cache->used_memory_bytes = 0;
+    cache->reserved_memory_bytes = 0;
+    cache->evicted_keys = 0;
+    cache->writes_since_check = 0;
+    cache->evicting = 0;
+    cache->budget_unreachable = 0;
+    cache->native_ttl = opts->native_ttl && engine->supports_native_ttl;
+    cache->no_index = opts->no_index;
+    cache->sweep_cursor = NULL;
+    cache->sweep_cursor_len = 0;
+    cache->iter_roptions = NULL;
+    cache->value_header = cache->native_ttl || opts->keep_existing || opts->no_index;
+    cache->ttl_filter = NULL;
+    cache->ephemeral = NULL;
+    cache->async_log = 0;
+    cache->async = NULL;
+    cache->scan_prefix_len = 0;
+    cache->codec = NULL;
+    cache->admission = NULL;
+    cache->early_refresh_beta = opts->early_refresh_beta;
+    cache->load_time_ns = 0;
+    cache->engine_statistics = 0;
+
+    if (cache_stats_init(&cache->stats, opts->stats_level, STAT_COUNT,
+                         LEVELCACHE_OP_COUNT * LEVELCACHE_PHASE_COUNT) != 0) {
+        log_warn("[open] Failed to allocate statistics, continuing without them");
+    }
+    cache->total_memory_bytes += cache_stats_memory(&cache->stats);
+    cache->reserved_memory_bytes += cache_stats_memory(&cache->stats);
+
+    char *err = NULL;
+
+    if (opts->keep_existing && !engine->persistent) {
+        log_warn("[open] %s keeps no data across close, keep_existing has nothing to restore", engine_names[etype]);
+    }
+    if (opts->no_index) {
+        log_info("[open] Keeping no key index, expirations are read from the stored values");
+        if (!opts->ephemeral) {
+            log_warn("[open] Without the ephemeral profile tables have no bloom filters, so every miss reads them");
         }
     }
-    log_info("[cleanup] Thread stopped");
-    return NULL;
+
+    if (!opts->keep_existing) {
+        void* destroy_options = cache->engine->options_create();
+        cache->engine->destroy_db(destroy_options, path, &err);
+        cache->engine->options_destroy(destroy_options);
+        if (err != NULL) {
+            log_warn("[open] Could not destroy existing database: %s", err);
+            cache->engine->free_fn(err);
+            err = NULL;
+        }
+    }
+
+    cache->options = cache->engine->options_create();
+    cache->engine->options_set_create_if_missing(cache->options, 1);
+
+    cache->max_memory_mb = max_memory_mb;
+    if (cache->max_memory_mb > 0) {
+        // The engine's own buffers are sized from the budget so that eviction
+        // only has to bound what grows with the number of keys.
+        size_t budget = cache->max_memory_mb * 1024 * 1024;
+        size_t cache_size = budget / BLOCK_CACHE_SHARE;
+        cache->lru_cache = cache->engine->cache_create_lru(cache_size);
+        cache->engine->options_set_write_buffer_size(cache->options, budget / WRITE_BUFFER_SHARE);
+        // Engines without a block cache hold values in memory they report
+        // themselves, so nothing is set aside for one.
+        if (cache->lru_cache != NULL) {
+            cache->engine->options_set_cache(cache->options, cache->lru_cache);
+            cache->total_memory_bytes += cache_size;
+            cache->reserved_memory_bytes += cache_size;
+            log_info("[open] LRU cache created with size %zu MB of a %zu MB budget", cache_size >> 20, max_memory_mb);
+        }
+    } else {
+        cache->lru_cache = NULL;
+    }
+
+    if (opts->hot_tier_bytes > 0) {
+        cache->hot = hot_tier_create(opts->hot_tier_bytes, LEVELCACHE_NUM_SHARDS);
+        if (cache->hot == NULL) {
+            log_warn("[open] Failed to allocate hot tier, continuing without it");
+        } else {
+            cache->total_memory_bytes += opts->hot_tier_bytes;
+            cache->reserved_memory_bytes += opts->hot_tier_bytes;
+            log_info("[open] Hot tier created with %zu bytes", opts->hot_tier_bytes);
+        }
+    }
+
+    if (opts->admission && (cache->max_memory_mb == 0 || cache->no_index)) {
+        log_warn("[open] Admission needs a memory budget and the key index, admission ignored");
+    } else if (opts->admission) {
+        cache->admission = (FrequencySketch *) malloc(sizeof(FrequencySketch));
+        if (cache->admission == NULL ||
+            sketch_init(cache->admission, cache->max_memory_mb * 1024 * 1024 / ADMISSION_BYTES_PER_KEY) != 0) {
+            log_warn("[open] Failed to allocate the admission sketch, continuing without it");
+            free(cache->admission);
+            cache->admission = NULL;
+        } else {
+            cache->total_memory_bytes += sketch_memory(cache->admission);
+            cache->reserved_memory_bytes += sketch_memory(cache->admission);
+            log_info("[open] Admission sketch created with %zu bytes", sketch_memory(cache->admission));
+        }
+    }
+
+    if (opts->ephemeral) {
+        size_t write_buffer = (cache->max_memory_mb > 0) ? cache->max_memory_mb * 1024 * 1024 / WRITE_BUFFER_SHARE
+                                                         : EPHEMERAL_WRITE_BUFFER;
+        cache->ephemeral = cache->engine->options_set_ephemeral(cache->options, cache->lru_cache, write_buffer);
+        log_info("[open] Using the ephemeral %s profile with %zu MB memtables", engine_names[etype], write_buffer >> 20);
+    }
+
+    if (opts->scan_prefix_len > 0) {
+        if (cache->engine->options_set_prefix_bloom != NULL) {
+            cache->engine->options_set_prefix_bloom(cache->options, opts->scan_prefix_len);
+            cache->scan_prefix_len = opts->scan_prefix_len;
+            log_info("[open] Prefix bloom filters over the first %zu bytes of keys", opts->scan_prefix_len);
+        } else {
+            log_warn("[open] %s has no prefix bloom filters, scan_prefix_len ignored", engine_names[etype]);
+        }
+    }
+
+    if (opts->engine_statistics) {
+        if (cache->engine->options_enable_statistics != NULL) {
+            cache->engine->options_enable_statistics(cache->options);
+            cache->engine_statistics = 1;
+        } else {
+            log_warn("[open] %s has no statistics object, engine_statistics ignored", engine_names[etype]);
+        }
+    }
+
+    if (cache->native_ttl) {
+        cache->ttl_filter = cache->engine->options_set_ttl_filter(cache->options);
+        log_info("[open] Expired values are dropped by %s compactions", engine_names[etype]);
+    }
+
+    cache->db = cache->engine->open(cache->options, path, &err);
+
+    if (err != NULL) {
+        log_error("[open] Failed to open database: %s", err);
+        cache->engine->free_fn(err);
+        cache->engine->options_destroy(cache->options);
+        if(cache->lru_cache) {
+            cache->engine->cache_destroy(cache->lru_cache);
+        }
+        hot_tier_destroy(cache->hot);
+        if (cache->admission != NULL) {
+            sketch_destroy(cache->admission);
+            free(cache->admission);
+        }
+        if (cache->ttl_filter) {
+            cache->engine->ttl_filter_destroy(cache->ttl_filter);
+        }
+        if (cache->ephemeral) {
+            cache->engine->ephemeral_destroy(cache->ephemeral);
+        }
+        for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+            pthread_rwlock_destroy(&cache->shards[i].lock);
+        }
+        cache_stats_destroy(&cache->stats);
+        coarse_clock_release();
+        free(cache);
+        return NULL;
+    }
+
+    single_flight_init(&cache->flights);
+    cache->roptions = cache->engine->readoptions_create();
+    // Restores, sweeps and range deletes walk whole key ranges, which a
+    // prefix extractor would otherwise confine to the seek key's prefix.
+    if (cache->engine->readoptions_create_scan != NULL) {
+        cache->iter_roptions = cache->engine->readoptions_create_scan(NULL, 0, 0, 0);
+    }
+    cache->woptions = cache->engine->writeoptions_create();
+    if (opts->ephemeral && cache->engine->writeoptions_disable_wal != NULL) {
+        cache->engine->writeoptions_disable_wal(cache->woptions);
+    }
+
+    if (opts->codec == LEVELCACHE_CODEC_ZSTD) {
+        // Only a persistent engine outlives the cache, so only it gets the
+        // dictionary saved.
+        char *dict_path = NULL;
+        if (cache->engine->persistent) {
+            size_t dict_path_len = strlen(path) + sizeof(CODEC_DICT_FILE) + 1;
+            dict_path = (char *) malloc(dict_path_len);
+            if (dict_path != NULL) {
+                snprintf(dict_path, dict_path_len, "%s/%s", path, CODEC_DICT_FILE);
+            }
+        }
+        if (!cache->engine->persistent || dict_path != NULL) {
+            cache->codec = value_codec_create(opts->codec_level ? opts->codec_level : CODEC_DEFAULT_LEVEL,
+                                              opts->codec_min_bytes ? opts->codec_min_bytes : CODEC_DEFAULT_MIN_BYTES,
+                                              opts->codec_dict_bytes ? opts->codec_dict_bytes : CODEC_DEFAULT_DICT_BYTES,
+                                              dict_path, opts->keep_existing);
+        }
+        free(dict_path);
+        if (cache->codec == NULL) {
+            log_error("[open] Failed to set up the value codec");
+            cache->cleanup_frequency_sec = 0;
+            levelcache_close(cache);
+            return NULL;
+        }
+        log_info("[open] Compressing values with zstd");
+    }
+
+    if (opts->keep_existing && !cache->no_index) {
+        uint32_t threads = opts->restore_threads;
+        if (threads == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = (cpus > 0) ? (uint32_t)cpus : 1;
+        }
+        if (restore_index(cache, threads) != 0) {
+            log_error("[open] Failed to restore the index from existing data");
+            cache->cleanup_frequency_sec = 0;
+            levelcache_close(cache);
+            return NULL;
+        }
+        enforce_memory_budget(cache);
+    }
+
+    if (cache->cleanup_frequency_sec > 0) {
+        if (pthread_create(&cache->cleanup_thread, NULL, cleanup_thread_function, cache)) {
+            log_error("[open] Failed to create cleanup thread");
+            cache->cleanup_frequency_sec = 0;
+            levelcache_close(cache);
+            return NULL;
+        }
+    }
+
+    if (opts->async_threads > 0) {
+        cache->async = async_pool_create(cache, opts->async_threads, opts->async_queue_depth);
+        if (cache->async == NULL) {
+            log_error("[open] Failed to start the async workers");
+            levelcache_close(cache);
+            return NULL;
+        }
+    }
+
+    if (opts->async_log) {
+        if (cache_log_async_acquire() == 0) {
+            cache->async_log = 1;
+        } else {
+            log_warn("[open] Failed to start the async logger, logging synchronously");
+        }
+    }
+
+    log_info("[open] Database opened successfully");
+    log_warn("[open] Memory usage tracking does not include all internal leveldb allocations.");
+    return cache;
+}
+
+void levelcache_close(LevelCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    log_info("[close] Closing database");
+
+    // Queued async operations still need the engine, so they go first.
+    async_pool_destroy(cache->async);
+
+    if (cache->cleanup_frequency_sec > 0) {
+        __atomic_store_n(&cache->stop_cleanup_thread, 1, __ATOMIC_RELEASE);
+        pthread_join(cache->cleanup_thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+        IndexShard *shard = &cache->shards[i];
+        // Slab-allocated metadata goes away with the slab chunks; only keys
+        // too long for the slab were allocated individually.
+        size_t cursor = 0;
+        KeyIndexNode *node;
+        while ((node = ki_iter_next(&shard->index, &cursor)) != NULL) {
+            if (slab_is_large(meta_alloc_size(node->key_len))) {
+                meta_free(shard, meta_from_node(node));
+            }
+        }
+        ki_destroy(&shard->index);
+        slab_release_all(&shard->slab);
+        pthread_rwlock_destroy(&shard->lock);
+    }
+
+    cache->engine->close(cache->db);
+    value_codec_destroy(cache->codec);
+    single_flight_destroy(&cache->flights);
+    if (cache->ttl_filter) {
+        cache->engine->ttl_filter_destroy(cache->ttl_filter);
+    }
+    if (cache->ephemeral) {
+        cache->engine->ephemeral_destroy(cache->ephemeral);
+    }
+    cache->engine->options_destroy(cache->options);
+    cache->engine->readoptions_destroy(cache->roptions);
+    if (cache->iter_roptions != NULL) {
+        cache->engine->readoptions_destroy(cache->iter_roptions);
+    }
+    cache->engine->writeoptions_destroy(cache->woptions);
+    if (cache->lru_cache) {
+        cache->engine->cache_destroy(cache->lru_cache);
+    }
+    hot_tier_destroy(cache->hot);
+    if (cache->admission != NULL) {
+        sketch_destroy(cache->admission);
+        free(cache->admission);
+    }
+    cache_stats_destroy(&cache->stats);
+    free(cache->sweep_cursor);
+    coarse_clock_release();
+    int async_log = cache->async_log;
+    free(cache);
+    log_info("[close] Database closed");
+    if (async_log) {
+        cache_log_async_release();
+    }
+}
+
+int levelcache_put(LevelCache *cache, const char *key, const char *value, uint32_t ttl_seconds) {
+    return levelcache_put_n(cache, key, strlen(key), value, strlen(value), ttl_seconds);
+}
+
+int levelcache_put_n(LevelCache *cache, const char *key, size_t key_len, const char *value, size_t value_len, uint32_t ttl_seconds) {
+    log_trace("[put] Putting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    uint64_t hash = ki_hash(key, key_len);
+    IndexShard *shard = shard_for(cache, hash);
+
+    uint32_t __ttl_seconds = (ttl_seconds > 0) ? ttl_seconds : cache->default_ttl;
+    uint64_t expiration = coarse_clock_now() + __ttl_seconds;
+
+    FramedValue framed;
+    if (frame_value(cache, &framed, value, value_len, expiration) != 0) {
+        log_error("[put] Failed to allocate memory for value");
+        return -1;
+    }
+    uint64_t framed_at = cache_stats_ticks(&cache->stats);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    KeyMetadata *meta = NULL;
+    if (!cache->no_index) {
+        meta = meta_find(shard, key, key_len, hash);
+    }
+
+    int new_key = 0;
+    if (cache->no_index) {
+        log_debug("[put] Key '%.*s' is not indexed", (int)key_len, key);
+    } else if (meta == NULL && !admit_new_key(cache, shard, hash, 1)) {
+        log_debug("[put] Key '%.*s' not admitted", (int)key_len, key);
+        pthread_rwlock_unlock(&shard->lock);
+        framed_release(&framed);
+        return 0;
+    } else if (meta == NULL) {
+        log_debug("[put] Key '%.*s' not found, creating new entry", (int)key_len, key);
+        meta = meta_create(shard, key, key_len, hash);
+        if (meta == NULL || ki_insert(&shard->index, &meta->node) != 0) {
+            log_error("[put] Failed to allocate memory for key metadata");
+            if (meta != NULL) {
+                meta_free(shard, meta);
+            }
+            pthread_rwlock_unlock(&shard->lock);
+            framed_release(&framed);
+            return -1;
+        }
+        new_key = 1;
+    } else {
+        log_debug("[put] Key '%.*s' found, updating expiration", (int)key_len, key);
+    }
+    uint64_t indexed_at = cache_stats_ticks(&cache->stats);
+
+    char *err = NULL;
+    cache->engine->put(cache->db, cache->woptions, key, key_len, framed.data, framed.len, &err);
+    size_t stored_len = framed.len;
+    framed_release(&framed);
+    uint64_t written_at = cache_stats_ticks(&cache->stats);
+
+    if (err != NULL) {
+        log_error("[put] Failed to put key '%.*s' into leveldb: %s", (int)key_len, key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        if (new_key) {
+            log_debug("[put] Rolling back in-memory insert for key '%.*s'", (int)key_len, key);
+            ki_erase(&shard->index, &meta->node);
+            meta_free(shard, meta);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+        return -1;
+    }
+
+    hot_invalidate(cache, key, key_len, hash);
+    if (meta != NULL) {
+        meta->expiration = expiration;
+        schedule_expiry(shard, meta);
+    }
+    if (new_key) {
+        memory_add(cache, meta_size(meta));
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    log_info("[put] Key '%.*s' put successfully with TTL %u seconds", (int)key_len, key, __ttl_seconds);
+
+    note_writes(cache, 1);
+    stat_add(cache, STAT_BYTES_WRITTEN, value_len);
+    stat_add(cache, STAT_BYTES_STORED, stored_len);
+    stat_time(cache, LEVELCACHE_OP_PUT, LEVELCACHE_PHASE_COPY, start, framed_at);
+    stat_time(cache, LEVELCACHE_OP_PUT, LEVELCACHE_PHASE_INDEX, framed_at, indexed_at);
+    stat_time(cache, LEVELCACHE_OP_PUT, LEVELCACHE_PHASE_ENGINE, indexed_at, written_at);
+    stat_time(cache, LEVELCACHE_OP_PUT, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+    return 0;
+}
+
+// Returns 1 if the key is live in the index and stores its expiration in
+// `expiration_out`. Expired keys are deleted on the spot and reported as
+// missing.
+static int index_lookup_live(LevelCache *cache, const char *key, size_t key_len, uint64_t hash, uint64_t *expiration_out) {
+    IndexShard *shard = shard_for(cache, hash);
+    admission_record(cache, hash);
+    pthread_rwlock_rdlock(&shard->lock);
+    KeyMetadata *meta;
+    meta = meta_find(shard, key, key_len, hash);
+    uint64_t expiration = (meta != NULL) ? meta->expiration : 0;
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (meta == NULL) {
+        log_debug("[get] Key '%.*s' not found in index", (int)key_len, key);
+        stat_add(cache, STAT_MISSES, 1);
+        return 0;
+    }
+    if (expiration > 0 && coarse_clock_now() > expiration) {
+        log_info("[get] Key '%.*s' expired, deleting", (int)key_len, key);
+        expire_key(cache, key, key_len, hash);
+        stat_add(cache, STAT_EXPIRED_ON_READ, 1);
+        stat_add(cache, STAT_MISSES, 1);
+        return 0;
+    }
+    *expiration_out = expiration;
+    return 1;
+}
+
+static void hot_entry_release_handle(void *handle) {
+    hot_entry_release((HotEntry *)handle);
+}
+
+// Looks the key up and pins its value, from the hot tier if it is there and
+// from the engine otherwise. Returns 0 and fills `out` on a hit, -1 on a miss
+// and -2 on an error; a hit also stores the key's expiration in
+// `expiration_out` unless it is NULL. Records the index and engine phases of the get.
+static int get_pinned(LevelCache *cache, const char *key, size_t key_len, LevelCachePinnedValue *out,
+                      uint64_t *expiration_out) {
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    uint64_t hash = ki_hash(key, key_len);
+    uint64_t expiration = 0;
+    int live = cache->no_index || index_lookup_live(cache, key, key_len, hash, &expiration);
+    uint64_t indexed_at = cache_stats_ticks(&cache->stats);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_INDEX, start, indexed_at);
+    if (!live) {
+        return -1;
+    }
+
+    uint64_t generation = 0;
+    if (cache->hot != NULL) {
+        HotEntry *entry = hot_tier_lookup(cache->hot, key, key_len, hash, coarse_clock_now());
+        if (entry != NULL) {
+            log_debug("[get] Key '%.*s' served from hot tier", (int)key_len, key);
+            out->data = hot_entry_value(entry);
+            out->len = entry->value_len;
+            out->handle = entry;
+            out->release = hot_entry_release_handle;
+            if (expiration_out != NULL) {
+                *expiration_out = entry->expiration;
+            }
+            stat_add(cache, STAT_HOT_TIER_HITS, 1);
+            stat_add(cache, STAT_HITS, 1);
+            stat_add(cache, STAT_BYTES_READ, out->len);
+            stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_ENGINE, indexed_at, cache_stats_ticks(&cache->stats));
+            return 0;
+        }
+        generation = hot_tier_generation(cache->hot, hash);
+    }
+
+    char *err = NULL;
+    out->release = cache->engine->pinned_destroy;
+    out->handle = cache->engine->get_pinned(cache->db, cache->roptions, key, key_len, &out->data, &out->len, &err);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_ENGINE, indexed_at, cache_stats_ticks(&cache->stats));
+
+    if (err != NULL) {
+        log_error("[get] Failed to get key '%.*s' from leveldb: %s", (int)key_len, key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        if (out->handle != NULL) {
+            cache->engine->pinned_destroy(out->handle);
+        }
+        out->handle = NULL;
+        return -2;
+    }
+
+    if (out->handle == NULL) {
+        // Without an index this is an ordinary miss; with one, a concurrent
+        // delete removed the key after the index lookup.
+        log_debug("[get] Key '%.*s' not found in db", (int)key_len, key);
+        stat_add(cache, STAT_MISSES, 1);
+        return -1;
+    }
+
+    if (!unframe_value(cache, &out->data, &out->len)) {
+        log_debug("[get] Key '%.*s' expired in db", (int)key_len, key);
+        cache->engine->pinned_destroy(out->handle);
+        out->handle = NULL;
+        if (cache->no_index) {
+            expire_stored_key(cache, key, key_len, hash);
+        }
+        stat_add(cache, STAT_EXPIRED_ON_READ, 1);
+        stat_add(cache, STAT_MISSES, 1);
+        return -1;
+    }
+    if (cache->no_index) {
+        expiration = value_header_expiration(out->data - VALUE_HEADER_SIZE);
+    }
+    char *decoded;
+    if (decode_value(cache, &out->data, &out->len, &decoded) != 0) {
+        log_error("[get] Failed to decode the value of key '%.*s'", (int)key_len, key);
+        cache->engine->pinned_destroy(out->handle);
+        out->handle = NULL;
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        stat_add(cache, STAT_MISSES, 1);
+        return -2;
+    }
+    if (decoded != NULL) {
+        // The decoded copy is what the caller pins; the engine's can go.
+        cache->engine->pinned_destroy(out->handle);
+        out->handle = decoded;
+        out->release = free;
+    }
+
+    if (cache->hot != NULL) {
+        hot_tier_insert(cache->hot, key, key_len, hash, out->data, out->len, expiration, generation);
+    }
+    if (expiration_out != NULL) {
+        *expiration_out = expiration;
+    }
+    stat_add(cache, STAT_HITS, 1);
+    stat_add(cache, STAT_BYTES_READ, out->len);
+    return 0;
+}
+
+char* levelcache_get(LevelCache *cache, const char *key) {
+    return levelcache_get_n(cache, key, strlen(key), NULL);
+}
+
+char* levelcache_get_n(LevelCache *cache, const char *key, size_t key_len, size_t *value_len) {
+    log_trace("[get] Getting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    LevelCachePinnedValue value;
+    if (get_pinned(cache, key, key_len, &value, NULL) != 0) {
+        stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+        return NULL;
+    }
+    uint64_t pinned_at = cache_stats_ticks(&cache->stats);
+
+    char *result = (char *)malloc(value.len + 1);
+    if (result == NULL) {
+        log_error("[get] Failed to allocate memory for result");
+        levelcache_value_release(&value);
+        return NULL;
+    }
+    memcpy(result, value.data, value.len);
+    result[value.len] = '\0';
+    if (value_len != NULL) {
+        *value_len = value.len;
+    }
+    levelcache_value_release(&value);
+    uint64_t end = cache_stats_ticks(&cache->stats);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_COPY, pinned_at, end);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, end);
+    log_info("[get] Key '%.*s' retrieved successfully", (int)key_len, key);
+    return result;
+}
+
+// Returns a NUL-terminated copy of a pinned value and releases it.
+static char* copy_pinned(LevelCachePinnedValue *value, size_t *value_len) {
+    char *result = (char *)malloc(value->len + 1);
+    if (result == NULL) {
+        log_error("[get_or_load] Failed to allocate memory for result");
+    } else {
+        memcpy(result, value->data, value->len);
+        result[value->len] = '\0';
+        if (value_len != NULL) {
+            *value_len = value->len;
+        }
+    }
+    levelcache_value_release(value);
+    return result;
+}
+
+static __thread uint64_t refresh_random;
+
+// XFetch (Vattani et al., "Optimal Probabilistic Cache Stampede Prevention"):
+// a hit reloads once now - beta * load_time * ln(U) reaches the expiration,
+// with U uniform in (0, 1]. Expirations have whole seconds and a key lives
+// through its expiration second, which therefore always reloads.
+static int refresh_early(LevelCache *cache, uint64_t expiration) {
+    if (cache->early_refresh_beta <= 0 || expiration == 0) {
+        return 0;
+    }
+    uint64_t now = coarse_clock_now();
+    if (now >= expiration) {
+        return 1;
+    }
+    uint64_t x = refresh_random;
+    if (x == 0) {
+        x = ((uint64_t)(uintptr_t)&refresh_random * 0x9e3779b97f4a7c15ull) | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    refresh_random = x;
+    double u = (double)((x >> 11) + 1) * 0x1.0p-53;
+    double load_seconds = (double)__atomic_load_n(&cache->load_time_ns, __ATOMIC_RELAXED) / 1e9;
+    return (double)now - cache->early_refresh_beta * load_seconds * log(u) >= (double)expiration;
+}
+
+// Runs the loader for a flight the caller leads, stores the value and hands
+// it to the flight's waiters. Stored before the flight ends, the value is
+// visible to every get that no longer finds the flight.
+static char* load_value(LevelCache *cache, const char *key, size_t key_len, size_t *value_len,
+                        LevelCacheLoader loader, void *ctx, uint32_t ttl_seconds, Flight *flight) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t len = 0;
+    char *value = loader(key, key_len, &len, ctx);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stat_add(cache, STAT_LOADS, 1);
+
+    int64_t elapsed = (int64_t)(end.tv_sec - begin.tv_sec) * 1000000000 + (end.tv_nsec - begin.tv_nsec);
+    uint64_t sample = elapsed > 0 ? (uint64_t)elapsed : 0;
+    uint64_t average = __atomic_load_n(&cache->load_time_ns, __ATOMIC_RELAXED);
+    average = (average == 0) ? sample : average - average / LOAD_TIME_WEIGHT + sample / LOAD_TIME_WEIGHT;
+    __atomic_store_n(&cache->load_time_ns, average, __ATOMIC_RELAXED);
+
+    if (value == NULL) {
+        log_debug("[get_or_load] Loader returned nothing for key '%.*s'", (int)key_len, key);
+    } else {
+        // Terminated like every value a get returns.
+        char *terminated = (char *)realloc(value, len + 1);
+        if (terminated == NULL) {
+            log_error("[get_or_load] Failed to allocate memory for result");
+            free(value);
+            value = NULL;
+        } else {
+            value = terminated;
+            value[len] = '\0';
+            if (levelcache_put_n(cache, key, key_len, value, len, ttl_seconds) != 0) {
+                log_warn("[get_or_load] Failed to store the loaded value of key '%.*s'", (int)key_len, key);
+            }
+        }
+    }
+    single_flight_finish(&cache->flights, flight, value, len);
+    if (value != NULL && value_len != NULL) {
+        *value_len = len;
+    }
+    return value;
+}
+
+char* levelcache_get_or_load(LevelCache *cache, const char *key, LevelCacheLoader loader, void *ctx, uint32_t ttl_seconds) {
+    return levelcache_get_or_load_n(cache, key, strlen(key), NULL, loader, ctx, ttl_seconds);
+}
+
+char* levelcache_get_or_load_n(LevelCache *cache, const char *key, size_t key_len, size_t *value_len,
+                               LevelCacheLoader loader, void *ctx, uint32_t ttl_seconds) {
+    log_trace("[get_or_load] Getting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    uint64_t hash = ki_hash(key, key_len);
+    LevelCachePinnedValue cached;
+    uint64_t expiration = 0;
+    int leader;
+    Flight *flight;
+
+    if (get_pinned(cache, key, key_len, &cached, &expiration) == 0) {
+        // Only one caller refreshes a key; the others keep the cached value.
+        if (!refresh_early(cache, expiration) ||
+            (flight = single_flight_begin(&cache->flights, key, key_len, hash, 0, &leader)) == NULL) {
+            char *result = copy_pinned(&cached, value_len);
+            stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+            return result;
+        }
+        log_debug("[get_or_load] Refreshing key '%.*s' before it expires", (int)key_len, key);
+        stat_add(cache, STAT_EARLY_REFRESHES, 1);
+        char *result = load_value(cache, key, key_len, value_len, loader, ctx, ttl_seconds, flight);
+        if (result == NULL) {
+            return copy_pinned(&cached, value_len);
+        }
+        levelcache_value_release(&cached);
+        return result;
+    }
+
+    flight = single_flight_begin(&cache->flights, key, key_len, hash, 1, &leader);
+    if (flight == NULL) {
+        log_error("[get_or_load] Failed to allocate memory for the load of key '%.*s'", (int)key_len, key);
+        return NULL;
+    }
+    if (!leader) {
+        log_debug("[get_or_load] Waiting for the load of key '%.*s' in progress", (int)key_len, key);
+        stat_add(cache, STAT_COALESCED_LOADS, 1);
+        return single_flight_wait(&cache->flights, flight, value_len);
+    }
+    // A flight that ended between the miss and single_flight_begin stored
+    // its value first, so look again before loading it a second time.
+    if (get_pinned(cache, key, key_len, &cached, NULL) == 0) {
+        size_t len = 0;
+        char *result = copy_pinned(&cached, &len);
+        single_flight_finish(&cache->flights, flight, result, len);
+        if (result != NULL && value_len != NULL) {
+            *value_len = len;
+        }
+        stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+        return result;
+    }
+    return load_value(cache, key, key_len, value_len, loader, ctx, ttl_seconds, flight);
+}
+
+ssize_t levelcache_get_into(LevelCache *cache, const char *key, char *buf, size_t buf_len) {
+    return levelcache_get_into_n(cache, key, strlen(key), buf, buf_len);
+}
+
+ssize_t levelcache_get_into_n(LevelCache *cache, const char *key, size_t key_len, char *buf, size_t buf_len) {
+    log_trace("[get_into] Getting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    LevelCachePinnedValue value;
+    if (get_pinned(cache, key, key_len, &value, NULL) != 0) {
+        stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+        return -1;
+    }
+    uint64_t pinned_at = cache_stats_ticks(&cache->stats);
+
+    ssize_t len = (ssize_t)value.len;
+    if (value.len <= buf_len) {
+        memcpy(buf, value.data, value.len);
+        log_info("[get_into] Key '%.*s' retrieved successfully", (int)key_len, key);
+    } else {
+        log_debug("[get_into] Buffer of %zu bytes too small for key '%.*s' (%zu bytes)", buf_len, (int)key_len, key, value.len);
+    }
+    levelcache_value_release(&value);
+    uint64_t end = cache_stats_ticks(&cache->stats);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_COPY, pinned_at, end);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, end);
+    return len;
+}
+
+int levelcache_get_pinned(LevelCache *cache, const char *key, LevelCachePinnedValue *value) {
+    return levelcache_get_pinned_n(cache, key, strlen(key), value);
+}
+
+int levelcache_get_pinned_n(LevelCache *cache, const char *key, size_t key_len, LevelCachePinnedValue *value) {
+    log_trace("[get_pinned] Getting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    value->handle = NULL;
+    value->data = NULL;
+    value->len = 0;
+    int rc = get_pinned(cache, key, key_len, value, NULL);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+    if (rc != 0) {
+        return rc;
+    }
+    log_info("[get_pinned] Key '%.*s' pinned successfully", (int)key_len, key);
+    return 0;
+}
+
+void levelcache_value_release(LevelCachePinnedValue *value) {
+    if (value == NULL || value->handle == NULL) {
+        return;
+    }
+    value->release(value->handle);
+    value->handle = NULL;
+    value->data = NULL;
+    value->len = 0;
+}
+
+int levelcache_delete(LevelCache *cache, const char *key) {
+    return levelcache_delete_n(cache, key, strlen(key));
+}
+
+int levelcache_delete_n(LevelCache *cache, const char *key, size_t key_len) {
+    log_trace("[delete] Deleting key '%.*s'", (int)key_len, key);
+    uint64_t start = cache_stats_ticks(&cache->stats);
+    uint64_t hash = ki_hash(key, key_len);
+    IndexShard *shard = shard_for(cache, hash);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    KeyMetadata *meta;
+    meta = meta_find(shard, key, key_len, hash);
+    uint64_t indexed_at = cache_stats_ticks(&cache->stats);
+
+    char *err = NULL;
+    cache->engine->del(cache->db, cache->woptions, key, key_len, &err);
+    uint64_t deleted_at = cache_stats_ticks(&cache->stats);
+
+    if (err != NULL) {
+        log_error("[delete] Failed to delete key '%.*s' from leveldb: %s", (int)key_len, key, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        pthread_rwlock_unlock(&shard->lock);
+        return -1;
+    }
+
+    hot_invalidate(cache, key, key_len, hash);
+    if (meta != NULL) {
+        ki_erase(&shard->index, &meta->node);
+        tw_cancel(&shard->wheel, &meta->timer);
+        memory_sub(cache, meta_size(meta));
+        meta_free(shard, meta);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    log_info("[delete] Key '%.*s' deleted successfully", (int)key_len, key);
+
+    stat_time(cache, LEVELCACHE_OP_DELETE, LEVELCACHE_PHASE_INDEX, start, indexed_at);
+    stat_time(cache, LEVELCACHE_OP_DELETE, LEVELCACHE_PHASE_ENGINE, indexed_at, deleted_at);
+    stat_time(cache, LEVELCACHE_OP_DELETE, LEVELCACHE_PHASE_TOTAL, start, cache_stats_ticks(&cache->stats));
+    return 0;
 }
 
-LevelCache* levelcache_open(const char *path, size_t max_memory_mb, uint32_t default_ttl_seconds, uint32_t cleanup_frequency_sec, int log_level, engine_t etype) {
-    log_set_level(log_level);
-    log_info("[open] Opening database at '%s'", path);
+// Per-key scratch state shared by the batch operations.
+typedef struct BatchEntry {
+    size_t key_len;
+    uint64_t hash;
+    uint32_t shard;
+    size_t value_len;
+    KeyMetadata *meta;
+    int created;
+} BatchEntry;
 
-    LevelCache *cache = (LevelCache *) malloc(sizeof(LevelCache));
-    if (cache == NULL) {
-        log_error("[open] Failed to allocate memory for cache");
+// A NULL `key_lens` means the keys are NUL-terminated.
+static BatchEntry* batch_prepare(const char *const *keys, const size_t *key_lens, size_t count, uint8_t *touched) {
+    BatchEntry *entries = (BatchEntry *) calloc(count, sizeof(BatchEntry));
+    if (entries == NULL) {
         return NULL;
     }
+    memset(touched, 0, LEVELCACHE_NUM_SHARDS);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].key_len = key_lens ? key_lens[i] : strlen(keys[i]);
+        entries[i].hash = ki_hash(keys[i], entries[i].key_len);
+        entries[i].shard = shard_index(entries[i].hash);
+        touched[entries[i].shard] = 1;
+    }
+    return entries;
+}
 
-    if (etype >= LIMIT && etype < 0) {
-        log_error("[open] Invalid engine type");
-        return NULL;
+// Shards are always locked in ascending order so concurrent batches cannot
+// deadlock against each other.
+static void batch_lock(LevelCache *cache, const uint8_t *touched) {
+    for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+        if (touched[i]) {
+            pthread_rwlock_wrlock(&cache->shards[i].lock);
+        }
     }
+}
 
-    log_info("[open] Configured engine to %s", engine_names[etype]);
+static void batch_unlock(LevelCache *cache, const uint8_t *touched) {
+    for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+        if (touched[i]) {
+            pthread_rwlock_unlock(&cache->shards[i].lock);
+        }
+    }
+}
 
-    StorageEngine *engine = ALL_ENGINES[etype];
-    
-    cache->engine = engine;
-    cache->index = NULL;
-    cache->default_ttl = (default_ttl_seconds > 0) ? default_ttl_seconds : DEFAULT_TTL_SEC;
-    cache->cleanup_frequency_sec = cleanup_frequency_sec;
-    cache->stop_cleanup_thread = 0;
-    cache->log_level = log_level;
-    cache->total_memory_bytes = sizeof(LevelCache);
-    
-    char *err = NULL;
+int levelcache_put_batch(LevelCache *cache, const char *const *keys, const char *const *values, size_t count, uint32_t ttl_seconds) {
+    return levelcache_put_batch_n(cache, keys, NULL, values, NULL, count, ttl_seconds);
+}
 
-    void* destroy_options = cache->engine->options_create();
-    cache->engine->destroy_db(destroy_options, path, &err);
-    cache->engine->options_destroy(destroy_options);
-    if (err != NULL) {
-        log_warn("[open] Could not destroy existing database: %s", err);
-        cache->engine->free_fn(err);
-        err = NULL; 
+int levelcache_put_batch_n(LevelCache *cache, const char *const *keys, const size_t *key_lens,
+                           const char *const *values, const size_t *value_lens, size_t count, uint32_t ttl_seconds) {
+    log_trace("[put_batch] Putting %zu keys", count);
+    if (count == 0) {
+        return 0;
     }
 
-    cache->options = cache->engine->options_create();
-    cache->engine->options_set_create_if_missing(cache->options, 1);
+    uint8_t touched[LEVELCACHE_NUM_SHARDS];
+    BatchEntry *entries = batch_prepare(keys, key_lens, count, touched);
+    if (entries == NULL) {
+        log_error("[put_batch] Failed to allocate batch state");
+        return -1;
+    }
 
-    cache->max_memory_mb = max_memory_mb;
-    if (cache->max_memory_mb > 0) {
-        size_t cache_size = cache->max_memory_mb * 1024 * 1024;
-        cache->lru_cache = cache->engine->cache_create_lru(cache_size);
-        cache->engine->options_set_cache(cache->options, cache->lru_cache);
-        cache->total_memory_bytes += cache_size;
-        log_info("[open] LRU cache created with size %zu MB", max_memory_mb);
+    uint32_t __ttl_seconds = (ttl_seconds > 0) ? ttl_seconds : cache->default_ttl;
+    uint64_t expiration = coarse_clock_now() + __ttl_seconds;
+
+    // Frame and encode every value before any shard is locked, as put does:
+    // compression, and training the codec's dictionary, can take a while.
+    FramedValue *framed = (FramedValue *) malloc(count * sizeof(FramedValue));
+    if (framed == NULL) {
+        log_error("[put_batch] Failed to allocate batch state");
+        free(entries);
+        return -1;
+    }
+    size_t num_framed = 0;
+    for (; num_framed < count; num_framed++) {
+        BatchEntry *e = &entries[num_framed];
+        e->value_len = value_lens ? value_lens[num_framed] : strlen(values[num_framed]);
+        if (frame_value(cache, &framed[num_framed], values[num_framed], e->value_len, expiration) != 0) {
+            log_error("[put_batch] Failed to allocate memory for value");
+            break;
+        }
+    }
+    if (num_framed < count) {
+        for (size_t i = 0; i < num_framed; i++) {
+            framed_release(&framed[i]);
+        }
+        free(framed);
+        free(entries);
+        return -1;
+    }
+
+    void *batch = cache->engine->writebatch_create();
+    batch_lock(cache, touched);
+
+    // Insert missing keys up front so duplicates within the batch share one
+    // entry; they are removed again if the engine write fails.
+    int rc = 0;
+    size_t added_bytes = 0;
+    uint64_t written_bytes = 0;
+    uint64_t stored_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        BatchEntry *e = &entries[i];
+        IndexShard *shard = &cache->shards[e->shard];
+        e->meta = cache->no_index ? NULL : meta_find(shard, keys[i], e->key_len, e->hash);
+        if (e->meta == NULL && !cache->no_index) {
+            if (!admit_new_key(cache, shard, e->hash, 0)) {
+                log_debug("[put_batch] Key '%.*s' not admitted", (int)e->key_len, keys[i]);
+                continue;
+            }
+            e->meta = meta_create(shard, keys[i], e->key_len, e->hash);
+            if (e->meta == NULL || ki_insert(&shard->index, &e->meta->node) != 0) {
+                log_error("[put_batch] Failed to allocate memory for key metadata");
+                if (e->meta != NULL) {
+                    meta_free(shard, e->meta);
+                }
+                rc = -1;
+                break;
+            }
+            e->created = 1;
+            added_bytes += meta_size(e->meta);
+        }
+        cache->engine->writebatch_put(batch, keys[i], e->key_len, framed[i].data, framed[i].len);
+        stored_bytes += framed[i].len;
+        written_bytes += e->value_len;
+    }
+
+    if (rc == 0) {
+        char *err = NULL;
+        cache->engine->write(cache->db, cache->woptions, batch, &err);
+        if (err != NULL) {
+            log_error("[put_batch] Failed to write batch of %zu keys: %s", count, err);
+            cache->engine->free_fn(err);
+            stat_add(cache, STAT_ENGINE_ERRORS, 1);
+            rc = -1;
+        }
+    }
+
+    if (rc == 0) {
+        for (size_t i = 0; i < count; i++) {
+            hot_invalidate(cache, keys[i], entries[i].key_len, entries[i].hash);
+            if (entries[i].meta != NULL) {
+                entries[i].meta->expiration = expiration;
+                schedule_expiry(&cache->shards[entries[i].shard], entries[i].meta);
+            }
+        }
+        memory_add(cache, added_bytes);
     } else {
-        cache->lru_cache = NULL;
-        cache->used_memory_bytes = 0;
+        log_debug("[put_batch] Rolling back in-memory inserts");
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i].created) {
+                ki_erase(&cache->shards[entries[i].shard].index, &entries[i].meta->node);
+                meta_free(&cache->shards[entries[i].shard], entries[i].meta);
+            }
+        }
     }
 
-    cache->db = cache->engine->open(cache->options, path, &err);
+    batch_unlock(cache, touched);
+    cache->engine->writebatch_destroy(batch);
+    for (size_t i = 0; i < count; i++) {
+        framed_release(&framed[i]);
+    }
+    free(framed);
+    free(entries);
+    if (rc == 0) {
+        log_info("[put_batch] %zu keys put successfully with TTL %u seconds", count, __ttl_seconds);
+        note_writes(cache, count);
+        stat_add(cache, STAT_BYTES_WRITTEN, written_bytes);
+        stat_add(cache, STAT_BYTES_STORED, stored_bytes);
+    }
+    return rc;
+}
 
-    if (err != NULL) {
-        log_error("[open] Failed to open database: %s", err);
-        cache->engine->free_fn(err);
-        cache->engine->options_destroy(cache->options);
-        if(cache->lru_cache) {
-            cache->engine->cache_destroy(cache->lru_cache);
+int levelcache_multi_get(LevelCache *cache, const char *const *keys, size_t count, char **values) {
+    return levelcache_multi_get_n(cache, keys, NULL, count, values, NULL);
+}
+
+int levelcache_multi_get_n(LevelCache *cache, const char *const *keys, const size_t *key_lens, size_t count,
+                           char **values, size_t *value_lens) {
+    log_trace("[multi_get] Getting %zu keys", count);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = NULL;
+        if (value_lens != NULL) {
+            value_lens[i] = 0;
         }
-        free(cache);
-        return NULL;
     }
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t start = cache_stats_ticks(&cache->stats);
 
-    cache->roptions = cache->engine->readoptions_create();
-    cache->woptions = cache->engine->writeoptions_create();
+    // Only keys that are live in the index and missing from the hot tier are
+    // sent to the engine.
+    const char **live_keys = (const char **) malloc(count * sizeof(char *));
+    size_t *live_lens = (size_t *) malloc(count * sizeof(size_t));
+    size_t *live_pos = (size_t *) malloc(count * sizeof(size_t));
+    char **engine_values = (char **) malloc(count * sizeof(char *));
+    size_t *engine_lens = (size_t *) malloc(count * sizeof(size_t));
+    char **errs = (char **) malloc(count * sizeof(char *));
+    uint64_t *live_hashes = (uint64_t *) malloc(count * sizeof(uint64_t));
+    uint64_t *live_expirations = (uint64_t *) malloc(count * sizeof(uint64_t));
+    uint64_t *live_generations = (uint64_t *) malloc(count * sizeof(uint64_t));
+    if (!live_keys || !live_lens || !live_pos || !engine_values || !engine_lens || !errs ||
+        !live_hashes || !live_expirations || !live_generations) {
+        log_error("[multi_get] Failed to allocate batch state");
+        free(live_keys); free(live_lens); free(live_pos);
+        free(engine_values); free(engine_lens); free(errs);
+        free(live_hashes); free(live_expirations); free(live_generations);
+        return -1;
+    }
 
-    if (cache->cleanup_frequency_sec > 0) {
-        if (pthread_create(&cache->cleanup_thread, NULL, cleanup_thread_function, cache)) {
-            log_error("[open] Failed to create cleanup thread");
-            cache->engine->close(cache);
-            return NULL;
+    int found = 0;
+    size_t live = 0;
+    uint64_t now = coarse_clock_now();
+    for (size_t i = 0; i < count && found >= 0; i++) {
+        size_t key_len = key_lens ? key_lens[i] : strlen(keys[i]);
+        uint64_t hash = ki_hash(keys[i], key_len);
+        uint64_t expiration = 0;
+        if (!cache->no_index && !index_lookup_live(cache, keys[i], key_len, hash, &expiration)) {
+            continue;
+        }
+        if (cache->hot != NULL) {
+            HotEntry *entry = hot_tier_lookup(cache->hot, keys[i], key_len, hash, now);
+            if (entry != NULL) {
+                char *result = (char *) malloc(entry->value_len + 1);
+                if (result == NULL) {
+                    log_error("[multi_get] Failed to allocate memory for result");
+                    found = -1;
+                } else {
+                    memcpy(result, hot_entry_value(entry), entry->value_len);
+                    result[entry->value_len] = '\0';
+                    values[i] = result;
+                    if (value_lens != NULL) {
+                        value_lens[i] = entry->value_len;
+                    }
+                    found++;
+                    stat_add(cache, STAT_HOT_TIER_HITS, 1);
+                    stat_add(cache, STAT_HITS, 1);
+                    stat_add(cache, STAT_BYTES_READ, entry->value_len);
+                }
+                hot_entry_release(entry);
+                continue;
+            }
+            live_generations[live] = hot_tier_generation(cache->hot, hash);
         }
+        live_hashes[live] = hash;
+        live_expirations[live] = expiration;
+        live_keys[live] = keys[i];
+        live_lens[live] = key_len;
+        live_pos[live] = i;
+        live++;
     }
 
-    log_info("[open] Database opened successfully");
-    log_warn("[open] Memory usage tracking does not include all internal leveldb allocations.");
-    return cache;
+    // The whole batch counts as one get: the index phase covers the pass
+    // over the index and hot tier, the copy phase the handling of what the
+    // engine returned.
+    uint64_t indexed_at = cache_stats_ticks(&cache->stats);
+    uint64_t fetched_at = indexed_at;
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_INDEX, start, indexed_at);
+    if (live > 0 && found >= 0) {
+        cache->engine->multi_get(cache->db, cache->roptions, live, live_keys, live_lens, engine_values, engine_lens, errs);
+        fetched_at = cache_stats_ticks(&cache->stats);
+        stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_ENGINE, indexed_at, fetched_at);
+        for (size_t j = 0; j < live; j++) {
+            if (errs[j] != NULL) {
+                log_error("[multi_get] Failed to get key '%.*s': %s", (int)live_lens[j], live_keys[j], errs[j]);
+                cache->engine->free_fn(errs[j]);
+                stat_add(cache, STAT_ENGINE_ERRORS, 1);
+                found = -1;
+            }
+            if (engine_values[j] == NULL) {
+                stat_add(cache, STAT_MISSES, 1);
+                continue;
+            }
+            const char *data = engine_values[j];
+            size_t len = engine_lens[j];
+            char *decoded = NULL;
+            int unexpired = found >= 0 && unframe_value(cache, &data, &len);
+            if (unexpired && decode_value(cache, &data, &len, &decoded) != 0) {
+                log_error("[multi_get] Failed to decode the value of key '%.*s'", (int)live_lens[j], live_keys[j]);
+                stat_add(cache, STAT_ENGINE_ERRORS, 1);
+                stat_add(cache, STAT_MISSES, 1);
+            } else if (unexpired) {
+                // A decoded value is already a NUL-terminated copy.
+                char *result = (decoded != NULL) ? decoded : (char *) malloc(len + 1);
+                if (result == NULL) {
+                    log_error("[multi_get] Failed to allocate memory for result");
+                    found = -1;
+                } else {
+                    if (result != decoded) {
+                        memcpy(result, data, len);
+                        result[len] = '\0';
+                    }
+                    if (cache->no_index) {
+                        live_expirations[j] = value_header_expiration(engine_values[j]);
+                    }
+                    if (cache->hot != NULL) {
+                        hot_tier_insert(cache->hot, live_keys[j], live_lens[j], live_hashes[j], data,
+                                        len, live_expirations[j], live_generations[j]);
+                    }
+                    values[live_pos[j]] = result;
+                    if (value_lens != NULL) {
+                        value_lens[live_pos[j]] = len;
+                    }
+                    found++;
+                    stat_add(cache, STAT_HITS, 1);
+                    stat_add(cache, STAT_BYTES_READ, len);
+                }
+            } else if (found >= 0) {
+                if (cache->no_index) {
+                    expire_stored_key(cache, live_keys[j], live_lens[j], live_hashes[j]);
+                }
+                stat_add(cache, STAT_EXPIRED_ON_READ, 1);
+                stat_add(cache, STAT_MISSES, 1);
+            }
+            cache->engine->free_fn(engine_values[j]);
+        }
+    }
+
+    if (found < 0) {
+        for (size_t i = 0; i < count; i++) {
+            free(values[i]);
+            values[i] = NULL;
+        }
+    }
+    free(live_keys); free(live_lens); free(live_pos);
+    free(engine_values); free(engine_lens); free(errs);
+    free(live_hashes); free(live_expirations); free(live_generations);
+    uint64_t end = cache_stats_ticks(&cache->stats);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_COPY, fetched_at, end);
+    stat_time(cache, LEVELCACHE_OP_GET, LEVELCACHE_PHASE_TOTAL, start, end);
+    log_info("[multi_get] %d of %zu keys retrieved", found, count);
+    return found;
 }
 
-void levelcache_close(LevelCache *cache) {
-    if (cache == NULL) {
-        return;
+int levelcache_delete_batch(LevelCache *cache, const char *const *keys, size_t count) {
+    return levelcache_delete_batch_n(cache, keys, NULL, count);
+}
+
+int levelcache_delete_batch_n(LevelCache *cache, const char *const *keys, const size_t *key_lens, size_t count) {
+    log_trace("[delete_batch] Deleting %zu keys", count);
+    if (count == 0) {
+        return 0;
     }
-    log_info("[close] Closing database");
 
-    if (cache->cleanup_frequency_sec > 0) {
-        cache->stop_cleanup_thread = 1;
-        pthread_join(cache->cleanup_thread, NULL);
+    uint8_t touched[LEVELCACHE_NUM_SHARDS];
+    BatchEntry *entries = batch_prepare(keys, key_lens, count, touched);
+    if (entries == NULL) {
+        log_error("[delete_batch] Failed to allocate batch state");
+        return -1;
     }
 
-    KeyMetadata *current, *tmp;
-    HASH_ITER(hh, cache->index, current, tmp) {
-        HASH_DEL(cache->index, current);
-        cache->total_memory_bytes -= (sizeof(KeyMetadata) + strlen(current->key) + 1);
-        free(current->key);
-        free(current);
+    void *batch = cache->engine->writebatch_create();
+    for (size_t i = 0; i < count; i++) {
+        cache->engine->writebatch_delete(batch, keys[i], entries[i].key_len);
     }
 
-    cache->engine->close(cache->db);
-    cache->engine->options_destroy(cache->options);
-    cache->engine->readoptions_destroy(cache->roptions);
-    cache->engine->writeoptions_destroy(cache->woptions);
-    if (cache->lru_cache) {
-        cache->engine->cache_destroy(cache->lru_cache);
+    batch_lock(cache, touched);
+    char *err = NULL;
+    cache->engine->write(cache->db, cache->woptions, batch, &err);
+    if (err != NULL) {
+        log_error("[delete_batch] Failed to write batch of %zu keys: %s", count, err);
+        cache->engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        batch_unlock(cache, touched);
+        cache->engine->writebatch_destroy(batch);
+        free(entries);
+        return -1;
     }
-    free(cache);
-    log_info("[close] Database closed");
+
+    size_t freed_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        BatchEntry *e = &entries[i];
+        IndexShard *shard = &cache->shards[e->shard];
+        KeyMetadata *meta;
+        hot_invalidate(cache, keys[i], e->key_len, e->hash);
+        meta = meta_find(shard, keys[i], e->key_len, e->hash);
+        if (meta != NULL) {
+            ki_erase(&shard->index, &meta->node);
+            tw_cancel(&shard->wheel, &meta->timer);
+            freed_bytes += meta_size(meta);
+            meta_free(shard, meta);
+        }
+    }
+    memory_sub(cache, freed_bytes);
+    batch_unlock(cache, touched);
+
+    cache->engine->writebatch_destroy(batch);
+    free(entries);
+    log_info("[delete_batch] %zu keys deleted successfully", count);
+    return 0;
 }
 
-int levelcache_put(LevelCache *cache, const char *key, const char *value, uint32_t ttl_seconds) {
-    log_trace("[put] Putting key '%s'", key);
-    KeyMetadata *meta;
-    HASH_FIND_STR(cache->index, key, meta);
+// The first key past every key starting with `prefix`: drop trailing 0xff
+// bytes and increment the last remaining one. Sets *limit to NULL when there
+// is no such key (an empty or all-0xff prefix). Returns -1 if out of memory.
+static int prefix_limit(const char *prefix, size_t prefix_len, char **limit, size_t *limit_len) {
+    size_t len = prefix_len;
+    while (len > 0 && (unsigned char)prefix[len - 1] == 0xff) {
+        len--;
+    }
+    *limit = NULL;
+    *limit_len = 0;
+    if (len == 0) {
+        return 0;
+    }
+    *limit = (char *) malloc(len);
+    if (*limit == NULL) {
+        return -1;
+    }
+    memcpy(*limit, prefix, len);
+    (*limit)[len - 1]++;
+    *limit_len = len;
+    return 0;
+}
 
-    uint32_t __ttl_seconds = (ttl_seconds > 0) ? ttl_seconds : cache->default_ttl;
-    uint64_t expiration = time(NULL) + __ttl_seconds;
+// Keys of one range delete chunk, packed back to back.
+typedef struct RangeChunk {
+    char *keys;
+    size_t len;
+    size_t cap;
+    size_t offsets[DELETE_RANGE_CHUNK + 1];
+    size_t count;
+} RangeChunk;
 
-    int new_key = 0;
-    if (meta == NULL) {
-        log_debug("[put] Key '%s' not found, creating new entry", key);
-        meta = (KeyMetadata *) malloc(sizeof(KeyMetadata));
-        if (meta == NULL) {
-            log_error("[put] Failed to allocate memory for key metadata");
-            return -1;
+static int chunk_append(RangeChunk *chunk, const char *key, size_t key_len) {
+    if (chunk->len + key_len > chunk->cap) {
+        size_t cap = chunk->cap ? chunk->cap : 4096;
+        while (cap < chunk->len + key_len) {
+            cap *= 2;
         }
-        meta->key = strdup(key);
-        if (meta->key == NULL) {
-            log_error("[put] Failed to duplicate key string");
-            free(meta);
+        char *grown = (char *) realloc(chunk->keys, cap);
+        if (grown == NULL) {
             return -1;
         }
-        new_key = 1;
-        cache->total_memory_bytes += (sizeof(KeyMetadata) + strlen(key) + 1);
+        chunk->keys = grown;
+        chunk->cap = cap;
+    }
+    memcpy(chunk->keys + chunk->len, key, key_len);
+    chunk->offsets[chunk->count++] = chunk->len;
+    chunk->len += key_len;
+    chunk->offsets[chunk->count] = chunk->len;
+    return 0;
+}
+
+// Deletes up to DELETE_RANGE_CHUNK keys from `*cursor` on, with every shard
+// locked so no put, get or hot tier fill interleaves. The keys are listed
+// from the engine first; once the engine write succeeds the same keys are
+// pruned from the index and the hot tier. With a range tombstone the chunk
+// costs one engine write however many keys it holds. Advances `*cursor` to
+// the next key, or sets `*done` at the end of the range.
+static int delete_range_chunk(LevelCache *cache, RangeChunk *chunk, char **cursor, size_t *cursor_len,
+                              const char *limit, size_t limit_len, int *done, size_t *deleted) {
+    StorageEngine *engine = cache->engine;
+    uint8_t all[LEVELCACHE_NUM_SHARDS];
+    memset(all, 1, sizeof(all));
+    batch_lock(cache, all);
+
+    chunk->len = 0;
+    chunk->count = 0;
+    chunk->offsets[0] = 0;
+    void *iter = internal_iter_create(cache);
+    if (*cursor != NULL) {
+        engine->iter_seek(iter, *cursor, *cursor_len);
     } else {
-        log_debug("[put] Key '%s' found, updating expiration", key);
+        engine->iter_seek_to_first(iter);
+    }
+    int rc = 0;
+    *done = 1;
+    for (; engine->iter_valid(iter); engine->iter_next(iter)) {
+        size_t key_len;
+        const char *key = engine->iter_key(iter, &key_len);
+        if (limit != NULL && key_compare(key, key_len, limit, limit_len) >= 0) {
+            break;
+        }
+        if (chunk->count == DELETE_RANGE_CHUNK) {
+            *done = 0;
+            break;
+        }
+        if (chunk_append(chunk, key, key_len) != 0) {
+            log_error("[delete_range] Failed to allocate memory for keys");
+            rc = -1;
+            break;
+        }
     }
-    meta->expiration = expiration;
 
+    // The chunk ends before the next key, at the limit, or right after its
+    // last key when the range is open-ended.
+    char *end = NULL;
+    size_t end_len = 0;
+    if (rc == 0 && chunk->count > 0) {
+        const char *end_key = limit;
+        end_len = limit_len;
+        if (!*done) {
+            end_key = engine->iter_key(iter, &end_len);
+        } else if (limit == NULL) {
+            end_key = chunk->keys + chunk->offsets[chunk->count - 1];
+            end_len = chunk->offsets[chunk->count] - chunk->offsets[chunk->count - 1] + 1;
+        }
+        end = (char *) malloc(end_len);
+        if (end == NULL) {
+            log_error("[delete_range] Failed to allocate memory for keys");
+            rc = -1;
+        } else if (!*done || limit != NULL) {
+            memcpy(end, end_key, end_len);
+        } else {
+            memcpy(end, end_key, end_len - 1);
+            end[end_len - 1] = '\0';
+        }
+    }
     char *err = NULL;
-    cache->engine->put(cache->db, cache->woptions, key, strlen(key), value, strlen(value), &err);
+    engine->iter_get_error(iter, &err);
+    engine->iter_destroy(iter);
 
+    if (rc == 0 && err == NULL && chunk->count > 0) {
+        if (engine->delete_range != NULL) {
+            engine->delete_range(cache->db, cache->woptions, *cursor ? *cursor : "", *cursor ? *cursor_len : 0,
+                                 end, end_len, &err);
+        } else {
+            void *batch = engine->writebatch_create();
+            for (size_t i = 0; i < chunk->count; i++) {
+                engine->writebatch_delete(batch, chunk->keys + chunk->offsets[i], chunk->offsets[i + 1] - chunk->offsets[i]);
+            }
+            engine->write(cache->db, cache->woptions, batch, &err);
+            engine->writebatch_destroy(batch);
+        }
+    }
     if (err != NULL) {
-        log_error("[put] Failed to put key '%s' into leveldb: %s", key, err);
-        cache->engine->free_fn(err);
-        if (new_key) {
-            log_debug("[put] Rolling back in-memory insert for key '%s'", key);
-            cache->total_memory_bytes -= (sizeof(KeyMetadata) + strlen(key) + 1);
-            free(meta->key);
-            free(meta);
+        log_error("[delete_range] Failed to delete keys from the engine: %s", err);
+        engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        rc = -1;
+    }
+
+    if (rc == 0) {
+        size_t freed_bytes = 0;
+        for (size_t i = 0; i < chunk->count; i++) {
+            const char *key = chunk->keys + chunk->offsets[i];
+            size_t key_len = chunk->offsets[i + 1] - chunk->offsets[i];
+            uint64_t hash = ki_hash(key, key_len);
+            IndexShard *shard = shard_for(cache, hash);
+            hot_invalidate(cache, key, key_len, hash);
+            KeyMetadata *meta = meta_find(shard, key, key_len, hash);
+            if (meta != NULL) {
+                ki_erase(&shard->index, &meta->node);
+                tw_cancel(&shard->wheel, &meta->timer);
+                freed_bytes += meta_size(meta);
+                meta_free(shard, meta);
+            }
+        }
+        memory_sub(cache, freed_bytes);
+        *deleted += chunk->count;
+    }
+    batch_unlock(cache, all);
+
+    free(*cursor);
+    *cursor = end;
+    *cursor_len = end_len;
+    if (rc != 0) {
+        *done = 1;
+    }
+    return rc;
+}
+
+static int delete_range(LevelCache *cache, const char *start, size_t start_len, const char *limit, size_t limit_len) {
+    // Without an index or a hot tier nothing in memory refers to the keys,
+    // so a bounded range is a single tombstone and no key is listed at all.
+    if (cache->no_index && cache->hot == NULL && cache->engine->delete_range != NULL && limit != NULL) {
+        char *err = NULL;
+        cache->engine->delete_range(cache->db, cache->woptions, start ? start : "", start ? start_len : 0,
+                                    limit, limit_len, &err);
+        if (err != NULL) {
+            log_error("[delete_range] Failed to delete keys from the engine: %s", err);
+            cache->engine->free_fn(err);
+            stat_add(cache, STAT_ENGINE_ERRORS, 1);
+            return -1;
         }
+        log_info("[delete_range] Range deleted with one tombstone");
+        return 0;
+    }
+
+    RangeChunk *chunk = (RangeChunk *) malloc(sizeof(RangeChunk));
+    char *cursor = NULL;
+    size_t cursor_len = start_len;
+    if (chunk == NULL || (start != NULL && (cursor = (char *) malloc(start_len ? start_len : 1)) == NULL)) {
+        log_error("[delete_range] Failed to allocate memory for keys");
+        free(chunk);
         return -1;
     }
+    chunk->keys = NULL;
+    chunk->cap = 0;
+    if (start != NULL) {
+        memcpy(cursor, start, start_len);
+    }
 
-    if (new_key) {
-        HASH_ADD_KEYPTR(hh, cache->index, meta->key, strlen(meta->key), meta);
+    int rc = 0;
+    int done = 0;
+    size_t deleted = 0;
+    while (!done) {
+        rc = delete_range_chunk(cache, chunk, &cursor, &cursor_len, limit, limit_len, &done, &deleted);
     }
-    log_info("[put] Key '%s' put successfully with TTL %u seconds", key, __ttl_seconds);
+    free(cursor);
+    free(chunk->keys);
+    free(chunk);
+    if (rc == 0) {
+        log_info("[delete_range] %zu keys deleted successfully", deleted);
+    }
+    return rc;
+}
 
-    return 0;
+int levelcache_delete_range(LevelCache *cache, const char *start, size_t start_len, const char *limit, size_t limit_len) {
+    log_trace("[delete_range] Deleting range '%.*s' to '%.*s'", (int)start_len, start ? start : "",
+              (int)limit_len, limit ? limit : "");
+    if (start != NULL && limit != NULL && key_compare(start, start_len, limit, limit_len) >= 0) {
+        return 0;
+    }
+    return delete_range(cache, start, start_len, limit, limit_len);
 }
 
-char* levelcache_get(LevelCache *cache, const char *key) {
-    log_trace("[get] Getting key '%s'", key);
-    KeyMetadata *meta;
-    HASH_FIND_STR(cache->index, key, meta);
+int levelcache_delete_prefix(LevelCache *cache, const char *prefix, size_t prefix_len) {
+    log_trace("[delete_prefix] Deleting prefix '%.*s'", (int)prefix_len, prefix);
+    char *limit;
+    size_t limit_len;
+    if (prefix_limit(prefix, prefix_len, &limit, &limit_len) != 0) {
+        log_error("[delete_prefix] Failed to allocate memory for keys");
+        return -1;
+    }
+    int rc = delete_range(cache, prefix_len ? prefix : NULL, prefix_len, limit, limit_len);
+    free(limit);
+    return rc;
+}
 
-    if (meta != NULL) {
-        if (meta->expiration > 0 && time(NULL) > meta->expiration) {
-            log_info("[get] Key '%s' expired, deleting", key);
-            levelcache_delete(cache, key);
+struct LevelCacheScan {
+    LevelCache *cache;
+    void *roptions;         // the scan's own read options, or NULL
+    void *iter;
+    char *limit;            // exclusive upper bound, or NULL
+    size_t limit_len;
+    char *buffer;           // keys and values of the last batch
+    size_t buffer_cap;
+    int done;
+};
+
+// The engine's read options keep a pointer to the limit, so the scan owns
+// its copy until it is closed.
+static LevelCacheScan* scan_open(LevelCache *cache, const char *start, size_t start_len,
+                                 const char *limit, size_t limit_len, int prefix_seek) {
+    LevelCacheScan *scan = (LevelCacheScan *) calloc(1, sizeof(LevelCacheScan));
+    if (scan == NULL) {
+        log_error("[scan] Failed to allocate memory for scan");
+        return NULL;
+    }
+    scan->cache = cache;
+    if (limit != NULL) {
+        scan->limit = (char *) malloc(limit_len ? limit_len : 1);
+        if (scan->limit == NULL) {
+            log_error("[scan] Failed to allocate memory for scan");
+            free(scan);
             return NULL;
         }
+        memcpy(scan->limit, limit, limit_len);
+        scan->limit_len = limit_len;
+    }
+    if (cache->engine->readoptions_create_scan != NULL) {
+        scan->roptions = cache->engine->readoptions_create_scan(scan->limit, scan->limit_len, SCAN_READAHEAD, prefix_seek);
+    }
+    scan->iter = cache->engine->iter_create(cache->db, scan->roptions ? scan->roptions : cache->roptions);
+    if (start != NULL) {
+        cache->engine->iter_seek(scan->iter, start, start_len);
     } else {
-        log_debug("[get] Key '%s' not found in index", key);
-        return NULL;
+        cache->engine->iter_seek_to_first(scan->iter);
     }
+    return scan;
+}
 
-    char *err = NULL;
-    size_t value_len;
-    char *value_buffer = cache->engine->get(cache->db, cache->roptions, key, strlen(key), &value_len, &err);
-
-    if (err != NULL) {
-        log_error("[get] Failed to get key '%s' from leveldb: %s", key, err);
-        cache->engine->free_fn(err);
+LevelCacheScan* levelcache_scan_prefix(LevelCache *cache, const char *prefix, size_t prefix_len) {
+    log_trace("[scan] Scanning prefix '%.*s'", (int)prefix_len, prefix);
+    char *limit;
+    size_t limit_len;
+    if (prefix_limit(prefix, prefix_len, &limit, &limit_len) != 0) {
+        log_error("[scan] Failed to allocate memory for scan");
         return NULL;
     }
+    int prefix_seek = cache->scan_prefix_len > 0 && prefix_len >= cache->scan_prefix_len;
+    LevelCacheScan *scan = scan_open(cache, prefix_len ? prefix : NULL, prefix_len, limit, limit_len, prefix_seek);
+    free(limit);
+    return scan;
+}
 
-    if (value_buffer == NULL) {
-        log_warn("[get] Key '%s' not found in db, but present in index. Inconsistency.", key);
-        return NULL;
-    }
-    
-    char *result = (char *)malloc(value_len + 1);
-    if (result == NULL) {
-        log_error("[get] Failed to allocate memory for result");
-        cache->engine->free_fn(value_buffer);
-        return NULL;
+LevelCacheScan* levelcache_scan_range(LevelCache *cache, const char *start, size_t start_len,
+                                      const char *limit, size_t limit_len) {
+    log_trace("[scan] Scanning range '%.*s' to '%.*s'", (int)start_len, start ? start : "",
+              (int)limit_len, limit ? limit : "");
+    return scan_open(cache, start, start_len, limit, limit_len, 0);
+}
+
+// With value headers the expiration is read from the value, as a get does.
+// Otherwise only the index knows it; keys it has already dropped are skipped
+// too. Expired keys are left for the cleanup thread.
+static int scan_entry_live(LevelCache *cache, const char *key, size_t key_len,
+                           const char **value, size_t *value_len, uint64_t now) {
+    if (cache->value_header) {
+        return unframe_value(cache, value, value_len);
     }
-    memcpy(result, value_buffer, value_len);
-    result[value_len] = '\0';
-    cache->engine->free_fn(value_buffer);
-    log_info("[get] Key '%s' retrieved successfully", key);
-    return result;
+    uint64_t hash = ki_hash(key, key_len);
+    IndexShard *shard = shard_for(cache, hash);
+    pthread_rwlock_rdlock(&shard->lock);
+    KeyMetadata *meta = meta_find(shard, key, key_len, hash);
+    uint64_t expiration = (meta != NULL) ? meta->expiration : 0;
+    pthread_rwlock_unlock(&shard->lock);
+    return meta != NULL && (expiration == 0 || now <= expiration);
 }
 
-int levelcache_delete(LevelCache *cache, const char *key) {
-    log_trace("[delete] Deleting key '%s'", key);
-    KeyMetadata *meta;
-    HASH_FIND_STR(cache->index, key, meta);
+ssize_t levelcache_scan_next(LevelCacheScan *scan, LevelCacheScanEntry *entries, size_t max) {
+    LevelCache *cache = scan->cache;
+    StorageEngine *engine = cache->engine;
+    uint64_t now = coarse_clock_now();
+    size_t used = 0;
+    size_t count = 0;
+    uint64_t read_bytes = 0;
 
-    if (meta != NULL) {
-        HASH_DEL(cache->index, meta);
-        cache->total_memory_bytes -= (sizeof(KeyMetadata) + strlen(key) + 1);
+    // Entries record offsets while the buffer may still move; pointers are
+    // filled in once the batch is complete.
+    while (!scan->done && count < max) {
+        if (!engine->iter_valid(scan->iter)) {
+            scan->done = 1;
+            break;
+        }
+        size_t key_len, value_len;
+        const char *key = engine->iter_key(scan->iter, &key_len);
+        if (scan->limit != NULL && key_compare(key, key_len, scan->limit, scan->limit_len) >= 0) {
+            scan->done = 1;
+            break;
+        }
+        const char *value = engine->iter_value(scan->iter, &value_len);
+        char *decoded = NULL;
+        int live = scan_entry_live(cache, key, key_len, &value, &value_len, now);
+        if (live && decode_value(cache, &value, &value_len, &decoded) != 0) {
+            log_error("[scan] Failed to decode the value of key '%.*s'", (int)key_len, key);
+            stat_add(cache, STAT_ENGINE_ERRORS, 1);
+            live = 0;
+        }
+        if (live) {
+            size_t needed = used + key_len + value_len;
+            if (needed > scan->buffer_cap) {
+                size_t cap = scan->buffer_cap ? scan->buffer_cap : 4096;
+                while (cap < needed) {
+                    cap *= 2;
+                }
+                char *grown = (char *) realloc(scan->buffer, cap);
+                if (grown == NULL) {
+                    log_error("[scan] Failed to allocate memory for scan results");
+                    free(decoded);
+                    return -1;
+                }
+                scan->buffer = grown;
+                scan->buffer_cap = cap;
+            }
+            memcpy(scan->buffer + used, key, key_len);
+            memcpy(scan->buffer + used + key_len, value, value_len);
+            entries[count].key = (const char *)(uintptr_t)used;
+            entries[count].key_len = key_len;
+            entries[count].value_len = value_len;
+            used = needed;
+            read_bytes += value_len;
+            count++;
+            free(decoded);
+        }
+        engine->iter_next(scan->iter);
     }
 
     char *err = NULL;
-    cache->engine->del(cache->db, cache->woptions, key, strlen(key), &err);
-    
+    engine->iter_get_error(scan->iter, &err);
     if (err != NULL) {
-        log_error("[delete] Failed to delete key '%s' from leveldb: %s", key, err);
-        cache->engine->free_fn(err);
-        if (meta != NULL) {
-            log_debug("[delete] Rolling back in-memory delete for key '%s'", key);
-            HASH_ADD_KEYPTR(hh, cache->index, meta->key, strlen(meta->key), meta);
-            cache->total_memory_bytes += (sizeof(KeyMetadata) + strlen(key) + 1);
-        }
+        log_error("[scan] Failed to iterate: %s", err);
+        engine->free_fn(err);
+        stat_add(cache, STAT_ENGINE_ERRORS, 1);
+        scan->done = 1;
         return -1;
     }
-
-    if (meta != NULL) {
-        free(meta->key);
-        free(meta);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].key = scan->buffer + (uintptr_t)entries[i].key;
+        entries[i].value = entries[i].key + entries[i].key_len;
     }
-    log_info("[delete] Key '%s' deleted successfully", key);
+    stat_add(cache, STAT_BYTES_READ, read_bytes);
+    log_debug("[scan] Returning %zu entries", count);
+    return (ssize_t)count;
+}
 
-    return 0;
+void levelcache_scan_close(LevelCacheScan *scan) {
+    if (scan == NULL) {
+        return;
+    }
+    scan->cache->engine->iter_destroy(scan->iter);
+    if (scan->roptions != NULL) {
+        scan->cache->engine->readoptions_destroy(scan->roptions);
+    }
+    free(scan->limit);
+    free(scan->buffer);
+    free(scan);
 }
 
 size_t levelcache_get_memory_usage(LevelCache *cache) {
     if (cache == NULL) {
         return 0;
     }
-    return cache->total_memory_bytes;
+    return __atomic_load_n(&cache->total_memory_bytes, __ATOMIC_RELAXED);
+}
+
+void levelcache_get_memory_stats(LevelCache *cache, LevelCacheMemoryStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (cache == NULL) {
+        return;
+    }
+    stats->index_bytes = levelcache_get_memory_usage(cache) - cache->reserved_memory_bytes;
+    for (uint32_t i = 0; i < LEVELCACHE_NUM_SHARDS; i++) {
+        IndexShard *shard = &cache->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        stats->index_bytes += ki_memory(&shard->index);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    if (cache->hot != NULL) {
+        stats->hot_tier_bytes = hot_tier_usage(cache->hot);
+    }
+    EngineMemoryUsage engine_usage;
+    cache->engine->memory_usage(cache->db, cache->lru_cache, &engine_usage);
+    stats->memtable_bytes = engine_usage.memtables;
+    stats->table_reader_bytes = engine_usage.table_readers;
+    stats->block_cache_bytes = engine_usage.block_cache;
+    stats->total_bytes = stats->index_bytes + stats->hot_tier_bytes + stats->memtable_bytes +
+                         stats->table_reader_bytes + stats->block_cache_bytes;
+    stats->limit_bytes = cache->max_memory_mb * 1024 * 1024;
+    stats->evicted_keys = __atomic_load_n(&cache->evicted_keys, __ATOMIC_RELAXED);
+}
+
+void levelcache_get_stats(LevelCache *cache, LevelCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (cache == NULL) {
+        return;
+    }
+    stats->hits = cache_stats_counter(&cache->stats, STAT_HITS);
+    stats->misses = cache_stats_counter(&cache->stats, STAT_MISSES);
+    stats->hot_tier_hits = cache_stats_counter(&cache->stats, STAT_HOT_TIER_HITS);
+    stats->expired_on_read = cache_stats_counter(&cache->stats, STAT_EXPIRED_ON_READ);
+    stats->cleanup_deletions = cache_stats_counter(&cache->stats, STAT_CLEANUP_DELETIONS);
+    stats->evictions = __atomic_load_n(&cache->evicted_keys, __ATOMIC_RELAXED);
+    stats->engine_errors = cache_stats_counter(&cache->stats, STAT_ENGINE_ERRORS);
+    stats->bytes_read = cache_stats_counter(&cache->stats, STAT_BYTES_READ);
+    stats->bytes_written = cache_stats_counter(&cache->stats, STAT_BYTES_WRITTEN);
+    stats->bytes_stored = cache_stats_counter(&cache->stats, STAT_BYTES_STORED);
+    stats->admitted = cache_stats_counter(&cache->stats, STAT_ADMITTED);
+    stats->rejected = cache_stats_counter(&cache->stats, STAT_REJECTED);
+    stats->loads = cache_stats_counter(&cache->stats, STAT_LOADS);
+    stats->coalesced_loads = cache_stats_counter(&cache->stats, STAT_COALESCED_LOADS);
+    stats->early_refreshes = cache_stats_counter(&cache->stats, STAT_EARLY_REFRESHES);
+    if (cache->engine_statistics && cache->engine->block_cache_stats != NULL) {
+        cache->engine->block_cache_stats(cache->options, &stats->block_cache_hits, &stats->block_cache_misses);
+    }
+    for (unsigned op = 0; op < LEVELCACHE_OP_COUNT; op++) {
+        for (unsigned phase = 0; phase < LEVELCACHE_PHASE_COUNT; phase++) {
+            cache_stats_summarize(&cache->stats, stat_histogram((LevelCacheOp)op, (LevelCachePhase)phase),
+                                  &stats->latency[op][phase]);
+        }
+    }
+}
+
+char* levelcache_get_engine_stats(LevelCache *cache) {
+    if (cache == NULL) {
+        return NULL;
+    }
+    char *report = cache->engine->stats_report(cache->db);
+    char *statistics = NULL;
+    if (cache->engine_statistics) {
+        statistics = cache->engine->statistics_report(cache->options);
+    }
+    size_t report_len = report ? strlen(report) : 0;
+    size_t statistics_len = statistics ? strlen(statistics) : 0;
+
+    // Copied so the caller can release it with free() whatever the engine.
+    char *result = (char *) malloc(report_len + 1 + statistics_len + 1);
+    if (result != NULL) {
+        memcpy(result, report ? report : "", report_len);
+        size_t len = report_len;
+        if (statistics_len > 0) {
+            result[len++] = '\n';
+            memcpy(result + len, statistics, statistics_len);
+            len += statistics_len;
+        }
+        result[len] = '\0';
+    } else {
+        log_error("[stats] Failed to allocate memory for engine stats");
+    }
+    if (report != NULL) {
+        cache->engine->free_fn(report);
+    }
+    if (statistics != NULL) {
+        cache->engine->free_fn(statistics);
+    }
+    return result;
 }
@@ -1,4 +1,5 @@
 #include "../include/storage_engine.h"
+#include <stdlib.h>
 #include "leveldb/c.h"
 
 static void* ldb_open(void *options, const char *path, char **err) {
@@ -21,14 +22,94 @@ static void ldb_put(void *db, void *woptions, const char *key, size_t keylen, co
 static char* ldb_get(void *db, void *roptions, const char *key, size_t keylen, size_t *valuelen, char **err) {
     return leveldb_get((leveldb_t*)db, (leveldb_readoptions_t*)roptions, key, keylen, valuelen, err);
 }
+// LevelDB's C API cannot pin values; the engine-allocated copy is the handle.
+static void* ldb_get_pinned(void *db, void *roptions, const char *key, size_t keylen, const char **value, size_t *valuelen, char **err) {
+    char *buf = leveldb_get((leveldb_t*)db, (leveldb_readoptions_t*)roptions, key, keylen, valuelen, err);
+    *value = buf;
+    return buf;
+}
+static void ldb_pinned_destroy(void *handle) { leveldb_free(handle); }
 static void ldb_del(void *db, void *woptions, const char *key, size_t klen, char **err) {
     leveldb_delete((leveldb_t*)db, (leveldb_writeoptions_t*)woptions, key, klen, err);
 }
 
+static void* ldb_writebatch_create() { return leveldb_writebatch_create(); }
+static void ldb_writebatch_destroy(void *batch) { leveldb_writebatch_destroy((leveldb_writebatch_t*)batch); }
+static void ldb_writebatch_put(void *batch, const char *key, size_t keylen, const char *value, size_t valuelen) {
+    leveldb_writebatch_put((leveldb_writebatch_t*)batch, key, keylen, value, valuelen);
+}
+static void ldb_writebatch_delete(void *batch, const char *key, size_t keylen) {
+    leveldb_writebatch_delete((leveldb_writebatch_t*)batch, key, keylen);
+}
+static void ldb_write(void *db, void *woptions, void *batch, char **err) {
+    leveldb_write((leveldb_t*)db, (leveldb_writeoptions_t*)woptions, (leveldb_writebatch_t*)batch, err);
+}
+// LevelDB has no MultiGet; issue the point lookups back to back.
+static void ldb_multi_get(void *db, void *roptions, size_t num_keys, const char *const *keys, const size_t *keylens,
+                          char **values, size_t *valuelens, char **errs) {
+    for (size_t i = 0; i < num_keys; i++) {
+        errs[i] = NULL;
+        values[i] = leveldb_get((leveldb_t*)db, (leveldb_readoptions_t*)roptions, keys[i], keylens[i], &valuelens[i], &errs[i]);
+    }
+}
+
+static void* ldb_iter_create(void *db, void *roptions) {
+    return leveldb_create_iterator((leveldb_t*)db, (leveldb_readoptions_t*)roptions);
+}
+static void ldb_iter_destroy(void *iter) { leveldb_iter_destroy((leveldb_iterator_t*)iter); }
+static int ldb_iter_valid(const void *iter) { return leveldb_iter_valid((const leveldb_iterator_t*)iter); }
+static void ldb_iter_seek_to_first(void *iter) { leveldb_iter_seek_to_first((leveldb_iterator_t*)iter); }
+static void ldb_iter_seek_to_last(void *iter) { leveldb_iter_seek_to_last((leveldb_iterator_t*)iter); }
+static void ldb_iter_seek(void *iter, const char *key, size_t keylen) { leveldb_iter_seek((leveldb_iterator_t*)iter, key, keylen); }
+static void ldb_iter_next(void *iter) { leveldb_iter_next((leveldb_iterator_t*)iter); }
+static const char* ldb_iter_key(const void *iter, size_t *keylen) { return leveldb_iter_key((const leveldb_iterator_t*)iter, keylen); }
+static const char* ldb_iter_value(const void *iter, size_t *valuelen) { return leveldb_iter_value((const leveldb_iterator_t*)iter, valuelen); }
+static void ldb_iter_get_error(const void *iter, char **err) { leveldb_iter_get_error((const leveldb_iterator_t*)iter, err); }
+
+// LevelDB has no upper bound, read-ahead or prefix seek; a scan can only keep
+// the blocks it streams through from evicting the point lookups' working set.
+static void* ldb_readoptions_create_scan(const char *limit, size_t limit_len, size_t readahead, int prefix_seek) {
+    leveldb_readoptions_t *ro = leveldb_readoptions_create();
+    leveldb_readoptions_set_fill_cache(ro, 0);
+    return ro;
+}
+
 static void* ldb_cache_create_lru(size_t capacity) { return leveldb_cache_create_lru(capacity); }
 static void ldb_options_set_cache(void *options, void *cache) { leveldb_options_set_cache((leveldb_options_t*)options, (leveldb_cache_t*)cache); }
 static void ldb_cache_destroy(void *cache) { leveldb_cache_destroy((leveldb_cache_t*)cache); }
 
+static void ldb_options_set_write_buffer_size(void *options, size_t size) {
+    leveldb_options_set_write_buffer_size((leveldb_options_t*)options, size);
+}
+// LevelDB only reports one combined figure, memtables plus block cache.
+static void ldb_memory_usage(void *db, void *cache, EngineMemoryUsage *usage) {
+    usage->memtables = 0;
+    usage->table_readers = 0;
+    usage->block_cache = 0;
+    char *value = leveldb_property_value((leveldb_t*)db, "leveldb.approximate-memory-usage");
+    if (value != NULL) {
+        usage->memtables = strtoull(value, NULL, 10);
+        leveldb_free(value);
+    }
+}
+
+// LevelDB already mmaps its tables on 64-bit builds and has no hash index or
+// way to skip its log, so the profile comes down to a bloom filter per table
+// and a larger memtable. The filter policy must outlive the db.
+static void* ldb_options_set_ephemeral(void *options, void *cache, size_t write_buffer_size) {
+    leveldb_filterpolicy_t *filter = leveldb_filterpolicy_create_bloom(10);
+    leveldb_options_set_filter_policy((leveldb_options_t*)options, filter);
+    leveldb_options_set_write_buffer_size((leveldb_options_t*)options, write_buffer_size);
+    return filter;
+}
+static void ldb_ephemeral_destroy(void *handle) { leveldb_filterpolicy_destroy((leveldb_filterpolicy_t*)handle); }
+
+static char* ldb_stats_report(void *db) { return leveldb_property_value((leveldb_t*)db, "leveldb.stats"); }
+
+static void ldb_compact_range(void *db, const char *start, size_t start_len, const char *limit, size_t limit_len) {
+    leveldb_compact_range((leveldb_t*)db, start, start_len, limit, limit_len);
+}
+
 static void ldb_free(void *ptr) { leveldb_free(ptr); }
 
 StorageEngine LEVELDB_ENGINE = {
@@ -46,9 +127,35 @@ StorageEngine LEVELDB_ENGINE = {
     .put = ldb_put,
     .get = ldb_get,
     .del = ldb_del,
+    .get_pinned = ldb_get_pinned,
+    .pinned_destroy = ldb_pinned_destroy,
+    .writebatch_create = ldb_writebatch_create,
+    .writebatch_destroy = ldb_writebatch_destroy,
+    .writebatch_put = ldb_writebatch_put,
+    .writebatch_delete = ldb_writebatch_delete,
+    .write = ldb_write,
+    .multi_get = ldb_multi_get,
+    .iter_create = ldb_iter_create,
+    .iter_destroy = ldb_iter_destroy,
+    .iter_valid = ldb_iter_valid,
+    .iter_seek_to_first = ldb_iter_seek_to_first,
+    .iter_seek_to_last = ldb_iter_seek_to_last,
+    .iter_seek = ldb_iter_seek,
+    .iter_next = ldb_iter_next,
+    .iter_key = ldb_iter_key,
+    .iter_value = ldb_iter_value,
+    .iter_get_error = ldb_iter_get_error,
+    .readoptions_create_scan = ldb_readoptions_create_scan,
     .cache_create_lru = ldb_cache_create_lru,
     .options_set_cache = ldb_options_set_cache,
     .cache_destroy = ldb_cache_destroy,
+    .options_set_write_buffer_size = ldb_options_set_write_buffer_size,
+    .memory_usage = ldb_memory_usage,
+    .stats_report = ldb_stats_report,
+    .compact_range = ldb_compact_range,
+    .options_set_ephemeral = ldb_options_set_ephemeral,
+    .ephemeral_destroy = ldb_ephemeral_destroy,
     .free_fn = ldb_free,
     .supports_native_ttl = false,
+    .persistent = true,
 };
@@ -0,0 +1,443 @@
+#include "../include/storage_engine.h"
+#include "../include/key_index.h"
+#include "../include/skiplist.h"
+#include "../include/write_batch.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An in-process engine: keys live in hash-partitioned skiplists, each shard
+// under its own lock, with nodes and small values carved out of the shard's
+// slab. Nothing touches the disk, so the path is ignored and the data is gone
+// once the db is closed.
+
+#define MEM_SHARD_BITS 4
+#define MEM_NUM_SHARDS (1u << MEM_SHARD_BITS)
+
+// A value is shared between its node and any pinned readers, and freed by
+// whoever drops the last reference.
+typedef struct MemValue {
+    uint32_t refs;
+    SkipList *shard;
+    size_t len;
+    char data[];
+} MemValue;
+
+typedef struct MemDb {
+    SkipList shards[MEM_NUM_SHARDS];
+} MemDb;
+
+// The engine has no tunables; every options object is this placeholder.
+static char mem_no_options;
+
+static inline size_t value_size(size_t len) {
+    return sizeof(MemValue) + len;
+}
+
+static inline SkipList* shard_for(MemDb *db, const char *key, size_t key_len) {
+    return &db->shards[ki_hash(key, key_len) & (MEM_NUM_SHARDS - 1)];
+}
+
+static char* mem_error(const char *message) {
+    return strdup(message);
+}
+
+static void value_free(MemValue *value) {
+    SkipList *shard = value->shard;
+    if (slab_is_large(value_size(value->len))) {
+        free(value);
+        return;
+    }
+    pthread_rwlock_wrlock(&shard->lock);
+    slab_free(&shard->slab, value, value_size(value->len));
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// Drops the node's reference. Called with the shard write lock held, so a
+// value with no pinned readers goes straight back to the slab.
+static void value_release_locked(SkipList *shard, MemValue *value) {
+    if (__atomic_sub_fetch(&value->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_sub_fetch(&shard->bytes, slab_object_size(value_size(value->len)), __ATOMIC_RELAXED);
+        slab_free(&shard->slab, value, value_size(value->len));
+    }
+}
+
+// Called with the shard write lock held. Returns 0, or -1 if out of memory.
+static int shard_put(SkipList *shard, const char *key, size_t key_len, const char *data, size_t len) {
+    MemValue *value = (MemValue *) slab_alloc(&shard->slab, value_size(len));
+    if (value == NULL) {
+        return -1;
+    }
+    value->refs = 1;
+    value->shard = shard;
+    value->len = len;
+    memcpy(value->data, data, len);
+
+    int created = 0;
+    SkipNode *node = skiplist_insert(shard, key, key_len, &created);
+    if (node == NULL) {
+        slab_free(&shard->slab, value, value_size(len));
+        return -1;
+    }
+    if (!created) {
+        value_release_locked(shard, (MemValue *)node->value);
+    }
+    node->value = value;
+    __atomic_add_fetch(&shard->bytes, slab_object_size(value_size(len)), __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Called with the shard write lock held.
+static void shard_delete(SkipList *shard, const char *key, size_t key_len) {
+    MemValue *value = (MemValue *) skiplist_erase(shard, key, key_len);
+    if (value != NULL) {
+        value_release_locked(shard, value);
+    }
+}
+
+static void* mem_open(void *options, const char *path, char **err) {
+    MemDb *db = NULL;
+    if (posix_memalign((void **)&db, 64, sizeof(MemDb)) != 0) {
+        *err = mem_error("memory engine: out of memory");
+        return NULL;
+    }
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        if (skiplist_init(&db->shards[i], 0x9e3779b9u * (i + 1)) != 0) {
+            for (uint32_t j = 0; j < i; j++) {
+                skiplist_destroy(&db->shards[j]);
+            }
+            free(db);
+            *err = mem_error("memory engine: out of memory");
+            return NULL;
+        }
+    }
+    return db;
+}
+
+static void mem_close(void *handle) {
+    MemDb *db = (MemDb *)handle;
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        SkipList *shard = &db->shards[i];
+        // Small values go away with the slab; only large ones are freed here.
+        for (SkipNode *node = shard->head->next[0]; node != NULL; node = node->next[0]) {
+            MemValue *value = (MemValue *)node->value;
+            if (slab_is_large(value_size(value->len))) {
+                free(value);
+            }
+        }
+        skiplist_destroy(shard);
+    }
+    free(db);
+}
+
+static void* mem_options_create() { return &mem_no_options; }
+static void mem_options_destroy(void *options) {}
+static void mem_options_set_create_if_missing(void *options, int v) {}
+static void mem_destroy_db(void *options, const char *path, char **err) {}
+
+static void* mem_readoptions_create() { return &mem_no_options; }
+static void* mem_writeoptions_create() { return &mem_no_options; }
+static void mem_readoptions_destroy(void *roptions) {}
+static void mem_writeoptions_destroy(void *woptions) {}
+
+static void mem_put(void *handle, void *woptions, const char *key, size_t keylen, const char *value, size_t valuelen, char **err) {
+    SkipList *shard = shard_for((MemDb *)handle, key, keylen);
+    pthread_rwlock_wrlock(&shard->lock);
+    int rc = shard_put(shard, key, keylen, value, valuelen);
+    pthread_rwlock_unlock(&shard->lock);
+    if (rc != 0) {
+        *err = mem_error("memory engine: out of memory");
+    }
+}
+
+static char* mem_get(void *handle, void *roptions, const char *key, size_t keylen, size_t *valuelen, char **err) {
+    SkipList *shard = shard_for((MemDb *)handle, key, keylen);
+    char *result = NULL;
+    pthread_rwlock_rdlock(&shard->lock);
+    SkipNode *node = skiplist_find(shard, key, keylen);
+    if (node != NULL) {
+        MemValue *found = (MemValue *)node->value;
+        result = (char *) malloc(found->len ? found->len : 1);
+        if (result != NULL) {
+            memcpy(result, found->data, found->len);
+            *valuelen = found->len;
+        } else {
+            *err = mem_error("memory engine: out of memory");
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+// The handle is a reference on the value itself, so reads copy nothing.
+static void* mem_get_pinned(void *handle, void *roptions, const char *key, size_t keylen, const char **value, size_t *valuelen, char **err) {
+    SkipList *shard = shard_for((MemDb *)handle, key, keylen);
+    MemValue *pinned = NULL;
+    pthread_rwlock_rdlock(&shard->lock);
+    SkipNode *node = skiplist_find(shard, key, keylen);
+    if (node != NULL) {
+        pinned = (MemValue *)node->value;
+        __atomic_add_fetch(&pinned->refs, 1, __ATOMIC_RELAXED);
+        *value = pinned->data;
+        *valuelen = pinned->len;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return pinned;
+}
+
+static void mem_pinned_destroy(void *handle) {
+    MemValue *value = (MemValue *)handle;
+    if (__atomic_sub_fetch(&value->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_sub_fetch(&value->shard->bytes, slab_object_size(value_size(value->len)), __ATOMIC_RELAXED);
+        value_free(value);
+    }
+}
+
+static void mem_del(void *handle, void *woptions, const char *key, size_t keylen, char **err) {
+    SkipList *shard = shard_for((MemDb *)handle, key, keylen);
+    pthread_rwlock_wrlock(&shard->lock);
+    shard_delete(shard, key, keylen);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+static void* mem_writebatch_create() { return write_batch_create(); }
+static void mem_writebatch_destroy(void *batch) { write_batch_destroy((WriteBatch *)batch); }
+static void mem_writebatch_put(void *batch, const char *key, size_t keylen, const char *value, size_t valuelen) {
+    write_batch_put((WriteBatch *)batch, key, keylen, value, valuelen);
+}
+static void mem_writebatch_delete(void *batch, const char *key, size_t keylen) {
+    write_batch_delete((WriteBatch *)batch, key, keylen);
+}
+
+// Every shard the batch touches is write-locked, in shard order, for the
+// whole write, so readers see all of the batch or none of it. Values and
+// missing nodes are allocated before any record is applied; if that runs out
+// of memory, what was allocated is given back and the db is left untouched.
+// Deletes only clear their node's value while records are applied, so a later
+// put of the same key finds its node still there; cleared nodes are unlinked
+// at the end.
+static void mem_write(void *handle, void *woptions, void *batch_handle, char **err) {
+    MemDb *db = (MemDb *)handle;
+    WriteBatch *batch = (WriteBatch *)batch_handle;
+    if (batch->failed) {
+        *err = mem_error("memory engine: out of memory building batch");
+        return;
+    }
+    size_t pos = 0, puts = 0;
+    uint32_t touched = 0;
+    WriteBatchEntry entry;
+    while (write_batch_next(batch, &pos, &entry)) {
+        touched |= 1u << (ki_hash(entry.key, entry.key_len) & (MEM_NUM_SHARDS - 1));
+        puts += (entry.type == WRITE_BATCH_PUT);
+    }
+    MemValue **values = NULL;
+    if (puts > 0 && (values = (MemValue **) malloc(puts * sizeof(MemValue *))) == NULL) {
+        *err = mem_error("memory engine: out of memory");
+        return;
+    }
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_wrlock(&db->shards[i].lock);
+        }
+    }
+
+    size_t prepared = 0;
+    int failed = 0;
+    for (pos = 0; !failed && write_batch_next(batch, &pos, &entry); ) {
+        if (entry.type != WRITE_BATCH_PUT) {
+            continue;
+        }
+        SkipList *shard = shard_for(db, entry.key, entry.key_len);
+        MemValue *value = (MemValue *) slab_alloc(&shard->slab, value_size(entry.value_len));
+        int created = 0;
+        if (value == NULL || skiplist_insert(shard, entry.key, entry.key_len, &created) == NULL) {
+            if (value != NULL) {
+                slab_free(&shard->slab, value, value_size(entry.value_len));
+            }
+            failed = 1;
+            break;
+        }
+        value->refs = 1;
+        value->shard = shard;
+        value->len = entry.value_len;
+        memcpy(value->data, entry.value, entry.value_len);
+        values[prepared++] = value;
+    }
+
+    if (failed) {
+        // Nodes created above are the only ones without a value.
+        size_t undone = 0;
+        for (pos = 0; undone < prepared && write_batch_next(batch, &pos, &entry); ) {
+            if (entry.type != WRITE_BATCH_PUT) {
+                continue;
+            }
+            SkipList *shard = shard_for(db, entry.key, entry.key_len);
+            MemValue *value = values[undone++];
+            slab_free(&shard->slab, value, value_size(value->len));
+        }
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            SkipList *shard = shard_for(db, entry.key, entry.key_len);
+            SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+            if (node != NULL && node->value == NULL) {
+                skiplist_erase(shard, entry.key, entry.key_len);
+            }
+        }
+        *err = mem_error("memory engine: out of memory");
+    } else {
+        size_t applied = 0;
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            SkipList *shard = shard_for(db, entry.key, entry.key_len);
+            SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+            if (node == NULL) {
+                continue;
+            }
+            if (node->value != NULL) {
+                value_release_locked(shard, (MemValue *)node->value);
+                node->value = NULL;
+            }
+            if (entry.type == WRITE_BATCH_PUT) {
+                MemValue *value = values[applied++];
+                node->value = value;
+                __atomic_add_fetch(&shard->bytes, slab_object_size(value_size(value->len)), __ATOMIC_RELAXED);
+            }
+        }
+        for (pos = 0; write_batch_next(batch, &pos, &entry); ) {
+            if (entry.type == WRITE_BATCH_DELETE) {
+                SkipList *shard = shard_for(db, entry.key, entry.key_len);
+                SkipNode *node = skiplist_find(shard, entry.key, entry.key_len);
+                if (node != NULL && node->value == NULL) {
+                    skiplist_erase(shard, entry.key, entry.key_len);
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_unlock(&db->shards[i].lock);
+        }
+    }
+    free(values);
+}
+
+static void mem_multi_get(void *db, void *roptions, size_t num_keys, const char *const *keys, const size_t *keylens,
+                          char **values, size_t *valuelens, char **errs) {
+    for (size_t i = 0; i < num_keys; i++) {
+        errs[i] = NULL;
+        values[i] = mem_get(db, roptions, keys[i], keylens[i], &valuelens[i], &errs[i]);
+    }
+}
+
+static const char* mem_value_of(const void *value, size_t *len) {
+    const MemValue *v = (const MemValue *)value;
+    *len = v->len;
+    return v->data;
+}
+
+static void* mem_iter_create(void *db, void *roptions) {
+    return skiplist_iter_create(((MemDb *)db)->shards, MEM_NUM_SHARDS, mem_value_of);
+}
+static void mem_iter_destroy(void *iter) { skiplist_iter_destroy((SkipIterator *)iter); }
+static int mem_iter_valid(const void *iter) { return skiplist_iter_valid((const SkipIterator *)iter); }
+static void mem_iter_seek(void *iter, const char *key, size_t keylen) { skiplist_iter_seek((SkipIterator *)iter, key, keylen); }
+static void mem_iter_seek_to_first(void *iter) { skiplist_iter_seek((SkipIterator *)iter, "", 0); }
+static void mem_iter_seek_to_last(void *iter) { skiplist_iter_seek_to_last((SkipIterator *)iter); }
+static void mem_iter_next(void *iter) { skiplist_iter_next((SkipIterator *)iter); }
+static const char* mem_iter_key(const void *iter, size_t *keylen) { return skiplist_iter_key((const SkipIterator *)iter, keylen); }
+static const char* mem_iter_value(const void *iter, size_t *valuelen) { return skiplist_iter_value((const SkipIterator *)iter, valuelen); }
+static void mem_iter_get_error(const void *iter, char **err) {
+    if (skiplist_iter_failed((const SkipIterator *)iter)) {
+        *err = mem_error("memory engine: out of memory while iterating");
+    }
+}
+
+// Values are the data itself; there is no block cache to size.
+static void* mem_cache_create_lru(size_t capacity) { return NULL; }
+static void mem_options_set_cache(void *options, void *cache) {}
+static void mem_cache_destroy(void *cache) {}
+static void mem_options_set_write_buffer_size(void *options, size_t size) {}
+
+// Everything the engine holds is reported as memtable memory.
+static void mem_memory_usage(void *handle, void *cache, EngineMemoryUsage *usage) {
+    MemDb *db = (MemDb *)handle;
+    usage->memtables = 0;
+    usage->table_readers = 0;
+    usage->block_cache = 0;
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        usage->memtables += __atomic_load_n(&db->shards[i].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static char* mem_stats_report(void *handle) {
+    MemDb *db = (MemDb *)handle;
+    size_t count = 0;
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < MEM_NUM_SHARDS; i++) {
+        SkipList *shard = &db->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        count += shard->count;
+        pthread_rwlock_unlock(&shard->lock);
+        bytes += __atomic_load_n(&shard->bytes, __ATOMIC_RELAXED);
+    }
+    char *report = (char *) malloc(128);
+    if (report != NULL) {
+        snprintf(report, 128, "memory engine: %zu entries, %zu bytes in %u shards\n", count, bytes, MEM_NUM_SHARDS);
+    }
+    return report;
+}
+
+static void mem_compact_range(void *db, const char *start, size_t start_len, const char *limit, size_t limit_len) {}
+
+// Already as ephemeral as it gets.
+static void* mem_options_set_ephemeral(void *options, void *cache, size_t write_buffer_size) { return NULL; }
+static void mem_ephemeral_destroy(void *handle) {}
+
+static void mem_free(void *ptr) { free(ptr); }
+
+StorageEngine MEMORY_ENGINE = {
+    .type = ENGINE_MEMORY,
+    .open = mem_open,
+    .close = mem_close,
+    .options_create = mem_options_create,
+    .options_destroy = mem_options_destroy,
+    .options_set_create_if_missing = mem_options_set_create_if_missing,
+    .destroy_db = mem_destroy_db,
+    .readoptions_create = mem_readoptions_create,
+    .writeoptions_create = mem_writeoptions_create,
+    .readoptions_destroy = mem_readoptions_destroy,
+    .writeoptions_destroy = mem_writeoptions_destroy,
+    .put = mem_put,
+    .get = mem_get,
+    .del = mem_del,
+    .get_pinned = mem_get_pinned,
+    .pinned_destroy = mem_pinned_destroy,
+    .writebatch_create = mem_writebatch_create,
+    .writebatch_destroy = mem_writebatch_destroy,
+    .writebatch_put = mem_writebatch_put,
+    .writebatch_delete = mem_writebatch_delete,
+    .write = mem_write,
+    .multi_get = mem_multi_get,
+    .iter_create = mem_iter_create,
+    .iter_destroy = mem_iter_destroy,
+    .iter_valid = mem_iter_valid,
+    .iter_seek_to_first = mem_iter_seek_to_first,
+    .iter_seek_to_last = mem_iter_seek_to_last,
+    .iter_seek = mem_iter_seek,
+    .iter_next = mem_iter_next,
+    .iter_key = mem_iter_key,
+    .iter_value = mem_iter_value,
+    .iter_get_error = mem_iter_get_error,
+    .cache_create_lru = mem_cache_create_lru,
+    .options_set_cache = mem_options_set_cache,
+    .cache_destroy = mem_cache_destroy,
+    .options_set_write_buffer_size = mem_options_set_write_buffer_size,
+    .memory_usage = mem_memory_usage,
+    .stats_report = mem_stats_report,
+    .compact_range = mem_compact_range,
+    .options_set_ephemeral = mem_options_set_ephemeral,
+    .ephemeral_destroy = mem_ephemeral_destroy,
+    .free_fn = mem_free,
+    .supports_native_ttl = false,
+    .persistent = false,
+};
@@ -1,5 +1,8 @@
 #include "../include/storage_engine.h"
+#include "../include/value_format.h"
+#include "../include/coarse_clock.h"
 #include <stdlib.h>
+#include <string.h>
 #include "rocksdb/c.h"
 
 static void* rdb_open(void *options, const char *path, char **err) {
@@ -22,20 +25,167 @@ static void rdb_put(void *db, void *woptions, const char *key, size_t keylen, co
 static char* rdb_get(void *db, void *roptions, const char *key, size_t keylen, size_t *valuelen, char **err) {
     return rocksdb_get((rocksdb_t*)db, (rocksdb_readoptions_t*)roptions, key, keylen, valuelen, err);
 }
+static void* rdb_get_pinned(void *db, void *roptions, const char *key, size_t keylen, const char **value, size_t *valuelen, char **err) {
+    rocksdb_pinnableslice_t *slice = rocksdb_get_pinned((rocksdb_t*)db, (rocksdb_readoptions_t*)roptions, key, keylen, err);
+    *value = slice ? rocksdb_pinnableslice_value(slice, valuelen) : NULL;
+    return slice;
+}
+static void rdb_pinned_destroy(void *handle) { rocksdb_pinnableslice_destroy((rocksdb_pinnableslice_t*)handle); }
 static void rdb_del(void *db, void *woptions, const char *key, size_t klen, char **err) {
     rocksdb_delete((rocksdb_t*)db, (rocksdb_writeoptions_t*)woptions, key, klen, err);
 }
 
+static void* rdb_writebatch_create() { return rocksdb_writebatch_create(); }
+static void rdb_writebatch_destroy(void *batch) { rocksdb_writebatch_destroy((rocksdb_writebatch_t*)batch); }
+static void rdb_writebatch_put(void *batch, const char *key, size_t keylen, const char *value, size_t valuelen) {
+    rocksdb_writebatch_put((rocksdb_writebatch_t*)batch, key, keylen, value, valuelen);
+}
+static void rdb_writebatch_delete(void *batch, const char *key, size_t keylen) {
+    rocksdb_writebatch_delete((rocksdb_writebatch_t*)batch, key, keylen);
+}
+static void rdb_write(void *db, void *woptions, void *batch, char **err) {
+    rocksdb_write((rocksdb_t*)db, (rocksdb_writeoptions_t*)woptions, (rocksdb_writebatch_t*)batch, err);
+}
+// The C API only offers DeleteRange on the default column family through a
+// write batch.
+static void rdb_delete_range(void *db, void *woptions, const char *start, size_t start_len,
+                             const char *limit, size_t limit_len, char **err) {
+    rocksdb_writebatch_t *batch = rocksdb_writebatch_create();
+    rocksdb_writebatch_delete_range(batch, start, start_len, limit, limit_len);
+    rocksdb_write((rocksdb_t*)db, (rocksdb_writeoptions_t*)woptions, batch, err);
+    rocksdb_writebatch_destroy(batch);
+}
+static void rdb_multi_get(void *db, void *roptions, size_t num_keys, const char *const *keys, const size_t *keylens,
+                          char **values, size_t *valuelens, char **errs) {
+    rocksdb_multi_get((rocksdb_t*)db, (rocksdb_readoptions_t*)roptions, num_keys, (const char* const*)keys, keylens,
+                      values, valuelens, errs);
+}
+
+static void* rdb_iter_create(void *db, void *roptions) {
+    return rocksdb_create_iterator((rocksdb_t*)db, (rocksdb_readoptions_t*)roptions);
+}
+static void rdb_iter_destroy(void *iter) { rocksdb_iter_destroy((rocksdb_iterator_t*)iter); }
+static int rdb_iter_valid(const void *iter) { return rocksdb_iter_valid((const rocksdb_iterator_t*)iter); }
+static void rdb_iter_seek_to_first(void *iter) { rocksdb_iter_seek_to_first((rocksdb_iterator_t*)iter); }
+static void rdb_iter_seek_to_last(void *iter) { rocksdb_iter_seek_to_last((rocksdb_iterator_t*)iter); }
+static void rdb_iter_seek(void *iter, const char *key, size_t keylen) { rocksdb_iter_seek((rocksdb_iterator_t*)iter, key, keylen); }
+static void rdb_iter_next(void *iter) { rocksdb_iter_next((rocksdb_iterator_t*)iter); }
+static const char* rdb_iter_key(const void *iter, size_t *keylen) { return rocksdb_iter_key((const rocksdb_iterator_t*)iter, keylen); }
+static const char* rdb_iter_value(const void *iter, size_t *valuelen) { return rocksdb_iter_value((const rocksdb_iterator_t*)iter, valuelen); }
+static void rdb_iter_get_error(const void *iter, char **err) { rocksdb_iter_get_error((const rocksdb_iterator_t*)iter, err); }
+
+// A prefix seek only visits keys sharing the seek key's prefix, which is what
+// lets the table and memtable prefix blooms skip files; every other scan
+// must ask for total order once a prefix extractor is configured.
+static void* rdb_readoptions_create_scan(const char *limit, size_t limit_len, size_t readahead, int prefix_seek) {
+    rocksdb_readoptions_t *ro = rocksdb_readoptions_create();
+    rocksdb_readoptions_set_fill_cache(ro, 0);
+    rocksdb_readoptions_set_readahead_size(ro, readahead);
+    if (limit != NULL) {
+        rocksdb_readoptions_set_iterate_upper_bound(ro, limit, limit_len);
+    }
+    if (prefix_seek) {
+        rocksdb_readoptions_set_prefix_same_as_start(ro, 1);
+    } else {
+        rocksdb_readoptions_set_total_order_seek(ro, 1);
+    }
+    return ro;
+}
+// Whole-key filtering stays on, so point lookups keep their bloom filter.
+static void rdb_options_set_prefix_bloom(void *options, size_t prefix_len) {
+    rocksdb_options_t *opts = (rocksdb_options_t*)options;
+    rocksdb_options_set_prefix_extractor(opts, rocksdb_slicetransform_create_fixed_prefix(prefix_len));
+    rocksdb_options_set_memtable_prefix_bloom_size_ratio(opts, 0.02);
+}
+
 static void* rdb_cache_create_lru(size_t capacity) { return rocksdb_cache_create_lru(capacity); }
 //static void rdb_options_set_cache(void *options, void *cache) { rocksdb_options_set_cache((rocksdb_options_t*)options, (rocksdb_cache_t*)cache); }
 static void rdb_options_set_cache(void *options, void *cache) {
     rocksdb_block_based_table_options_t* bbt_opts = rocksdb_block_based_options_create();
     rocksdb_block_based_options_set_block_cache(bbt_opts, (rocksdb_cache_t*)cache);
     rocksdb_options_set_block_based_table_factory((rocksdb_options_t*)options, bbt_opts);
+    rocksdb_block_based_options_destroy(bbt_opts);
 }
 
 static void rdb_cache_destroy(void *cache) { rocksdb_cache_destroy((rocksdb_cache_t*)cache); }
 
+static void rdb_options_set_write_buffer_size(void *options, size_t size) {
+    rocksdb_options_set_write_buffer_size((rocksdb_options_t*)options, size);
+}
+static void rdb_memory_usage(void *db, void *cache, EngineMemoryUsage *usage) {
+    uint64_t value = 0;
+    usage->memtables = rocksdb_property_int((rocksdb_t*)db, "rocksdb.cur-size-all-mem-tables", &value) == 0 ? value : 0;
+    usage->table_readers = rocksdb_property_int((rocksdb_t*)db, "rocksdb.estimate-table-readers-mem", &value) == 0 ? value : 0;
+    usage->block_cache = cache != NULL ? rocksdb_cache_get_usage((rocksdb_cache_t*)cache) : 0;
+}
+
+// Point lookups dominate, so tables get a bloom filter and a hash index
+// inside each data block, and reads go through mmap instead of pread. The
+// memtable has its own bloom filter so misses skip it cheaply.
+static void* rdb_options_set_ephemeral(void *options, void *cache, size_t write_buffer_size) {
+    rocksdb_options_t *opts = (rocksdb_options_t*)options;
+    rocksdb_block_based_table_options_t *bbt_opts = rocksdb_block_based_options_create();
+    if (cache != NULL) {
+        rocksdb_block_based_options_set_block_cache(bbt_opts, (rocksdb_cache_t*)cache);
+    }
+    rocksdb_block_based_options_set_filter_policy(bbt_opts, rocksdb_filterpolicy_create_bloom(10));
+    rocksdb_block_based_options_set_data_block_index_type(bbt_opts, rocksdb_block_based_table_data_block_index_type_binary_search_and_hash);
+    rocksdb_block_based_options_set_data_block_hash_ratio(bbt_opts, 0.75);
+    rocksdb_options_set_block_based_table_factory(opts, bbt_opts);
+    rocksdb_block_based_options_destroy(bbt_opts);
+
+    rocksdb_options_set_allow_mmap_reads(opts, 1);
+    rocksdb_options_set_memtable_prefix_bloom_size_ratio(opts, 0.02);
+    rocksdb_options_set_memtable_whole_key_filtering(opts, 1);
+    rocksdb_options_set_write_buffer_size(opts, write_buffer_size);
+    rocksdb_options_set_max_write_buffer_number(opts, 2);
+    return NULL;
+}
+static void rdb_ephemeral_destroy(void *handle) {}
+static void rdb_writeoptions_disable_wal(void *woptions) { rocksdb_writeoptions_disable_WAL((rocksdb_writeoptions_t*)woptions, 1); }
+
+static char* rdb_stats_report(void *db) { return rocksdb_property_value((rocksdb_t*)db, "rocksdb.stats"); }
+static void rdb_options_enable_statistics(void *options) { rocksdb_options_enable_statistics((rocksdb_options_t*)options); }
+static char* rdb_statistics_report(void *options) { return rocksdb_options_statistics_get_string((rocksdb_options_t*)options); }
+
+static uint64_t statistics_ticker(const char *report, const char *name) {
+    const char *found = strstr(report, name);
+    if (found == NULL) {
+        return 0;
+    }
+    found = strstr(found, "COUNT : ");
+    return found ? strtoull(found + strlen("COUNT : "), NULL, 10) : 0;
+}
+static void rdb_block_cache_stats(void *options, uint64_t *hits, uint64_t *misses) {
+    char *report = rocksdb_options_statistics_get_string((rocksdb_options_t*)options);
+    *hits = 0;
+    *misses = 0;
+    if (report != NULL) {
+        *hits = statistics_ticker(report, "rocksdb.block.cache.hit ");
+        *misses = statistics_ticker(report, "rocksdb.block.cache.miss ");
+        free(report);
+    }
+}
+
+static void rdb_compact_range(void *db, const char *start, size_t start_len, const char *limit, size_t limit_len) {
+    rocksdb_compact_range((rocksdb_t*)db, start, start_len, limit, limit_len);
+}
+
+// Returning 1 tells RocksDB to drop the entry while compacting.
+static unsigned char rdb_ttl_filter(void *state, int level, const char *key, size_t key_len,
+                                    const char *value, size_t value_len,
+                                    char **new_value, size_t *new_value_len, unsigned char *value_changed) {
+    *value_changed = 0;
+    return (unsigned char)value_is_expired(value, value_len, coarse_clock_now());
+}
+static const char* rdb_ttl_filter_name(void *state) { return "levelcache.ttl"; }
+static void* rdb_options_set_ttl_filter(void *options) {
+    rocksdb_compactionfilter_t *filter = rocksdb_compactionfilter_create(NULL, NULL, rdb_ttl_filter, rdb_ttl_filter_name);
+    rocksdb_options_set_compaction_filter((rocksdb_options_t*)options, filter);
+    return filter;
+}
+static void rdb_ttl_filter_destroy(void *filter) { rocksdb_compactionfilter_destroy((rocksdb_compactionfilter_t*)filter); }
+
 static void rdb_free(void *ptr) { free(ptr); }
 
 StorageEngine ROCKSDB_ENGINE = {
@@ -53,11 +203,45 @@ StorageEngine ROCKSDB_ENGINE = {
     .put = rdb_put,
     .get = rdb_get,
     .del = rdb_del,
+    .get_pinned = rdb_get_pinned,
+    .pinned_destroy = rdb_pinned_destroy,
+    .writebatch_create = rdb_writebatch_create,
+    .writebatch_destroy = rdb_writebatch_destroy,
+    .writebatch_put = rdb_writebatch_put,
+    .writebatch_delete = rdb_writebatch_delete,
+    .write = rdb_write,
+    .delete_range = rdb_delete_range,
+    .multi_get = rdb_multi_get,
+    .iter_create = rdb_iter_create,
+    .iter_destroy = rdb_iter_destroy,
+    .iter_valid = rdb_iter_valid,
+    .iter_seek_to_first = rdb_iter_seek_to_first,
+    .iter_seek_to_last = rdb_iter_seek_to_last,
+    .iter_seek = rdb_iter_seek,
+    .iter_next = rdb_iter_next,
+    .iter_key = rdb_iter_key,
+    .iter_value = rdb_iter_value,
+    .iter_get_error = rdb_iter_get_error,
+    .readoptions_create_scan = rdb_readoptions_create_scan,
+    .options_set_prefix_bloom = rdb_options_set_prefix_bloom,
     .cache_create_lru = rdb_cache_create_lru,
     .options_set_cache = rdb_options_set_cache,
     .cache_destroy = rdb_cache_destroy,
+    .options_set_write_buffer_size = rdb_options_set_write_buffer_size,
+    .memory_usage = rdb_memory_usage,
+    .stats_report = rdb_stats_report,
+    .options_enable_statistics = rdb_options_enable_statistics,
+    .statistics_report = rdb_statistics_report,
+    .block_cache_stats = rdb_block_cache_stats,
+    .compact_range = rdb_compact_range,
+    .options_set_ephemeral = rdb_options_set_ephemeral,
+    .ephemeral_destroy = rdb_ephemeral_destroy,
+    .writeoptions_disable_wal = rdb_writeoptions_disable_wal,
+    .options_set_ttl_filter = rdb_options_set_ttl_filter,
+    .ttl_filter_destroy = rdb_ttl_filter_destroy,
     .free_fn = rdb_free,
     .supports_native_ttl = true, // RocksDB supports TTL natively
+    .persistent = true,
 };
 
 
@@ -0,0 +1,129 @@
+#include "single_flight.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline FlightStripe* stripe_for(SingleFlight *sf, uint64_t hash) {
+    return &sf->stripes[hash >> 58];
+}
+
+// Drops one reference under the stripe lock; returns 1 if it was the last.
+static inline int flight_unref(Flight *flight) {
+    return --flight->refs == 0;
+}
+
+static void flight_free(Flight *flight) {
+    free(flight->value);
+    free(flight);
+}
+
+void single_flight_init(SingleFlight *sf) {
+    for (int i = 0; i < SINGLE_FLIGHT_STRIPES; i++) {
+        pthread_mutex_init(&sf->stripes[i].lock, NULL);
+        pthread_cond_init(&sf->stripes[i].done, NULL);
+        sf->stripes[i].flights = NULL;
+    }
+}
+
+void single_flight_destroy(SingleFlight *sf) {
+    for (int i = 0; i < SINGLE_FLIGHT_STRIPES; i++) {
+        pthread_mutex_destroy(&sf->stripes[i].lock);
+        pthread_cond_destroy(&sf->stripes[i].done);
+    }
+}
+
+Flight* single_flight_begin(SingleFlight *sf, const char *key, size_t key_len, uint64_t hash, int join, int *leader) {
+    FlightStripe *stripe = stripe_for(sf, hash);
+    pthread_mutex_lock(&stripe->lock);
+    for (Flight *flight = stripe->flights; flight != NULL; flight = flight->next) {
+        if (flight->hash == hash && flight->key_len == key_len && memcmp(flight->key, key, key_len) == 0) {
+            if (join) {
+                flight->refs++;
+            } else {
+                flight = NULL;
+            }
+            pthread_mutex_unlock(&stripe->lock);
+            *leader = 0;
+            return flight;
+        }
+    }
+
+    Flight *flight = (Flight *) malloc(sizeof(Flight) + key_len);
+    if (flight != NULL) {
+        flight->hash = hash;
+        flight->refs = 1;
+        flight->done = 0;
+        flight->value = NULL;
+        flight->value_len = 0;
+        flight->key_len = key_len;
+        memcpy(flight->key, key, key_len);
+        flight->next = stripe->flights;
+        stripe->flights = flight;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    *leader = 1;
+    return flight;
+}
+
+void single_flight_finish(SingleFlight *sf, Flight *flight, const char *value, size_t value_len) {
+    FlightStripe *stripe = stripe_for(sf, flight->hash);
+    pthread_mutex_lock(&stripe->lock);
+    Flight **link = &stripe->flights;
+    while (*link != flight) {
+        link = &(*link)->next;
+    }
+    *link = flight->next;
+    // Unlinked, the flight gains no more waiters, so the copy can be made
+    // outside the lock and skipped when nobody waits.
+    int waited = flight->refs > 1;
+    pthread_mutex_unlock(&stripe->lock);
+
+    if (waited && value != NULL) {
+        flight->value = (char *) malloc(value_len + 1);
+        if (flight->value != NULL) {
+            memcpy(flight->value, value, value_len);
+            flight->value[value_len] = '\0';
+            flight->value_len = value_len;
+        }
+    }
+
+    pthread_mutex_lock(&stripe->lock);
+    flight->done = 1;
+    int last = flight_unref(flight);
+    if (!last) {
+        pthread_cond_broadcast(&stripe->done);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    if (last) {
+        flight_free(flight);
+    }
+}
+
+char* single_flight_wait(SingleFlight *sf, Flight *flight, size_t *value_len) {
+    FlightStripe *stripe = stripe_for(sf, flight->hash);
+    pthread_mutex_lock(&stripe->lock);
+    while (!flight->done) {
+        pthread_cond_wait(&stripe->done, &stripe->lock);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    // The value no longer changes once the flight is done, and our reference
+    // keeps it alive.
+    char *result = NULL;
+    if (flight->value != NULL) {
+        result = (char *) malloc(flight->value_len + 1);
+        if (result != NULL) {
+            memcpy(result, flight->value, flight->value_len + 1);
+            if (value_len != NULL) {
+                *value_len = flight->value_len;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&stripe->lock);
+    int last = flight_unref(flight);
+    pthread_mutex_unlock(&stripe->lock);
+    if (last) {
+        flight_free(flight);
+    }
+    return result;
+}
@@ -0,0 +1,302 @@
+#include "../include/skiplist.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline size_t node_size(uint32_t height, size_t key_len) {
+    return sizeof(SkipNode) + height * sizeof(SkipNode *) + key_len;
+}
+
+static int key_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) {
+        return c;
+    }
+    return (a_len < b_len) ? -1 : (a_len > b_len);
+}
+
+// Branching factor 4, as in LevelDB's memtable.
+static uint32_t random_height(SkipList *list) {
+    uint32_t height = 1;
+    while (height < SKIPLIST_MAX_HEIGHT) {
+        list->rng ^= list->rng << 13;
+        list->rng ^= list->rng >> 17;
+        list->rng ^= list->rng << 5;
+        if ((list->rng & 3) != 0) {
+            break;
+        }
+        height++;
+    }
+    return height;
+}
+
+// First node whose key is >= `key` (> with `strict`). Fills `prev` with the
+// rightmost node before it on every level when it is not NULL.
+static SkipNode* find_from(const SkipList *list, const char *key, size_t key_len, int strict, SkipNode **prev) {
+    SkipNode *x = list->head;
+    for (int level = (int)list->height - 1; level >= 0; level--) {
+        SkipNode *next = x->next[level];
+        while (next != NULL) {
+            int c = key_compare(skiplist_key(next), next->key_len, key, key_len);
+            if (c > 0 || (c == 0 && !strict)) {
+                break;
+            }
+            x = next;
+            next = x->next[level];
+        }
+        if (prev != NULL) {
+            prev[level] = x;
+        }
+    }
+    return x->next[0];
+}
+
+static SkipNode* find_exact(const SkipList *list, const char *key, size_t key_len, SkipNode **prev) {
+    SkipNode *node = find_from(list, key, key_len, 0, prev);
+    if (node != NULL && key_compare(skiplist_key(node), node->key_len, key, key_len) == 0) {
+        return node;
+    }
+    return NULL;
+}
+
+int skiplist_init(SkipList *list, uint32_t seed) {
+    list->head = (SkipNode *) calloc(1, node_size(SKIPLIST_MAX_HEIGHT, 0));
+    if (list->head == NULL) {
+        return -1;
+    }
+    list->head->height = SKIPLIST_MAX_HEIGHT;
+    pthread_rwlock_init(&list->lock, NULL);
+    slab_init(&list->slab);
+    list->height = 1;
+    list->rng = seed ? seed : 1;
+    list->count = 0;
+    list->bytes = 0;
+    return 0;
+}
+
+void skiplist_destroy(SkipList *list) {
+    // Chunks go away with the slab; only large nodes are freed one by one.
+    SkipNode *node = list->head->next[0];
+    while (node != NULL) {
+        SkipNode *next = node->next[0];
+        if (slab_is_large(node_size(node->height, node->key_len))) {
+            free(node);
+        }
+        node = next;
+    }
+    free(list->head);
+    slab_release_all(&list->slab);
+    pthread_rwlock_destroy(&list->lock);
+}
+
+SkipNode* skiplist_find(const SkipList *list, const char *key, size_t key_len) {
+    return find_exact(list, key, key_len, NULL);
+}
+
+SkipNode* skiplist_seek(const SkipList *list, const char *key, size_t key_len, int strict) {
+    return find_from(list, key, key_len, strict, NULL);
+}
+
+SkipNode* skiplist_last(const SkipList *list) {
+    SkipNode *x = list->head;
+    for (int level = (int)list->height - 1; level >= 0; level--) {
+        while (x->next[level] != NULL) {
+            x = x->next[level];
+        }
+    }
+    return (x == list->head) ? NULL : x;
+}
+
+SkipNode* skiplist_insert(SkipList *list, const char *key, size_t key_len, int *created) {
+    SkipNode *prev[SKIPLIST_MAX_HEIGHT];
+    SkipNode *node = find_exact(list, key, key_len, prev);
+    if (node != NULL) {
+        *created = 0;
+        return node;
+    }
+    uint32_t height = random_height(list);
+    node = (SkipNode *) slab_alloc(&list->slab, node_size(height, key_len));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->value = NULL;
+    node->key_len = (uint32_t)key_len;
+    node->height = height;
+    memcpy((char *)skiplist_key(node), key, key_len);
+    for (uint32_t level = list->height; level < height; level++) {
+        prev[level] = list->head;
+    }
+    if (height > list->height) {
+        list->height = height;
+    }
+    for (uint32_t level = 0; level < height; level++) {
+        node->next[level] = prev[level]->next[level];
+        prev[level]->next[level] = node;
+    }
+    list->count++;
+    __atomic_add_fetch(&list->bytes, slab_object_size(node_size(height, key_len)), __ATOMIC_RELAXED);
+    *created = 1;
+    return node;
+}
+
+void* skiplist_erase(SkipList *list, const char *key, size_t key_len) {
+    SkipNode *prev[SKIPLIST_MAX_HEIGHT];
+    SkipNode *node = find_exact(list, key, key_len, prev);
+    if (node == NULL) {
+        return NULL;
+    }
+    for (uint32_t level = 0; level < node->height; level++) {
+        prev[level]->next[level] = node->next[level];
+    }
+    void *value = node->value;
+    list->count--;
+    __atomic_sub_fetch(&list->bytes, slab_object_size(node_size(node->height, node->key_len)), __ATOMIC_RELAXED);
+    slab_free(&list->slab, node, node_size(node->height, node->key_len));
+    return value;
+}
+
+typedef struct SkipBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+} SkipBuffer;
+
+typedef struct SkipCursor {
+    int valid;
+    SkipBuffer key;
+    SkipBuffer value;
+} SkipCursor;
+
+struct SkipIterator {
+    SkipList *lists;
+    uint32_t num_lists;
+    SkipValueFn value_of;
+    int current;            // shard of the current entry, or -1
+    int failed;
+    SkipCursor cursors[];
+};
+
+static int buffer_set(SkipBuffer *buffer, const char *data, size_t len) {
+    if (len > buffer->cap) {
+        char *grown = (char *) realloc(buffer->data, len);
+        if (grown == NULL) {
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->cap = len;
+    }
+    if (len > 0) {
+        memcpy(buffer->data, data, len);
+    }
+    buffer->len = len;
+    return 0;
+}
+
+// Loads the first entry of shard `i` at or after `key` (after, with
+// `strict`); with `last` set, loads the shard's last entry instead.
+static void cursor_load(SkipIterator *it, uint32_t i, const char *key, size_t key_len, int strict, int last) {
+    SkipList *list = &it->lists[i];
+    SkipCursor *cursor = &it->cursors[i];
+    pthread_rwlock_rdlock(&list->lock);
+    SkipNode *node = last ? skiplist_last(list) : find_from(list, key, key_len, strict, NULL);
+    cursor->valid = 0;
+    if (node != NULL) {
+        size_t value_len = 0;
+        const char *value = it->value_of(node->value, &value_len);
+        if (buffer_set(&cursor->key, skiplist_key(node), node->key_len) != 0 ||
+            buffer_set(&cursor->value, value, value_len) != 0) {
+            it->failed = 1;
+        } else {
+            cursor->valid = 1;
+        }
+    }
+    pthread_rwlock_unlock(&list->lock);
+}
+
+static void iterator_pick_min(SkipIterator *it) {
+    it->current = -1;
+    if (it->failed) {
+        return;
+    }
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        SkipCursor *cursor = &it->cursors[i];
+        if (!cursor->valid) {
+            continue;
+        }
+        if (it->current < 0 || key_compare(cursor->key.data, cursor->key.len,
+                                           it->cursors[it->current].key.data,
+                                           it->cursors[it->current].key.len) < 0) {
+            it->current = (int)i;
+        }
+    }
+}
+
+SkipIterator* skiplist_iter_create(SkipList *lists, uint32_t num_lists, SkipValueFn value_of) {
+    SkipIterator *it = (SkipIterator *) calloc(1, sizeof(SkipIterator) + num_lists * sizeof(SkipCursor));
+    if (it != NULL) {
+        it->lists = lists;
+        it->num_lists = num_lists;
+        it->value_of = value_of;
+        it->current = -1;
+    }
+    return it;
+}
+
+void skiplist_iter_destroy(SkipIterator *it) {
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        free(it->cursors[i].key.data);
+        free(it->cursors[i].value.data);
+    }
+    free(it);
+}
+
+int skiplist_iter_valid(const SkipIterator *it) { return it->current >= 0; }
+
+void skiplist_iter_seek(SkipIterator *it, const char *key, size_t key_len) {
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        cursor_load(it, i, key, key_len, 0, 0);
+    }
+    iterator_pick_min(it);
+}
+
+// Only forward iteration exists, so the other shards have nothing after the
+// last entry and their cursors are left empty.
+void skiplist_iter_seek_to_last(SkipIterator *it) {
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        cursor_load(it, i, NULL, 0, 0, 1);
+    }
+    int max = -1;
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        SkipCursor *cursor = &it->cursors[i];
+        if (cursor->valid && (max < 0 || key_compare(cursor->key.data, cursor->key.len,
+                                                     it->cursors[max].key.data, it->cursors[max].key.len) > 0)) {
+            max = (int)i;
+        }
+    }
+    for (uint32_t i = 0; i < it->num_lists; i++) {
+        if ((int)i != max) {
+            it->cursors[i].valid = 0;
+        }
+    }
+    it->current = it->failed ? -1 : max;
+}
+
+void skiplist_iter_next(SkipIterator *it) {
+    if (it->current < 0) {
+        return;
+    }
+    SkipCursor *cursor = &it->cursors[it->current];
+    cursor_load(it, (uint32_t)it->current, cursor->key.data, cursor->key.len, 1, 0);
+    iterator_pick_min(it);
+}
+
+const char* skiplist_iter_key(const SkipIterator *it, size_t *key_len) {
+    *key_len = it->cursors[it->current].key.len;
+    return it->cursors[it->current].key.data;
+}
+
+const char* skiplist_iter_value(const SkipIterator *it, size_t *value_len) {
+    *value_len = it->cursors[it->current].value.len;
+    return it->cursors[it->current].value.data;
+}
+
+int skiplist_iter_failed(const SkipIterator *it) { return it->failed; }
@@ -0,0 +1,77 @@
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Chunk payloads start after a header padded to the slab granularity.
+#define CHUNK_HEADER_BYTES (((sizeof(SlabChunk) + SLAB_GRANULARITY - 1) / SLAB_GRANULARITY) * SLAB_GRANULARITY)
+
+static inline size_t size_class(size_t size) {
+    return (size + SLAB_GRANULARITY - 1) / SLAB_GRANULARITY - 1;
+}
+
+void slab_init(Slab *slab) {
+    memset(slab, 0, sizeof(*slab));
+}
+
+void* slab_alloc(Slab *slab, size_t size) {
+    if (slab_is_large(size)) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    size_t cls = size_class(size);
+    void *obj = slab->free_lists[cls];
+    if (obj != NULL) {
+        slab->free_lists[cls] = *(void **)obj;
+        return obj;
+    }
+
+    size_t bytes = (cls + 1) * SLAB_GRANULARITY;
+    if (slab->bump == NULL || (size_t)(slab->bump_end - slab->bump) < bytes) {
+        // The tail of the old chunk is too small for this class; file it
+        // under the class that fits so it is not lost.
+        if (slab->bump != NULL && slab->bump_end > slab->bump) {
+            size_t rest = slab->bump_end - slab->bump;
+            size_t rest_cls = rest / SLAB_GRANULARITY - 1;
+            *(void **)slab->bump = slab->free_lists[rest_cls];
+            slab->free_lists[rest_cls] = slab->bump;
+        }
+        SlabChunk *chunk = (SlabChunk *) malloc(SLAB_CHUNK_BYTES);
+        if (chunk == NULL) {
+            slab->bump = NULL;
+            slab->bump_end = NULL;
+            return NULL;
+        }
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->bump = (char *)chunk + CHUNK_HEADER_BYTES;
+        slab->bump_end = (char *)chunk + SLAB_CHUNK_BYTES;
+    }
+    obj = slab->bump;
+    slab->bump += bytes;
+    return obj;
+}
+
+void slab_free(Slab *slab, void *ptr, size_t size) {
+    if (slab_is_large(size)) {
+        free(ptr);
+        return;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    size_t cls = size_class(size);
+    *(void **)ptr = slab->free_lists[cls];
+    slab->free_lists[cls] = ptr;
+}
+
+void slab_release_all(Slab *slab) {
+    SlabChunk *chunk = slab->chunks;
+    while (chunk != NULL) {
+        SlabChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    slab_init(slab);
+}
@@ -0,0 +1,132 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+static void link_node(TimerNode **head, TimerNode *node) {
+    node->next = *head;
+    if (node->next != NULL) {
+        node->next->pprev = &node->next;
+    }
+    node->pprev = head;
+    *head = node;
+}
+
+static void unlink_node(TimerNode *node) {
+    *node->pprev = node->next;
+    if (node->next != NULL) {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+// `first_tick` is the earliest tick the wheel will still process: the current
+// one while cascading, the next one otherwise. Timers already due are filed
+// there.
+static void place(TimerWheel *wheel, TimerNode *node, uint64_t first_tick) {
+    uint64_t expires = node->expires;
+    if (expires < first_tick) {
+        expires = first_tick;
+    }
+    uint64_t delta = expires - wheel->current;
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    uint32_t slot;
+    if (delta >= ((uint64_t)1 << (TW_SLOT_BITS * TW_LEVELS))) {
+        // Beyond the wheel's range: park in the farthest top-level slot.
+        slot = ((wheel->current >> (TW_SLOT_BITS * level)) + TW_SLOT_MASK) & TW_SLOT_MASK;
+    } else {
+        slot = (expires >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK;
+    }
+    link_node(&wheel->slots[level][slot], node);
+}
+
+void tw_init(TimerWheel *wheel, uint64_t now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->current = now;
+}
+
+void tw_schedule(TimerWheel *wheel, TimerNode *node, uint64_t expires) {
+    if (tw_is_scheduled(node)) {
+        unlink_node(node);
+    } else {
+        wheel->count++;
+    }
+    node->expires = expires;
+    place(wheel, node, wheel->current + 1);
+}
+
+void tw_cancel(TimerWheel *wheel, TimerNode *node) {
+    if (!tw_is_scheduled(node)) {
+        return;
+    }
+    unlink_node(node);
+    wheel->count--;
+}
+
+// Re-places every node of a higher-level slot now that the wheel has moved
+// into its range.
+static void cascade(TimerWheel *wheel, int level, uint32_t slot) {
+    TimerNode *node = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    while (node != NULL) {
+        TimerNode *next = node->next;
+        node->next = NULL;
+        node->pprev = NULL;
+        place(wheel, node, wheel->current);
+        node = next;
+    }
+}
+
+TimerNode* tw_advance(TimerWheel *wheel, uint64_t now) {
+    TimerNode *fired = NULL;
+
+    while (wheel->current < now) {
+        if (wheel->count == 0) {
+            wheel->current = now;
+            break;
+        }
+        wheel->current++;
+
+        uint64_t t = wheel->current;
+        for (int level = 1; level < TW_LEVELS; level++) {
+            if (((t >> (TW_SLOT_BITS * (level - 1))) & TW_SLOT_MASK) != 0) {
+                break;
+            }
+            cascade(wheel, level, (t >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK);
+        }
+
+        TimerNode **head = &wheel->slots[0][t & TW_SLOT_MASK];
+        while (*head != NULL) {
+            TimerNode *node = *head;
+            unlink_node(node);
+            wheel->count--;
+            node->next = fired;
+            fired = node;
+        }
+    }
+    return fired;
+}
+
+TimerNode* tw_pop_next(TimerWheel *wheel) {
+    if (wheel->count == 0) {
+        return NULL;
+    }
+    // Lower levels hold the nearer timers; within a level, walk the slots
+    // forward from the wheel's position.
+    for (int level = 0; level < TW_LEVELS; level++) {
+        uint64_t pos = wheel->current >> (TW_SLOT_BITS * level);
+        for (uint32_t i = 0; i < TW_SLOTS; i++) {
+            TimerNode *node = wheel->slots[level][(pos + i) & TW_SLOT_MASK];
+            if (node != NULL) {
+                unlink_node(node);
+                wheel->count--;
+                return node;
+            }
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,313 @@
+#include "value_codec.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <zdict.h>
+#include "cache_log.h"
+
+#define CODEC_TRAIN_FACTOR 64          // sample bytes per dictionary byte before training
+#define CODEC_MAX_SAMPLE (16 << 10)    // longer values contribute only their first bytes
+#define CODEC_MIN_SAMPLES 16           // fewer samples than this cannot train a dictionary
+
+struct ValueCodec {
+    int level;
+    size_t min_bytes;
+    size_t dict_capacity;
+    char *dict_path;
+    ZSTD_CDict *cdict;          // published once, read without the lock
+    ZSTD_DDict *ddict;
+    size_t dict_size;
+    int sampling;               // 1 until the dictionary is trained or given up on
+    pthread_mutex_t lock;       // guards the samples and training
+    char *samples;
+    size_t samples_len;
+    size_t *sample_sizes;
+    size_t num_samples;
+    size_t max_samples;
+};
+
+// One compression and one decompression context per thread, freed when the
+// thread exits.
+typedef struct CodecContexts {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+} CodecContexts;
+
+static pthread_key_t contexts_key;
+static pthread_once_t contexts_once = PTHREAD_ONCE_INIT;
+
+static void contexts_free(void *arg) {
+    CodecContexts *contexts = (CodecContexts *)arg;
+    ZSTD_freeCCtx(contexts->cctx);
+    ZSTD_freeDCtx(contexts->dctx);
+    free(contexts);
+}
+
+static void contexts_key_create(void) {
+    pthread_key_create(&contexts_key, contexts_free);
+}
+
+static CodecContexts* thread_contexts(void) {
+    pthread_once(&contexts_once, contexts_key_create);
+    CodecContexts *contexts = (CodecContexts *) pthread_getspecific(contexts_key);
+    if (contexts == NULL) {
+        contexts = (CodecContexts *) calloc(1, sizeof(CodecContexts));
+        if (contexts == NULL) {
+            return NULL;
+        }
+        contexts->cctx = ZSTD_createCCtx();
+        contexts->dctx = ZSTD_createDCtx();
+        if (contexts->cctx == NULL || contexts->dctx == NULL || pthread_setspecific(contexts_key, contexts) != 0) {
+            contexts_free(contexts);
+            return NULL;
+        }
+    }
+    return contexts;
+}
+
+// Builds the compression and decompression dictionaries and publishes them.
+static int codec_install_dict(ValueCodec *codec, const void *dict, size_t dict_size) {
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict, dict_size, codec->level);
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict, dict_size);
+    if (cdict == NULL || ddict == NULL) {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return -1;
+    }
+    codec->dict_size = dict_size;
+    __atomic_store_n(&codec->ddict, ddict, __ATOMIC_RELEASE);
+    __atomic_store_n(&codec->cdict, cdict, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Written to a temporary file and renamed, so a crash never leaves a torn
+// dictionary behind.
+static int codec_save_dict(const ValueCodec *codec, const void *dict, size_t dict_size) {
+    size_t tmp_len = strlen(codec->dict_path) + 5;
+    char *tmp = (char *) malloc(tmp_len);
+    if (tmp == NULL) {
+        log_error("[codec] Failed to allocate memory to save the dictionary");
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", codec->dict_path);
+    FILE *file = fopen(tmp, "wb");
+    int ok = file != NULL && fwrite(dict, 1, dict_size, file) == dict_size;
+    if (file != NULL && fclose(file) != 0) {
+        ok = 0;
+    }
+    if (ok && rename(tmp, codec->dict_path) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        log_error("[codec] Failed to save the dictionary to '%s': %s", codec->dict_path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+static int codec_load_dict(ValueCodec *codec) {
+    FILE *file = fopen(codec->dict_path, "rb");
+    if (file == NULL) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    // The file is read whole: it may have been trained with a different
+    // dictionary size than this open asks for.
+    long file_size = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+    size_t dict_size = (file_size > 0) ? (size_t)file_size : 0;
+    char *dict = (dict_size > 0) ? (char *) malloc(dict_size) : NULL;
+    int rc = -1;
+    if (dict != NULL && fseek(file, 0, SEEK_SET) == 0 && fread(dict, 1, dict_size, file) == dict_size) {
+        rc = codec_install_dict(codec, dict, dict_size);
+    }
+    fclose(file);
+    free(dict);
+    if (rc == 0) {
+        log_info("[codec] Loaded a %zu byte dictionary from '%s'", dict_size, codec->dict_path);
+    }
+    return rc;
+}
+
+static void codec_stop_sampling(ValueCodec *codec) {
+    free(codec->samples);
+    free(codec->sample_sizes);
+    codec->samples = NULL;
+    codec->sample_sizes = NULL;
+    codec->num_samples = 0;
+    __atomic_store_n(&codec->sampling, 0, __ATOMIC_RELEASE);
+}
+
+// Called with the lock held once the samples are complete. Training takes
+// tens of milliseconds, paid once by the put that completed the set.
+static void codec_train(ValueCodec *codec) {
+    char *dict = (char *) malloc(codec->dict_capacity);
+    if (dict == NULL) {
+        log_error("[codec] Failed to allocate memory for the dictionary");
+        codec_stop_sampling(codec);
+        return;
+    }
+    size_t dict_size = ZDICT_trainFromBuffer(dict, codec->dict_capacity, codec->samples,
+                                             codec->sample_sizes, (unsigned)codec->num_samples);
+    // A dictionary that could not be saved is not used either: values
+    // written with it would be unreadable after a reopen.
+    if (ZDICT_isError(dict_size)) {
+        log_warn("[codec] Dictionary training failed, compressing without one: %s",
+                 ZDICT_getErrorName(dict_size));
+    } else if (codec->dict_path != NULL && codec_save_dict(codec, dict, dict_size) != 0) {
+        log_warn("[codec] Compressing without a dictionary");
+    } else if (codec_install_dict(codec, dict, dict_size) != 0) {
+        log_error("[codec] Failed to allocate memory for the dictionary");
+    } else {
+        log_info("[codec] Trained a %zu byte dictionary on %zu values", dict_size, codec->num_samples);
+    }
+    free(dict);
+    codec_stop_sampling(codec);
+}
+
+static void codec_sample(ValueCodec *codec, const char *value, size_t len) {
+    if (len > CODEC_MAX_SAMPLE) {
+        len = CODEC_MAX_SAMPLE;
+    }
+    pthread_mutex_lock(&codec->lock);
+    if (codec->sampling && codec->num_samples < codec->max_samples) {
+        memcpy(codec->samples + codec->samples_len, value, len);
+        codec->samples_len += len;
+        codec->sample_sizes[codec->num_samples++] = len;
+        if (codec->samples_len >= codec->dict_capacity * CODEC_TRAIN_FACTOR ||
+            codec->num_samples == codec->max_samples) {
+            if (codec->num_samples >= CODEC_MIN_SAMPLES) {
+                codec_train(codec);
+            } else {
+                codec_stop_sampling(codec);
+            }
+        }
+    }
+    pthread_mutex_unlock(&codec->lock);
+}
+
+ValueCodec* value_codec_create(int level, size_t min_bytes, size_t dict_bytes, const char *dict_path, int load) {
+    ValueCodec *codec = (ValueCodec *) calloc(1, sizeof(ValueCodec));
+    if (codec == NULL) {
+        return NULL;
+    }
+    codec->level = level;
+    codec->min_bytes = min_bytes;
+    codec->dict_capacity = dict_bytes;
+    pthread_mutex_init(&codec->lock, NULL);
+    if (dict_path != NULL && (codec->dict_path = strdup(dict_path)) == NULL) {
+        value_codec_destroy(codec);
+        return NULL;
+    }
+    if (codec->dict_path != NULL) {
+        if (load && codec_load_dict(codec) != 0) {
+            log_error("[codec] Failed to load the dictionary from '%s'", codec->dict_path);
+            value_codec_destroy(codec);
+            return NULL;
+        }
+        if (!load) {
+            unlink(codec->dict_path);
+        }
+    }
+    if (dict_bytes > 0 && codec->cdict == NULL) {
+        // Room for the target plus one maximal sample past it.
+        size_t capacity = dict_bytes * CODEC_TRAIN_FACTOR + CODEC_MAX_SAMPLE;
+        codec->max_samples = capacity / (min_bytes > 0 ? min_bytes : 1) + 1;
+        codec->samples = (char *) malloc(capacity);
+        codec->sample_sizes = (size_t *) malloc(codec->max_samples * sizeof(size_t));
+        if (codec->samples == NULL || codec->sample_sizes == NULL) {
+            value_codec_destroy(codec);
+            return NULL;
+        }
+        codec->sampling = 1;
+    }
+    return codec;
+}
+
+void value_codec_destroy(ValueCodec *codec) {
+    if (codec == NULL) {
+        return;
+    }
+    ZSTD_freeCDict(codec->cdict);
+    ZSTD_freeDDict(codec->ddict);
+    free(codec->samples);
+    free(codec->sample_sizes);
+    free(codec->dict_path);
+    pthread_mutex_destroy(&codec->lock);
+    free(codec);
+}
+
+size_t value_codec_bound(size_t len) {
+    return 1 + ZSTD_compressBound(len);
+}
+
+size_t value_codec_encode(ValueCodec *codec, char *dst, const char *src, size_t len) {
+    if (len >= codec->min_bytes && len > 0) {
+        if (__atomic_load_n(&codec->sampling, __ATOMIC_ACQUIRE)) {
+            codec_sample(codec, src, len);
+        }
+        CodecContexts *contexts = thread_contexts();
+        if (contexts != NULL) {
+            ZSTD_CDict *cdict = __atomic_load_n(&codec->cdict, __ATOMIC_ACQUIRE);
+            size_t capacity = ZSTD_compressBound(len);
+            size_t n = (cdict != NULL)
+                ? ZSTD_compress_usingCDict(contexts->cctx, dst + 1, capacity, src, len, cdict)
+                : ZSTD_compressCCtx(contexts->cctx, dst + 1, capacity, src, len, codec->level);
+            if (!ZSTD_isError(n) && n < len) {
+                dst[0] = (char)((cdict != NULL) ? VALUE_CODEC_ZSTD_DICT : VALUE_CODEC_ZSTD);
+                return n + 1;
+            }
+        }
+    }
+    dst[0] = (char)VALUE_CODEC_RAW;
+    memcpy(dst + 1, src, len);
+    return len + 1;
+}
+
+int value_codec_decode(ValueCodec *codec, const char *src, size_t len,
+                       const char **out, size_t *out_len, char **owned) {
+    *owned = NULL;
+    if (len < 1) {
+        return -1;
+    }
+    unsigned char type = (unsigned char)src[0];
+    if (type == VALUE_CODEC_RAW) {
+        *out = src + 1;
+        *out_len = len - 1;
+        return 0;
+    }
+    ZSTD_DDict *ddict = __atomic_load_n(&codec->ddict, __ATOMIC_ACQUIRE);
+    if ((type != VALUE_CODEC_ZSTD && type != VALUE_CODEC_ZSTD_DICT) ||
+        (type == VALUE_CODEC_ZSTD_DICT && ddict == NULL)) {
+        return -1;
+    }
+    unsigned long long size = ZSTD_getFrameContentSize(src + 1, len - 1);
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+        return -1;
+    }
+    CodecContexts *contexts = thread_contexts();
+    char *buf = (char *) malloc(size + 1);
+    if (contexts == NULL || buf == NULL) {
+        free(buf);
+        return -1;
+    }
+    size_t n = (type == VALUE_CODEC_ZSTD_DICT)
+        ? ZSTD_decompress_usingDDict(contexts->dctx, buf, size, src + 1, len - 1, ddict)
+        : ZSTD_decompressDCtx(contexts->dctx, buf, size, src + 1, len - 1);
+    if (ZSTD_isError(n) || n != size) {
+        free(buf);
+        return -1;
+    }
+    buf[size] = '\0';
+    *out = buf;
+    *out_len = size;
+    *owned = buf;
+    return 0;
+}
+
+size_t value_codec_dict_size(const ValueCodec *codec) {
+    return (__atomic_load_n(&codec->cdict, __ATOMIC_ACQUIRE) != NULL) ? codec->dict_size : 0;
+}
@@ -0,0 +1,66 @@
+#include "../include/write_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct WriteBatchRecord {
+    uint8_t type;
+    uint32_t key_len;
+    uint64_t value_len;
+} __attribute__((packed)) WriteBatchRecord;
+
+WriteBatch* write_batch_create(void) { return (WriteBatch *) calloc(1, sizeof(WriteBatch)); }
+
+void write_batch_destroy(WriteBatch *batch) {
+    free(batch->data);
+    free(batch);
+}
+
+static void batch_append(WriteBatch *batch, uint8_t type, const char *key, size_t key_len, const char *value, size_t value_len) {
+    size_t need = sizeof(WriteBatchRecord) + key_len + value_len;
+    if (batch->failed) {
+        return;
+    }
+    if (batch->len + need > batch->cap) {
+        size_t cap = batch->cap ? batch->cap * 2 : 4096;
+        while (cap < batch->len + need) {
+            cap *= 2;
+        }
+        char *data = (char *) realloc(batch->data, cap);
+        if (data == NULL) {
+            batch->failed = 1;
+            return;
+        }
+        batch->data = data;
+        batch->cap = cap;
+    }
+    WriteBatchRecord record = { type, (uint32_t)key_len, value_len };
+    memcpy(batch->data + batch->len, &record, sizeof(record));
+    memcpy(batch->data + batch->len + sizeof(record), key, key_len);
+    if (value_len > 0) {
+        memcpy(batch->data + batch->len + sizeof(record) + key_len, value, value_len);
+    }
+    batch->len += need;
+}
+
+void write_batch_put(WriteBatch *batch, const char *key, size_t key_len, const char *value, size_t value_len) {
+    batch_append(batch, WRITE_BATCH_PUT, key, key_len, value, value_len);
+}
+
+void write_batch_delete(WriteBatch *batch, const char *key, size_t key_len) {
+    batch_append(batch, WRITE_BATCH_DELETE, key, key_len, NULL, 0);
+}
+
+int write_batch_next(const WriteBatch *batch, size_t *pos, WriteBatchEntry *entry) {
+    if (*pos >= batch->len) {
+        return 0;
+    }
+    WriteBatchRecord record;
+    memcpy(&record, batch->data + *pos, sizeof(record));
+    entry->type = record.type;
+    entry->key = batch->data + *pos + sizeof(record);
+    entry->key_len = record.key_len;
+    entry->value = entry->key + record.key_len;
+    entry->value_len = record.value_len;
+    *pos += sizeof(record) + record.key_len + record.value_len;
+    return 1;
+}
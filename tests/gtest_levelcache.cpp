@@ -1,18 +1,26 @@
 #include "gtest/gtest.h"
+#include <poll.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include "levelcache.h"
+#include "value_format.h"
 #include "log.h"
 }
 
-engine_t etype = ENGINE_LEVELDB;
-
 namespace {
 
 const char* DB_PATH = "/tmp/levelcache_test_db";
 
-class LevelCacheTest : public ::testing::Test {
+// Every cache test runs once per engine.
+class LevelCacheTest : public ::testing::TestWithParam<engine_t> {
 protected:
     LevelCache *cache;
 
@@ -20,7 +28,7 @@ protected:
         char command[256];
         snprintf(command, sizeof(command), "rm -rf %s", DB_PATH);
         system(command);
-        cache = levelcache_open(DB_PATH, 0, 1, 0, LOG_FATAL, etype);
+        cache = levelcache_open(DB_PATH, 0, 1, 0, LOG_FATAL, GetParam());
         ASSERT_NE(cache, nullptr);
     }
 
@@ -32,7 +40,7 @@ protected:
     }
 };
 
-TEST_F(LevelCacheTest, PutAndGet) {
+TEST_P(LevelCacheTest, PutAndGet) {
     const char *key = "test_key";
     const char *value = "test_value";
 
@@ -45,13 +53,13 @@ TEST_F(LevelCacheTest, PutAndGet) {
     free(retrieved_value);
 }
 
-TEST_F(LevelCacheTest, GetNonExistent) {
+TEST_P(LevelCacheTest, GetNonExistent) {
     const char *key = "non_existent_key";
     char *retrieved_value = levelcache_get(cache, key);
     ASSERT_EQ(retrieved_value, nullptr);
 }
 
-TEST_F(LevelCacheTest, Delete) {
+TEST_P(LevelCacheTest, Delete) {
     const char *key = "test_key";
     const char *value = "test_value";
 
@@ -62,7 +70,7 @@ TEST_F(LevelCacheTest, Delete) {
     ASSERT_EQ(retrieved_value, nullptr);
 }
 
-TEST_F(LevelCacheTest, Ttl) {
+TEST_P(LevelCacheTest, Ttl) {
     const char *key = "ttl_key";
     const char *value = "ttl_value";
 
@@ -80,7 +88,26 @@ TEST_F(LevelCacheTest, Ttl) {
     free(retrieved_value);
 }
 
-TEST_F(LevelCacheTest, OverwriteKey) {
+TEST_P(LevelCacheTest, TtlFollowsInjectedClock) {
+    coarse_clock_set(1000000);
+    ASSERT_EQ(levelcache_put(cache, "clock_key", "clock_value", 10), 0);
+
+    coarse_clock_advance(10);
+    char *retrieved_value = levelcache_get(cache, "clock_key");
+    ASSERT_NE(retrieved_value, nullptr);
+    free(retrieved_value);
+
+    coarse_clock_advance(1);
+    EXPECT_EQ(levelcache_get(cache, "clock_key"), nullptr);
+
+    // Leaving the manual clock resumes wall-clock time on either source.
+    coarse_clock_set_source(COARSE_CLOCK_MONOTONIC);
+    EXPECT_LE(std::llabs((long long)coarse_clock_now() - (long long)time(NULL)), 1);
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+    EXPECT_LE(std::llabs((long long)coarse_clock_now() - (long long)time(NULL)), 1);
+}
+
+TEST_P(LevelCacheTest, OverwriteKey) {
     const char *key = "overwrite_key";
     const char *value1 = "value1";
     const char *value2 = "value2";
@@ -96,7 +123,7 @@ TEST_F(LevelCacheTest, OverwriteKey) {
     free(retrieved_value);
 }
 
-TEST_F(LevelCacheTest, UpdateTtl) {
+TEST_P(LevelCacheTest, UpdateTtl) {
     const char *key = "update_ttl_key";
     const char *value = "update_ttl_value";
 
@@ -122,11 +149,11 @@ TEST_F(LevelCacheTest, UpdateTtl) {
     ASSERT_EQ(retrieved_value, nullptr);
 }
 
-TEST_F(LevelCacheTest, DeleteNonExistent) {
+TEST_P(LevelCacheTest, DeleteNonExistent) {
     ASSERT_EQ(levelcache_delete(cache, "non_existent_key"), 0);
 }
 
-TEST_F(LevelCacheTest, EmptyValue) {
+TEST_P(LevelCacheTest, EmptyValue) {
     const char *key = "empty_value_key";
     const char *value = "";
 
@@ -137,9 +164,9 @@ TEST_F(LevelCacheTest, EmptyValue) {
     free(retrieved_value);
 }
 
-TEST_F(LevelCacheTest, DefaultTtl) {
+TEST_P(LevelCacheTest, DefaultTtl) {
     levelcache_close(cache);
-    cache = levelcache_open(DB_PATH, 0, 2, 0, LOG_FATAL, etype); // 2 seconds default TTL
+    cache = levelcache_open(DB_PATH, 0, 2, 0, LOG_FATAL, GetParam()); // 2 seconds default TTL
     ASSERT_NE(cache, nullptr);
 
     const char *key = "default_ttl_key";
@@ -159,9 +186,9 @@ TEST_F(LevelCacheTest, DefaultTtl) {
     ASSERT_EQ(retrieved_value, nullptr);
 }
 
-TEST_F(LevelCacheTest, CleanupThread) {
+TEST_P(LevelCacheTest, CleanupThread) {
     levelcache_close(cache);
-    cache = levelcache_open(DB_PATH, 0, 1, 1, LOG_FATAL, etype); // 1 second cleanup frequency
+    cache = levelcache_open(DB_PATH, 0, 1, 1, LOG_FATAL, GetParam()); // 1 second cleanup frequency
     ASSERT_NE(cache, nullptr);
 
     const char *key1 = "key1";
@@ -191,14 +218,14 @@ TEST_F(LevelCacheTest, CleanupThread) {
     ASSERT_EQ(retrieved_value, nullptr);
 }
 
-TEST_F(LevelCacheTest, LogLevel) {
+TEST_P(LevelCacheTest, LogLevel) {
     levelcache_close(cache);
-    cache = levelcache_open(DB_PATH, 0, 1, 0, LOG_INFO, etype);
+    cache = levelcache_open(DB_PATH, 0, 1, 0, LOG_INFO, GetParam());
     ASSERT_NE(cache, nullptr);
     ASSERT_EQ(cache->log_level, LOG_INFO);
 }
 
-TEST_F(LevelCacheTest, MemoryUsage) {
+TEST_P(LevelCacheTest, MemoryUsage) {
     size_t initial_memory = levelcache_get_memory_usage(cache);
     
     const char *key1 = "mem_key_1";
@@ -222,4 +249,1801 @@ TEST_F(LevelCacheTest, MemoryUsage) {
     ASSERT_EQ(memory_after_delete2, initial_memory);
 }
 
+TEST_P(LevelCacheTest, ConcurrentAccess) {
+    levelcache_close(cache);
+    cache = levelcache_open(DB_PATH, 0, 60, 1, LOG_FATAL, GetParam());
+    ASSERT_NE(cache, nullptr);
+
+    const int num_threads = 8;
+    const int keys_per_thread = 500;
+    std::vector<std::thread> threads;
+    std::vector<int> failures(num_threads, 0);
+
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([this, t, &failures]() {
+            for (int i = 0; i < keys_per_thread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_k" + std::to_string(i);
+                std::string value = "v" + std::to_string(i);
+                if (levelcache_put(cache, key.c_str(), value.c_str(), 0) != 0) {
+                    failures[t]++;
+                    continue;
+                }
+                char *retrieved = levelcache_get(cache, key.c_str());
+                if (retrieved == nullptr || value != retrieved) {
+                    failures[t]++;
+                }
+                free(retrieved);
+                if (i % 2 == 0 && levelcache_delete(cache, key.c_str()) != 0) {
+                    failures[t]++;
+                }
+                // Every thread also hammers a shared key.
+                levelcache_put(cache, "shared", value.c_str(), 0);
+                free(levelcache_get(cache, "shared"));
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    for (int t = 0; t < num_threads; ++t) {
+        EXPECT_EQ(failures[t], 0) << "thread " << t;
+    }
+    for (int t = 0; t < num_threads; ++t) {
+        for (int i = 0; i < keys_per_thread; ++i) {
+            std::string key = "t" + std::to_string(t) + "_k" + std::to_string(i);
+            char *retrieved = levelcache_get(cache, key.c_str());
+            if (i % 2 == 0) {
+                EXPECT_EQ(retrieved, nullptr);
+            } else {
+                EXPECT_NE(retrieved, nullptr);
+            }
+            free(retrieved);
+        }
+    }
+    char *shared = levelcache_get(cache, "shared");
+    ASSERT_NE(shared, nullptr);
+    free(shared);
+}
+
+TEST_P(LevelCacheTest, BatchOperations) {
+    const size_t n = 100;
+    std::vector<std::string> keys, values;
+    for (size_t i = 0; i < n; ++i) {
+        keys.push_back("batch_key_" + std::to_string(i));
+        values.push_back("batch_value_" + std::to_string(i));
+    }
+    // A duplicate key in the same batch: the last value wins.
+    keys.push_back("batch_key_0");
+    values.push_back("batch_value_last");
+
+    std::vector<const char*> key_ptrs, value_ptrs;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        key_ptrs.push_back(keys[i].c_str());
+        value_ptrs.push_back(values[i].c_str());
+    }
+
+    size_t initial_memory = levelcache_get_memory_usage(cache);
+    ASSERT_EQ(levelcache_put_batch(cache, key_ptrs.data(), value_ptrs.data(), key_ptrs.size(), 0), 0);
+
+    std::vector<const char*> lookup(key_ptrs.begin(), key_ptrs.begin() + n);
+    lookup.push_back("batch_missing");
+    std::vector<char*> results(lookup.size());
+    ASSERT_EQ(levelcache_multi_get(cache, lookup.data(), lookup.size(), results.data()), (int)n);
+    EXPECT_STREQ(results[0], "batch_value_last");
+    for (size_t i = 1; i < n; ++i) {
+        EXPECT_STREQ(results[i], values[i].c_str());
+    }
+    EXPECT_EQ(results[n], nullptr);
+    for (char* r : results) {
+        free(r);
+    }
+
+    // Delete the even keys in one batch.
+    std::vector<const char*> evens;
+    for (size_t i = 0; i < n; i += 2) {
+        evens.push_back(key_ptrs[i]);
+    }
+    ASSERT_EQ(levelcache_delete_batch(cache, evens.data(), evens.size()), 0);
+    ASSERT_EQ(levelcache_multi_get(cache, lookup.data(), n, results.data()), (int)(n / 2));
+    for (size_t i = 0; i < n; ++i) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(results[i], nullptr);
+        } else {
+            EXPECT_STREQ(results[i], values[i].c_str());
+        }
+        free(results[i]);
+    }
+
+    std::vector<const char*> odds;
+    for (size_t i = 1; i < n; i += 2) {
+        odds.push_back(key_ptrs[i]);
+    }
+    ASSERT_EQ(levelcache_delete_batch(cache, odds.data(), odds.size()), 0);
+    EXPECT_EQ(levelcache_get_memory_usage(cache), initial_memory);
+}
+
+TEST_P(LevelCacheTest, GetIntoCallerBuffer) {
+    const char *key = "into_key";
+    const char *value = "a value that needs 31 bytes...";
+    const size_t value_len = strlen(value);
+    ASSERT_EQ(levelcache_put(cache, key, value, 0), 0);
+
+    char small[8];
+    memset(small, 'x', sizeof(small));
+    EXPECT_EQ(levelcache_get_into(cache, key, small, sizeof(small)), (ssize_t)value_len);
+    EXPECT_EQ(small[0], 'x');
+
+    char buf[64];
+    ASSERT_EQ(levelcache_get_into(cache, key, buf, sizeof(buf)), (ssize_t)value_len);
+    EXPECT_EQ(std::string(buf, value_len), value);
+
+    EXPECT_EQ(levelcache_get_into(cache, "into_missing", buf, sizeof(buf)), -1);
+}
+
+TEST_P(LevelCacheTest, GetPinned) {
+    const char *key = "pinned_key";
+    const char *value = "pinned_value";
+    ASSERT_EQ(levelcache_put(cache, key, value, 0), 0);
+
+    LevelCachePinnedValue pinned;
+    ASSERT_EQ(levelcache_get_pinned(cache, key, &pinned), 0);
+    EXPECT_EQ(std::string(pinned.data, pinned.len), value);
+
+    // The pinned value stays readable while the key is overwritten.
+    ASSERT_EQ(levelcache_put(cache, key, "other", 0), 0);
+    EXPECT_EQ(std::string(pinned.data, pinned.len), value);
+    levelcache_value_release(&pinned);
+    levelcache_value_release(&pinned);
+
+    EXPECT_EQ(levelcache_get_pinned(cache, "pinned_missing", &pinned), -1);
+    levelcache_value_release(&pinned);
+}
+
+TEST_P(LevelCacheTest, BinarySafeKeysAndValues) {
+    const char key_a[] = {'b', 'i', 'n', '\0', 'a'};
+    const char key_b[] = {'b', 'i', 'n', '\0', 'b'};
+    const char value[] = {'\x00', '\x01', '\xff', '\0', 'z'};
+
+    ASSERT_EQ(levelcache_put_n(cache, key_a, sizeof(key_a), value, sizeof(value), 0), 0);
+    ASSERT_EQ(levelcache_put_n(cache, key_b, sizeof(key_b), "b", 1, 0), 0);
+
+    size_t value_len = 0;
+    char *retrieved = levelcache_get_n(cache, key_a, sizeof(key_a), &value_len);
+    ASSERT_NE(retrieved, nullptr);
+    ASSERT_EQ(value_len, sizeof(value));
+    EXPECT_EQ(memcmp(retrieved, value, sizeof(value)), 0);
+    free(retrieved);
+
+    // The NUL-terminated prefix "bin" is a different key.
+    EXPECT_EQ(levelcache_get(cache, "bin"), nullptr);
+
+    const char *keys[] = {key_a, key_b};
+    const size_t key_lens[] = {sizeof(key_a), sizeof(key_b)};
+    char *values[2];
+    size_t value_lens[2];
+    ASSERT_EQ(levelcache_multi_get_n(cache, keys, key_lens, 2, values, value_lens), 2);
+    EXPECT_EQ(value_lens[0], sizeof(value));
+    EXPECT_EQ(std::string(values[1], value_lens[1]), "b");
+    free(values[0]);
+    free(values[1]);
+
+    ASSERT_EQ(levelcache_delete_n(cache, key_a, sizeof(key_a)), 0);
+    EXPECT_EQ(levelcache_get_n(cache, key_a, sizeof(key_a), &value_len), nullptr);
+    retrieved = levelcache_get_n(cache, key_b, sizeof(key_b), nullptr);
+    ASSERT_NE(retrieved, nullptr);
+    free(retrieved);
+}
+
+TEST_P(LevelCacheTest, StatsCountOperations) {
+    ASSERT_EQ(levelcache_put(cache, "stats_key", "12345", 0), 0);
+    char *value = levelcache_get(cache, "stats_key");
+    ASSERT_NE(value, nullptr);
+    free(value);
+    EXPECT_EQ(levelcache_get(cache, "stats_missing"), nullptr);
+
+    coarse_clock_set(1000000);
+    ASSERT_EQ(levelcache_put(cache, "stats_expiring", "x", 5), 0);
+    coarse_clock_advance(6);
+    EXPECT_EQ(levelcache_get(cache, "stats_expiring"), nullptr);
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+    ASSERT_EQ(levelcache_delete(cache, "stats_key"), 0);
+
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_GET][LEVELCACHE_PHASE_TOTAL].count, 3u);
+
+    // A multi_get is timed once, whatever the number of keys.
+    const char *keys[] = {"stats_key", "stats_missing"};
+    char *values[2];
+    EXPECT_EQ(levelcache_multi_get(cache, keys, 2, values), 0);
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.expired_on_read, 1u);
+    EXPECT_EQ(stats.bytes_read, 5u);
+    EXPECT_EQ(stats.bytes_written, 6u);
+    EXPECT_EQ(stats.engine_errors, 0u);
+
+    const CacheStatsSummary &get = stats.latency[LEVELCACHE_OP_GET][LEVELCACHE_PHASE_TOTAL];
+    EXPECT_EQ(get.count, 4u);
+    EXPECT_LE(get.min_ns, get.p50_ns);
+    EXPECT_LE(get.p50_ns, get.p99_ns);
+    EXPECT_LE(get.p99_ns, get.max_ns);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_GET][LEVELCACHE_PHASE_INDEX].count, 4u);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_GET][LEVELCACHE_PHASE_COPY].count, 2u);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_PUT][LEVELCACHE_PHASE_ENGINE].count, 2u);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_DELETE][LEVELCACHE_PHASE_TOTAL].count, 1u);
+
+    char *report = levelcache_get_engine_stats(cache);
+    ASSERT_NE(report, nullptr);
+    free(report);
+}
+
+// Starts every test from an empty DB_PATH with `options` set up for the
+// engine under test; a test changes the options it is about, then opens.
+class LevelCacheOptionsTest : public ::testing::TestWithParam<engine_t> {
+protected:
+    LevelCacheOptions options;
+    LevelCache *cache = nullptr;
+
+    static void RemoveDb() {
+        char command[256];
+        snprintf(command, sizeof(command), "rm -rf %s", DB_PATH);
+        system(command);
+    }
+
+    void SetUp() override {
+        RemoveDb();
+        levelcache_options_init(&options);
+        options.cleanup_frequency_sec = 0;
+        options.log_level = LOG_FATAL;
+        options.engine = GetParam();
+    }
+
+    void TearDown() override {
+        levelcache_close(cache);
+        RemoveDb();
+    }
+
+    // Opens `cache` with `options`, closing the one opened before if any.
+    LevelCache* Open() {
+        levelcache_close(cache);
+        cache = levelcache_open_with_options(DB_PATH, &options);
+        return cache;
+    }
+};
+
+TEST_P(LevelCacheOptionsTest, StatsCanBeTurnedOff) {
+    options.stats_level = CACHE_STATS_COUNTERS;
+    ASSERT_NE(Open(), nullptr);
+    ASSERT_EQ(levelcache_put(cache, "key", "value", 0), 0);
+    char *value = levelcache_get(cache, "key");
+    free(value);
+
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.latency[LEVELCACHE_OP_GET][LEVELCACHE_PHASE_TOTAL].count, 0u);
+
+    options.stats_level = CACHE_STATS_OFF;
+    ASSERT_NE(Open(), nullptr);
+    ASSERT_EQ(levelcache_put(cache, "key", "value", 0), 0);
+    value = levelcache_get(cache, "key");
+    free(value);
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.hits, 0u);
+}
+
+TEST_P(LevelCacheOptionsTest, HotTierStaysCoherent) {
+    options.hot_tier_bytes = 1 << 20;
+    ASSERT_NE(Open(), nullptr);
+    ASSERT_NE(cache->hot, nullptr);
+
+    ASSERT_EQ(levelcache_put(cache, "hot", "v1", 0), 0);
+    char *value = levelcache_get(cache, "hot");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "v1");
+    free(value);
+
+    // The second read is answered by the tier and stays valid across eviction.
+    LevelCachePinnedValue pinned;
+    ASSERT_EQ(levelcache_get_pinned(cache, "hot", &pinned), 0);
+    EXPECT_NE(pinned.release, cache->engine->pinned_destroy);
+    ASSERT_EQ(levelcache_put(cache, "hot", "v2", 0), 0);
+    EXPECT_EQ(std::string(pinned.data, pinned.len), "v1");
+    levelcache_value_release(&pinned);
+
+    value = levelcache_get(cache, "hot");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "v2");
+    free(value);
+
+    ASSERT_EQ(levelcache_delete(cache, "hot"), 0);
+    EXPECT_EQ(levelcache_get(cache, "hot"), nullptr);
+
+    ASSERT_EQ(levelcache_put(cache, "short", "lived", 1), 0);
+    value = levelcache_get(cache, "short");
+    ASSERT_NE(value, nullptr);
+    free(value);
+    sleep(2);
+    EXPECT_EQ(levelcache_get(cache, "short"), nullptr);
+}
+
+TEST_P(LevelCacheOptionsTest, MemoryBudgetEvictsNearestExpiry) {
+    options.max_memory_mb = 1;
+    ASSERT_NE(Open(), nullptr);
+
+    ASSERT_EQ(levelcache_put(cache, "keeper", "value", 3600), 0);
+    // Long keys make the index alone outgrow the 1 MB budget.
+    std::string key(200, 'k');
+    for (int i = 0; i < 10 * 1024 - 1; ++i) {
+        std::string numbered = key + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, numbered.c_str(), "value", 60), 0);
+    }
+
+    LevelCacheMemoryStats stats;
+    levelcache_get_memory_stats(cache, &stats);
+    EXPECT_EQ(stats.limit_bytes, 1u << 20);
+    EXPECT_GT(stats.evicted_keys, 0u);
+    EXPECT_GT(stats.index_bytes, 0u);
+    EXPECT_LE(stats.total_bytes, stats.limit_bytes);
+    EXPECT_EQ(stats.total_bytes, stats.index_bytes + stats.hot_tier_bytes + stats.memtable_bytes +
+                                 stats.table_reader_bytes + stats.block_cache_bytes);
+
+    // The key furthest from expiring survives eviction.
+    char *value = levelcache_get(cache, "keeper");
+    ASSERT_NE(value, nullptr);
+    free(value);
+}
+
+TEST_P(LevelCacheOptionsTest, MemoryBudgetKeepsIndexOverLargeData) {
+    options.max_memory_mb = 1;
+    ASSERT_NE(Open(), nullptr);
+    if (cache->lru_cache == nullptr) {
+        GTEST_SKIP() << "engine keeps its values in memory that eviction gives back";
+    }
+
+    // 32 MB of values on disk, read back so the block cache fills up. The
+    // block cache, memtables and table readers then take most of the 1 MB
+    // budget or more, and deleting keys gives none of it back.
+    ASSERT_EQ(levelcache_put(cache, "keeper", "value", 7200), 0);
+    std::string value(16 << 10, 'v');
+    for (int i = 0; i < 2048; ++i) {
+        std::string key = "large:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put_n(cache, key.data(), key.size(), value.data(), value.size(), 3600), 0);
+    }
+    for (int i = 0; i < 2048; ++i) {
+        std::string key = "large:" + std::to_string(i);
+        free(levelcache_get(cache, key.c_str()));
+    }
+
+    // Many more budget checks, none of which adds a key. Eviction may make
+    // room for the index once, but must not drain it check after check.
+    for (int i = 0; i < 64 * 1024; ++i) {
+        ASSERT_EQ(levelcache_put(cache, "ticker", "tick", 7200), 0);
+    }
+    size_t kept = 0;
+    for (int i = 0; i < 2048; ++i) {
+        std::string key = "large:" + std::to_string(i);
+        char *found = levelcache_get(cache, key.c_str());
+        kept += (found != nullptr);
+        free(found);
+    }
+    EXPECT_GT(kept, 0u);
+    char *found = levelcache_get(cache, "keeper");
+    EXPECT_NE(found, nullptr);
+    free(found);
+}
+
+TEST_P(LevelCacheTest, NativeTtlDropsExpiredValuesOnCompaction) {
+    if (!cache->native_ttl) {
+        GTEST_SKIP() << "engine has no native TTL";
+    }
+    ASSERT_EQ(levelcache_put(cache, "short", "lived", 1), 0);
+    ASSERT_EQ(levelcache_put(cache, "long", "lived", 3600), 0);
+
+    // The stored value carries its expiration in front of the payload.
+    size_t len = 0;
+    char *err = nullptr;
+    char *raw = cache->engine->get(cache->db, cache->roptions, "long", 4, &len, &err);
+    ASSERT_NE(raw, nullptr);
+    ASSERT_EQ(len, VALUE_HEADER_SIZE + 5);
+    EXPECT_GT(value_header_expiration(raw), (uint64_t)time(NULL));
+    EXPECT_EQ(std::string(raw + VALUE_HEADER_SIZE, 5), "lived");
+    cache->engine->free_fn(raw);
+
+    sleep(2);
+    EXPECT_EQ(levelcache_get(cache, "short"), nullptr);
+    cache->engine->compact_range(cache->db, nullptr, 0, nullptr, 0);
+    raw = cache->engine->get(cache->db, cache->roptions, "short", 5, &len, &err);
+    EXPECT_EQ(raw, nullptr);
+
+    char *value = levelcache_get(cache, "long");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "lived");
+    free(value);
+}
+
+TEST_P(LevelCacheOptionsTest, WarmRestartRebuildsIndex) {
+    if (!ALL_ENGINES[GetParam()]->persistent) {
+        GTEST_SKIP() << "engine keeps no data across close";
+    }
+    options.keep_existing = 1;
+    options.restore_threads = 4;
+    ASSERT_NE(Open(), nullptr);
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "user:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), key.c_str(), 3600), 0);
+    }
+    ASSERT_EQ(levelcache_put(cache, "session:1", "gone", 1), 0);
+    size_t memory = levelcache_get_memory_usage(cache);
+
+    sleep(2);
+    ASSERT_NE(Open(), nullptr);
+    EXPECT_LT(levelcache_get_memory_usage(cache), memory);
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "user:" + std::to_string(i);
+        char *value = levelcache_get(cache, key.c_str());
+        ASSERT_NE(value, nullptr) << key;
+        EXPECT_EQ(key, value);
+        free(value);
+    }
+    EXPECT_EQ(levelcache_get(cache, "session:1"), nullptr);
+
+    // Without keep_existing the cache starts empty again.
+    options.keep_existing = 0;
+    ASSERT_NE(Open(), nullptr);
+    EXPECT_EQ(levelcache_get(cache, "user:1"), nullptr);
+}
+
+TEST_P(LevelCacheOptionsTest, NoIndexReadsExpirationFromValues) {
+    options.cleanup_frequency_sec = 1;
+    options.ephemeral = 1;
+    options.no_index = 1;
+    ASSERT_NE(Open(), nullptr);
+    coarse_clock_set(1000000);
+
+    LevelCacheMemoryStats before;
+    levelcache_get_memory_stats(cache, &before);
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "user:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), key.c_str(), 3600), 0);
+    }
+    const char *keys[] = {"batch:1", "batch:2"};
+    const char *values[] = {"one", "two"};
+    ASSERT_EQ(levelcache_put_batch(cache, keys, values, 2, 10), 0);
+    ASSERT_EQ(levelcache_put(cache, "session:1", "gone", 10), 0);
+    LevelCacheMemoryStats after;
+    levelcache_get_memory_stats(cache, &after);
+    EXPECT_EQ(after.index_bytes, before.index_bytes);
+
+    char *value = levelcache_get(cache, "user:7");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "user:7");
+    free(value);
+    EXPECT_EQ(levelcache_get(cache, "user:missing"), nullptr);
+    ASSERT_EQ(levelcache_delete(cache, "user:7"), 0);
+    EXPECT_EQ(levelcache_get(cache, "user:7"), nullptr);
+
+    // Expiry is read from the value header and the stale value is dropped.
+    coarse_clock_advance(11);
+    EXPECT_EQ(levelcache_get(cache, "session:1"), nullptr);
+    char *found[2];
+    ASSERT_EQ(levelcache_multi_get(cache, keys, 2, found), 0);
+    EXPECT_EQ(found[0], nullptr);
+    EXPECT_EQ(found[1], nullptr);
+    value = levelcache_get(cache, "user:8");
+    ASSERT_NE(value, nullptr);
+    free(value);
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.misses, 5u);
+    // Bitcask already hides expired values, so only the other engines see them.
+    EXPECT_EQ(stats.expired_on_read, GetParam() == ENGINE_BITCASK ? 0u : 3u);
+    if (!cache->native_ttl) {
+        size_t len = 0;
+        char *err = nullptr;
+        EXPECT_EQ(cache->engine->get(cache->db, cache->roptions, "session:1", 9, &len, &err), nullptr);
+        EXPECT_EQ(cache->engine->get(cache->db, cache->roptions, "batch:1", 7, &len, &err), nullptr);
+
+        // Keys that are never read again are found by the cleanup sweep.
+        coarse_clock_advance(3600);
+        sleep(2);
+        levelcache_get_stats(cache, &stats);
+        EXPECT_EQ(stats.cleanup_deletions, 999u);
+        EXPECT_EQ(cache->engine->get(cache->db, cache->roptions, "user:8", 6, &len, &err), nullptr);
+    }
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+}
+
+TEST_P(LevelCacheOptionsTest, NoIndexDeletePrefix) {
+    options.no_index = 1;
+    ASSERT_NE(Open(), nullptr);
+
+    ASSERT_EQ(levelcache_put(cache, "tenant:1", "one", 3600), 0);
+    ASSERT_EQ(levelcache_put(cache, "tenant:2", "two", 3600), 0);
+    ASSERT_EQ(levelcache_put(cache, "tenants", "kept", 3600), 0);
+    ASSERT_EQ(levelcache_delete_prefix(cache, "tenant:", 7), 0);
+    EXPECT_EQ(levelcache_get(cache, "tenant:1"), nullptr);
+    EXPECT_EQ(levelcache_get(cache, "tenant:2"), nullptr);
+    char *value = levelcache_get(cache, "tenants");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "kept");
+    free(value);
+}
+
+TEST_P(LevelCacheOptionsTest, ScanReturnsLiveKeysInOrder) {
+    options.scan_prefix_len = 4;
+    ASSERT_NE(Open(), nullptr);
+    coarse_clock_set(1000000);
+
+    std::vector<std::string> expected;
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "ten:a:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), ("value" + std::to_string(i)).c_str(), 3600), 0);
+        expected.push_back(key);
+    }
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_EQ(levelcache_put(cache, ("ten:b:" + std::to_string(i)).c_str(), "other", 3600), 0);
+    }
+    ASSERT_EQ(levelcache_put(cache, "ten:a:gone", "expired", 10), 0);
+    ASSERT_EQ(levelcache_put(cache, "ten:a:deleted", "deleted", 3600), 0);
+    ASSERT_EQ(levelcache_delete(cache, "ten:a:deleted"), 0);
+    coarse_clock_advance(11);
+    std::sort(expected.begin(), expected.end());
+
+    // Collects every entry of a scan, 16 per batch.
+    auto collect = [](LevelCacheScan *scan, std::vector<std::string> *keys, std::vector<std::string> *values) {
+        LevelCacheScanEntry entries[16];
+        ssize_t n;
+        while ((n = levelcache_scan_next(scan, entries, 16)) > 0) {
+            EXPECT_LE(n, 16);
+            for (ssize_t i = 0; i < n; ++i) {
+                keys->emplace_back(entries[i].key, entries[i].key_len);
+                values->emplace_back(entries[i].value, entries[i].value_len);
+            }
+        }
+        EXPECT_EQ(n, 0);
+        levelcache_scan_close(scan);
+    };
+
+    std::vector<std::string> keys, values;
+    LevelCacheScan *scan = levelcache_scan_prefix(cache, "ten:a:", 6);
+    ASSERT_NE(scan, nullptr);
+    collect(scan, &keys, &values);
+    ASSERT_EQ(keys, expected);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(values[i], "value" + keys[i].substr(6));
+    }
+
+    // [ten:a:10, ten:a:20) holds 10..19 and 2 in bytewise order.
+    keys.clear();
+    values.clear();
+    scan = levelcache_scan_range(cache, "ten:a:10", 8, "ten:a:20", 8);
+    ASSERT_NE(scan, nullptr);
+    collect(scan, &keys, &values);
+    EXPECT_EQ(keys.size(), 11u);
+    EXPECT_EQ(keys.front(), "ten:a:10");
+    EXPECT_EQ(keys.back(), "ten:a:2");
+
+    // Open bounds cover the whole keyspace.
+    keys.clear();
+    values.clear();
+    scan = levelcache_scan_range(cache, nullptr, 0, nullptr, 0);
+    ASSERT_NE(scan, nullptr);
+    collect(scan, &keys, &values);
+    EXPECT_EQ(keys.size(), 150u);
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+    keys.clear();
+    values.clear();
+    scan = levelcache_scan_prefix(cache, "ten:c:", 6);
+    ASSERT_NE(scan, nullptr);
+    collect(scan, &keys, &values);
+    EXPECT_TRUE(keys.empty());
+
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+}
+
+TEST_P(LevelCacheOptionsTest, DeletePrefixPrunesEngineAndIndex) {
+    options.hot_tier_bytes = 1 << 20;
+    ASSERT_NE(Open(), nullptr);
+
+    // More keys than one chunk, so the prefix is deleted in several.
+    std::vector<std::string> keys;
+    for (int i = 0; i < 40000; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "t:a:%05d", i);
+        keys.push_back(key);
+    }
+    for (int i = 0; i < 100; ++i) {
+        keys.push_back("t:b:" + std::to_string(i));
+    }
+    std::vector<const char *> key_ptrs;
+    for (const std::string &key : keys) {
+        key_ptrs.push_back(key.c_str());
+    }
+    ASSERT_EQ(levelcache_put_batch(cache, key_ptrs.data(), key_ptrs.data(), key_ptrs.size(), 3600), 0);
+    char *value = levelcache_get(cache, "t:a:00042");
+    ASSERT_NE(value, nullptr);
+    free(value);
+    size_t memory = levelcache_get_memory_usage(cache);
+
+    ASSERT_EQ(levelcache_delete_prefix(cache, "t:a:", 4), 0);
+    EXPECT_LT(levelcache_get_memory_usage(cache), memory);
+    EXPECT_EQ(levelcache_get(cache, "t:a:00042"), nullptr);
+    EXPECT_EQ(levelcache_get(cache, "t:a:39999"), nullptr);
+    LevelCacheScan *scan = levelcache_scan_range(cache, nullptr, 0, nullptr, 0);
+    ASSERT_NE(scan, nullptr);
+    LevelCacheScanEntry entries[128];
+    EXPECT_EQ(levelcache_scan_next(scan, entries, 128), 100);
+    levelcache_scan_close(scan);
+
+    // [t:b:10, t:b:20) holds 10..19 and 2; an open end takes the rest.
+    ASSERT_EQ(levelcache_delete_range(cache, "t:b:10", 6, "t:b:20", 6), 0);
+    EXPECT_EQ(levelcache_get(cache, "t:b:15"), nullptr);
+    EXPECT_EQ(levelcache_get(cache, "t:b:2"), nullptr);
+    value = levelcache_get(cache, "t:b:1");
+    ASSERT_NE(value, nullptr);
+    free(value);
+    ASSERT_EQ(levelcache_delete_range(cache, "t:b:5", 5, nullptr, 0), 0);
+    EXPECT_EQ(levelcache_get(cache, "t:b:99"), nullptr);
+    value = levelcache_get(cache, "t:b:49");
+    ASSERT_NE(value, nullptr);
+    free(value);
+
+    // Keys written after the delete are unaffected.
+    ASSERT_EQ(levelcache_put(cache, "t:a:00042", "again", 3600), 0);
+    value = levelcache_get(cache, "t:a:00042");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "again");
+    free(value);
+}
+
+TEST_P(LevelCacheOptionsTest, PrefixBloomsLeaveInternalScansWhole) {
+    options.scan_prefix_len = 4;
+    options.keep_existing = 1;
+    options.restore_threads = 4;
+    ASSERT_NE(Open(), nullptr);
+
+    // Every key prefix differs, so a seek confined to the seek key's prefix
+    // would stop short of the next one.
+    auto key_of = [](int p, int i) {
+        char key[32];
+        snprintf(key, sizeof(key), "%c%c%c%c:%03d", 'a' + p, 'a' + p, 'a' + p, 'a' + p, i);
+        return std::string(key);
+    };
+    for (int p = 0; p < 8; ++p) {
+        for (int i = 0; i < 200; ++i) {
+            std::string key = key_of(p, i);
+            ASSERT_EQ(levelcache_put(cache, key.c_str(), key.c_str(), 3600), 0);
+        }
+    }
+    ASSERT_EQ(levelcache_delete_range(cache, "bbbb:100", 8, "dddd:100", 8), 0);
+    auto check = [&](LevelCache *c) {
+        for (int p = 0; p < 8; ++p) {
+            for (int i = 0; i < 200; ++i) {
+                std::string key = key_of(p, i);
+                bool deleted = key >= "bbbb:100" && key < "dddd:100";
+                char *value = levelcache_get(c, key.c_str());
+                if (deleted) {
+                    EXPECT_EQ(value, nullptr) << key;
+                } else {
+                    EXPECT_NE(value, nullptr) << key;
+                }
+                free(value);
+            }
+        }
+    };
+    check(cache);
+
+    // The restore splits the key space across threads and seeks to each
+    // split point; every surviving key must come back.
+    if (ALL_ENGINES[GetParam()]->persistent) {
+        ASSERT_NE(Open(), nullptr);
+        check(cache);
+    }
+}
+
+static std::string JsonDocument(int i) {
+    std::string id = std::to_string(i);
+    return "{\"id\":" + id + ",\"name\":\"user" + id + "\",\"email\":\"user" + id +
+           "@example.com\",\"plan\":\"" + (i % 3 ? "free" : "premium") +
+           "\",\"created_at\":\"2024-03-" + std::to_string(10 + i % 20) +
+           "T12:00:00Z\",\"settings\":{\"theme\":\"dark\",\"notifications\":true,\"language\":\"en-US\"}," +
+           "\"tags\":[\"alpha\",\"beta\",\"gamma\"],\"score\":" + std::to_string(i * 7 % 1000) + "}";
+}
+
+TEST_P(LevelCacheOptionsTest, CodecCompressesValuesWithTrainedDictionary) {
+    options.keep_existing = 1;
+    options.codec = LEVELCACHE_CODEC_ZSTD;
+    options.codec_dict_bytes = 4096;
+    ASSERT_NE(Open(), nullptr);
+
+    const int count = 3000;
+    for (int i = 0; i < count; ++i) {
+        std::string key = "doc:" + std::to_string(10000 + i);
+        std::string value = JsonDocument(i);
+        ASSERT_EQ(levelcache_put_n(cache, key.data(), key.size(), value.data(), value.size(), 3600), 0);
+    }
+    EXPECT_GT(value_codec_dict_size(cache->codec), 0u);
+    const char *keys[] = {"doc:batch:1", "doc:batch:2"};
+    std::string docs[] = {JsonDocument(count), JsonDocument(count + 1)};
+    const char *values[] = {docs[0].c_str(), docs[1].c_str()};
+    ASSERT_EQ(levelcache_put_batch(cache, keys, values, 2, 3600), 0);
+    ASSERT_EQ(levelcache_put(cache, "small", "below the threshold", 3600), 0);
+
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_LT(stats.bytes_stored * 2, stats.bytes_written);
+
+    // Values under codec_min_bytes keep their codec byte but stay readable as is.
+    size_t len = 0;
+    char *err = nullptr;
+    char *raw = cache->engine->get(cache->db, cache->roptions, "small", 5, &len, &err);
+    ASSERT_NE(raw, nullptr);
+    ASSERT_EQ(len, VALUE_HEADER_SIZE + 1 + strlen("below the threshold"));
+    EXPECT_EQ(raw[VALUE_HEADER_SIZE], VALUE_CODEC_RAW);
+    cache->engine->free_fn(raw);
+    raw = cache->engine->get(cache->db, cache->roptions, "doc:12999", 9, &len, &err);
+    ASSERT_NE(raw, nullptr);
+    EXPECT_EQ(raw[VALUE_HEADER_SIZE], VALUE_CODEC_ZSTD_DICT);
+    EXPECT_LT(len, JsonDocument(2999).size());
+    cache->engine->free_fn(raw);
+
+    char *value = levelcache_get(cache, "small");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "below the threshold");
+    free(value);
+    for (int i : {0, 1500, 2999}) {
+        std::string key = "doc:" + std::to_string(10000 + i);
+        value = levelcache_get(cache, key.c_str());
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(std::string(value), JsonDocument(i));
+        free(value);
+    }
+    char *found[2];
+    ASSERT_EQ(levelcache_multi_get(cache, keys, 2, found), 2);
+    EXPECT_EQ(std::string(found[0]), docs[0]);
+    EXPECT_EQ(std::string(found[1]), docs[1]);
+    free(found[0]);
+    free(found[1]);
+    LevelCacheScan *scan = levelcache_scan_prefix(cache, "doc:1299", 8);
+    ASSERT_NE(scan, nullptr);
+    LevelCacheScanEntry entries[16];
+    ASSERT_EQ(levelcache_scan_next(scan, entries, 16), 10);
+    EXPECT_EQ(std::string(entries[9].value, entries[9].value_len), JsonDocument(2999));
+    levelcache_scan_close(scan);
+
+    // A persistent engine keeps the dictionary, so old values still decode.
+    if (ALL_ENGINES[GetParam()]->persistent) {
+        ASSERT_NE(Open(), nullptr);
+        value = levelcache_get(cache, "doc:12999");
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(std::string(value), JsonDocument(2999));
+        free(value);
+    }
+}
+
+TEST_P(LevelCacheOptionsTest, AdmissionKeepsColdKeysOutUnderPressure) {
+    options.max_memory_mb = 1;
+    options.admission = 1;
+    ASSERT_NE(Open(), nullptr);
+    ASSERT_NE(cache->admission, nullptr);
+
+    // Hot keys outlive the filler, so eviction never picks them first.
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "hot:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), "hot", 7200), 0);
+        for (int j = 0; j < 5; ++j) {
+            free(levelcache_get(cache, key.c_str()));
+        }
+    }
+    // Fill until the budget is nearly used up and the filter starts to act.
+    LevelCacheStats stats;
+    for (int i = 0; i < 200000; ++i) {
+        std::string key = "fill:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), "fill", 3600), 0);
+        levelcache_get_stats(cache, &stats);
+        if (stats.rejected > 0) {
+            break;
+        }
+    }
+    ASSERT_GT(stats.rejected, 0u);
+
+    // Keys written once are no more popular than the victims and stay out.
+    for (int i = 0; i < 10000; ++i) {
+        std::string key = "cold:" + std::to_string(i);
+        ASSERT_EQ(levelcache_put(cache, key.c_str(), "cold", 3600), 0);
+    }
+    levelcache_get_stats(cache, &stats);
+    EXPECT_GT(stats.rejected, stats.admitted);
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "hot:" + std::to_string(i);
+        char *value = levelcache_get(cache, key.c_str());
+        ASSERT_NE(value, nullptr) << key;
+        free(value);
+    }
+
+    // Misses count too, so a key that keeps being asked for gets in.
+    for (int j = 0; j < 3; ++j) {
+        EXPECT_EQ(levelcache_get(cache, "wanted"), nullptr);
+    }
+    ASSERT_EQ(levelcache_put(cache, "wanted", "at last", 3600), 0);
+    char *value = levelcache_get(cache, "wanted");
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "at last");
+    free(value);
+}
+
+struct LoaderState {
+    std::atomic<int> calls{0};
+    int delay_ms = 0;
+    const char *value = "loaded";   // nullptr makes the load fail
+};
+
+static char* CountingLoader(const char *key, size_t key_len, size_t *value_len, void *ctx) {
+    LoaderState *state = (LoaderState *)ctx;
+    state->calls++;
+    if (state->delay_ms > 0) {
+        usleep(state->delay_ms * 1000);
+    }
+    if (state->value == nullptr) {
+        return nullptr;
+    }
+    *value_len = strlen(state->value);
+    return strdup(state->value);
+}
+
+TEST_P(LevelCacheOptionsTest, GetOrLoadCoalescesConcurrentMisses) {
+    ASSERT_NE(Open(), nullptr);
+
+    // Every thread misses while the first one's load is still running.
+    LoaderState state;
+    state.delay_ms = 200;
+    const int kThreads = 16;
+    std::atomic<int> served{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&]() {
+            size_t len = 0;
+            char *value = levelcache_get_or_load_n(cache, "stampede", 8, &len, CountingLoader, &state, 3600);
+            if (value != nullptr && len == 6 && strcmp(value, "loaded") == 0) {
+                served++;
+            }
+            free(value);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(state.calls.load(), 1);
+    EXPECT_EQ(served.load(), kThreads);
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.loads, 1u);
+    EXPECT_EQ(stats.coalesced_loads, (uint64_t)(kThreads - 1));
+
+    // The loaded value was stored, so the next call is a plain hit.
+    char *value = levelcache_get_or_load(cache, "stampede", CountingLoader, &state, 3600);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "loaded");
+    free(value);
+    EXPECT_EQ(state.calls.load(), 1);
+
+    // A failed load returns nothing and stores nothing.
+    LoaderState failing;
+    failing.value = nullptr;
+    EXPECT_EQ(levelcache_get_or_load(cache, "missing", CountingLoader, &failing, 3600), nullptr);
+    EXPECT_EQ(levelcache_get(cache, "missing"), nullptr);
+    EXPECT_EQ(failing.calls.load(), 1);
+}
+
+TEST_P(LevelCacheOptionsTest, GetOrLoadLoadsOnceAcrossWaves) {
+    ASSERT_NE(Open(), nullptr);
+
+    // Loads finish at once, so later callers of a wave keep missing just as
+    // the flight before them ends; they must find its stored value rather
+    // than load again.
+    const int kThreads = 8, kWaves = 500;
+    LoaderState state;
+    std::atomic<int> wave{-1}, arrived{0}, served{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&]() {
+            for (int w = 0; w < kWaves; ++w) {
+                while (wave.load() < w) {
+                    std::this_thread::yield();
+                }
+                std::string key = "wave:" + std::to_string(w);
+                for (int i = 0; i < 4; ++i) {
+                    char *value = levelcache_get_or_load_n(cache, key.data(), key.size(), nullptr, CountingLoader, &state, 3600);
+                    if (value != nullptr && strcmp(value, "loaded") == 0) {
+                        served++;
+                    }
+                    free(value);
+                }
+                arrived++;
+            }
+        });
+    }
+    for (int w = 0; w < kWaves; ++w) {
+        wave.store(w);
+        while (arrived.load() < (w + 1) * kThreads) {
+            std::this_thread::yield();
+        }
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(state.calls.load(), kWaves);
+    EXPECT_EQ(served.load(), kWaves * kThreads * 4);
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.loads, (uint64_t)kWaves);
+}
+
+TEST_P(LevelCacheOptionsTest, GetOrLoadRefreshesBeforeExpiry) {
+    coarse_clock_set(1000000);
+
+    options.hot_tier_bytes = 1 << 20;
+    options.early_refresh_beta = 1;
+    ASSERT_NE(Open(), nullptr);
+
+    LoaderState state;
+    state.value = "first";
+    char *value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "first");
+    free(value);
+
+    // Loads are quick, so well before expiry hits never reload.
+    state.value = "second";
+    coarse_clock_advance(5);
+    for (int i = 0; i < 100; ++i) {
+        value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+        ASSERT_NE(value, nullptr);
+        EXPECT_STREQ(value, "first");
+        free(value);
+    }
+    EXPECT_EQ(state.calls.load(), 1);
+
+    // In its last second the key is reloaded before anyone misses it.
+    coarse_clock_advance(5);
+    value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "second");
+    free(value);
+    EXPECT_EQ(state.calls.load(), 2);
+    LevelCacheStats stats;
+    levelcache_get_stats(cache, &stats);
+    EXPECT_EQ(stats.early_refreshes, 1u);
+
+    // A refresh that fails keeps the cached value.
+    state.value = nullptr;
+    coarse_clock_advance(10);
+    value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "second");
+    free(value);
+    EXPECT_EQ(state.calls.load(), 3);
+
+    // Without early refresh the key is only reloaded once it has expired.
+    levelcache_close(cache);
+    cache = nullptr;
+    RemoveDb();
+    options.early_refresh_beta = 0;
+    ASSERT_NE(Open(), nullptr);
+    state.calls = 0;
+    state.value = "first";
+    free(levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10));
+    state.value = "second";
+    coarse_clock_advance(10);
+    value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "first");
+    free(value);
+    coarse_clock_advance(1);
+    value = levelcache_get_or_load(cache, "hot", CountingLoader, &state, 10);
+    ASSERT_NE(value, nullptr);
+    EXPECT_STREQ(value, "second");
+    free(value);
+    EXPECT_EQ(state.calls.load(), 2);
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+}
+
+static std::atomic<int> async_callbacks_seen;
+
+static void CountAsyncCallback(LevelCacheCompletion *completion) {
+    EXPECT_EQ(completion->op, LEVELCACHE_ASYNC_GET);
+    if (completion->status == 0) {
+        EXPECT_EQ(std::string(completion->value, completion->value_len), (const char *)completion->user_data);
+    }
+    free(completion->value);
+    async_callbacks_seen++;
+}
+
+TEST_P(LevelCacheOptionsTest, AsyncOperationsComplete) {
+    options.async_threads = 4;
+    options.async_queue_depth = 256;
+    ASSERT_NE(Open(), nullptr);
+    int fd = levelcache_completion_fd(cache);
+    ASSERT_GE(fd, 0);
+
+    // Waits on the eventfd like an event loop would.
+    auto drain = [&](size_t expected, std::vector<LevelCacheCompletion> *out) {
+        while (out->size() < expected) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+            LevelCacheCompletion batch[16];
+            size_t n;
+            while ((n = levelcache_poll_completions(cache, batch, 16)) > 0) {
+                out->insert(out->end(), batch, batch + n);
+            }
+        }
+    };
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < 200; ++i) {
+        keys.push_back("async:" + std::to_string(i));
+        ASSERT_EQ(levelcache_put_async(cache, keys[i].data(), keys[i].size(), keys[i].data(), keys[i].size(),
+                                       3600, nullptr, (void *)(intptr_t)i), 0);
+    }
+    std::vector<LevelCacheCompletion> done;
+    drain(200, &done);
+    ASSERT_EQ(done.size(), 200u);
+    for (const LevelCacheCompletion &completion : done) {
+        EXPECT_EQ(completion.op, LEVELCACHE_ASYNC_PUT);
+        EXPECT_EQ(completion.status, 0);
+        EXPECT_EQ(completion.value, nullptr);
+    }
+
+    done.clear();
+    for (int i = 0; i < 200; ++i) {
+        ASSERT_EQ(levelcache_get_async(cache, keys[i].data(), keys[i].size(), nullptr, (void *)(intptr_t)i), 0);
+    }
+    ASSERT_EQ(levelcache_get_async(cache, "async:none", 10, nullptr, (void *)(intptr_t)-1), 0);
+    drain(201, &done);
+    ASSERT_EQ(done.size(), 201u);
+    for (const LevelCacheCompletion &completion : done) {
+        intptr_t i = (intptr_t)completion.user_data;
+        if (i < 0) {
+            EXPECT_EQ(completion.status, -1);
+            EXPECT_EQ(completion.value, nullptr);
+            continue;
+        }
+        ASSERT_EQ(completion.status, 0);
+        EXPECT_EQ(std::string(completion.value, completion.value_len), keys[i]);
+        free(completion.value);
+    }
+
+    // Callbacks run on the workers instead of going through the queue.
+    async_callbacks_seen = 0;
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_EQ(levelcache_get_async(cache, keys[i].data(), keys[i].size(), CountAsyncCallback,
+                                       (void *)keys[i].c_str()), 0);
+    }
+    ASSERT_EQ(levelcache_delete_async(cache, "async:0", 7, nullptr, nullptr), 0);
+    done.clear();
+    drain(1, &done);
+    EXPECT_EQ(done[0].op, LEVELCACHE_ASYNC_DELETE);
+    EXPECT_EQ(done[0].status, 0);
+    while (async_callbacks_seen < 50) {
+        usleep(1000);
+    }
+
+    // Completions nobody polls count against the depth; close frees them.
+    int accepted = 0;
+    while (accepted <= 256 && levelcache_delete_async(cache, "async:1", 7, nullptr, nullptr) == 0) {
+        accepted++;
+    }
+    EXPECT_EQ(accepted, 256);
+}
+
+TEST_P(LevelCacheOptionsTest, AsyncSingleWorkerKeepsSubmissionOrder) {
+    options.async_threads = 1;
+    ASSERT_NE(Open(), nullptr);
+
+    // Reads and writes of the same keys interleaved, enough of them that the
+    // worker takes several in one go.
+    std::vector<std::string> keys;
+    for (int i = 0; i < 20; ++i) {
+        keys.push_back("order:" + std::to_string(i));
+        ASSERT_EQ(levelcache_put(cache, keys[i].c_str(), "old", 3600), 0);
+    }
+    for (int i = 0; i < 20; ++i) {
+        const std::string &key = keys[i];
+        ASSERT_EQ(levelcache_get_async(cache, key.data(), key.size(), nullptr, (void *)(intptr_t)0), 0);
+        ASSERT_EQ(levelcache_put_async(cache, key.data(), key.size(), "new", 3, 3600, nullptr, (void *)(intptr_t)1), 0);
+        ASSERT_EQ(levelcache_get_async(cache, key.data(), key.size(), nullptr, (void *)(intptr_t)2), 0);
+        ASSERT_EQ(levelcache_delete_async(cache, key.data(), key.size(), nullptr, (void *)(intptr_t)3), 0);
+        ASSERT_EQ(levelcache_get_async(cache, key.data(), key.size(), nullptr, (void *)(intptr_t)4), 0);
+    }
+
+    size_t seen = 0;
+    int fd = levelcache_completion_fd(cache);
+    while (seen < 100) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+        LevelCacheCompletion batch[16];
+        size_t n;
+        while ((n = levelcache_poll_completions(cache, batch, 16)) > 0) {
+            for (size_t i = 0; i < n; ++i, ++seen) {
+                LevelCacheCompletion &completion = batch[i];
+                switch ((intptr_t)completion.user_data) {
+                case 0:
+                    ASSERT_EQ(completion.status, 0);
+                    EXPECT_EQ(std::string(completion.value, completion.value_len), "old");
+                    break;
+                case 2:
+                    ASSERT_EQ(completion.status, 0);
+                    EXPECT_EQ(std::string(completion.value, completion.value_len), "new");
+                    break;
+                case 4:
+                    EXPECT_EQ(completion.status, -1);
+                    EXPECT_EQ(completion.value, nullptr);
+                    break;
+                default:
+                    EXPECT_EQ(completion.status, 0);
+                    break;
+                }
+                free(completion.value);
+            }
+        }
+    }
+}
+
+static std::string EngineName(const ::testing::TestParamInfo<engine_t>& info) {
+    return engine_names[info.param];
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, LevelCacheTest,
+                         ::testing::Values(ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_MEMORY, ENGINE_BITCASK), EngineName);
+INSTANTIATE_TEST_SUITE_P(Engines, LevelCacheOptionsTest,
+                         ::testing::Values(ENGINE_LEVELDB, ENGINE_ROCKSDB, ENGINE_MEMORY, ENGINE_BITCASK), EngineName);
+
+static size_t async_records_seen;
+
+static void CountTestRecords(log_Event *ev) {
+    if (strcmp(ev->file, __FILE__) == 0) {
+        __atomic_add_fetch(&async_records_seen, 1, __ATOMIC_RELAXED);
+    }
+}
+
+TEST(CacheLogTest, AsyncLoggerDeliversEveryRecord) {
+    static bool registered = false;
+    if (!registered) {
+        log_add_callback(CountTestRecords, nullptr, LOG_TRACE);
+        registered = true;
+    }
+    log_set_quiet(true);
+    cache_log_set_level(LOG_INFO);
+    async_records_seen = 0;
+    size_t dropped_before = cache_log_async_dropped();
+
+    ASSERT_EQ(cache_log_async_acquire(), 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 500; ++i) {
+                log_info("[test] thread %d record %d", t, i);
+                log_debug("[test] below the runtime level");
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // Releasing the last user drains the ring before returning.
+    cache_log_async_release();
+
+    EXPECT_EQ(cache_log_async_dropped(), dropped_before);
+    EXPECT_EQ(async_records_seen, 2000u);
+    cache_log_set_level(LOG_FATAL);
+    log_set_quiet(false);
+}
+
+TEST(CacheStatsTest, HistogramBucketsKeepRelativePrecision) {
+    CacheStats stats;
+    ASSERT_EQ(cache_stats_init(&stats, CACHE_STATS_TIMINGS, 1, 1), 0);
+    for (uint64_t ticks = 1; ticks < (1ull << 36); ticks = ticks * 3 + 1) {
+        unsigned bucket = cache_stats_bucket(ticks);
+        ASSERT_LT(bucket, (unsigned)CACHE_STATS_BUCKETS);
+        EXPECT_LE(bucket, cache_stats_bucket(ticks + 1));
+    }
+    // Within one power of two the buckets are linear.
+    EXPECT_EQ(cache_stats_bucket(1024) + 1, cache_stats_bucket(1024 + 128));
+
+    for (int i = 0; i < 99; i++) {
+        cache_stats_record(&stats, 0, 0, 100);
+    }
+    cache_stats_record(&stats, 0, 0, 100000);
+    cache_stats_add(&stats, 0, 7);
+    EXPECT_EQ(cache_stats_counter(&stats, 0), 7u);
+
+    CacheStatsSummary summary;
+    cache_stats_summarize(&stats, 0, &summary);
+    EXPECT_EQ(summary.count, 100u);
+    EXPECT_LT(summary.p50_ns, summary.p999_ns);
+    EXPECT_EQ(summary.p50_ns, summary.p90_ns);
+    cache_stats_destroy(&stats);
+}
+
+TEST(MemoryEngineTest, IteratesInOrderAndPinsValues) {
+    StorageEngine *engine = &MEMORY_ENGINE;
+    char *err = nullptr;
+    void *db = engine->open(engine->options_create(), "unused", &err);
+    ASSERT_NE(db, nullptr);
+    void *woptions = engine->writeoptions_create();
+    void *roptions = engine->readoptions_create();
+
+    // Keys hash to different shards; iteration must still merge them in order.
+    std::vector<std::string> keys;
+    for (int i = 0; i < 500; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "k%05d", (i * 7919) % 500);
+        keys.push_back(key);
+        engine->put(db, woptions, key, strlen(key), key, strlen(key), &err);
+        ASSERT_EQ(err, nullptr);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    void *iter = engine->iter_create(db, roptions);
+    size_t seen = 0;
+    for (engine->iter_seek(iter, "k00100", 6); engine->iter_valid(iter); engine->iter_next(iter)) {
+        size_t len;
+        const char *key = engine->iter_key(iter, &len);
+        ASSERT_EQ(std::string(key, len), keys[100 + seen]);
+        seen++;
+    }
+    EXPECT_EQ(seen, 400u);
+    engine->iter_seek_to_last(iter);
+    ASSERT_TRUE(engine->iter_valid(iter));
+    size_t len;
+    EXPECT_EQ(std::string(engine->iter_key(iter, &len), 6), "k00499");
+    engine->iter_destroy(iter);
+
+    // A pinned value outlives an overwrite and a delete of its key.
+    const char *data;
+    void *pinned = engine->get_pinned(db, roptions, "k00042", 6, &data, &len, &err);
+    ASSERT_NE(pinned, nullptr);
+    engine->put(db, woptions, "k00042", 6, "new", 3, &err);
+    engine->del(db, woptions, "k00042", 6, &err);
+    EXPECT_EQ(std::string(data, len), "k00042");
+    engine->pinned_destroy(pinned);
+    EXPECT_EQ(engine->get(db, roptions, "k00042", 6, &len, &err), nullptr);
+
+    void *batch = engine->writebatch_create();
+    engine->writebatch_put(batch, "b1", 2, "v1", 2);
+    engine->writebatch_delete(batch, "k00001", 6);
+    engine->write(db, woptions, batch, &err);
+    engine->writebatch_destroy(batch);
+    ASSERT_EQ(err, nullptr);
+    char *value = engine->get(db, roptions, "b1", 2, &len, &err);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(std::string(value, len), "v1");
+    engine->free_fn(value);
+    EXPECT_EQ(engine->get(db, roptions, "k00001", 6, &len, &err), nullptr);
+
+    // Records of one key apply in batch order, whichever way they alternate.
+    batch = engine->writebatch_create();
+    engine->writebatch_delete(batch, "b1", 2);
+    engine->writebatch_put(batch, "b1", 2, "v2", 2);
+    engine->writebatch_put(batch, "b2", 2, "v1", 2);
+    engine->writebatch_delete(batch, "b2", 2);
+    engine->write(db, woptions, batch, &err);
+    engine->writebatch_destroy(batch);
+    ASSERT_EQ(err, nullptr);
+    value = engine->get(db, roptions, "b1", 2, &len, &err);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(std::string(value, len), "v2");
+    engine->free_fn(value);
+    EXPECT_EQ(engine->get(db, roptions, "b2", 2, &len, &err), nullptr);
+    iter = engine->iter_create(db, roptions);
+    engine->iter_seek(iter, "b", 1);
+    ASSERT_TRUE(engine->iter_valid(iter));
+    data = engine->iter_key(iter, &len);
+    EXPECT_EQ(std::string(data, len), "b1");
+    engine->iter_next(iter);
+    ASSERT_TRUE(engine->iter_valid(iter));
+    data = engine->iter_key(iter, &len);
+    EXPECT_EQ(std::string(data, len), "k00000");
+    engine->iter_destroy(iter);
+
+    EngineMemoryUsage usage;
+    engine->memory_usage(db, nullptr, &usage);
+    EXPECT_GT(usage.memtables, 0u);
+    engine->readoptions_destroy(roptions);
+    engine->writeoptions_destroy(woptions);
+    engine->close(db);
+}
+
+static unsigned long long bitcask_reclaimed(StorageEngine *engine, void *db) {
+    char *report = engine->stats_report(db);
+    const char *field = strstr(report, "MB mapped, ");
+    unsigned long long reclaimed = field ? strtoull(field + strlen("MB mapped, "), NULL, 10) : 0;
+    engine->free_fn(report);
+    return reclaimed;
+}
+
+TEST(BitcaskEngineTest, ReclaimsOverwrittenAndExpiredSegments) {
+    StorageEngine *engine = &BITCASK_ENGINE;
+    char *err = nullptr;
+    void *options = engine->options_create();
+    engine->options_set_create_if_missing(options, 1);
+    engine->options_set_write_buffer_size(options, 4096);
+    engine->options_set_ttl_filter(options);
+    engine->destroy_db(options, DB_PATH, &err);
+    void *db = engine->open(options, DB_PATH, &err);
+    ASSERT_NE(db, nullptr);
+    void *woptions = engine->writeoptions_create();
+    void *roptions = engine->readoptions_create();
+
+    // Small segments hold a few dozen records each.
+    coarse_clock_set(1000000);
+    char value[VALUE_HEADER_SIZE + 100];
+    memset(value, 'v', sizeof(value));
+    value_header_encode(value, 1000010);
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "key" + std::to_string(i);
+        engine->put(db, woptions, key.data(), key.size(), value, sizeof(value), &err);
+        ASSERT_EQ(err, nullptr);
+    }
+    const char *data;
+    size_t len;
+    void *pinned = engine->get_pinned(db, roptions, "key0", 4, &data, &len, &err);
+    ASSERT_NE(pinned, nullptr);
+
+    // Overwriting every key leaves the old segments with nothing live.
+    value_header_encode(value, 1000100);
+    value[VALUE_HEADER_SIZE] = 'w';
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "key" + std::to_string(i);
+        engine->put(db, woptions, key.data(), key.size(), value, sizeof(value), &err);
+    }
+    EXPECT_GE(bitcask_reclaimed(engine, db), 2u);
+    ASSERT_EQ(len, sizeof(value));
+    EXPECT_EQ(data[VALUE_HEADER_SIZE], 'v');
+    engine->pinned_destroy(pinned);
+    char *current = engine->get(db, roptions, "key0", 4, &len, &err);
+    ASSERT_NE(current, nullptr);
+    EXPECT_EQ(current[VALUE_HEADER_SIZE], 'w');
+    engine->free_fn(current);
+
+    // Once everything has expired, the remaining segments go as well and
+    // the index is left empty.
+    unsigned long long before = bitcask_reclaimed(engine, db);
+    coarse_clock_advance(101);
+    EXPECT_EQ(engine->get(db, roptions, "key1", 4, &len, &err), nullptr);
+    engine->compact_range(db, nullptr, 0, nullptr, 0);
+    EXPECT_GT(bitcask_reclaimed(engine, db), before);
+    EngineMemoryUsage usage;
+    engine->memory_usage(db, nullptr, &usage);
+    EXPECT_EQ(usage.memtables, 0u);
+    coarse_clock_set_source(COARSE_CLOCK_TICKER);
+
+    engine->readoptions_destroy(roptions);
+    engine->writeoptions_destroy(woptions);
+    engine->close(db);
+    engine->options_destroy(options);
+}
+
+TEST(BitcaskEngineTest, BatchesSpanSegments) {
+    StorageEngine *engine = &BITCASK_ENGINE;
+    char *err = nullptr;
+    void *options = engine->options_create();
+    engine->options_set_create_if_missing(options, 1);
+    engine->options_set_write_buffer_size(options, 4096);
+    engine->destroy_db(options, DB_PATH, &err);
+    void *db = engine->open(options, DB_PATH, &err);
+    ASSERT_NE(db, nullptr);
+    void *woptions = engine->writeoptions_create();
+    void *roptions = engine->readoptions_create();
+
+    // One batch rolls through several segments; records of one key still
+    // apply in batch order.
+    std::string value(200, 'v');
+    void *batch = engine->writebatch_create();
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "key" + std::to_string(i);
+        engine->writebatch_put(batch, key.data(), key.size(), value.data(), value.size());
+    }
+    engine->writebatch_delete(batch, "key1", 4);
+    engine->writebatch_put(batch, "key2", 4, "new", 3);
+    engine->writebatch_delete(batch, "key2", 4);
+    engine->writebatch_put(batch, "key2", 4, "last", 4);
+    engine->write(db, woptions, batch, &err);
+    engine->writebatch_destroy(batch);
+    ASSERT_EQ(err, nullptr);
+
+    size_t len;
+    EXPECT_EQ(engine->get(db, roptions, "key1", 4, &len, &err), nullptr);
+    char *found = engine->get(db, roptions, "key2", 4, &len, &err);
+    ASSERT_NE(found, nullptr);
+    EXPECT_EQ(std::string(found, len), "last");
+    engine->free_fn(found);
+    for (int i = 3; i < 100; ++i) {
+        std::string key = "key" + std::to_string(i);
+        found = engine->get(db, roptions, key.data(), key.size(), &len, &err);
+        ASSERT_NE(found, nullptr) << key;
+        EXPECT_EQ(std::string(found, len), value);
+        engine->free_fn(found);
+    }
+    char *report = engine->stats_report(db);
+    EXPECT_NE(strstr(report, "99 keys"), nullptr) << report;
+    engine->free_fn(report);
+
+    // With the directory gone no new segment can be created, and a batch
+    // that needs one changes nothing.
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", DB_PATH);
+    system(command);
+    std::string other(200, 'w');
+    batch = engine->writebatch_create();
+    engine->writebatch_delete(batch, "key3", 4);
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "new" + std::to_string(i);
+        engine->writebatch_put(batch, key.data(), key.size(), other.data(), other.size());
+        key = "key" + std::to_string(i);
+        engine->writebatch_put(batch, key.data(), key.size(), other.data(), other.size());
+    }
+    engine->write(db, woptions, batch, &err);
+    engine->writebatch_destroy(batch);
+    ASSERT_NE(err, nullptr);
+    engine->free_fn(err);
+    err = nullptr;
+    EXPECT_EQ(engine->get(db, roptions, "new0", 4, &len, &err), nullptr);
+    for (int i = 3; i < 100; ++i) {
+        std::string key = "key" + std::to_string(i);
+        found = engine->get(db, roptions, key.data(), key.size(), &len, &err);
+        ASSERT_NE(found, nullptr) << key;
+        EXPECT_EQ(std::string(found, len), value);
+        engine->free_fn(found);
+    }
+    report = engine->stats_report(db);
+    EXPECT_NE(strstr(report, "99 keys"), nullptr) << report;
+    engine->free_fn(report);
+
+    engine->readoptions_destroy(roptions);
+    engine->writeoptions_destroy(woptions);
+    engine->close(db);
+    engine->options_destroy(options);
+}
+
+TEST(BitcaskEngineTest, OverwritesRaceWithSegmentRolls) {
+    StorageEngine *engine = &BITCASK_ENGINE;
+    char *err = nullptr;
+    void *options = engine->options_create();
+    engine->options_set_create_if_missing(options, 1);
+    engine->options_set_write_buffer_size(options, 4096);
+    engine->options_set_ttl_filter(options);
+    engine->destroy_db(options, DB_PATH, &err);
+    void *db = engine->open(options, DB_PATH, &err);
+    ASSERT_NE(db, nullptr);
+    void *woptions = engine->writeoptions_create();
+    void *roptions = engine->readoptions_create();
+
+    // A few keys overwritten from several threads keep killing the last live
+    // record of a segment while other writers seal and roll the active one.
+    // Short expirations let sealed segments be reclaimed as expired as well.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            char value[VALUE_HEADER_SIZE + 200];
+            memset(value, 'a' + t, sizeof(value));
+            char *werr = nullptr;
+            for (int i = 0; i < 20000; ++i) {
+                std::string key = "key" + std::to_string((i + t) % 8);
+                value_header_encode(value, (i % 3 == 0) ? 1 : 0);
+                engine->put(db, woptions, key.data(), key.size(), value, sizeof(value), &werr);
+                ASSERT_EQ(werr, nullptr);
+                if (i % 64 == 0) {
+                    engine->compact_range(db, nullptr, 0, nullptr, 0);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_GT(bitcask_reclaimed(engine, db), 100u);
+
+    // Every key still reads back one whole record, whichever writer won.
+    for (int k = 0; k < 8; ++k) {
+        std::string key = "key" + std::to_string(k);
+        size_t len;
+        char *value = engine->get(db, roptions, key.data(), key.size(), &len, &err);
+        if (value == nullptr) {
+            continue;
+        }
+        ASSERT_EQ(len, VALUE_HEADER_SIZE + 200);
+        EXPECT_EQ(std::string(value + VALUE_HEADER_SIZE, 200), std::string(200, value[VALUE_HEADER_SIZE]));
+        engine->free_fn(value);
+    }
+
+    engine->readoptions_destroy(roptions);
+    engine->writeoptions_destroy(woptions);
+    engine->close(db);
+    engine->options_destroy(options);
+}
+
+TEST(HotTierTest, ClockEvictsUnreferencedFirst) {
+    const size_t value_len = 100;
+    const size_t entry = sizeof(HotEntry) + 1 + value_len;
+    // Room for four entries; the single-entry cap is a quarter of the shard.
+    HotTier *tier = hot_tier_create(entry * 4, 1);
+    ASSERT_NE(tier, nullptr);
+    std::string value(value_len, 'x');
+
+    const char *keys[] = {"a", "b", "c", "d", "e"};
+    for (int i = 0; i < 4; ++i) {
+        hot_tier_insert(tier, keys[i], 1, i, value.data(), value_len, 0, hot_tier_generation(tier, i));
+    }
+    // Touch "a" so the hand skips it and evicts "b" to make room for "e".
+    HotEntry *hit = hot_tier_lookup(tier, "a", 1, 0, 0);
+    ASSERT_NE(hit, nullptr);
+    hot_entry_release(hit);
+    hot_tier_insert(tier, "e", 1, 4, value.data(), value_len, 0, hot_tier_generation(tier, 4));
+
+    hit = hot_tier_lookup(tier, "a", 1, 0, 0);
+    ASSERT_NE(hit, nullptr);
+    hot_entry_release(hit);
+    EXPECT_EQ(hot_tier_lookup(tier, "b", 1, 1, 0), nullptr);
+
+    // An insert racing with an invalidation is dropped.
+    uint64_t generation = hot_tier_generation(tier, 5);
+    hot_tier_invalidate(tier, "f", 1, 5);
+    hot_tier_insert(tier, "f", 1, 5, value.data(), value_len, 0, generation);
+    EXPECT_EQ(hot_tier_lookup(tier, "f", 1, 5, 0), nullptr);
+
+    // Expired entries are not served.
+    hot_tier_insert(tier, "g", 1, 6, value.data(), value_len, 10, hot_tier_generation(tier, 6));
+    EXPECT_EQ(hot_tier_lookup(tier, "g", 1, 6, 11), nullptr);
+    hot_tier_destroy(tier);
+}
+
+TEST(SlabTest, RecyclesBySizeClass) {
+    Slab slab;
+    slab_init(&slab);
+    void *a = slab_alloc(&slab, 40);
+    void *b = slab_alloc(&slab, 40);
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    EXPECT_EQ((uintptr_t)a % SLAB_GRANULARITY, 0u);
+    EXPECT_EQ((char *)b - (char *)a, (ptrdiff_t)slab_object_size(40));
+
+    // A freed object is handed out again for any size of the same class.
+    slab_free(&slab, a, 40);
+    EXPECT_EQ(slab_alloc(&slab, 48), a);
+    EXPECT_NE(slab_alloc(&slab, 40), a);
+
+    // Objects past the largest class bypass the chunks.
+    void *large = slab_alloc(&slab, SLAB_MAX_OBJECT + 1);
+    ASSERT_NE(large, nullptr);
+    slab_free(&slab, large, SLAB_MAX_OBJECT + 1);
+
+    // Filling more than one chunk keeps every object distinct.
+    std::vector<void *> objects;
+    for (size_t i = 0; i < 2 * SLAB_CHUNK_BYTES / 64; ++i) {
+        objects.push_back(slab_alloc(&slab, 64));
+        memset(objects.back(), 0xab, 64);
+    }
+    std::sort(objects.begin(), objects.end());
+    EXPECT_EQ(std::adjacent_find(objects.begin(), objects.end()), objects.end());
+    slab_release_all(&slab);
+}
+
+struct TestIndexNode {
+    KeyIndexNode node;
+    char key[16];
+};
+
+static TestIndexNode* MakeIndexNode(std::vector<TestIndexNode> &nodes, size_t i, uint64_t hash) {
+    TestIndexNode *n = &nodes[i];
+    n->node.key_len = snprintf(n->key, sizeof(n->key), "key%zu", i);
+    n->node.hash = hash;
+    return n;
+}
+
+TEST(KeyIndexTest, FindsKeysAcrossIncrementalResize) {
+    const size_t count = 20000;
+    std::vector<TestIndexNode> nodes(count);
+    KeyIndex index;
+    ki_init(&index);
+
+    bool saw_migration = false;
+    for (size_t i = 0; i < count; ++i) {
+        TestIndexNode *n = MakeIndexNode(nodes, i, 0);
+        n->node.hash = ki_hash(n->key, n->node.key_len);
+        ASSERT_EQ(ki_insert(&index, &n->node), 0);
+        saw_migration |= index.old.capacity != 0;
+        // Keys that were only ever in the old table must stay visible.
+        size_t probe = i / 2;
+        ASSERT_EQ(ki_find(&index, nodes[probe].key, nodes[probe].node.key_len, nodes[probe].node.hash),
+                  &nodes[probe].node);
+    }
+    EXPECT_TRUE(saw_migration);
+    EXPECT_EQ(ki_size(&index), count);
+
+    for (size_t i = 0; i < count; i += 2) {
+        ki_erase(&index, &nodes[i].node);
+    }
+    EXPECT_EQ(ki_size(&index), count / 2);
+    for (size_t i = 0; i < count; ++i) {
+        KeyIndexNode *found = ki_find(&index, nodes[i].key, nodes[i].node.key_len, nodes[i].node.hash);
+        EXPECT_EQ(found, i % 2 ? &nodes[i].node : nullptr) << nodes[i].key;
+    }
+
+    size_t cursor = 0, seen = 0;
+    while (ki_iter_next(&index, &cursor) != nullptr) {
+        seen++;
+    }
+    EXPECT_EQ(seen, count / 2);
+    ki_destroy(&index);
+}
+
+TEST(KeyIndexTest, EraseDuringMigrationLeavesNoStaleNodes) {
+    const size_t count = 4096;
+    std::vector<TestIndexNode> nodes(count);
+    KeyIndex index;
+    ki_init(&index);
+
+    size_t inserted = 0;
+    for (; inserted < count; ++inserted) {
+        TestIndexNode *n = MakeIndexNode(nodes, inserted, 0);
+        n->node.hash = ki_hash(n->key, n->node.key_len);
+        ASSERT_EQ(ki_insert(&index, &n->node), 0);
+        // Stop right after a resize, with most of the old table still to move.
+        if (index.old.capacity >= 512 && index.migrate_pos < 4) {
+            inserted++;
+            break;
+        }
+    }
+    ASSERT_NE(index.old.capacity, 0u);
+
+    // Erase some of the keys, each erase migrating one more group, and check
+    // every step while the migration is still in progress.
+    std::vector<bool> erased(inserted, false);
+    size_t live = inserted, erased_mid_migration = 0;
+    for (size_t i = 0; i < inserted && index.old.capacity != 0; i += 3) {
+        erased_mid_migration++;
+        ki_erase(&index, &nodes[i].node);
+        erased[i] = true;
+        live--;
+        ASSERT_EQ(ki_find(&index, nodes[i].key, nodes[i].node.key_len, nodes[i].node.hash), nullptr) << i;
+        ASSERT_EQ(ki_size(&index), live);
+
+        size_t cursor = 0, seen = 0;
+        std::vector<bool> visited(inserted, false);
+        KeyIndexNode *node;
+        while ((node = ki_iter_next(&index, &cursor)) != nullptr) {
+            size_t at = (TestIndexNode *)node - nodes.data();
+            ASSERT_LT(at, inserted);
+            ASSERT_FALSE(erased[at]) << "erased node " << at << " still iterated";
+            ASSERT_FALSE(visited[at]) << "node " << at << " iterated twice";
+            visited[at] = true;
+            seen++;
+        }
+        ASSERT_EQ(seen, live);
+    }
+    EXPECT_GT(erased_mid_migration, 16u);
+    for (size_t i = 0; i < inserted; ++i) {
+        EXPECT_EQ(ki_find(&index, nodes[i].key, nodes[i].node.key_len, nodes[i].node.hash),
+                  erased[i] ? nullptr : &nodes[i].node) << i;
+    }
+    ki_destroy(&index);
+}
+
+TEST(KeyIndexTest, SampleReturnsDistinctLiveNodes) {
+    const size_t count = 1000;
+    std::vector<TestIndexNode> nodes(count);
+    KeyIndex index;
+    ki_init(&index);
+    KeyIndexNode *sample[8];
+    EXPECT_EQ(ki_sample(&index, 1, sample, 8), 0u);
+
+    for (size_t i = 0; i < 5; ++i) {
+        TestIndexNode *n = MakeIndexNode(nodes, i, 0);
+        n->node.hash = ki_hash(n->key, n->node.key_len);
+        ASSERT_EQ(ki_insert(&index, &n->node), 0);
+    }
+    // Fewer nodes than asked for: all of them, each once.
+    ASSERT_EQ(ki_sample(&index, 7, sample, 8), 5u);
+    std::sort(sample, sample + 5);
+    EXPECT_EQ(std::unique(sample, sample + 5), sample + 5);
+
+    for (size_t i = 5; i < count; ++i) {
+        TestIndexNode *n = MakeIndexNode(nodes, i, 0);
+        n->node.hash = ki_hash(n->key, n->node.key_len);
+        ASSERT_EQ(ki_insert(&index, &n->node), 0);
+    }
+    for (size_t i = 0; i < count; i += 2) {
+        ki_erase(&index, &nodes[i].node);
+    }
+    for (uint64_t seed = 0; seed < 100; ++seed) {
+        ASSERT_EQ(ki_sample(&index, seed, sample, 8), 8u);
+        for (KeyIndexNode *node : sample) {
+            size_t at = (TestIndexNode *)node - nodes.data();
+            ASSERT_EQ(at % 2, 1u) << "erased node sampled";
+        }
+    }
+    ki_destroy(&index);
+}
+
+TEST(KeyIndexTest, CollidingHashesSurviveChurn) {
+    // Every key has the same hash, so all of them share one probe sequence
+    // and erases in full groups leave tombstones behind.
+    const size_t count = 200;
+    std::vector<TestIndexNode> nodes(count);
+    KeyIndex index;
+    ki_init(&index);
+    for (int round = 0; round < 50; ++round) {
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(ki_insert(&index, &MakeIndexNode(nodes, i, 42)->node), 0);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(ki_find(&index, nodes[i].key, nodes[i].node.key_len, 42), &nodes[i].node);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            ki_erase(&index, &nodes[i].node);
+        }
+        ASSERT_EQ(ki_size(&index), 0u);
+        ASSERT_EQ(ki_find(&index, nodes[0].key, nodes[0].node.key_len, 42), nullptr);
+    }
+    // Tombstones are reclaimed rather than growing the table every round.
+    EXPECT_LE(index.cur.capacity, 1024u);
+    ki_destroy(&index);
+}
+
+static size_t CountFired(TimerNode *node) {
+    size_t n = 0;
+    for (; node != nullptr; node = node->next) {
+        n++;
+    }
+    return n;
+}
+
+TEST(TimerWheelTest, FiresAcrossLevels) {
+    const uint64_t start = 1000000;
+    const uint64_t offsets[] = {1, 63, 64, 65, 4095, 4096, 300000, (1ull << 24) + 5, (1ull << 26)};
+    const size_t n = sizeof(offsets) / sizeof(offsets[0]);
+    TimerWheel *wheel = new TimerWheel;
+    tw_init(wheel, start);
+    std::vector<TimerNode> nodes(n);
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i] = TimerNode{};
+        tw_schedule(wheel, &nodes[i], start + offsets[i]);
+    }
+    ASSERT_EQ(wheel->count, n);
+
+    for (size_t i = 0; i < n; ++i) {
+        // Nothing fires a second early, exactly one timer fires on time.
+        EXPECT_EQ(CountFired(tw_advance(wheel, start + offsets[i] - 1)), 0u) << offsets[i];
+        TimerNode *fired = tw_advance(wheel, start + offsets[i]);
+        ASSERT_EQ(CountFired(fired), 1u) << offsets[i];
+        EXPECT_EQ(fired, &nodes[i]);
+        EXPECT_FALSE(tw_is_scheduled(&nodes[i]));
+    }
+    EXPECT_EQ(wheel->count, 0u);
+    delete wheel;
+}
+
+TEST(TimerWheelTest, RescheduleAndCancel) {
+    TimerWheel *wheel = new TimerWheel;
+    tw_init(wheel, 0);
+    TimerNode a{}, b{};
+    tw_schedule(wheel, &a, 10);
+    tw_schedule(wheel, &b, 20);
+    tw_schedule(wheel, &a, 100);  // TTL extended: moved, not duplicated
+    tw_cancel(wheel, &b);
+    EXPECT_EQ(wheel->count, 1u);
+
+    EXPECT_EQ(CountFired(tw_advance(wheel, 99)), 0u);
+    TimerNode *fired = tw_advance(wheel, 150);
+    ASSERT_EQ(CountFired(fired), 1u);
+    EXPECT_EQ(fired, &a);
+    delete wheel;
+}
+
 } // namespace